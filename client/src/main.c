@@ -1,51 +1,307 @@
 #include <arpa/inet.h>
+#include <dirent.h>
+#include <endian.h>
+#include <errno.h>
 #include <netinet/in.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
 #define SERVER_PORT 5000
 #define BUF_SIZE 256
+#define UNIX_PREFIX "unix:"
+#define SHM_PREFIX "shm:"
+#define DEFAULT_BENCH_SIZE 64
+#define MAX_BENCH_SIZE 4096    // the server reads a request in one block of this size
+#define NS_PER_SEC 1000000000U
+#define NS_PER_MS 1000000U
+#define IDLE_PER_SOURCE 20000       // connections per loopback source address, below the ephemeral port range
+#define IDLE_SETTLE_MS 2000         // time the server gets to accept and register the last connections
+#define LINE_SIZE 256
+#define FETCH_BUFFER_SIZE (256 * 1024)
+#define FILE_NOT_FOUND UINT64_MAX   // reply length for a name the server has no file for
+#define MAX_NOISY 64
+#define NOISY_SEND_SIZE (64 * 1024)
+#define RING_MAGIC 0x53524e47U      // must match servers/include/shm_ring.h
+#define RING_VERSION 1
+#define RING_CACHE_LINE 64
+#define RING_RECORD_ALIGN 8
+#define RING_FDS 3
+#define RING_SPIN 20000             // polls of the ring before sleeping on the eventfd, only with more than one CPU
+
+// the layout of the server's shm_ring_header, see servers/include/shm_ring.h
+struct ring_index
+{
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t tail;
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t head;
+};
+
+struct ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t max_message;
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t server_sleeping;
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t client_sleeping;
+    struct ring_index requests;
+    struct ring_index replies;
+};
+
+struct ring_hello
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t map_size;
+};
+
+// this side of a shm: connection, which writes requests and reads replies
+struct ring_client
+{
+    struct ring_header *header;
+    uint8_t *requests;
+    uint8_t *replies;
+    size_t map_size;
+    uint32_t capacity;
+    uint32_t request_tail;
+    uint32_t reply_head;
+    long spin;
+    int socket_fd;          // closed by the server when it drops the client
+    int server_wake_fd;
+    int wake_fd;
+};
+
+static int connect_to_server(const char *target, long index);
+static int run_interactive(int socket_fd);
+static int run_benchmark(int socket_fd, struct ring_client *ring, const char *target, long requests, long size);
+static int run_idle(const char *target, long count, long server_pid);
+static int run_fetch(int socket_fd, const char *target, const char *name, long requests);
+static int run_noisy(const char *target, long seconds, long count);
+static int receive_all(int socket_fd, void *data, size_t length);
+static int open_ring(int socket_fd, struct ring_client *ring);
+static int ring_round_trip(struct ring_client *ring, const char *request, size_t size, uint16_t *reply);
+static int ring_wait(struct ring_client *ring, _Atomic uint32_t *position, uint32_t unwanted);
+static void ring_wake(_Atomic uint32_t *sleeping, int fd);
+static uint32_t ring_record_size(size_t length);
+static long count_closed(const int *fds, long count);
+static long process_rss_kb(long pid);
+static long tree_rss_kb(long pid);
+static long slab_kb(void);
+static int compare_latency(const void *a, const void *b);
+static uint64_t now_ns(void);
 
 int main(int argc, char *argv[])
 {
     int socket_fd;
-    struct sockaddr_in server_addr;
-    char buffer[BUF_SIZE];
+    int status;
+
+    if (argc < 2 || (argc > 2 && strcmp(argv[2], "bench") != 0 && strcmp(argv[2], "idle") != 0 && strcmp(argv[2], "get") != 0 &&
+                      strcmp(argv[2], "noisy") != 0))
+    {
+        printf("Usage: %s <server_ip|unix:path|shm:path> [bench <requests> [request bytes] | idle <connections> [server pid] | get <file> [requests] | noisy <seconds> [connections]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc > 2 && strcmp(argv[2], "idle") == 0)
+    {
+        long count = argc > 3 ? strtol(argv[3], NULL, 10) : 0;
+        long server_pid = argc > 4 ? strtol(argv[4], NULL, 10) : 0;
+
+        if (count <= 0)
+        {
+            printf("idle needs a positive number of connections\n");
+            return EXIT_FAILURE;
+        }
+
+        return run_idle(argv[1], count, server_pid);
+    }
+
+    if (argc > 2 && strcmp(argv[2], "noisy") == 0)
+    {
+        long seconds = argc > 3 ? strtol(argv[3], NULL, 10) : 0;
+        long count = argc > 4 ? strtol(argv[4], NULL, 10) : 1;
+
+        if (seconds <= 0 || count <= 0 || count > MAX_NOISY)
+        {
+            printf("noisy needs a positive number of seconds and 1 to %d connections\n", MAX_NOISY);
+            return EXIT_FAILURE;
+        }
+
+        return run_noisy(argv[1], seconds, count);
+    }
+
+    // the ring only carries bench requests, the other modes need the socket's byte stream
+    if (strncmp(argv[1], SHM_PREFIX, strlen(SHM_PREFIX)) == 0 && (argc < 3 || strcmp(argv[2], "bench") != 0))
+    {
+        printf("shm: targets only support bench\n");
+        return EXIT_FAILURE;
+    }
+
+    socket_fd = connect_to_server(argv[1], 0);
 
-    if (argc < 2)
+    if (socket_fd < 0)
     {
-        printf("Usage: %s <server_ip>\n", argv[0]);
         return EXIT_FAILURE;
     }
 
+    if (argc > 2 && strcmp(argv[2], "get") == 0)
+    {
+        long requests = argc > 4 ? strtol(argv[4], NULL, 10) : 1;
+
+        if (argc < 4 || requests <= 0)
+        {
+            printf("get needs a file name and a positive number of requests\n");
+            close(socket_fd);
+            return EXIT_FAILURE;
+        }
+
+        status = run_fetch(socket_fd, argv[1], argv[3], requests);
+    }
+    else if (argc > 2)
+    {
+        long requests = argc > 3 ? strtol(argv[3], NULL, 10) : 0;
+        long size = argc > 4 ? strtol(argv[4], NULL, 10) : DEFAULT_BENCH_SIZE;
+
+        if (requests <= 0 || size <= 0 || size > MAX_BENCH_SIZE)
+        {
+            printf("bench needs a positive number of requests and 1 to %d request bytes\n", MAX_BENCH_SIZE);
+            close(socket_fd);
+            return EXIT_FAILURE;
+        }
+
+        if (strncmp(argv[1], SHM_PREFIX, strlen(SHM_PREFIX)) == 0)
+        {
+            struct ring_client ring;
+
+            if (open_ring(socket_fd, &ring) != 0)
+            {
+                close(socket_fd);
+                return EXIT_FAILURE;
+            }
+
+            status = run_benchmark(socket_fd, &ring, argv[1], requests, size);
+            munmap(ring.header, ring.map_size);
+            close(ring.server_wake_fd);
+            close(ring.wake_fd);
+        }
+        else
+        {
+            status = run_benchmark(socket_fd, NULL, argv[1], requests, size);
+        }
+    }
+    else
+    {
+        printf("Connected to server.\n");
+        status = run_interactive(socket_fd);
+    }
+
+    close(socket_fd);
+
+    return status;
+}
+
+static int connect_to_server(const char *target, long index)
+{
+    int socket_fd;
+
+    // unix:path reaches a server listening with x=path or X=path on this host, shm:path one started with q=path
+    if (strncmp(target, UNIX_PREFIX, strlen(UNIX_PREFIX)) == 0 || strncmp(target, SHM_PREFIX, strlen(SHM_PREFIX)) == 0)
+    {
+        struct sockaddr_un server_addr;
+        const char *path = strchr(target, ':') + 1;
+
+        if (strlen(path) >= sizeof(server_addr.sun_path))
+        {
+            printf("Unix socket path is too long\n");
+            return -1;
+        }
+
+        socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+        if (socket_fd < 0)
+        {
+            perror("socket");
+            return -1;
+        }
+
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sun_family = AF_UNIX;
+        memcpy(server_addr.sun_path, path, strlen(path));
+
+        if (connect(socket_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0)
+        {
+            perror("connect");
+            close(socket_fd);
+            return -1;
+        }
+
+        return socket_fd;
+    }
+
+    struct sockaddr_in server_addr;
+
     socket_fd = socket(AF_INET, SOCK_STREAM, 0);
 
     if (socket_fd < 0)
     {
         perror("socket");
-        return EXIT_FAILURE;
+        return -1;
     }
 
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(SERVER_PORT);
 
-    if (inet_pton(AF_INET, argv[1], &server_addr.sin_addr) <= 0)
+    if (inet_pton(AF_INET, target, &server_addr.sin_addr) <= 0)
     {
         perror("inet_pton");
-        return EXIT_FAILURE;
+        close(socket_fd);
+        return -1;
+    }
+
+    // one source address only has the ephemeral port range, so spread many connections to a loopback server over
+    // 127.0.0.2, 127.0.0.3, ... and let connect pick the port for the whole 4-tuple
+    if (index >= IDLE_PER_SOURCE && strncmp(target, "127.", strlen("127.")) == 0)
+    {
+        struct sockaddr_in source_addr;
+        int on = 1;
+
+        memset(&source_addr, 0, sizeof(source_addr));
+        source_addr.sin_family = AF_INET;
+        source_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK + (uint32_t) (index / IDLE_PER_SOURCE));
+        setsockopt(socket_fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &on, sizeof(on));
+
+        if (bind(socket_fd, (struct sockaddr *) &source_addr, sizeof(source_addr)) < 0)
+        {
+            perror("bind");
+            close(socket_fd);
+            return -1;
+        }
     }
 
     if (connect(socket_fd, (struct sockaddr *) &server_addr, sizeof(server_addr)) < 0)
     {
         perror("connect");
-        return EXIT_FAILURE;
+        close(socket_fd);
+        return -1;
     }
 
-    printf("Connected to server.\n");
+    return socket_fd;
+}
+
+static int run_interactive(int socket_fd)
+{
+    char buffer[BUF_SIZE];
 
     while(fgets(buffer, BUF_SIZE, stdin) != NULL)
     {
@@ -61,7 +317,7 @@ int main(int argc, char *argv[])
         write(STDOUT_FILENO, buffer, n);
 
         uint16_t read_number;
-        ssize_t m = recv(socket_fd, &read_number, BUF_SIZE, 0);
+        ssize_t m = recv(socket_fd, &read_number, sizeof(read_number), 0);
 
         if (m < 0)
         {
@@ -72,7 +328,669 @@ int main(int argc, char *argv[])
         printf("Server Read: %d\n", read_number);
     }
 
-    close(socket_fd);
+    return EXIT_SUCCESS;
+}
+
+static int run_benchmark(int socket_fd, struct ring_client *ring, const char *target, long requests, long size)
+{
+    char request[MAX_BENCH_SIZE];
+    uint64_t *latencies;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t total;
+
+    latencies = (uint64_t *) malloc((size_t) requests * sizeof(uint64_t));
+
+    if (latencies == NULL)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    memset(request, 'a', (size_t) size);
+    request[size - 1] = '\n';
+    total = 0;
+    start = now_ns();
+
+    // one request in flight at a time, so each sample is a full round trip through the server
+    for (long i = 0; i < requests; i++)
+    {
+        uint16_t reply;
+        size_t received = 0;
+        uint64_t sent_at = now_ns();
+
+        if (ring != NULL)
+        {
+            if (ring_round_trip(ring, request, (size_t) size, &reply) != 0)
+            {
+                free(latencies);
+                return EXIT_FAILURE;
+            }
+
+            latencies[i] = now_ns() - sent_at;
+            total += latencies[i];
+            continue;
+        }
+
+        if (send(socket_fd, request, (size_t) size, 0) != size)
+        {
+            perror("send");
+            free(latencies);
+            return EXIT_FAILURE;
+        }
+
+        while (received < sizeof(reply))
+        {
+            ssize_t m = recv(socket_fd, (char *) &reply + received, sizeof(reply) - received, 0);
+
+            if (m <= 0)
+            {
+                perror("recv");
+                free(latencies);
+                return EXIT_FAILURE;
+            }
+
+            received += (size_t) m;
+        }
+
+        latencies[i] = now_ns() - sent_at;
+        total += latencies[i];
+    }
+
+    elapsed = now_ns() - start;
+    qsort(latencies, (size_t) requests, sizeof(uint64_t), compare_latency);
+    printf("%s: %ld requests of %ld bytes in %" PRIu64 " ms\n", target, requests, size, elapsed / NS_PER_MS);
+    printf("%" PRIu64 " req/s, latency ns mean %" PRIu64 " p50 %" PRIu64 " p99 %" PRIu64 " max %" PRIu64 "\n",
+           elapsed == 0 ? 0 : (uint64_t) requests * NS_PER_SEC / elapsed,
+           total / (uint64_t) requests,
+           latencies[requests / 2],
+           latencies[requests * 99 / 100],
+           latencies[requests - 1]);
+    free(latencies);
 
     return EXIT_SUCCESS;
 }
+
+static int run_fetch(int socket_fd, const char *target, const char *name, long requests)
+{
+    uint8_t *body;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t bytes;
+
+    body = (uint8_t *) malloc(FETCH_BUFFER_SIZE);
+
+    if (body == NULL)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    bytes = 0;
+    start = now_ns();
+
+    // a server started with r=ROOT replies with an 8-byte big-endian length and then the file
+    for (long i = 0; i < requests; i++)
+    {
+        uint64_t length;
+        uint64_t remaining;
+
+        if (send(socket_fd, name, strlen(name), 0) != (ssize_t) strlen(name) || receive_all(socket_fd, &length, sizeof(length)) != 0)
+        {
+            perror("get");
+            free(body);
+            return EXIT_FAILURE;
+        }
+
+        length = be64toh(length);
+
+        if (length == FILE_NOT_FOUND)
+        {
+            printf("%s: no file %s\n", target, name);
+            free(body);
+            return EXIT_FAILURE;
+        }
+
+        for (remaining = length; remaining > 0;)
+        {
+            ssize_t m = recv(socket_fd, body, remaining < FETCH_BUFFER_SIZE ? (size_t) remaining : FETCH_BUFFER_SIZE, 0);
+
+            if (m <= 0)
+            {
+                printf("%s: reply cut short, %" PRIu64 " of %" PRIu64 " bytes\n", target, length - remaining, length);
+                free(body);
+                return EXIT_FAILURE;
+            }
+
+            remaining -= (uint64_t) m;
+        }
+
+        bytes += length;
+    }
+
+    elapsed = now_ns() - start;
+    printf("%s: %ld requests for %s, %" PRIu64 " bytes in %" PRIu64 " ms\n", target, requests, name, bytes, elapsed / NS_PER_MS);
+    printf("%" PRIu64 " req/s, %" PRIu64 " MB/s\n", elapsed == 0 ? 0 : (uint64_t) requests * NS_PER_SEC / elapsed,
+           elapsed == 0 ? 0 : bytes * (NS_PER_SEC / 1000000U) / elapsed);
+    free(body);
+
+    return EXIT_SUCCESS;
+}
+
+static int run_noisy(const char *target, long seconds, long count)
+{
+    static char data[NOISY_SEND_SIZE];
+    static char replies[NOISY_SEND_SIZE];
+    struct pollfd fds[MAX_NOISY];
+    uint64_t deadline;
+    uint64_t sent;
+    uint64_t received;
+
+    // full-size requests with no gaps, so each connection always has a socket buffer of work waiting in the server
+    memset(data, 'a', sizeof(data));
+
+    for (long i = 0; i < count; i++)
+    {
+        // from 127.0.0.2 against a loopback server, so w=127.0.0.2/32=WEIGHT can single it out
+        fds[i].fd = connect_to_server(target, IDLE_PER_SOURCE);
+        fds[i].events = POLLIN | POLLOUT;
+
+        if (fds[i].fd < 0)
+        {
+            while (--i >= 0)
+            {
+                close(fds[i].fd);
+            }
+
+            return EXIT_FAILURE;
+        }
+    }
+
+    sent = 0;
+    received = 0;
+    deadline = now_ns() + (uint64_t) seconds * NS_PER_SEC;
+
+    while (now_ns() < deadline)
+    {
+        if (poll(fds, (nfds_t) count, (int) (NS_PER_SEC / NS_PER_MS)) < 0)
+        {
+            perror("poll");
+            break;
+        }
+
+        for (long i = 0; i < count; i++)
+        {
+            ssize_t n;
+
+            if (fds[i].revents & POLLOUT)
+            {
+                n = send(fds[i].fd, data, sizeof(data), MSG_DONTWAIT);
+                sent += n > 0 ? (uint64_t) n : 0;
+            }
+
+            if (fds[i].revents & POLLIN)
+            {
+                n = recv(fds[i].fd, replies, sizeof(replies), MSG_DONTWAIT);
+
+                if (n == 0)
+                {
+                    fds[i].events = 0;
+                }
+
+                received += n > 0 ? (uint64_t) n : 0;
+            }
+        }
+    }
+
+    printf("%s: %ld noisy connections sent %" PRIu64 " MB in %lds, %" PRIu64 " reply bytes back\n", target, count, sent / (1024 * 1024), seconds, received);
+
+    for (long i = 0; i < count; i++)
+    {
+        close(fds[i].fd);
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int receive_all(int socket_fd, void *data, size_t length)
+{
+    size_t received = 0;
+
+    while (received < length)
+    {
+        ssize_t m = recv(socket_fd, (char *) data + received, length - received, 0);
+
+        if (m <= 0)
+        {
+            return -1;
+        }
+
+        received += (size_t) m;
+    }
+
+    return 0;
+}
+
+static int open_ring(int socket_fd, struct ring_client *ring)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct ring_hello hello;
+    char control_buf[CMSG_SPACE(RING_FDS * sizeof(int))];
+    struct cmsghdr *cmsg;
+    struct stat info;
+    int fds[RING_FDS];
+    void *mapping;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&hello, 0, sizeof(hello));
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_buf;
+    msg.msg_controllen = sizeof(control_buf);
+
+    // the server sends the memfd and both eventfds as soon as it accepts
+    if (recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC) != (ssize_t) sizeof(hello))
+    {
+        printf("No shared memory ring from the server, is it listening with q=PATH?\n");
+        return -1;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+
+    if (cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        printf("The server sent no ring descriptors\n");
+        return -1;
+    }
+
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    if (hello.magic != RING_MAGIC || hello.version != RING_VERSION || fstat(fds[0], &info) != 0 || (uint64_t) info.st_size != hello.map_size)
+    {
+        printf("The server's ring does not match this client\n");
+        close(fds[0]);
+        close(fds[1]);
+        close(fds[2]);
+        return -1;
+    }
+
+    mapping = mmap(NULL, hello.map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+
+    if (mapping == MAP_FAILED)
+    {
+        perror("mmap");
+        close(fds[1]);
+        close(fds[2]);
+        return -1;
+    }
+
+    memset(ring, 0, sizeof(*ring));
+    ring->header = (struct ring_header *) mapping;
+    ring->map_size = hello.map_size;
+    ring->capacity = ring->header->capacity;
+    ring->requests = (uint8_t *) mapping + sizeof(struct ring_header);
+    ring->replies = ring->requests + ring->capacity;
+    ring->socket_fd = socket_fd;
+    ring->server_wake_fd = fds[1];
+    ring->wake_fd = fds[2];
+
+    // on one CPU a spinning client only keeps the server from running
+    ring->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPIN : 0;
+
+    if (ring->header->magic != RING_MAGIC || sizeof(struct ring_header) + 2 * (size_t) ring->capacity != ring->map_size)
+    {
+        printf("The server's ring header does not match this client\n");
+        munmap(mapping, hello.map_size);
+        close(fds[1]);
+        close(fds[2]);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ring_round_trip(struct ring_client *ring, const char *request, size_t size, uint16_t *reply)
+{
+    uint32_t length = (uint32_t) size;
+    uint32_t offset;
+    size_t first;
+
+    if (size > ring->header->max_message)
+    {
+        printf("Requests over %u bytes do not fit the server's ring\n", ring->header->max_message);
+        return -1;
+    }
+
+    // one request in flight, so the server has taken every earlier one and the ring has room
+    offset = ring->request_tail & (ring->capacity - 1);
+    memcpy(ring->requests + offset, &length, sizeof(length));
+    offset = (offset + (uint32_t) sizeof(length)) & (ring->capacity - 1);
+    first = size < ring->capacity - offset ? size : ring->capacity - offset;
+    memcpy(ring->requests + offset, request, first);
+    memcpy(ring->requests, request + first, size - first);
+    ring->request_tail += ring_record_size(size);
+    atomic_store_explicit(&ring->header->requests.tail, ring->request_tail, memory_order_release);
+    ring_wake(&ring->header->server_sleeping, ring->server_wake_fd);
+
+    if (ring_wait(ring, &ring->header->replies.tail, ring->reply_head) != 0)
+    {
+        return -1;
+    }
+
+    // the reply is the server's 2-byte count, the same bytes it sends over a socket
+    offset = (ring->reply_head + (uint32_t) sizeof(length)) & (ring->capacity - 1);
+    memcpy(reply, ring->replies + offset, sizeof(*reply));
+    ring->reply_head += ring_record_size(sizeof(*reply));
+    atomic_store_explicit(&ring->header->replies.head, ring->reply_head, memory_order_release);
+    ring_wake(&ring->header->server_sleeping, ring->server_wake_fd);
+
+    return 0;
+}
+
+static int ring_wait(struct ring_client *ring, _Atomic uint32_t *position, uint32_t unwanted)
+{
+    for (long spins = 0; atomic_load_explicit(position, memory_order_acquire) == unwanted; spins++)
+    {
+        struct pollfd fds[2];
+        uint64_t count;
+
+        if (spins < ring->spin)
+        {
+            continue;
+        }
+
+        // flag, then check again: the server either sees the flag and writes the eventfd, or this sees its reply
+        atomic_store_explicit(&ring->header->client_sleeping, 1, memory_order_seq_cst);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (atomic_load_explicit(position, memory_order_acquire) != unwanted)
+        {
+            atomic_store_explicit(&ring->header->client_sleeping, 0, memory_order_relaxed);
+            break;
+        }
+
+        fds[0].fd = ring->wake_fd;
+        fds[0].events = POLLIN;
+        fds[1].fd = ring->socket_fd;
+        fds[1].events = POLLIN;
+
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            return -1;
+        }
+
+        // the server only writes to the socket by closing it
+        if (fds[1].revents != 0)
+        {
+            printf("The server closed the ring\n");
+            return -1;
+        }
+
+        if ((fds[0].revents & POLLIN) && read(ring->wake_fd, &count, sizeof(count)) < 0)
+        {
+            perror("read");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void ring_wake(_Atomic uint32_t *sleeping, int fd)
+{
+    uint64_t one = 1;
+
+    // the published position must be visible before the flag is read, or both sides could sleep
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load_explicit(sleeping, memory_order_relaxed) != 0 && atomic_exchange_explicit(sleeping, 0, memory_order_acq_rel) != 0)
+    {
+        if (write(fd, &one, sizeof(one)) < 0)
+        {
+            perror("write");
+        }
+    }
+}
+
+static uint32_t ring_record_size(size_t length)
+{
+    return (uint32_t) ((sizeof(uint32_t) + length + RING_RECORD_ALIGN - 1) & ~(size_t) (RING_RECORD_ALIGN - 1));
+}
+
+static int run_idle(const char *target, long count, long server_pid)
+{
+    struct rlimit limit;
+    int *fds;
+    long opened;
+    long closed;
+    long rss_before;
+    long rss_after;
+    long slab_before;
+    long slab_after;
+    uint64_t start;
+    struct timespec settle;
+
+    // every connection is a descriptor here as well as in the server
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    fds = (int *) malloc((size_t) count * sizeof(int));
+
+    if (fds == NULL)
+    {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+
+    rss_before = server_pid > 0 ? tree_rss_kb(server_pid) : 0;
+    slab_before = slab_kb();
+    start = now_ns();
+
+    for (opened = 0; opened < count; opened++)
+    {
+        fds[opened] = connect_to_server(target, opened);
+
+        if (fds[opened] < 0)
+        {
+            break;
+        }
+    }
+
+    printf("%s: %ld idle connections opened in %" PRIu64 " ms\n", target, opened, (now_ns() - start) / NS_PER_MS);
+    settle.tv_sec = IDLE_SETTLE_MS / 1000;
+    settle.tv_nsec = 0;
+    nanosleep(&settle, NULL);
+
+    // a connection the server turned away has its busy reply or EOF waiting
+    closed = count_closed(fds, opened);
+    rss_after = server_pid > 0 ? tree_rss_kb(server_pid) : 0;
+    slab_after = slab_kb();
+    printf("%ld held by the server, %ld closed by it\n", opened - closed, closed);
+
+    if (server_pid > 0 && opened > closed)
+    {
+        printf("server anonymous and shared RSS %ld KiB before, %ld KiB after, %ld bytes per connection\n", rss_before, rss_after,
+               (rss_after - rss_before) * 1024 / (opened - closed));
+    }
+
+    if (opened > 0)
+    {
+        printf("kernel slab +%ld KiB, %ld bytes per connection for both ends (host wide)\n", slab_after - slab_before,
+               (slab_after - slab_before) * 1024 / opened);
+    }
+
+    for (long i = 0; i < opened; i++)
+    {
+        close(fds[i]);
+    }
+
+    free(fds);
+
+    return opened == count ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static long count_closed(const int *fds, long count)
+{
+    struct pollfd *poll_fds;
+    long closed;
+
+    poll_fds = (struct pollfd *) calloc((size_t) count, sizeof(struct pollfd));
+
+    if (poll_fds == NULL)
+    {
+        return 0;
+    }
+
+    for (long i = 0; i < count; i++)
+    {
+        poll_fds[i].fd = fds[i];
+        poll_fds[i].events = POLLIN;
+    }
+
+    closed = poll(poll_fds, (nfds_t) count, 0);
+    free(poll_fds);
+
+    return closed < 0 ? 0 : closed;
+}
+
+static long process_rss_kb(long pid)
+{
+    char path[LINE_SIZE];
+    char line[LINE_SIZE];
+    FILE *status;
+    long rss = 0;
+
+    snprintf(path, sizeof(path), "/proc/%ld/status", pid);
+    status = fopen(path, "r");
+
+    if (status == NULL)
+    {
+        return 0;
+    }
+
+    // anonymous and shared memory only, code and libraries paged in by the first connections are not per connection
+    while (fgets(line, sizeof(line), status) != NULL)
+    {
+        if (strncmp(line, "RssAnon:", strlen("RssAnon:")) == 0)
+        {
+            rss += strtol(line + strlen("RssAnon:"), NULL, 10);
+        }
+        else if (strncmp(line, "RssShmem:", strlen("RssShmem:")) == 0)
+        {
+            rss += strtol(line + strlen("RssShmem:"), NULL, 10);
+        }
+    }
+
+    fclose(status);
+
+    return rss;
+}
+
+static long tree_rss_kb(long pid)
+{
+    DIR *proc;
+    struct dirent *entry;
+    long rss;
+
+    // the poll server's workers are its children
+    rss = process_rss_kb(pid);
+    proc = opendir("/proc");
+
+    if (proc == NULL)
+    {
+        return rss;
+    }
+
+    while ((entry = readdir(proc)) != NULL)
+    {
+        char path[LINE_SIZE];
+        char line[LINE_SIZE];
+        FILE *stat;
+        long child;
+        long parent = 0;
+
+        child = strtol(entry->d_name, NULL, 10);
+
+        if (child <= 0 || child == pid)
+        {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "/proc/%ld/stat", child);
+        stat = fopen(path, "r");
+
+        if (stat == NULL)
+        {
+            continue;
+        }
+
+        // pid (comm) state ppid ..., and comm may hold spaces
+        if (fgets(line, sizeof(line), stat) != NULL && strrchr(line, ')') != NULL)
+        {
+            sscanf(strrchr(line, ')') + 1, " %*c %ld", &parent);
+        }
+
+        fclose(stat);
+
+        if (parent == pid)
+        {
+            rss += process_rss_kb(child);
+        }
+    }
+
+    closedir(proc);
+
+    return rss;
+}
+
+static long slab_kb(void)
+{
+    char line[LINE_SIZE];
+    FILE *meminfo;
+    long slab = 0;
+
+    meminfo = fopen("/proc/meminfo", "r");
+
+    if (meminfo == NULL)
+    {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), meminfo) != NULL)
+    {
+        if (strncmp(line, "Slab:", strlen("Slab:")) == 0)
+        {
+            slab = strtol(line + strlen("Slab:"), NULL, 10);
+            break;
+        }
+    }
+
+    fclose(meminfo);
+
+    return slab;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+    uint64_t left = *(const uint64_t *) a;
+    uint64_t right = *(const uint64_t *) b;
+
+    return (left > right) - (left < right);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * NS_PER_SEC + (uint64_t) now.tv_nsec;
+}
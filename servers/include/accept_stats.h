@@ -0,0 +1,73 @@
+#ifndef SCALABLE_SERVER_ACCEPT_STATS_H
+#define SCALABLE_SERVER_ACCEPT_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#define ACCEPT_BATCH_BUCKETS 8    // wakeups that accepted 1, 2-3, 4-7, ... 128 or more connections
+
+/**
+ * How the accept path keeps up with the listen queue, collected by the process that accepts.
+ */
+struct accept_stats
+{
+    /**
+     * Listener readiness events handled.
+     */
+    uint64_t wakeups;
+    /**
+     * Connections taken off the queue, including ones admission control rejected.
+     */
+    uint64_t accepted;
+    /**
+     * Wakeups that stopped at the per-wakeup cap with connections possibly still queued.
+     */
+    uint64_t capped;
+    uint32_t max_batch;
+    uint64_t batches[ACCEPT_BATCH_BUCKETS];
+    /**
+     * Time TCP connections waited in the accept queue, from TCP_INFO: time since the client's last packet when
+     * accept returned.
+     */
+    uint64_t wait_ms_total;
+    uint32_t wait_ms_max;
+    uint64_t waits;
+    /**
+     * Longest accept queue seen at a wakeup and the listener's backlog, from TCP_INFO on the listener.
+     */
+    uint32_t queue_peak;
+    uint32_t backlog;
+    /**
+     * Host wide TcpExt ListenOverflows and ListenDrops when the stats were initialised.
+     */
+    uint64_t overflows_start;
+    uint64_t drops_start;
+    bool have_netstat;
+};
+
+void accept_stats_init(struct accept_stats *stats);
+
+/**
+ * Note a readiness event on listener and sample its accept queue.
+ */
+void accept_stats_wakeup(struct accept_stats *stats, int listener);
+
+/**
+ * Record how long an accepted connection waited in the queue, TCP connections only.
+ */
+void accept_stats_connection(struct accept_stats *stats, int fd, sa_family_t family);
+
+/**
+ * Close the current wakeup after accepted connections.
+ * @param capped The wakeup stopped at its cap rather than on an empty queue.
+ */
+void accept_stats_batch(struct accept_stats *stats, uint32_t accepted, bool capped);
+
+/**
+ * Print the counters, with the host's listen queue overflows since accept_stats_init.
+ */
+void accept_stats_report(const struct accept_stats *stats, FILE *out);
+
+#endif //SCALABLE_SERVER_ACCEPT_STATS_H
@@ -0,0 +1,47 @@
+#ifndef SCALABLE_SERVER_ADMISSION_H
+#define SCALABLE_SERVER_ADMISSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+enum admission_verdict
+{
+    ADMIT,
+    REJECT_CONNECTIONS, // over the concurrent connection limit
+    REJECT_RATE         // out of accept tokens
+};
+
+struct admission
+{
+    /**
+     * Most concurrent connections, 0 for no limit.
+     */
+    uint32_t max_connections;
+    /**
+     * Most requests dispatched to each worker at once, 0 for no limit.
+     */
+    uint32_t max_in_flight_per_worker;
+    /**
+     * Accepts per second refilled into the bucket, 0 for no limit.
+     */
+    uint32_t accept_rate;
+    uint32_t accept_burst;
+    /**
+     * Tokens in thousandths so the refill needs no floating point.
+     */
+    uint64_t millitokens;
+    uint64_t last_refill_ms;
+    uint64_t admitted;
+    uint64_t rejected_connections;
+    uint64_t rejected_rate;
+    uint64_t deferred;
+};
+
+void admission_init(struct admission *admission, uint32_t max_connections, uint32_t max_in_flight_per_worker, uint32_t accept_rate, uint32_t accept_burst, uint64_t now_ms);
+enum admission_verdict admission_accept(struct admission *admission, uint32_t connections, uint64_t now_ms);
+bool admission_can_dispatch(const struct admission *admission, int in_flight, int workers);
+void admission_reject(int client_socket);
+void admission_report(const struct admission *admission, FILE *stream);
+
+#endif //SCALABLE_SERVER_ADMISSION_H
@@ -0,0 +1,34 @@
+#ifndef SCALABLE_SERVER_AFFINITY_H
+#define SCALABLE_SERVER_AFFINITY_H
+
+#include <stddef.h>
+
+/**
+ * Fill cpus with the CPUs this process may run on.
+ * @return the number of CPUs written, at most max.
+ */
+int affinity_available_cpus(int *cpus, int max);
+/**
+ * CPU for worker slot, leaving cpus[0] to the dispatcher when there is more than one CPU.
+ */
+int affinity_worker_cpu(const int *cpus, int count, int slot);
+/**
+ * Pin the calling process to a single CPU.
+ * @return 0 on success, -1 on failure.
+ */
+int affinity_pin(int cpu);
+/**
+ * NUMA node of the CPU the caller is running on, 0 when unknown.
+ */
+int affinity_current_node(void);
+/**
+ * Allocate and fault in pages so the kernel's first-touch policy places them on the caller's NUMA node.
+ */
+void *affinity_alloc_local(size_t size);
+void affinity_free_local(void *memory, size_t size);
+/**
+ * CPU that handled the socket's most recent receive softirq, -1 when unknown.
+ */
+int affinity_incoming_cpu(int socket);
+
+#endif //SCALABLE_SERVER_AFFINITY_H
@@ -0,0 +1,71 @@
+#ifndef SCALABLE_SERVER_BUFFER_POOL_H
+#define SCALABLE_SERVER_BUFFER_POOL_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct buffer_pool_stats
+{
+    uint64_t borrows;
+    /**
+     * Borrows the free list could not serve, each one a malloc.
+     */
+    uint64_t allocations;
+    /**
+     * Buffers borrowed and not returned yet, i.e. reads in progress.
+     */
+    size_t outstanding;
+    size_t peak_outstanding;
+    size_t num_free;
+    size_t buffer_size;
+};
+
+struct pool_buffer;
+
+/**
+ * Fixed size I/O buffers lent out for the length of one read. A connection holds no buffer between reads, so memory
+ * follows the number of reads in flight instead of the number of connections.
+ */
+struct buffer_pool
+{
+    pthread_mutex_t lock;
+    struct pool_buffer *free_list;
+    size_t buffer_size;
+    /**
+     * Returned buffers beyond this many are freed instead of kept.
+     */
+    size_t max_free;
+    struct buffer_pool_stats stats;
+};
+
+void buffer_pool_init(struct buffer_pool *pool, size_t buffer_size, size_t max_free);
+
+/**
+ * Take a buffer of pool->buffer_size bytes, from the free list when one is there.
+ * @return NULL, with err set, if a new buffer could not be allocated.
+ */
+uint8_t *buffer_pool_borrow(const struct dc_env *env, struct dc_error *err, struct buffer_pool *pool);
+
+/**
+ * Give back a buffer from buffer_pool_borrow on the same pool.
+ */
+void buffer_pool_return(const struct dc_env *env, struct buffer_pool *pool, uint8_t *buffer);
+
+void buffer_pool_stats(struct buffer_pool *pool, struct buffer_pool_stats *stats);
+
+/**
+ * Print the counters, or nothing if the pool was never borrowed from.
+ */
+void buffer_pool_report(struct buffer_pool *pool, const char *name, FILE *out);
+
+/**
+ * Free the buffers on the free list. Borrowed buffers must have been returned.
+ */
+void buffer_pool_destroy(const struct dc_env *env, struct buffer_pool *pool);
+
+#endif //SCALABLE_SERVER_BUFFER_POOL_H
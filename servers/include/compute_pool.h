@@ -0,0 +1,120 @@
+#ifndef SCALABLE_SERVER_COMPUTE_POOL_H
+#define SCALABLE_SERVER_COMPUTE_POOL_H
+
+#include "message_handler.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define COMPUTE_CACHE_LINE 64
+
+/**
+ * A request on its way through the processor stage: the raw data on the way in, the processed data on the way out.
+ */
+struct compute_job
+{
+    int fd;
+    /**
+     * Processor of the handler set current when the request was read.
+     */
+    process_message_func processor;
+    uint8_t *data;
+    ssize_t length;
+    /**
+     * Set by the compute thread when the processor raised an error.
+     */
+    bool failed;
+};
+
+struct compute_cell
+{
+    /**
+     * Vyukov sequence number: equal to the position when the cell is free for it, position + 1 once it holds a job.
+     */
+    _Atomic size_t sequence;
+    struct compute_job job;
+};
+
+/**
+ * Bounded multi-producer multi-consumer ring, a power of two in size.
+ */
+struct compute_queue
+{
+    struct compute_cell *cells;
+    size_t mask;
+    _Alignas(COMPUTE_CACHE_LINE) _Atomic size_t enqueue_pos;
+    _Alignas(COMPUTE_CACHE_LINE) _Atomic size_t dequeue_pos;
+};
+
+struct compute_pool
+{
+    pthread_t *threads;
+    int num_threads;
+    /**
+     * Requests waiting for a compute thread.
+     */
+    struct compute_queue requests;
+    /**
+     * Processed requests waiting for the event loop to send them.
+     */
+    struct compute_queue results;
+    /**
+     * Counts queued requests, the threads sleep on it when the request queue is empty.
+     */
+    sem_t pending;
+    atomic_bool stopping;
+    /**
+     * Set once a wakeup byte has been written and not yet consumed, so a burst of results costs one write.
+     */
+    atomic_bool notified;
+    /**
+     * Write end of the pipe the event loop waits on for results.
+     */
+    int notify_fd;
+};
+
+/**
+ * Start the compute threads.
+ * @param env Environment object.
+ * @param err Error object.
+ * @param pool Pool to start.
+ * @param num_threads Compute threads.
+ * @param depth Requests allowed in the processor stage at once, rounded up to a power of two. The result queue
+ * has the same depth, so a caller that keeps at most depth requests in flight never finds it full.
+ * @param notify_fd Written to when results are ready.
+ * @return true if every thread started.
+ */
+bool compute_pool_start(const struct dc_env *env, struct dc_error *err, struct compute_pool *pool, int num_threads, size_t depth, int notify_fd);
+
+/**
+ * Requests the processor stage holds at most.
+ */
+size_t compute_pool_depth(const struct compute_pool *pool);
+
+/**
+ * Queue a request for a compute thread, the pool owns job->data from now on.
+ * @return false if the request queue is full.
+ */
+bool compute_pool_submit(struct compute_pool *pool, const struct compute_job *job);
+
+/**
+ * Take a processed request, the caller owns job->data from now on.
+ * Call compute_pool_rearm once the wakeup has been consumed and before taking the results.
+ * @return false if there is none.
+ */
+bool compute_pool_complete(struct compute_pool *pool, struct compute_job *job);
+
+/**
+ * Allow the next result to write a wakeup again.
+ */
+void compute_pool_rearm(struct compute_pool *pool);
+
+/**
+ * Let the threads finish the queued requests, then join them and free whatever was not collected.
+ */
+void compute_pool_stop(const struct dc_env *env, struct compute_pool *pool);
+
+#endif //SCALABLE_SERVER_COMPUTE_POOL_H
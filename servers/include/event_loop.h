@@ -0,0 +1,70 @@
+#ifndef SCALABLE_SERVER_EVENT_LOOP_H
+#define SCALABLE_SERVER_EVENT_LOOP_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+
+enum event_backend_type
+{
+    EVENT_BACKEND_SELECT,
+    EVENT_BACKEND_POLL,
+    EVENT_BACKEND_EPOLL
+};
+
+enum event_flags
+{
+    EVENT_READ = 1,
+    EVENT_HANGUP = 2,   // peer closed or the descriptor is in error, not reported by select
+    EVENT_WRITE = 4
+};
+
+struct event
+{
+    int fd;
+    unsigned int events;
+};
+
+struct event_backend;
+
+/**
+ * Readiness notification over select, poll or epoll behind one interface.
+ */
+struct event_loop
+{
+    const struct event_backend *backend;
+    /**
+     * Backend specific interest set.
+     */
+    void *state;
+};
+
+const char *event_backend_name(enum event_backend_type type);
+
+/**
+ * @return true if the backend could be set up.
+ */
+bool event_loop_init(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, enum event_backend_type type);
+void event_loop_destroy(const struct dc_env *env, struct dc_error *err, struct event_loop *loop);
+
+/**
+ * Start watching fd.
+ * @return false if the backend cannot hold the descriptor (select past FD_SETSIZE).
+ */
+bool event_loop_add(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, int fd, unsigned int events);
+
+/**
+ * Change what fd is watched for, 0 keeps it registered but silent.
+ */
+void event_loop_modify(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, int fd, unsigned int events);
+void event_loop_remove(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, int fd);
+
+/**
+ * Wait for descriptors to become ready.
+ * @param events Filled with up to max_events ready descriptors.
+ * @param timeout_ms -1 to wait forever.
+ * @return number of ready descriptors, 0 on timeout or signal, -1 on error.
+ */
+int event_loop_wait(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event *events, int max_events, int timeout_ms);
+
+#endif //SCALABLE_SERVER_EVENT_LOOP_H
@@ -0,0 +1,92 @@
+#ifndef SCALABLE_SERVER_EVENT_SERVER_H
+#define SCALABLE_SERVER_EVENT_SERVER_H
+
+#include "event_loop.h"
+#include "util.h"
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define EVENT_SERVER_STALL_TIMEOUT_MS 30000
+#define EVENT_SERVER_SHUTDOWN_TIMEOUT_MS 10000
+
+enum dispatch_strategy
+{
+    DISPATCH_INLINE,    // the event loop runs the handler itself
+    DISPATCH_THREADS,   // pool threads run the handler while the loop keeps polling
+    DISPATCH_COMPUTE,   // the loop reads and sends, compute threads run the processor
+    DISPATCH_FIBERS,    // the loop runs the handler in a fiber that goes back to the loop whenever its socket would block
+    DISPATCH_PROCESSES  // the loop passes readable sockets to forked worker processes, the pool grows and shrinks with load
+};
+
+/**
+ * What distinguishes one event driven server mode from another.
+ */
+struct event_server_config
+{
+    /**
+     * Server name written to the metrics log.
+     */
+    const char *name;
+    enum event_backend_type backend;
+    enum dispatch_strategy dispatch;
+    /**
+     * Pool threads for DISPATCH_THREADS, compute threads for DISPATCH_COMPUTE, starting workers for DISPATCH_PROCESSES.
+     */
+    int threads;
+    /**
+     * Requests in the processor stage at once for DISPATCH_COMPUTE, further readable connections wait unread.
+     */
+    size_t compute_depth;
+    int backlog;
+    /**
+     * Concurrent connections before new ones are rejected, 0 for the descriptor limit less the server's own.
+     */
+    uint32_t max_connections;
+    /**
+     * Accepts per second before new connections are rejected, 0 disables.
+     */
+    uint32_t accept_rate;
+    /**
+     * Accepts allowed at once after being idle.
+     */
+    uint32_t accept_burst;
+    /**
+     * Requests passed to each worker process at once for DISPATCH_PROCESSES, the rest wait unread, 0 disables.
+     */
+    uint32_t max_in_flight_per_worker;
+    /**
+     * Time a new connection has to send its first request, 0 disables.
+     */
+    uint32_t header_timeout_ms;
+    /**
+     * Time an idle connection is kept between requests, 0 disables.
+     */
+    uint32_t idle_timeout_ms;
+    /**
+     * Time a request may spend with a pool, or waiting for one, before its socket is shut down, 0 disables.
+     */
+    uint32_t stall_timeout_ms;
+    /**
+     * Time the first SIGINT/SIGTERM gives requests in progress before the server stops anyway.
+     */
+    uint32_t shutdown_timeout_ms;
+    /**
+     * Log every connection accepted, rejected and timed out.
+     */
+    bool verbose;
+};
+
+/**
+ * Serve on opts->ip_address:opts->config.port and/or opts->unix_path until SIGINT/SIGTERM has drained the connections,
+ * or SIGUSR2 has handed them to a new process running opts->argv. SIGHUP reloads the message handlers.
+ * @param env Environment object.
+ * @param err Error object.
+ * @param opts Options object.
+ * @param config Backend, dispatch strategy and limits.
+ * @return EXIT_SUCCESS, or EXIT_FAILURE if the server could not start.
+ */
+int run_event_server(struct dc_env *env, struct dc_error *err, struct options *opts, const struct event_server_config *config);
+
+#endif //SCALABLE_SERVER_EVENT_SERVER_H
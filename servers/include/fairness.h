@@ -0,0 +1,99 @@
+#ifndef SCALABLE_SERVER_FAIRNESS_H
+#define SCALABLE_SERVER_FAIRNESS_H
+
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#define FAIR_MAX_CLASSES 8
+#define FAIR_DEFAULT_CLASS 0    // clients that match no configured class
+#define FAIR_BUCKETS 40         // power of two nanosecond buckets, up to about 9 minutes
+
+/**
+ * Clients from one IPv4 network, served weight times the per-wakeup budget.
+ */
+struct fair_class
+{
+    in_addr_t network;  // network byte order
+    in_addr_t mask;     // network byte order
+    uint32_t weight;
+};
+
+/**
+ * Service times of one class, updated from the event loop and pool threads.
+ */
+struct fair_stats
+{
+    _Atomic uint64_t requests;
+    /**
+     * Wakeups where a connection still had data when its budget ran out.
+     */
+    _Atomic uint64_t budget_exhausted;
+    _Atomic uint64_t max_ns;
+    _Atomic uint64_t buckets[FAIR_BUCKETS];
+};
+
+struct fairness
+{
+    /**
+     * Requests one connection may have served per wakeup, times its class weight.
+     */
+    uint32_t request_budget;
+    /**
+     * Bytes one connection may have read per wakeup, times its class weight, 0 for no byte limit. A request that
+     * starts under the budget is read whole.
+     */
+    uint32_t byte_budget;
+    /**
+     * Class 0 is the default class with weight 1, configured classes follow in the order given.
+     */
+    struct fair_class classes[FAIR_MAX_CLASSES];
+    uint8_t num_classes;
+    struct fair_stats stats[FAIR_MAX_CLASSES];
+};
+
+/**
+ * Budgets from the configuration and only the default class.
+ */
+void fairness_init(struct fairness *fairness, uint32_t request_budget, uint32_t byte_budget);
+
+/**
+ * Add classes from a list like 10.0.0.0/8=4,127.0.0.2/32=2; the first class that matches a client wins.
+ * @return false if the list cannot be parsed or has too many classes.
+ */
+bool fairness_add_classes(struct fairness *fairness, const char *spec);
+
+/**
+ * Class of a client, FAIR_DEFAULT_CLASS for Unix domain and IPv6 clients and those no class matches.
+ */
+uint8_t fairness_classify(const struct fairness *fairness, const struct sockaddr_storage *peer);
+
+/**
+ * Requests a connection of this class may have served in one wakeup.
+ */
+uint32_t fairness_request_budget(const struct fairness *fairness, uint8_t class_id);
+
+/**
+ * Bytes a connection of this class may have read in one wakeup, 0 for no limit.
+ */
+uint32_t fairness_byte_budget(const struct fairness *fairness, uint8_t class_id);
+
+/**
+ * Record one request from the wakeup that found it readable to its reply being sent.
+ */
+void fairness_record(struct fairness *fairness, uint8_t class_id, uint64_t service_ns);
+
+/**
+ * Note a connection that was stopped by its budget with more data waiting.
+ */
+void fairness_exhausted(struct fairness *fairness, uint8_t class_id);
+
+/**
+ * Print service time percentiles per class, for classes that served anything.
+ */
+void fairness_report(struct fairness *fairness, FILE *out);
+
+#endif //SCALABLE_SERVER_FAIRNESS_H
@@ -0,0 +1,134 @@
+#ifndef SCALABLE_SERVER_FIBER_H
+#define SCALABLE_SERVER_FIBER_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <ucontext.h>
+
+/**
+ * Body of a fiber, run with the arguments it was created with and an error object of its own. The return value is
+ * kept for fiber_result.
+ */
+typedef int (*fiber_func)(void *arg, int fd, struct dc_error *err);
+
+struct fiber;
+
+struct fiber_stats
+{
+    uint64_t started;
+    /**
+     * Stacks mapped, each with a guard page below it. Starts beyond this reused a pooled stack.
+     */
+    uint64_t stacks_mapped;
+    /**
+     * Waits that suspended a fiber until the loop saw its descriptor ready.
+     */
+    uint64_t waits;
+    /**
+     * Fibers whose waits were failed because their connection was closed under them.
+     */
+    uint64_t cancelled;
+    uint32_t live;
+    uint32_t peak_live;
+};
+
+/**
+ * The fibers of one thread. Each runs on its own stack until it waits, then the thread is back in whoever resumed it.
+ * Finished fibers keep their stack for the next one, up to max_free of them.
+ */
+struct fiber_pool
+{
+    /**
+     * Where a fiber that waits or finishes switches back to.
+     */
+    ucontext_t scheduler;
+    /**
+     * Every fiber created, indexed by id, finished ones included.
+     */
+    struct fiber **fibers;
+    int num_fibers;
+    int capacity;
+    /**
+     * Finished fibers that kept their stack, most recently used first.
+     */
+    struct fiber *free_list;
+    size_t num_free;
+    /**
+     * Finished fibers whose stack was unmapped because max_free were already kept.
+     */
+    struct fiber *spare_list;
+    /**
+     * Usable bytes per stack, a multiple of the page size.
+     */
+    size_t stack_size;
+    size_t max_free;
+    struct fiber_stats stats;
+};
+
+/**
+ * @param stack_size Usable stack per fiber, rounded up to whole pages.
+ * @param max_free Finished fibers that keep their stack mapped for reuse.
+ */
+void fiber_pool_init(struct fiber_pool *pool, size_t stack_size, size_t max_free);
+
+/**
+ * Unmap every stack and free every fiber. No fiber may be suspended.
+ */
+void fiber_pool_destroy(struct fiber_pool *pool);
+
+/**
+ * Set up a fiber that will run func(arg, fd, err) when first resumed.
+ * @return its id, or -1 with err set if no stack could be mapped.
+ */
+int fiber_create(const struct dc_env *env, struct dc_error *err, struct fiber_pool *pool, fiber_func func, void *arg, int fd);
+
+/**
+ * Run a fiber until it waits or finishes. Only called from outside every fiber.
+ * @return true once it has finished.
+ */
+bool fiber_resume(struct fiber_pool *pool, int id);
+
+/**
+ * Fail the fiber's current wait and every later one, and run it to the end.
+ * @return true once it has finished, false if it waited again regardless.
+ */
+bool fiber_cancel(struct fiber_pool *pool, int id);
+
+/**
+ * Poll events (POLLIN, POLLOUT) a suspended fiber waits for on its fd.
+ */
+short fiber_waiting_for(const struct fiber_pool *pool, int id);
+
+/**
+ * The return value of a finished fiber's body.
+ */
+int fiber_result(const struct fiber_pool *pool, int id);
+
+/**
+ * Give a finished fiber, and its stack, back to the pool. Its id may be handed out again.
+ */
+void fiber_release(struct fiber_pool *pool, int id);
+
+/**
+ * Wait until fd is ready for events. Inside a fiber created for fd this switches back to the loop that resumed it and
+ * returns when the loop resumes it again; how long that may take is up to the loop. Anywhere else it polls for up to
+ * timeout_ms.
+ * @return false on a timeout or a cancelled fiber.
+ */
+bool fiber_wait_fd(int fd, short events, int timeout_ms);
+
+/**
+ * @return true when called from inside a fiber.
+ */
+bool fiber_running(void);
+
+/**
+ * Print how many fibers ran and how many stacks they needed, if any ran.
+ */
+void fiber_pool_report(const struct fiber_pool *pool, FILE *out);
+
+#endif //SCALABLE_SERVER_FIBER_H
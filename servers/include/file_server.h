@@ -0,0 +1,88 @@
+#ifndef SCALABLE_SERVER_FILE_SERVER_H
+#define SCALABLE_SERVER_FILE_SERVER_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define FILE_NOT_FOUND UINT64_MAX   // reply header for a name that does not resolve to a readable regular file
+
+/**
+ * How the file body gets from the page cache to the socket.
+ */
+enum file_transfer
+{
+    /**
+     * sendfile straight from the file, falling back to splice if the file system cannot.
+     */
+    FILE_TRANSFER_SENDFILE,
+    /**
+     * splice the file into a pipe and the pipe into the socket.
+     */
+    FILE_TRANSFER_SPLICE,
+    /**
+     * pread into a buffer and write it out, the baseline the other two are measured against.
+     */
+    FILE_TRANSFER_COPY
+};
+
+struct file_server_stats
+{
+    uint64_t requests;
+    /**
+     * Names refused before any lookup: absolute, with a .. component, or empty.
+     */
+    uint64_t rejected;
+    uint64_t not_found;
+    /**
+     * Requests served from a descriptor already in the cache.
+     */
+    uint64_t hits;
+    /**
+     * Opens, on a miss or because the file changed since it was cached.
+     */
+    uint64_t opens;
+    uint64_t evictions;
+    uint64_t bytes_sent;
+    /**
+     * Replies cut short by a client that stopped reading or went away.
+     */
+    uint64_t aborted;
+};
+
+/**
+ * Serve files under root from now on. Paths are resolved below root only, symlinks that lead out of it included.
+ * @param env Environment object.
+ * @param err Error object.
+ * @param root Directory the request names are relative to.
+ * @param transfer How bodies are sent.
+ * @return false, with err set, if root is not a directory that can be opened.
+ */
+bool file_server_init(const struct dc_env *env, struct dc_error *err, const char *root, enum file_transfer transfer);
+
+/**
+ * Sender that treats the processed request as a file name below the root and replies with an 8-byte big-endian
+ * length, FILE_NOT_FOUND if there is no such file, followed by the file. Same contract as send_message_func.
+ */
+void send_file_handler(const struct dc_env *env, struct dc_error *err, uint8_t *buffer, size_t count, int client_socket, bool *closed);
+
+/**
+ * Counters so far in this process.
+ * @return false if file serving is not enabled.
+ */
+bool file_server_stats(struct file_server_stats *stats);
+
+/**
+ * Print the counters if file serving is enabled and served anything.
+ */
+void file_server_report(FILE *out);
+
+/**
+ * Close the cached descriptors and the root.
+ */
+void file_server_destroy(void);
+
+#endif //SCALABLE_SERVER_FILE_SERVER_H
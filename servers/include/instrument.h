@@ -0,0 +1,54 @@
+#ifndef SCALABLE_SERVER_INSTRUMENT_H
+#define SCALABLE_SERVER_INSTRUMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define INSTRUMENT_BUCKETS 64
+
+/**
+ * Stages of the poll server pipeline. Each stage records the time elapsed since the previous one.
+ */
+enum instrument_stage
+{
+    STAGE_DISPATCH,     // poll wakeup -> fd sent to the domain socket
+    STAGE_HANDOFF,      // fd sent -> worker pickup
+    STAGE_READ,         // worker pickup -> reader done
+    STAGE_PROCESS,      // reader done -> processor done
+    STAGE_SEND,         // processor done -> sender done
+    STAGE_REVIVE,       // sender done -> parent revived the fd
+    STAGE_TOTAL,        // poll wakeup -> parent revived the fd
+    STAGE_COUNT
+};
+
+struct stage_histogram
+{
+    /**
+     * Number of samples in each power of two nanosecond bucket.
+     */
+    uint64_t buckets[INSTRUMENT_BUCKETS];
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+};
+
+struct instrument
+{
+    /**
+     * When false every call is a no-op and timestamps are 0.
+     */
+    bool enabled;
+    /**
+     * One histogram per stage, owned by a single process so no locking is needed.
+     */
+    struct stage_histogram stages[STAGE_COUNT];
+};
+
+void instrument_init(struct instrument *instrument, bool enabled);
+uint64_t instrument_stamp(const struct instrument *instrument);
+void instrument_record(struct instrument *instrument, enum instrument_stage stage, uint64_t start_ns, uint64_t end_ns);
+void instrument_report(const struct instrument *instrument, FILE *stream, const char *label);
+
+#endif //SCALABLE_SERVER_INSTRUMENT_H
@@ -0,0 +1,81 @@
+#ifndef SCALABLE_SERVER_KERNELS_H
+#define SCALABLE_SERVER_KERNELS_H
+
+#include "message_handler.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define KERNEL_NOT_FOUND SIZE_MAX
+#define KERNEL_MAX_SETS 3
+
+typedef uint32_t (*crc32c_kernel)(uint32_t crc, const uint8_t *data, size_t length);
+typedef size_t (*scan_kernel)(const uint8_t *data, size_t length, uint8_t delimiter, size_t *last);
+typedef void (*normalize_kernel)(const uint8_t *data, uint8_t *out, size_t length);
+
+/**
+ * One implementation of every kernel for an instruction set.
+ */
+struct kernel_set
+{
+    const char *name;
+    /**
+     * Continue a CRC32C (Castagnoli) over data, without the initial/final inversion.
+     */
+    crc32c_kernel crc32c;
+    /**
+     * Count the delimiters in data and store the index of the last one in last (KERNEL_NOT_FOUND if none).
+     */
+    scan_kernel scan;
+    /**
+     * Copy data to out with ASCII letters lowercased and \t \n \v \f \r turned into spaces.
+     */
+    normalize_kernel normalize;
+};
+
+/**
+ * The fastest kernel set this CPU supports, chosen on first use.
+ */
+const struct kernel_set *kernels_active(void);
+
+/**
+ * Every kernel set this CPU supports, slowest (scalar) first.
+ * @param sets Filled with up to KERNEL_MAX_SETS sets.
+ * @return Number of sets.
+ */
+size_t kernels_supported(const struct kernel_set *sets[KERNEL_MAX_SETS]);
+
+/**
+ * CRC32C of data with the standard inversions, e.g. "123456789" is 0xE3069283.
+ */
+uint32_t kernel_crc32c(const uint8_t *data, size_t length);
+
+/**
+ * Strip and check a trailing 4 byte big-endian CRC32C, raises an error if it does not match.
+ */
+size_t process_crc32c_handler(const struct dc_env *env, struct dc_error *err, const uint8_t *raw_data, uint8_t **processed_data, ssize_t count);
+
+/**
+ * Keep the complete newline terminated records, a trailing partial record is dropped.
+ */
+size_t process_lines_handler(const struct dc_env *env, struct dc_error *err, const uint8_t *raw_data, uint8_t **processed_data, ssize_t count);
+
+/**
+ * Lowercase ASCII letters and turn whitespace into spaces.
+ */
+size_t process_normalize_handler(const struct dc_env *env, struct dc_error *err, const uint8_t *raw_data, uint8_t **processed_data, ssize_t count);
+
+/**
+ * Look up a built-in processor by name (crc32c, lines or normalize).
+ * @return The processor, NULL if there is none by that name.
+ */
+process_message_func kernel_processor(const char *name);
+
+/**
+ * Measure bytes per cycle of every kernel in every supported set across payload sizes.
+ * @param out Where to print the table.
+ */
+void kernels_benchmark(FILE *out);
+
+#endif //SCALABLE_SERVER_KERNELS_H
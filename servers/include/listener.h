@@ -0,0 +1,56 @@
+#ifndef SCALABLE_SERVER_LISTENER_H
+#define SCALABLE_SERVER_LISTENER_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define LISTENER_ACCEPT_BATCH 64    // connections accepted per wakeup before the loop serves everyone else
+
+/**
+ * Create a non-blocking TCP socket bound to address:port and listening with the given backlog.
+ * Every server mode goes through here so they all listen the same way.
+ * Being non-blocking, the listener can be drained until accept finds the queue empty.
+ * @param env Environment object.
+ * @param err Error object.
+ * @param address IPv4 address to bind.
+ * @param port Port to bind.
+ * @param backlog Listen queue length.
+ * @return the listening socket, or -1 on failure.
+ */
+int listener_open(const struct dc_env *env, struct dc_error *err, const char *address, in_port_t port, int backlog);
+
+/**
+ * Create a non-blocking Unix domain stream socket bound to path and listening with the given backlog.
+ * A stale socket left at path is replaced, any other kind of file is an error.
+ * @param env Environment object.
+ * @param err Error object.
+ * @param path Filesystem path to bind.
+ * @param backlog Listen queue length.
+ * @return the listening socket, or -1 on failure.
+ */
+int listener_open_unix(const struct dc_env *env, struct dc_error *err, const char *path, int backlog);
+
+/**
+ * Close a listener from listener_open_unix and remove its path.
+ * Pass a NULL path to close it but leave the path for another process that shares the socket.
+ * @param env Environment object.
+ * @param err Error object.
+ * @param listener Listening socket, ignored if negative.
+ * @param path Path it is bound to, or NULL.
+ */
+void listener_close_unix(const struct dc_env *env, struct dc_error *err, int listener, const char *path);
+
+/**
+ * Accept a connection with accept4 and apply the active socket tuning profile to it.
+ * @param env Environment object.
+ * @param err Error object, left clear when the queue is empty or the client already went away.
+ * @param listener Listening socket.
+ * @param address Filled with the peer address.
+ * @param flags SOCK_NONBLOCK and SOCK_CLOEXEC, as the caller needs them.
+ * @return the connection, or -1.
+ */
+int listener_accept(const struct dc_env *env, struct dc_error *err, int listener, struct sockaddr_storage *address, int flags);
+
+#endif //SCALABLE_SERVER_LISTENER_H
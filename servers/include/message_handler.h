@@ -0,0 +1,103 @@
+#ifndef SCALABLE_SERVER_MESSAGE_HANDLER_H
+#define SCALABLE_SERVER_MESSAGE_HANDLER_H
+
+#include "file_server.h"
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef ssize_t (*read_message_func)(const struct dc_env *env, struct dc_error *err, uint8_t **raw_data, int client_socket);
+typedef size_t (*process_message_func)(const struct dc_env *env, struct dc_error *err, const uint8_t *raw_data, uint8_t **processed_data, ssize_t count);
+typedef void (*send_message_func)(const struct dc_env *env, struct dc_error *err, uint8_t *buffer, size_t count, int client_socket, bool *closed);
+
+/**
+ * The three stages every server mode runs a request through.
+ */
+struct message_handler
+{
+    read_message_func reader;
+    process_message_func processor;
+    send_message_func sender;
+};
+
+typedef int (*handler_init_func)(void);
+typedef void (*handler_teardown_func)(void);
+
+/**
+ * Use the built-in handlers from util.c.
+ * @param message_handler Handler to fill in.
+ */
+void message_handler_default(struct message_handler *message_handler);
+
+/**
+ * Use a built-in processor kernel instead of the plain copy, also for shared objects that do not export a processor.
+ * @param name Kernel name, see kernel_processor.
+ * @return false if there is no kernel by that name.
+ */
+bool message_handler_use_kernel(const char *name);
+
+/**
+ * Reply with files below root instead of the 2-byte count, also for shared objects that do not export a sender.
+ * See send_file_handler for the reply format.
+ * @param env Environment object.
+ * @param err Error object.
+ * @param root Directory request names are looked up in.
+ * @param transfer How file bodies are sent.
+ * @return false, with err set, if root cannot be opened.
+ */
+bool message_handler_use_files(const struct dc_env *env, struct dc_error *err, const char *root, enum file_transfer transfer);
+
+/**
+ * Load handlers from a shared object and make them current.
+ * The object may export handler_read, handler_process and handler_send (any missing one falls back to the
+ * built-in), and optionally handler_init/handler_teardown which run once in every process that serves requests.
+ * Previously loaded objects stay mapped since a request may still be running their code.
+ * @param env Environment object.
+ * @param err Error object.
+ * @param path Shared object to load.
+ * @return true if it loaded, the current handlers are unchanged otherwise.
+ */
+bool message_handler_load(const struct dc_env *env, struct dc_error *err, const char *path);
+
+/**
+ * Load the current shared object again, picking up a new file installed at the same path.
+ * @return true if it loaded, false on failure or if no shared object was loaded.
+ */
+bool message_handler_reload(const struct dc_env *env, struct dc_error *err);
+
+/**
+ * Current handlers, the loaded shared object's or the built-in ones.
+ * @param message_handler Handler to fill in.
+ */
+void message_handler_current(struct message_handler *message_handler);
+
+/**
+ * Run the current handlers' init hook in this process.
+ * @return false if the hook failed.
+ */
+bool message_handler_attach(void);
+
+/**
+ * Run the teardown hook of the handlers this process attached to.
+ */
+void message_handler_detach(void);
+
+/**
+ * Read one request from the client, process it and send the reply.
+ * @param env Environment object.
+ * @param err Error object.
+ * @param message_handler Handler to run.
+ * @param client_socket Client to serve.
+ * @return true if the connection should be closed.
+ */
+bool message_handler_run(const struct dc_env *env, struct dc_error *err, const struct message_handler *message_handler, int client_socket);
+
+/**
+ * Send a processed reply with the handler's sender, corked as a whole when the socket tuning profile asks for it.
+ * Same contract as send_message_func.
+ */
+void message_handler_send(const struct dc_env *env, struct dc_error *err, const struct message_handler *message_handler, uint8_t *buffer, size_t count, int client_socket, bool *closed);
+
+#endif //SCALABLE_SERVER_MESSAGE_HANDLER_H
@@ -0,0 +1,122 @@
+#ifndef SCALABLE_SERVER_METRICS_LOG_H
+#define SCALABLE_SERVER_METRICS_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define METRICS_MAGIC "SSMETRIC"
+#define METRICS_VERSION 1
+#define METRICS_MAX_STRINGS 255
+#define METRICS_STRING_SIZE 48
+#define METRICS_SCHEMA_SIZE 256
+#define METRICS_HEADER_SIZE 16384   // records start on a page boundary, the string table fits in front of them
+
+/**
+ * One measurement, written with a single O_APPEND write so processes sharing the log never interleave records.
+ */
+struct metrics_record
+{
+    /**
+     * CLOCK_REALTIME when the record was written.
+     */
+    uint64_t timestamp_ns;
+    /**
+     * Milliseconds for timings, a count for rates, as the event name says.
+     */
+    double value;
+    /**
+     * Indexes into the header's string table.
+     */
+    uint16_t server_id;
+    uint16_t event_id;
+    uint32_t pid;
+    uint64_t reserved;
+};
+
+/**
+ * The start of the file. Host byte order, the reader rejects a file whose magic, version or sizes differ from its own.
+ */
+struct metrics_header
+{
+    char magic[8];  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t string_size;
+    uint32_t max_strings;
+    uint32_t num_strings;
+    /**
+     * The record layout as text, for tools that don't share this header.
+     */
+    char schema[METRICS_SCHEMA_SIZE];
+    /**
+     * Interned server and event names, NUL terminated and cut to METRICS_STRING_SIZE - 1 bytes. Entries are added
+     * under an flock on the file and never removed.
+     */
+    char strings[METRICS_MAX_STRINGS][METRICS_STRING_SIZE];
+};
+
+_Static_assert(sizeof(struct metrics_record) == 32, "metrics records are 32 bytes");    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+_Static_assert(sizeof(struct metrics_header) <= METRICS_HEADER_SIZE, "the string table must fit in the header");
+
+/**
+ * Writer side, one per process. The header is mapped shared, so a name interned by another process is seen
+ * without a system call.
+ */
+struct metrics_log
+{
+    int fd;
+    struct metrics_header *header;
+};
+
+/**
+ * Read only view of a whole log file.
+ */
+struct metrics_view
+{
+    const struct metrics_header *header;
+    const struct metrics_record *records;
+    /**
+     * Complete records, a record still being appended is left out.
+     */
+    size_t num_records;
+    size_t mapped_size;
+};
+
+/**
+ * Open or create a log and load its string table.
+ * @param log Log to set up.
+ * @param path File to append to.
+ * @param truncate Start the file over instead of appending.
+ * @return false, with errno set, if the file cannot be opened or is not a metrics log of this version.
+ */
+bool metrics_log_open(struct metrics_log *log, const char *path, bool truncate);
+
+/**
+ * Append one record, interning server and event on first use.
+ * @return false if the write failed or the string table is full.
+ */
+bool metrics_log_append(struct metrics_log *log, const char *server, const char *event, double value);
+
+void metrics_log_close(struct metrics_log *log);
+
+/**
+ * Map a log for reading. The pages are only faulted in as the records are walked.
+ * @return false, with errno set, if the file cannot be mapped or is not a metrics log of this version.
+ */
+bool metrics_view_open(struct metrics_view *view, const char *path);
+
+/**
+ * Name behind a string id, "?" for an id outside the table.
+ */
+const char *metrics_view_string(const struct metrics_view *view, uint16_t id);
+
+/**
+ * Drop the pages of records before index from memory, for a reader streaming over a file larger than RAM.
+ */
+void metrics_view_release(const struct metrics_view *view, size_t index);
+
+void metrics_view_close(struct metrics_view *view);
+
+#endif //SCALABLE_SERVER_METRICS_LOG_H
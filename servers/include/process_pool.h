@@ -0,0 +1,143 @@
+#ifndef SCALABLE_SERVER_PROCESS_POOL_H
+#define SCALABLE_SERVER_PROCESS_POOL_H
+
+#include "instrument.h"
+#include "util.h"
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define PROCESS_POOL_INTERVAL_MS 250
+
+/**
+ * Run in a newly forked worker before it serves anything, to let go of what it inherited from the event loop.
+ */
+typedef void (*process_pool_forked_func)(struct dc_env *env, struct dc_error *err, void *context);
+
+/**
+ * Written to the completion pipe by a worker once it has served a request.
+ */
+struct process_pool_completion
+{
+    int fd; // the parent's descriptor, the worker's copy is already closed
+    bool closed;
+    uint64_t wakeup_ns;
+    uint64_t finished_ns;
+};
+
+struct process_pool
+{
+    /**
+     * One idle worker at a time waits on the domain socket, the others wait for this, so a socket wakes one worker.
+     */
+    sem_t *select_sem;
+    /**
+     * Parent end of the datagram socket pair readable client sockets are passed over with SCM_RIGHTS.
+     */
+    int domain_socket;
+    /**
+     * Worker ends, kept open so workers can be forked later.
+     */
+    int worker_domain_socket;
+    int worker_shutdown_fd;
+    /**
+     * Closing it wakes every worker with end of file.
+     */
+    int shutdown_fd;
+    /**
+     * Write end of the pipe the event loop reads completions from.
+     */
+    int completion_fd;
+    pid_t *workers; // room for max_workers
+    int num_workers;
+    int min_workers;
+    int max_workers;
+    /**
+     * Workers told to retire but not yet reaped, there are never more than max_workers.
+     */
+    pid_t retiring_pids[UINT8_MAX];
+    int retiring;
+    /**
+     * Moving average of busy workers, in percent.
+     */
+    int utilization;
+    uint64_t last_scale_ms;
+    bool stopping;
+    bool verbose;
+    bool pin_cpus;
+    /**
+     * CPUs this process may use when pinning, the event loop on the first and a worker on each of the others.
+     */
+    int *cpus;
+    int num_cpus;
+    size_t read_buffer_size;
+    /**
+     * The parent's stages: dispatch, revive and total.
+     */
+    struct instrument instrument;
+    process_pool_forked_func forked;
+    void *context;
+};
+
+/**
+ * Fork the workers, each serves one request at a time with the message handler current at the fork.
+ * @param num_workers Starting size, the pool grows to 4x and shrinks to half of it.
+ * @param opts Verbose logging, instrumentation, CPU pinning and the read buffer size.
+ * @param completion_fd Write end of the loop's completion pipe.
+ * @param forked Run in every worker first, with context.
+ * @return true if every worker started, otherwise the ones that did are stopped again.
+ */
+bool process_pool_start(struct dc_env *env, struct dc_error *err, struct process_pool *pool, int num_workers, const struct options *opts, int completion_fd, process_pool_forked_func forked, void *context);
+
+/**
+ * Pass a readable client socket to the next idle worker, the event loop must not watch it until its completion
+ * arrives.
+ * @param wakeup_ns When the loop woke up to find it readable, for the instrumentation.
+ * @return false if the socket could not be passed, it is still the caller's.
+ */
+bool process_pool_submit(const struct dc_env *env, struct dc_error *err, struct process_pool *pool, int client_socket, uint64_t wakeup_ns);
+
+/**
+ * Record the parent's side of a completion read from the pipe.
+ */
+void process_pool_revived(struct process_pool *pool, const struct process_pool_completion *completion);
+
+/**
+ * Workers that take new requests, not counting those on their way out.
+ */
+int process_pool_active(const struct process_pool *pool);
+
+/**
+ * Replace workers that died, fork more while requests wait for one, and retire one after a quiet spell. Called every
+ * PROCESS_POOL_INTERVAL_MS.
+ * @param in_flight Requests passed and not yet completed.
+ * @param queued Requests waiting in the event loop for a worker.
+ */
+void process_pool_resize(struct dc_env *env, struct dc_error *err, struct process_pool *pool, int in_flight, int queued);
+
+/**
+ * Replace every worker once it finishes its current request, the new ones are forked with the handlers reloaded in
+ * this process.
+ */
+void process_pool_reload(const struct dc_env *env, struct dc_error *err, struct process_pool *pool);
+
+/**
+ * Wake the workers to exit once they are idle, and kill those still busy at the deadline.
+ */
+void process_pool_stop(const struct dc_env *env, struct dc_error *err, struct process_pool *pool, uint64_t deadline_ms);
+
+/**
+ * Print the parent's per-stage latencies if instrumented.
+ */
+void process_pool_report(const struct process_pool *pool, FILE *out);
+
+/**
+ * Close the pool's descriptors and semaphore once it has stopped, or of one that never started.
+ */
+void process_pool_destroy(const struct dc_env *env, struct dc_error *err, struct process_pool *pool);
+
+#endif //SCALABLE_SERVER_PROCESS_POOL_H
@@ -0,0 +1,60 @@
+#ifndef SCALABLE_SERVER_RESULT_CACHE_H
+#define SCALABLE_SERVER_RESULT_CACHE_H
+
+#include "message_handler.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct result_cache_stats
+{
+    uint64_t hits;
+    uint64_t misses;
+    /**
+     * Requests not looked up: too large for a slot, or the processor failed.
+     */
+    uint64_t bypassed;
+    uint64_t insertions;
+    /**
+     * Insertions that replaced a live entry.
+     */
+    uint64_t evictions;
+    size_t capacity;
+};
+
+/**
+ * Memoize processor results for repeated requests from now on.
+ * A request is looked up by a hash of its bytes and the processor that serves it, and only a byte for byte match
+ * is a hit. Processors must therefore be pure functions of the request.
+ * @param env Environment object.
+ * @param err Error object.
+ * @param max_bytes Memory the cache may use, rounded down to whole buckets.
+ * @param shared Share the cache with processes forked later, otherwise each one gets its own copy.
+ * @return true if the cache is enabled.
+ */
+bool result_cache_init(const struct dc_env *env, struct dc_error *err, size_t max_bytes, bool shared);
+
+/**
+ * Run the processor through the cache, or directly if the cache is not enabled.
+ * Same contract as process_message_func.
+ */
+size_t result_cache_process(const struct dc_env *env, struct dc_error *err, process_message_func processor, const uint8_t *raw_data, uint8_t **processed_data, ssize_t count);
+
+/**
+ * Counters so far, summed over every process sharing the cache.
+ * @return false if the cache is not enabled.
+ */
+bool result_cache_stats(struct result_cache_stats *stats);
+
+/**
+ * Print the counters if the cache is enabled.
+ */
+void result_cache_report(FILE *out);
+
+/**
+ * Unmap the cache in this process.
+ */
+void result_cache_destroy(void);
+
+#endif //SCALABLE_SERVER_RESULT_CACHE_H
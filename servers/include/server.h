@@ -9,5 +9,26 @@ int run_normal_server(struct dc_env * env, struct dc_error * error, struct optio
 int run_poll_server(struct dc_env * env, struct dc_error * error, struct options *opts);
 int run_select_server(struct dc_env * env, struct dc_error * error, struct options *opts);
 int run_thread_poll_server(struct dc_env * env, struct dc_error * error, struct options *opts);
+int run_epoll_server(struct dc_env * env, struct dc_error * error, struct options *opts);
+
+/**
+ * Runs the datagram server: one SO_REUSEPORT socket per processor, batched with recvmmsg/sendmmsg.
+ * @param env Environment object.
+ * @param error Error object.
+ * @param opts Options object.
+ * @return Return status of the server.
+ */
+int run_udp_server(struct dc_env * env, struct dc_error * error, struct options *opts);
+
+/**
+ * Sweep workers, read_buffer_size, accept_batch and event_batch one at a time against a loopback request/reply
+ * load, restarting the server in opts->server_to_run for every candidate, and write the fastest configuration to
+ * opts->tune_path.
+ * @param env Environment object.
+ * @param error Error object.
+ * @param opts Options object, the base configuration and the command line the candidates are started with.
+ * @return EXIT_SUCCESS once the configuration is written.
+ */
+int run_autotune(struct dc_env * env, struct dc_error * error, struct options *opts);
 
 #endif //SCALABLE_SERVER_SERVER_H
@@ -0,0 +1,116 @@
+#ifndef SCALABLE_SERVER_SERVER_CONFIG_H
+#define SCALABLE_SERVER_SERVER_CONFIG_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Knobs read at startup from a configuration file and key=value arguments, in that order.
+ */
+struct server_config
+{
+    in_port_t port;
+    int backlog;
+    /**
+     * Worker processes (poll), threads (thread pool, UDP), 0 for one per processor.
+     */
+    int workers;
+    /**
+     * Bytes read for one request.
+     */
+    int read_buffer_size;
+    /**
+     * Connections accepted per listener wakeup.
+     */
+    int accept_batch;
+    /**
+     * Events taken per event loop wait (select, thread pool, epoll).
+     */
+    int event_batch;
+    /**
+     * Datagrams received per recvmmsg (UDP).
+     */
+    int udp_batch;
+    /**
+     * Requests in the processor stage at once with compute threads (select, epoll).
+     */
+    int compute_depth;
+    /**
+     * Concurrent connections before new ones are rejected, 0 for the mode's default.
+     */
+    int max_connections;
+    int header_timeout_ms;
+    int idle_timeout_ms;
+    /**
+     * How files are sent with r=ROOT: 0 sendfile, 1 splice, 2 read and write.
+     */
+    int file_transfer;
+    /**
+     * Requests served from one connection per wakeup before the next ready one (inline select and epoll).
+     */
+    int fair_requests;
+    /**
+     * Bytes read from one connection per wakeup before the next ready one, 0 for no byte limit (inline select and epoll).
+     */
+    int fair_bytes;
+    /**
+     * Stack of each fiber with y, rounded up to whole pages.
+     */
+    int fiber_stack_size;
+    /**
+     * Bytes in each direction of a shared memory ring client's mapping, rounded up to a power of two.
+     */
+    int ring_size;
+    /**
+     * Microseconds a loop polls without sleeping before it blocks, 0 to always block (select, poll, epoll).
+     */
+    int spin_us;
+    /**
+     * Log every connection and request (poll).
+     */
+    bool verbose;
+};
+
+enum server_config_result
+{
+    SERVER_CONFIG_SET,
+    SERVER_CONFIG_UNKNOWN_KEY,
+    SERVER_CONFIG_INVALID
+};
+
+/**
+ * The values the server used before it was configurable.
+ */
+void server_config_defaults(struct server_config *config);
+
+/**
+ * Override config with the keys present in a libconfig file, e.g. workers = 8;
+ * @param env Environment object.
+ * @param err Error object, raised for a file that cannot be parsed or a value out of range.
+ * @param config Configuration to update.
+ * @param path File to read.
+ * @return true if the file was applied.
+ */
+bool server_config_load(const struct dc_env *env, struct dc_error *err, struct server_config *config, const char *path);
+
+/**
+ * Apply one key=value argument.
+ */
+enum server_config_result server_config_set(struct server_config *config, const char *assignment);
+
+/**
+ * Write every key to a libconfig file that server_config_load reads back.
+ */
+bool server_config_write(const struct dc_env *env, struct dc_error *err, const struct server_config *config, const char *path);
+
+/**
+ * Print every key as it would appear on the command line.
+ */
+void server_config_print(const struct server_config *config, FILE *out);
+
+#endif //SCALABLE_SERVER_SERVER_CONFIG_H
@@ -0,0 +1,129 @@
+#ifndef SCALABLE_SERVER_SHM_RING_H
+#define SCALABLE_SERVER_SHM_RING_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SHM_RING_MAGIC 0x53524e47U      // "SRNG"
+#define SHM_RING_VERSION 1
+#define SHM_RING_CACHE_LINE 64
+#define SHM_RING_RECORD_ALIGN 8         // records start 8-aligned, so a length never wraps around the end
+#define SHM_RING_FDS 3                  // memfd, server wakeup eventfd, client wakeup eventfd, in that order
+
+/**
+ * Positions in one single-producer single-consumer byte ring. Both count bytes since the start and wrap at 2^32;
+ * the ring holds tail - head bytes. Each is written by one side only and sits on its own cache line.
+ */
+struct shm_ring_index
+{
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint32_t tail;    // producer
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint32_t head;    // consumer
+};
+
+/**
+ * Start of the shared mapping, followed by the request ring's data and then the reply ring's, capacity bytes each.
+ * A record is a 32-bit length and that many bytes, padded to SHM_RING_RECORD_ALIGN. The client's copy of this layout
+ * is in client/src/main.c.
+ */
+struct shm_ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;      // bytes of data per ring, a power of two
+    uint32_t max_message;   // longest request the server takes, its read_buffer_size
+    /**
+     * Set by a side that is about to block on its eventfd, cleared by whoever wakes it. The other side only writes the
+     * eventfd when it finds this set, so a busy pair exchanges messages without a system call.
+     */
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint32_t server_sleeping;
+    _Alignas(SHM_RING_CACHE_LINE) _Atomic uint32_t client_sleeping;
+    struct shm_ring_index requests;
+    struct shm_ring_index replies;
+};
+
+/**
+ * What the client receives with the descriptors, so it can check the mapping before it trusts it.
+ */
+struct shm_ring_hello
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t map_size;
+};
+
+/**
+ * The server's side of one ring connection. The positions it owns are kept here as well, so a client writing to the
+ * shared ones can confuse only itself.
+ */
+struct shm_ring
+{
+    struct shm_ring_header *header;
+    uint8_t *requests;
+    uint8_t *replies;
+    size_t map_size;
+    uint32_t capacity;
+    uint32_t max_message;
+    uint32_t request_head;
+    uint32_t reply_tail;
+    int memfd;
+    int wake_fd;            // the client writes it to wake the server, the event loop watches it
+    int client_wake_fd;     // the server writes it to wake the client
+};
+
+/**
+ * Create the shared mapping and both eventfds for a new client.
+ * @param capacity Bytes per ring, rounded up to a power of two.
+ * @param max_message Longest request accepted.
+ * @return false, with err set, if any of them cannot be created.
+ */
+bool shm_ring_create(const struct dc_env *env, struct dc_error *err, struct shm_ring *ring, size_t capacity, size_t max_message);
+
+/**
+ * Pass the memfd and eventfds to the client over its Unix domain socket with SCM_RIGHTS.
+ * @return false, with err set, if they could not be sent.
+ */
+bool shm_ring_send_hello(const struct dc_env *env, struct dc_error *err, const struct shm_ring *ring, int socket);
+
+/**
+ * Unmap and close everything shm_ring_create made.
+ */
+void shm_ring_destroy(struct shm_ring *ring);
+
+/**
+ * Take the next request into a buffer the caller frees.
+ * @return its length, 0 if there is none, or -1 if the client wrote something that is not a valid record.
+ */
+ssize_t shm_ring_read(const struct dc_env *env, struct dc_error *err, struct shm_ring *ring, uint8_t **data);
+
+/**
+ * @return true if a reply of length bytes fits now.
+ */
+bool shm_ring_can_write(const struct shm_ring *ring, size_t length);
+
+/**
+ * Append a reply and wake the client if it sleeps. Check shm_ring_can_write first.
+ */
+void shm_ring_write(struct shm_ring *ring, const void *data, size_t length);
+
+/**
+ * Empty the server's eventfd after the loop saw it readable.
+ */
+void shm_ring_clear_wakeup(const struct shm_ring *ring);
+
+/**
+ * Mark the server asleep before it goes back to the loop.
+ * @return false, and the server stays awake, if a request arrived meanwhile that it has room to answer.
+ */
+bool shm_ring_sleep(struct shm_ring *ring, size_t reply_length);
+
+/**
+ * Make the loop come back to this ring on its next wakeup, when it stops with requests left.
+ */
+void shm_ring_wake_self(const struct shm_ring *ring);
+
+#endif //SCALABLE_SERVER_SHM_RING_H
@@ -0,0 +1,81 @@
+#ifndef SCALABLE_SERVER_SOCKET_TUNING_H
+#define SCALABLE_SERVER_SOCKET_TUNING_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+enum reply_policy
+{
+    REPLY_DEFAULT,  // leave Nagle on, the kernel default
+    REPLY_NODELAY,  // TCP_NODELAY on every connection, each write goes out at once
+    REPLY_CORK      // TCP_CORK around each reply, a reply written in pieces leaves as full segments
+};
+
+/**
+ * Socket options applied to listeners and accepted connections, 0 leaves an option at the kernel default.
+ */
+struct socket_tuning
+{
+    enum reply_policy reply;
+    /**
+     * TCP_DEFER_ACCEPT: seconds the kernel holds a connection that has not sent data before waking accept.
+     */
+    int defer_accept_s;
+    int rcvbuf;
+    int sndbuf;
+    /**
+     * SO_BUSY_POLL: microseconds a blocking read spins on the device queue, inherited by accepted connections.
+     */
+    int busy_poll_us;
+    /**
+     * TCP_FASTOPEN: pending connections that may carry data in their SYN.
+     */
+    int fastopen_queue;
+};
+
+/**
+ * Parse a comma separated profile and make it the one every listener and connection gets from now on.
+ * Recognised: nodelay, cork, defer=S, rcvbuf=BYTES, sndbuf=BYTES, busypoll=US, fastopen=N.
+ * @param spec Profile, NULL for the kernel defaults.
+ * @return false if spec is malformed, the active profile is then unchanged.
+ */
+bool socket_tuning_configure(const char *spec);
+
+/**
+ * The active profile.
+ */
+const struct socket_tuning *socket_tuning_active(void);
+
+/**
+ * Apply the profile to a listener before bind and listen, so buffer sizes shape the window scale it advertises.
+ * An option the kernel refuses is reported and skipped.
+ * @param env Environment object.
+ * @param listener Socket not yet listening.
+ * @param family AF_INET or AF_UNIX, TCP options only apply to AF_INET.
+ */
+void socket_tuning_listener(const struct dc_env *env, int listener, sa_family_t family);
+
+/**
+ * Apply the per connection part of the profile to an accepted socket.
+ */
+void socket_tuning_connection(const struct dc_env *env, int fd, sa_family_t family);
+
+/**
+ * Hold back partial segments while a reply is written, under the cork policy.
+ */
+void socket_tuning_begin_reply(int fd);
+
+/**
+ * Send whatever the reply left corked, under the cork policy.
+ */
+void socket_tuning_end_reply(int fd);
+
+/**
+ * Print the active profile.
+ */
+void socket_tuning_report(FILE *out);
+
+#endif //SCALABLE_SERVER_SOCKET_TUNING_H
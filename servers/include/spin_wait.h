@@ -0,0 +1,75 @@
+#ifndef SCALABLE_SERVER_SPIN_WAIT_H
+#define SCALABLE_SERVER_SPIN_WAIT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Where one loop's time went, for the report on exit.
+ */
+struct spin_wait_stats
+{
+    uint64_t waits;
+    /**
+     * Waits whose events turned up while the loop was still polling without sleeping.
+     */
+    uint64_t caught;
+    /**
+     * Waits that spun through the whole budget and then blocked anyway.
+     */
+    uint64_t missed;
+    /**
+     * Waits that blocked straight away, because the estimator turned spinning off or a deadline was due.
+     */
+    uint64_t blocked;
+    uint64_t caught_ns;     // spinning that ended in events
+    uint64_t missed_ns;     // spinning that ended in a block, CPU burnt for nothing
+    uint64_t blocked_ns;    // asleep in the kernel
+    uint64_t busy_ns;       // handling events, the useful work
+};
+
+/**
+ * Decides how long an event loop polls with a zero timeout before it blocks. A blocked loop pays a scheduler wakeup on
+ * every request; a spinning one pays a CPU. Spinning only pays off when the next event is due within the budget, so the
+ * gap between the end of one batch of events and the start of the next is tracked as a moving average, and the loop
+ * spins for twice that gap, or not at all once the gap outgrows the configured limit. A spin that comes up empty also
+ * makes the loop skip spinning for the next few waits, doubling each time, so a peer that only runs once this loop
+ * gives up the CPU is not starved by it.
+ */
+struct spin_wait
+{
+    uint64_t max_ns;        // configured limit, 0 to always block
+    uint64_t gap_ns;        // moving average of the time from going idle to the next events
+    uint64_t busy_since_ns; // when the last wait returned
+    uint32_t backoff;       // waits skipped after the last miss, 0 after a catch
+    uint32_t skip;          // waits still to block at once
+    struct spin_wait_stats stats;
+};
+
+/**
+ * @param max_us Longest a loop spins before it blocks, 0 to never spin.
+ */
+void spin_wait_init(struct spin_wait *spin, uint32_t max_us);
+
+/**
+ * Close the busy period that started when the last wait returned, and size the spin before the next wait.
+ * @param now_ns CLOCK_MONOTONIC nanoseconds.
+ * @return nanoseconds to poll without sleeping first, 0 to block at once.
+ */
+uint64_t spin_wait_budget(struct spin_wait *spin, uint64_t now_ns);
+
+/**
+ * Record how a wait ended and start the next busy period.
+ * @param spun_ns Time spent polling without sleeping.
+ * @param blocked_ns Time spent in the blocking wait after that, 0 if the spin caught events.
+ * @param caught true if the spin found events and the loop never blocked.
+ */
+void spin_wait_woke(struct spin_wait *spin, uint64_t spun_ns, uint64_t blocked_ns, bool caught, uint64_t now_ns);
+
+/**
+ * Print where the loop's time went, if spinning was configured.
+ */
+void spin_wait_report(const struct spin_wait *spin, FILE *out);
+
+#endif //SCALABLE_SERVER_SPIN_WAIT_H
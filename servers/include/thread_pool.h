@@ -0,0 +1,131 @@
+#ifndef SCALABLE_SERVER_THREAD_POOL_H
+#define SCALABLE_SERVER_THREAD_POOL_H
+
+#include "message_handler.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define THREAD_POOL_CACHE_LINE 64
+
+/**
+ * Written to the completion pipe by a thread once it has served a request.
+ */
+struct thread_pool_completion
+{
+    int fd;
+    int worker; // the thread that served it, for thread_pool_submit with the connection's next request
+    bool closed;
+};
+
+/**
+ * Slots of one queue, a power of two. The loop replaces a full one with one twice the size; a thief may still be
+ * reading the old one, so it is kept on the retired list until the pool is destroyed.
+ */
+struct thread_pool_slots
+{
+    struct thread_pool_slots *retired;
+    int64_t mask;
+    _Atomic int fds[];
+};
+
+/**
+ * Written by its thread only, read once the thread has been joined.
+ */
+struct thread_pool_stats
+{
+    uint64_t requests;
+    /**
+     * Requests taken from another thread's queue.
+     */
+    uint64_t stolen;
+    /**
+     * Times the thread found no work anywhere and slept on its futex.
+     */
+    uint64_t parks;
+    uint64_t busy_ns;   // serving requests
+};
+
+/**
+ * A thread and its ring of client sockets with a request waiting, a FIFO queue with one producer and many consumers.
+ * The event loop is the only producer and pushes at the tail; the thread takes from the head of its own queue first,
+ * then steals from the head of the others, each take a compare and swap on head.
+ */
+struct thread_pool_worker
+{
+    _Alignas(THREAD_POOL_CACHE_LINE) _Atomic int64_t head;
+    _Alignas(THREAD_POOL_CACHE_LINE) _Atomic int64_t tail;
+    _Atomic(struct thread_pool_slots *) slots;
+    /**
+     * Futex word: whether the thread is serving a request, looking for one, or asleep or about to be. Whoever wakes a
+     * parked thread sets it back to looking first.
+     */
+    _Alignas(THREAD_POOL_CACHE_LINE) _Atomic uint32_t state;
+    struct thread_pool *pool;
+    pthread_t thread;
+    int id;
+    uint32_t seed;      // picks where a steal starts looking
+    struct thread_pool_stats stats;
+};
+
+struct thread_pool
+{
+    struct thread_pool_worker *workers;
+    int num_threads;
+    /**
+     * Next thread for a socket no thread has served yet.
+     */
+    int next_worker;
+    atomic_bool stopping;
+    /**
+     * Guards message_handler. A thread copies it only when handler_generation moved since its last copy, so a reload
+     * never mixes two handler sets and requests do not take the lock.
+     */
+    pthread_mutex_t lock;
+    struct message_handler message_handler;
+    _Atomic uint32_t handler_generation;
+    /**
+     * Write end of the pipe the event loop reads completions from.
+     */
+    int completion_fd;
+    uint64_t start_ns;
+    uint64_t stop_ns;
+};
+
+/**
+ * Start the threads, each serves one request at a time with the message handler.
+ * @return true if every thread started, otherwise the ones that did are stopped again.
+ */
+bool thread_pool_start(const struct dc_env *env, struct dc_error *err, struct thread_pool *pool, int num_threads, const struct message_handler *message_handler, int completion_fd);
+
+/**
+ * Queue a readable client socket, the event loop must not watch it until its completion arrives. Called from the event
+ * loop only.
+ * @param worker The thread that served the connection's last request, from its completion, or -1. The socket goes on
+ * that thread's queue, whose caches still hold the connection, and an idle thread steals it if that one is busy.
+ */
+void thread_pool_submit(const struct dc_env *env, struct dc_error *err, struct thread_pool *pool, int client_socket, int worker);
+
+/**
+ * Use new handlers for requests taken from now on.
+ */
+void thread_pool_set_handler(struct thread_pool *pool, const struct message_handler *message_handler);
+
+/**
+ * Let the threads finish the queued requests, then join them.
+ */
+void thread_pool_stop(const struct dc_env *env, struct thread_pool *pool);
+
+/**
+ * Print requests, steals, parks and utilization per thread, once the pool has stopped.
+ */
+void thread_pool_report(const struct thread_pool *pool, FILE *out);
+
+/**
+ * Free the queues of a stopped pool, or of one that never started.
+ */
+void thread_pool_destroy(const struct dc_env *env, struct thread_pool *pool);
+
+#endif //SCALABLE_SERVER_THREAD_POOL_H
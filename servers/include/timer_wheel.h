@@ -0,0 +1,62 @@
+#ifndef SCALABLE_SERVER_TIMER_WHEEL_H
+#define SCALABLE_SERVER_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1U << TIMER_WHEEL_BITS)
+
+struct timer;
+
+/**
+ * Called when a timer expires. The timer is no longer pending and may be re-added from the callback.
+ */
+typedef void (*timer_callback)(struct timer *timer, void *context);
+
+struct timer
+{
+    /**
+     * Intrusive list links, NULL when the timer is not pending.
+     */
+    struct timer *next;
+    struct timer *prev;
+    /**
+     * Absolute expiry in milliseconds on the wheel's clock.
+     */
+    uint64_t expires_ms;
+    timer_callback callback;
+    /**
+     * Owner of the timer (connection, client slot, ...).
+     */
+    void *data;
+};
+
+struct timer_wheel
+{
+    /**
+     * Last tick that has been processed.
+     */
+    uint64_t now_ms;
+    /**
+     * Number of pending timers.
+     */
+    size_t active;
+    /**
+     * Level n holds timers due within 64^(n+1) ms, each slot is a circular list with a sentinel head.
+     */
+    struct timer slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+uint64_t timer_now_ms(void);
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now_ms);
+void timer_init(struct timer *timer, timer_callback callback, void *data);
+bool timer_pending(const struct timer *timer);
+void timer_wheel_add(struct timer_wheel *wheel, struct timer *timer, uint64_t expires_ms);
+void timer_wheel_cancel(struct timer_wheel *wheel, struct timer *timer);
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now_ms, void *context);
+int timer_wheel_timeout(const struct timer_wheel *wheel, uint64_t now_ms);
+
+#endif //SCALABLE_SERVER_TIMER_WHEEL_H
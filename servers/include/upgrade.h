@@ -0,0 +1,42 @@
+#ifndef SCALABLE_SERVER_UPGRADE_H
+#define SCALABLE_SERVER_UPGRADE_H
+
+#include <dc_env/env.h>
+#include <dc_error/error.h>
+#include <sys/types.h>
+
+#define UPGRADE_ENV "SCALABLE_SERVER_UPGRADE_FD"
+
+enum upgrade_kind
+{
+    UPGRADE_LISTENER,
+    UPGRADE_UNIX_LISTENER,
+    UPGRADE_RING_LISTENER,
+    UPGRADE_CONNECTION
+};
+
+struct upgrade_message
+{
+    enum upgrade_kind kind;
+    /**
+     * Descriptor number in the sending process, for logging only.
+     */
+    int fd;
+};
+
+/**
+ * Fork and exec argv with one end of a SOCK_SEQPACKET pair inherited through UPGRADE_ENV.
+ * @return the parent's end of the pair, or -1 if the new process could not be started.
+ */
+int upgrade_start(const struct dc_env *env, struct dc_error *err, char *const argv[], pid_t *pid);
+/**
+ * Take the channel handed to this process by upgrade_start, -1 when started normally.
+ */
+int upgrade_inherited_channel(const struct dc_env *env);
+void upgrade_send_descriptor(const struct dc_env *env, struct dc_error *err, int channel, enum upgrade_kind kind, int fd);
+/**
+ * @return the received descriptor, or -1 once the sender has closed the channel.
+ */
+int upgrade_receive_descriptor(const struct dc_env *env, struct dc_error *err, int channel, enum upgrade_kind *kind);
+
+#endif //SCALABLE_SERVER_UPGRADE_H
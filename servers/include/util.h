@@ -1,6 +1,8 @@
 #ifndef SCALABLE_SERVER_UTIL_H
 #define SCALABLE_SERVER_UTIL_H
 
+#include "metrics_log.h"
+#include "server_config.h"
 #include <netinet/in.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -29,16 +31,17 @@
 #include <sys/stat.h>
 #include <dc_util/io.h>
 
-#define READ_BUFFER_SIZE 1024
 #define CONVERT_TO_MS 1000
-#define BACKLOG SOMAXCONN
 static const int BLOCK_SIZE = 1024 * 4;
 
 enum server_types {
     ONE_TO_ONE,
     POLL_SERVER,
     SELECT_SERVER,
-    THREAD_POLL_SERVER
+    THREAD_POLL_SERVER,
+    EPOLL_SERVER,
+    UDP_SERVER,
+    KERNEL_BENCHMARK
 };
 
 struct options
@@ -48,23 +51,98 @@ struct options
      */
     char * ip_address;
     /**
-     * File to write the server states to.
+     * Binary log the server states are appended to, read with metrics_report.
      */
-    FILE * csv_file;
+    struct metrics_log metrics;
     /**
      * Type of server to run
      */
     enum server_types server_to_run;
     /**
-     * Port to run on
+     * Port, buffer and batch sizes, worker counts and timeouts, from f=PATH and key=value arguments.
      */
-    in_port_t port_out;
+    struct server_config config;
     clock_t time;
+    /**
+     * Record per-stage latency histograms (poll server).
+     */
+    bool instrument;
+    /**
+     * Pin the dispatcher and workers to CPUs (poll server).
+     */
+    bool pin_cpus;
+    /**
+     * Command line, re-executed on a hot upgrade.
+     */
+    char **argv;
+    /**
+     * Shared object to load the message handlers from, NULL for the built-in ones.
+     */
+    const char *handler_path;
+    /**
+     * Compute threads running the processor stage (select and epoll servers), 0 runs it on the event loop.
+     */
+    int compute_threads;
+    /**
+     * Built-in processor kernel to use instead of the plain copy, NULL for the copy.
+     */
+    const char *kernel;
+    /**
+     * Memory for the processor result cache, 0 disables it.
+     */
+    size_t cache_bytes;
+    /**
+     * Coalesce datagrams with UDP_GRO and replies with UDP_SEGMENT (UDP server).
+     */
+    bool udp_segmentation;
+    /**
+     * Run each request in a fiber on the event loop (select, epoll).
+     */
+    bool fibers;
+    /**
+     * Unix domain socket path to listen on as well (TCP servers), NULL for TCP only.
+     */
+    const char *unix_path;
+    /**
+     * Listen on unix_path instead of TCP.
+     */
+    bool unix_only;
+    /**
+     * Unix domain socket path shared memory ring clients connect to (select, thread pool, epoll), NULL for none.
+     */
+    const char *ring_path;
+    /**
+     * Socket tuning profile for listeners and connections (TCP servers), NULL for the kernel defaults.
+     */
+    const char *socket_tuning;
+    /**
+     * Directory to serve files from (TCP servers), NULL to reply with the byte count.
+     */
+    const char *file_root;
+    /**
+     * Weighted fairness classes by client address, e.g. 10.0.0.0/8=4 (event servers), NULL for one class.
+     */
+    const char *fair_classes;
+    /**
+     * Sweep the configuration against a loopback workload and write the best one here instead of serving.
+     */
+    const char *tune_path;
 };
 
 void write_to_file(struct options *opts, const char * server_name, const char * function_name, double time_taken);
 void send_message_handler(const struct dc_env *env, struct dc_error *err, __attribute__((unused)) uint8_t *buffer, size_t count, int client_socket, bool *closed);
 size_t process_message_handler(const struct dc_env *env, struct dc_error *err, const uint8_t *raw_data, uint8_t **processed_data, ssize_t count);
 ssize_t read_message_handler(const struct dc_env *env, struct dc_error *err, uint8_t **raw_data, int client_socket);
+void set_read_buffer(uint8_t *buffer, size_t length);
+
+/**
+ * Size of the buffer each read borrows from the shared read pool. Only the first call takes effect.
+ */
+void set_read_size(size_t length);
+
+/**
+ * Print how the read buffers were lent out, if set_read_size set up the pool.
+ */
+void read_buffer_report(FILE *out);
 
 #endif //SCALABLE_SERVER_UTIL_H
@@ -0,0 +1,64 @@
+#!/bin/sh
+# Parks a fiber in the middle of a large file reply while three waves of idle connections make the fiber mode grow its
+# connection array past malloc's mmap threshold, so the array the fiber started with is unmapped under it. Fails if the
+# server dies or the file client does not get every reply.
+# usage: fiber_growth.sh SERVER CLIENT [CONNECTIONS]
+
+if [ $# -lt 2 ] || [ ! -x "$1" ] || [ ! -x "$2" ]; then
+    echo "usage: $0 SERVER CLIENT [CONNECTIONS]" >&2
+    exit 2
+fi
+
+server=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+client=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+# per wave; the first takes the array past 2048 slots, the second past 4096 and the third past 8192
+connections=${3:-3000}
+requests=100
+status=0
+
+ulimit -n "$(ulimit -H -n)"
+
+work=$(mktemp -d)
+cd "$work" || exit 2
+mkdir files
+# large enough that every reply fills the socket buffer and its fiber waits for room several times
+dd if=/dev/zero of=files/large bs=1M count=64 2> /dev/null
+
+"$server" 127.0.0.1 e y r="$work/files" verbose=false > server.log 2>&1 &
+pid=$!
+sleep 1
+
+# each wave holds its connections while the next opens, so the next gets the higher descriptors
+"$client" 127.0.0.1 idle "$connections" > idle1.log &
+first=$!
+sleep 0.5
+"$client" 127.0.0.1 get large "$requests" > get.log 2>&1 &
+fetch=$!
+sleep 0.3
+"$client" 127.0.0.1 idle "$connections" > idle2.log &
+second=$!
+sleep 0.3
+"$client" 127.0.0.1 idle "$connections" > idle3.log
+wait "$first"
+wait "$second"
+
+if ! wait "$fetch"; then
+    echo "FAIL, the file client did not get its $requests replies:"
+    tail -n 1 get.log
+    status=1
+fi
+
+if kill -INT "$pid" 2> /dev/null; then
+    wait "$pid"
+else
+    wait "$pid"
+    echo "FAIL, the server exited with status $? while fibers were parked"
+    status=1
+fi
+
+if [ $status -eq 0 ]; then
+    echo "fibers survived three connection array moves, $(sed -n 's/^\([0-9]*\) held by the server.*/\1/p' idle3.log) connections held by the last wave"
+fi
+
+cd / && rm -rf "$work"
+exit $status
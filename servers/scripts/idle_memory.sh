@@ -0,0 +1,59 @@
+#!/bin/sh
+# Opens idle connections against each TCP server mode with the client's idle mode and fails if the server's user space
+# memory per connection is over the target in README.md (Idle Connections), or if it dropped any of them.
+# usage: idle_memory.sh SERVER CLIENT [CONNECTIONS] [MAX_BYTES]
+
+if [ $# -lt 2 ] || [ ! -x "$1" ] || [ ! -x "$2" ]; then
+    echo "usage: $0 SERVER CLIENT [CONNECTIONS] [MAX_BYTES]" >&2
+    exit 2
+fi
+
+server=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+client=$(cd "$(dirname "$2")" && pwd)/$(basename "$2")
+connections=${3:-10000}
+max_bytes=${4:-256}
+status=0
+
+# the server raises its own limit, the client inherits this one
+ulimit -n "$(ulimit -H -n)"
+
+# the servers append to metrics.bin in the working directory
+work=$(mktemp -d)
+cd "$work" || exit 2
+
+# o leaves all but one connection in the backlog, and u has none
+for mode in e t p s; do
+    count=$connections
+
+    # select cannot watch descriptors past FD_SETSIZE, the rest get the busy reply
+    if [ "$mode" = s ] && [ "$count" -gt 1000 ]; then
+        count=1000
+    fi
+
+    "$server" 127.0.0.1 "$mode" verbose=false > server.log 2>&1 &
+    pid=$!
+    sleep 1
+    result=$("$client" 127.0.0.1 idle "$count" "$pid")
+    kill -INT "$pid"
+    wait "$pid"
+
+    held=$(echo "$result" | sed -n 's/^\([0-9]*\) held by the server.*/\1/p')
+    bytes=$(echo "$result" | sed -n 's/.*, \([0-9]*\) bytes per connection$/\1/p')
+
+    if [ -z "$held" ] || [ -z "$bytes" ]; then
+        echo "$mode: no result from the client" >&2
+        echo "$result" >&2
+        status=1
+    elif [ "$held" -ne "$count" ]; then
+        echo "$mode: FAIL, the server held $held of $count idle connections"
+        status=1
+    elif [ "$bytes" -gt "$max_bytes" ]; then
+        echo "$mode: FAIL, $bytes bytes per idle connection, the target is $max_bytes"
+        status=1
+    else
+        echo "$mode: $bytes bytes per idle connection over $held connections, the target is $max_bytes"
+    fi
+done
+
+cd / && rm -rf "$work"
+exit $status
@@ -0,0 +1,203 @@
+#include "accept_stats.h"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool read_listen_counters(uint64_t *overflows, uint64_t *drops);
+static bool find_counter(const char *names, const char *values, const char *name, uint64_t *value);
+
+
+#define NETSTAT_LINE 8192    // the TcpExt names line is a few KiB
+
+void accept_stats_init(struct accept_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->have_netstat = read_listen_counters(&stats->overflows_start, &stats->drops_start);
+}
+
+void accept_stats_wakeup(struct accept_stats *stats, int listener)
+{
+    struct tcp_info info;
+    socklen_t length;
+
+    stats->wakeups++;
+    length = sizeof(info);
+
+    // on a listening socket the kernel reports the accept queue length as unacked and the backlog as sacked
+    if(getsockopt(listener, IPPROTO_TCP, TCP_INFO, &info, &length) == 0 && info.tcpi_state == TCP_LISTEN)
+    {
+        stats->backlog = info.tcpi_sacked;
+
+        if(info.tcpi_unacked > stats->queue_peak)
+        {
+            stats->queue_peak = info.tcpi_unacked;
+        }
+    }
+}
+
+void accept_stats_connection(struct accept_stats *stats, int fd, sa_family_t family)
+{
+    struct tcp_info info;
+    socklen_t length;
+
+    if(family != AF_INET)
+    {
+        return;
+    }
+
+    length = sizeof(info);
+
+    // the final ACK of the handshake, or the first request, is the last packet before accept
+    if(getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &length) == 0)
+    {
+        stats->wait_ms_total += info.tcpi_last_ack_recv;
+        stats->waits++;
+
+        if(info.tcpi_last_ack_recv > stats->wait_ms_max)
+        {
+            stats->wait_ms_max = info.tcpi_last_ack_recv;
+        }
+    }
+}
+
+void accept_stats_batch(struct accept_stats *stats, uint32_t accepted, bool capped)
+{
+    size_t bucket;
+
+    if(accepted == 0)
+    {
+        return;
+    }
+
+    stats->accepted += accepted;
+    stats->capped += capped ? 1 : 0;
+
+    if(accepted > stats->max_batch)
+    {
+        stats->max_batch = accepted;
+    }
+
+    bucket = 0;
+
+    while(bucket < ACCEPT_BATCH_BUCKETS - 1 && (accepted >> (bucket + 1)) != 0)
+    {
+        bucket++;
+    }
+
+    stats->batches[bucket]++;
+}
+
+void accept_stats_report(const struct accept_stats *stats, FILE *out)
+{
+    uint64_t overflows;
+    uint64_t drops;
+
+    if(stats->wakeups == 0)
+    {
+        return;
+    }
+
+    fprintf(out, "Accept: %lu connections in %lu wakeups, at most %u per wakeup, %lu wakeups hit the cap\n",    // NOLINT(cert-err33-c)
+            (unsigned long)stats->accepted, (unsigned long)stats->wakeups, stats->max_batch, (unsigned long)stats->capped);
+    fprintf(out, "Accepts per wakeup:");    // NOLINT(cert-err33-c)
+
+    for(size_t i = 0; i < ACCEPT_BATCH_BUCKETS; i++)
+    {
+        if(stats->batches[i] != 0)
+        {
+            fprintf(out, " %u+:%lu", 1U << i, (unsigned long)stats->batches[i]);    // NOLINT(cert-err33-c)
+        }
+    }
+
+    fprintf(out, "\n");    // NOLINT(cert-err33-c)
+
+    if(stats->backlog != 0)
+    {
+        fprintf(out, "Accept queue: peak %u of backlog %u, wait avg %lums max %ums\n",    // NOLINT(cert-err33-c)
+                stats->queue_peak, stats->backlog, (unsigned long)(stats->waits == 0 ? 0 : stats->wait_ms_total / stats->waits), stats->wait_ms_max);
+    }
+
+    if(stats->have_netstat && read_listen_counters(&overflows, &drops))
+    {
+        fprintf(out, "Listen queue overflows %lu, drops %lu (whole host, since start)\n",    // NOLINT(cert-err33-c)
+                (unsigned long)(overflows - stats->overflows_start), (unsigned long)(drops - stats->drops_start));
+    }
+}
+
+static bool read_listen_counters(uint64_t *overflows, uint64_t *drops)
+{
+    char names[NETSTAT_LINE];
+    char values[NETSTAT_LINE];
+    bool found;
+    FILE *netstat;
+
+    netstat = fopen("/proc/net/netstat", "re");
+
+    if(netstat == NULL)
+    {
+        return false;
+    }
+
+    found = false;
+
+    // pairs of lines, the first names the counters of a group and the second holds their values
+    while(!found && fgets(names, sizeof(names), netstat) && fgets(values, sizeof(values), netstat))
+    {
+        if(strncmp(names, "TcpExt:", strlen("TcpExt:")) == 0)
+        {
+            found = find_counter(names, values, "ListenOverflows", overflows) && find_counter(names, values, "ListenDrops", drops);
+        }
+    }
+
+    fclose(netstat);    // NOLINT(cert-err33-c)
+
+    return found;
+}
+
+static bool find_counter(const char *names, const char *values, const char *name, uint64_t *value)
+{
+    size_t name_length;
+    size_t column;
+    const char *cursor;
+
+    name_length = strlen(name);
+    column = 0;
+    cursor = names;
+
+    // count the columns before name, then skip as many in the values line
+    for(;;)
+    {
+        cursor = strchr(cursor, ' ');
+
+        if(cursor == NULL)
+        {
+            return false;
+        }
+
+        cursor++;
+        column++;
+
+        if(strncmp(cursor, name, name_length) == 0 && (cursor[name_length] == ' ' || cursor[name_length] == '\n'))
+        {
+            break;
+        }
+    }
+
+    cursor = values;
+
+    for(size_t i = 0; i < column && cursor; i++)
+    {
+        cursor = strchr(cursor, ' ');
+        cursor = cursor ? cursor + 1 : NULL;
+    }
+
+    if(cursor == NULL)
+    {
+        return false;
+    }
+
+    *value = strtoull(cursor, NULL, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return true;
+}
@@ -0,0 +1,98 @@
+#include "admission.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MILLI 1000ULL
+
+static const uint16_t BUSY_REPLY = UINT16_MAX;
+
+static void refill(struct admission *admission, uint64_t now_ms);
+
+void admission_init(struct admission *admission, uint32_t max_connections, uint32_t max_in_flight_per_worker, uint32_t accept_rate, uint32_t accept_burst, uint64_t now_ms)
+{
+    memset(admission, 0, sizeof(*admission));
+    admission->max_connections = max_connections;
+    admission->max_in_flight_per_worker = max_in_flight_per_worker;
+    admission->accept_rate = accept_rate;
+    admission->accept_burst = accept_burst > 0 ? accept_burst : accept_rate;
+    admission->millitokens = (uint64_t)admission->accept_burst * MILLI;
+    admission->last_refill_ms = now_ms;
+}
+
+enum admission_verdict admission_accept(struct admission *admission, uint32_t connections, uint64_t now_ms)
+{
+    if(admission->max_connections > 0 && connections >= admission->max_connections)
+    {
+        admission->rejected_connections++;
+        return REJECT_CONNECTIONS;
+    }
+
+    if(admission->accept_rate > 0)
+    {
+        refill(admission, now_ms);
+
+        if(admission->millitokens < MILLI)
+        {
+            admission->rejected_rate++;
+            return REJECT_RATE;
+        }
+
+        admission->millitokens -= MILLI;
+    }
+
+    admission->admitted++;
+
+    return ADMIT;
+}
+
+bool admission_can_dispatch(const struct admission *admission, int in_flight, int workers)
+{
+    if(admission->max_in_flight_per_worker == 0)
+    {
+        return true;
+    }
+
+    return in_flight < (int)admission->max_in_flight_per_worker * workers;
+}
+
+void admission_reject(int client_socket)
+{
+    uint16_t reply;
+
+    // best effort: a count no real reply can carry tells the client to back off, then the connection is dropped
+    reply = htons(BUSY_REPLY);
+    send(client_socket, &reply, sizeof(reply), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(client_socket);
+}
+
+void admission_report(const struct admission *admission, FILE *stream)
+{
+    fprintf(stream, "admission: %llu admitted, %llu rejected over connection limit, %llu rejected over accept rate, %llu requests deferred\n",    // NOLINT(cert-err33-c)
+            (unsigned long long)admission->admitted,
+            (unsigned long long)admission->rejected_connections,
+            (unsigned long long)admission->rejected_rate,
+            (unsigned long long)admission->deferred);
+}
+
+static void refill(struct admission *admission, uint64_t now_ms)
+{
+    uint64_t capacity;
+
+    if(now_ms <= admission->last_refill_ms)
+    {
+        return;
+    }
+
+    // rate tokens per second is rate millitokens per millisecond
+    capacity = (uint64_t)admission->accept_burst * MILLI;
+    admission->millitokens += (now_ms - admission->last_refill_ms) * admission->accept_rate;
+
+    if(admission->millitokens > capacity)
+    {
+        admission->millitokens = capacity;
+    }
+
+    admission->last_refill_ms = now_ms;
+}
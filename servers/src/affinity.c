@@ -0,0 +1,118 @@
+#include "affinity.h"
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+int affinity_available_cpus(int *cpus, int max)
+{
+    cpu_set_t set;
+    int count;
+
+    CPU_ZERO(&set);
+
+    if(sched_getaffinity(0, sizeof(set), &set) != 0)
+    {
+        return 0;
+    }
+
+    count = 0;
+
+    for(int cpu = 0; cpu < CPU_SETSIZE && count < max; cpu++)
+    {
+        if(CPU_ISSET(cpu, &set))
+        {
+            cpus[count] = cpu;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+int affinity_worker_cpu(const int *cpus, int count, int slot)
+{
+    if(count <= 0)
+    {
+        return -1;
+    }
+
+    if(count == 1)
+    {
+        return cpus[0];
+    }
+
+    return cpus[1 + slot % (count - 1)];
+}
+
+int affinity_pin(int cpu)
+{
+    cpu_set_t set;
+
+    if(cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        return -1;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+int affinity_current_node(void)
+{
+    unsigned int cpu;
+    unsigned int node;
+
+    if(getcpu(&cpu, &node) != 0)
+    {
+        return 0;
+    }
+
+    return (int)node;
+}
+
+void *affinity_alloc_local(size_t size)
+{
+    void *memory;
+
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(memory == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    // touch every page now, while pinned, instead of on first use
+    memset(memory, 0, size);
+
+    return memory;
+}
+
+void affinity_free_local(void *memory, size_t size)
+{
+    if(memory)
+    {
+        munmap(memory, size);
+    }
+}
+
+int affinity_incoming_cpu(int socket)
+{
+#ifdef SO_INCOMING_CPU
+    int cpu;
+    socklen_t length;
+
+    length = sizeof(cpu);
+
+    if(getsockopt(socket, SOL_SOCKET, SO_INCOMING_CPU, &cpu, &length) == 0)
+    {
+        return cpu;
+    }
+#else
+    (void)socket;
+#endif
+
+    return -1;
+}
@@ -0,0 +1,451 @@
+#include "server.h"
+#include "server_config.h"
+#include <arpa/inet.h>
+#include <dc_util/system.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TUNE_CANDIDATES 4
+#define TUNE_MAX_ARGS 64
+#define TUNE_ARG_LENGTH 40
+#define TUNE_REQUEST_SIZE 1024
+#define TUNE_REPLY_SIZE 2                   // the processed length, as send_message_handler writes it
+#define TUNE_REQUESTS_PER_CONNECTION 100    // reconnecting keeps the accept path in the measurement
+#define TUNE_CONNECTIONS_PER_CPU 4
+#define TUNE_MAX_CONNECTIONS 64
+#define TUNE_WARMUP_MS 500
+#define TUNE_MEASURE_MS 2000
+#define TUNE_START_TIMEOUT_MS 5000
+#define TUNE_RETRY_MS 50
+#define TUNE_IO_TIMEOUT_S 1
+#define TUNE_MIN_GAIN_PERCENT 5             // smaller differences are run to run noise on loopback
+#define TUNE_MAX_WORKERS 255
+#define DEFAULT_N_PROCESSES 2
+#define CACHE_LINE 64
+#define MS_PER_S 1000
+#define PERCENT 100
+#define NS_PER_MS 1000000
+
+/**
+ * One knob of the sweep and the values tried for it, 0 ends the list early.
+ */
+struct tune_knob
+{
+    const char *key;
+    unsigned int modes; // bit per enum server_types the knob changes anything in
+    int candidates[TUNE_CANDIDATES];
+};
+
+enum trial_phase
+{
+    TRIAL_WARMUP,
+    TRIAL_MEASURE,
+    TRIAL_DONE
+};
+
+struct tune_trial
+{
+    struct sockaddr_in address;
+    _Atomic int phase;
+};
+
+/**
+ * One client connection looping on requests, padded so the counters of neighbouring threads don't share a line.
+ */
+struct load_thread
+{
+    _Alignas(CACHE_LINE) pthread_t thread;
+    struct tune_trial *trial;
+    uint64_t requests;
+    uint64_t errors;
+    bool started;
+};
+
+static uint64_t measure(struct dc_env *env, struct dc_error *err, const struct options *opts, const struct server_config *config, int connections);
+static pid_t start_server(const struct options *opts, const struct server_config *config);
+static bool wait_for_server(pid_t pid, const struct sockaddr_in *address);
+static void stop_server(pid_t pid);
+static int connect_to(const struct sockaddr_in *address);
+static void *load_main(void *arg);
+static bool exchange(int fd, const uint8_t *request);
+static void sleep_ms(long ms);
+
+
+#define MODE(type) (1U << (type))
+
+int run_autotune(struct dc_env *env, struct dc_error *error, struct options *opts)
+{
+    struct tune_knob knobs[] = {    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        {"workers",          MODE(POLL_SERVER) | MODE(THREAD_POLL_SERVER), {0, 0, 0, 0}},
+        {"read_buffer_size", MODE(ONE_TO_ONE) | MODE(POLL_SERVER) | MODE(SELECT_SERVER) | MODE(THREAD_POLL_SERVER) | MODE(EPOLL_SERVER), {1024, 4096, 16384, 65536}},
+        {"accept_batch",     MODE(POLL_SERVER) | MODE(SELECT_SERVER) | MODE(THREAD_POLL_SERVER) | MODE(EPOLL_SERVER), {1, 8, 64, 256}},
+        {"event_batch",      MODE(POLL_SERVER) | MODE(SELECT_SERVER) | MODE(THREAD_POLL_SERVER) | MODE(EPOLL_SERVER), {16, 64, 256, 0}},
+    };
+    struct server_config best;
+    uint64_t best_rate;
+    int processors;
+    int connections;
+
+    DC_TRACE(env);
+
+    // the load is TCP request/reply, which the datagram server doesn't speak
+    if(opts->server_to_run == UDP_SERVER || opts->unix_only)
+    {
+        DC_ERROR_RAISE_USER(error, "The sweep drives TCP servers only", -1);
+        return EXIT_FAILURE;
+    }
+
+    processors = (int)dc_get_number_of_processors(env, error, DEFAULT_N_PROCESSES);
+    knobs[0].candidates[0] = 1;
+    knobs[0].candidates[1] = processors > 1 ? processors / 2 : 0;
+    knobs[0].candidates[2] = processors > 1 ? processors : 0;
+    knobs[0].candidates[3] = processors * 2 <= TUNE_MAX_WORKERS ? processors * 2 : TUNE_MAX_WORKERS;
+    connections = processors * TUNE_CONNECTIONS_PER_CPU < TUNE_MAX_CONNECTIONS ? processors * TUNE_CONNECTIONS_PER_CPU : TUNE_MAX_CONNECTIONS;
+    printf("Sweeping with %d connections sending %d byte requests, %dms per candidate\n", connections, TUNE_REQUEST_SIZE, TUNE_MEASURE_MS);
+
+    best = opts->config;
+    best_rate = measure(env, error, opts, &best, connections);
+    printf("  baseline: %lu requests/s\n", (unsigned long)best_rate);
+
+    // one knob at a time from the best so far, the knobs interact less than a full grid would pay for
+    for(size_t k = 0; k < sizeof(knobs) / sizeof(knobs[0]); k++)
+    {
+        struct server_config base;
+
+        if((knobs[k].modes & MODE(opts->server_to_run)) == 0)
+        {
+            continue;
+        }
+
+        base = best;
+
+        for(size_t c = 0; c < TUNE_CANDIDATES; c++)
+        {
+            struct server_config trial;
+            char assignment[TUNE_ARG_LENGTH];
+            uint64_t rate;
+
+            if(knobs[k].candidates[c] == 0)
+            {
+                continue;
+            }
+
+            trial = base;
+            snprintf(assignment, sizeof(assignment), "%s=%d", knobs[k].key, knobs[k].candidates[c]);    // NOLINT(cert-err33-c)
+
+            if(server_config_set(&trial, assignment) != SERVER_CONFIG_SET)
+            {
+                continue;
+            }
+
+            rate = measure(env, error, opts, &trial, connections);
+            printf("  %s: %lu requests/s\n", assignment, (unsigned long)rate);
+
+            if(rate * PERCENT > best_rate * (PERCENT + TUNE_MIN_GAIN_PERCENT))
+            {
+                best = trial;
+                best_rate = rate;
+            }
+        }
+    }
+
+    printf("Best, %lu requests/s: ", (unsigned long)best_rate);
+    server_config_print(&best, stdout);
+
+    if(!server_config_write(env, error, &best, opts->tune_path))
+    {
+        return EXIT_FAILURE;
+    }
+
+    printf("Wrote %s, run with f=%s\n", opts->tune_path, opts->tune_path);
+
+    return EXIT_SUCCESS;
+}
+
+static uint64_t measure(struct dc_env *env, struct dc_error *err, const struct options *opts, const struct server_config *config, int connections)
+{
+    struct tune_trial trial;
+    struct load_thread *threads;
+    uint64_t requests;
+    uint64_t errors;
+    pid_t pid;
+
+    DC_TRACE(env);
+    memset(&trial, 0, sizeof(trial));
+    trial.address.sin_family = AF_INET;
+    trial.address.sin_port = htons(config->port);
+    trial.address.sin_addr.s_addr = inet_addr(opts->ip_address);
+    atomic_init(&trial.phase, TRIAL_WARMUP);
+    pid = start_server(opts, config);
+
+    if(pid < 0 || !wait_for_server(pid, &trial.address))
+    {
+        printf("  server did not start\n");
+
+        if(pid > 0)
+        {
+            stop_server(pid);
+        }
+
+        return 0;
+    }
+
+    threads = (struct load_thread *)aligned_alloc(CACHE_LINE, (size_t)connections * sizeof(*threads));
+
+    if(threads == NULL)
+    {
+        stop_server(pid);
+        DC_ERROR_RAISE_USER(err, "Out of memory for the load threads", -1);
+        return 0;
+    }
+
+    memset(threads, 0, (size_t)connections * sizeof(*threads));
+
+    for(int i = 0; i < connections; i++)
+    {
+        threads[i].trial = &trial;
+        threads[i].started = pthread_create(&threads[i].thread, NULL, load_main, &threads[i]) == 0;
+    }
+
+    sleep_ms(TUNE_WARMUP_MS);
+    atomic_store(&trial.phase, TRIAL_MEASURE);
+    sleep_ms(TUNE_MEASURE_MS);
+    atomic_store(&trial.phase, TRIAL_DONE);
+    requests = 0;
+    errors = 0;
+
+    for(int i = 0; i < connections; i++)
+    {
+        if(threads[i].started)
+        {
+            pthread_join(threads[i].thread, NULL);
+            requests += threads[i].requests;
+            errors += threads[i].errors;
+        }
+    }
+
+    // refused connections and timeouts mean the candidate dropped load rather than served it slowly
+    if(errors > 0)
+    {
+        printf("  %lu failed connections or requests\n", (unsigned long)errors);
+    }
+
+    free(threads);
+    stop_server(pid);
+
+    return requests * MS_PER_S / TUNE_MEASURE_MS;
+}
+
+static pid_t start_server(const struct options *opts, const struct server_config *config)
+{
+    char values[4][TUNE_ARG_LENGTH];    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    char quiet[] = "verbose=false";
+    char *argv[TUNE_MAX_ARGS];
+    size_t argc;
+    pid_t pid;
+
+    argc = 0;
+
+    // the same command line without tune=, followed by the candidate, which overrides any earlier key=value or f=
+    for(size_t i = 0; opts->argv[i] && argc < TUNE_MAX_ARGS - 6; i++)    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    {
+        if(strncmp(opts->argv[i], "tune=", strlen("tune=")) != 0)
+        {
+            argv[argc++] = opts->argv[i];
+        }
+    }
+
+    snprintf(values[0], sizeof(values[0]), "workers=%d", config->workers);    // NOLINT(cert-err33-c)
+    snprintf(values[1], sizeof(values[1]), "read_buffer_size=%d", config->read_buffer_size);    // NOLINT(cert-err33-c)
+    snprintf(values[2], sizeof(values[2]), "accept_batch=%d", config->accept_batch);    // NOLINT(cert-err33-c)
+    snprintf(values[3], sizeof(values[3]), "event_batch=%d", config->event_batch);    // NOLINT(cert-err33-c)
+
+    for(size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+    {
+        argv[argc++] = values[i];
+    }
+
+    // every candidate pays the same for logging, none at all
+    argv[argc++] = quiet;
+
+    argv[argc] = NULL;
+    fflush(stdout);     // NOLINT(cert-err33-c)
+    pid = fork();
+
+    if(pid == 0)
+    {
+        int null_fd;
+
+        null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+        if(null_fd >= 0)
+        {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+
+        execv("/proc/self/exe", argv);
+        _exit(EXIT_FAILURE);
+    }
+
+    return pid;
+}
+
+static bool wait_for_server(pid_t pid, const struct sockaddr_in *address)
+{
+    for(int waited = 0; waited < TUNE_START_TIMEOUT_MS; waited += TUNE_RETRY_MS)
+    {
+        int fd;
+
+        if(waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            return false;
+        }
+
+        fd = connect_to(address);
+
+        if(fd >= 0)
+        {
+            close(fd);
+            return true;
+        }
+
+        sleep_ms(TUNE_RETRY_MS);
+    }
+
+    return false;
+}
+
+static void stop_server(pid_t pid)
+{
+    kill(pid, SIGTERM);
+
+    while(waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+    {
+    }
+}
+
+static int connect_to(const struct sockaddr_in *address)
+{
+    struct timeval timeout;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+    if(fd < 0)
+    {
+        return -1;
+    }
+
+    // a stuck server fails the request instead of hanging the sweep
+    timeout.tv_sec = TUNE_IO_TIMEOUT_S;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    if(connect(fd, (const struct sockaddr *)address, sizeof(*address)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void *load_main(void *arg)
+{
+    struct load_thread *self;
+    uint8_t request[TUNE_REQUEST_SIZE];
+
+    self = (struct load_thread *)arg;
+    memset(request, 'a', sizeof(request));
+
+    while(atomic_load(&self->trial->phase) != TRIAL_DONE)
+    {
+        int fd;
+
+        fd = connect_to(&self->trial->address);
+
+        if(fd < 0)
+        {
+            self->errors++;
+            sleep_ms(1);
+            continue;
+        }
+
+        for(int i = 0; i < TUNE_REQUESTS_PER_CONNECTION && atomic_load(&self->trial->phase) != TRIAL_DONE; i++)
+        {
+            if(!exchange(fd, request))
+            {
+                self->errors++;
+                break;
+            }
+
+            if(atomic_load(&self->trial->phase) == TRIAL_MEASURE)
+            {
+                self->requests++;
+            }
+        }
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+static bool exchange(int fd, const uint8_t *request)
+{
+    uint8_t reply[TUNE_REPLY_SIZE];
+    size_t done;
+
+    for(done = 0; done < TUNE_REQUEST_SIZE;)
+    {
+        ssize_t sent;
+
+        sent = send(fd, request + done, TUNE_REQUEST_SIZE - done, MSG_NOSIGNAL);
+
+        if(sent <= 0)
+        {
+            return false;
+        }
+
+        done += (size_t)sent;
+    }
+
+    for(done = 0; done < sizeof(reply);)
+    {
+        ssize_t received;
+
+        received = recv(fd, reply + done, sizeof(reply) - done, 0);
+
+        if(received <= 0)
+        {
+            return false;
+        }
+
+        done += (size_t)received;
+    }
+
+    return true;
+}
+
+static void sleep_ms(long ms)
+{
+    struct timespec delay;
+
+    delay.tv_sec = ms / MS_PER_S;
+    delay.tv_nsec = (ms % MS_PER_S) * NS_PER_MS;
+    nanosleep(&delay, NULL);
+}
@@ -0,0 +1,129 @@
+#include "buffer_pool.h"
+#include <dc_c/dc_stdlib.h>
+#include <inttypes.h>
+
+/**
+ * A free buffer's first bytes link it into the free list, so idle buffers cost nothing beyond themselves.
+ */
+struct pool_buffer
+{
+    struct pool_buffer *next;
+};
+
+
+void buffer_pool_init(struct buffer_pool *pool, size_t buffer_size, size_t max_free)
+{
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->free_list = NULL;
+    pool->buffer_size = buffer_size < sizeof(struct pool_buffer) ? sizeof(struct pool_buffer) : buffer_size;
+    pool->max_free = max_free;
+    pool->stats = (struct buffer_pool_stats){0};
+    pool->stats.buffer_size = pool->buffer_size;
+}
+
+uint8_t *buffer_pool_borrow(const struct dc_env *env, struct dc_error *err, struct buffer_pool *pool)
+{
+    struct pool_buffer *buffer;
+
+    pthread_mutex_lock(&pool->lock);
+    buffer = pool->free_list;
+
+    if(buffer)
+    {
+        pool->free_list = buffer->next;
+        pool->stats.num_free--;
+    }
+    else
+    {
+        pool->stats.allocations++;
+    }
+
+    pool->stats.borrows++;
+    pool->stats.outstanding++;
+
+    if(pool->stats.outstanding > pool->stats.peak_outstanding)
+    {
+        pool->stats.peak_outstanding = pool->stats.outstanding;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    // the allocation happens outside the lock, only the list manipulation is serialized
+    if(buffer == NULL)
+    {
+        buffer = (struct pool_buffer *)dc_malloc(env, err, pool->buffer_size);
+
+        if(buffer == NULL)
+        {
+            pthread_mutex_lock(&pool->lock);
+            pool->stats.outstanding--;
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+
+    return (uint8_t *)buffer;
+}
+
+void buffer_pool_return(const struct dc_env *env, struct buffer_pool *pool, uint8_t *buffer)
+{
+    struct pool_buffer *node;
+    bool keep;
+
+    node = (struct pool_buffer *)buffer;
+    pthread_mutex_lock(&pool->lock);
+    pool->stats.outstanding--;
+    keep = pool->stats.num_free < pool->max_free;
+
+    if(keep)
+    {
+        node->next = pool->free_list;
+        pool->free_list = node;
+        pool->stats.num_free++;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+
+    if(!keep)
+    {
+        dc_free(env, buffer);
+    }
+}
+
+void buffer_pool_stats(struct buffer_pool *pool, struct buffer_pool_stats *stats)
+{
+    pthread_mutex_lock(&pool->lock);
+    *stats = pool->stats;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void buffer_pool_report(struct buffer_pool *pool, const char *name, FILE *out)
+{
+    struct buffer_pool_stats stats;
+
+    buffer_pool_stats(pool, &stats);
+
+    if(stats.borrows == 0)
+    {
+        return;
+    }
+
+    fprintf(out, "%s buffers: %zu bytes each, %" PRIu64 " borrowed, %" PRIu64 " allocated, peak %zu in use, %zu kept free\n",    // NOLINT(cert-err33-c)
+            name, stats.buffer_size, stats.borrows, stats.allocations, stats.peak_outstanding, stats.num_free);
+}
+
+void buffer_pool_destroy(const struct dc_env *env, struct buffer_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+
+    while(pool->free_list)
+    {
+        struct pool_buffer *next;
+
+        next = pool->free_list->next;
+        dc_free(env, pool->free_list);
+        pool->free_list = next;
+    }
+
+    pool->stats.num_free = 0;
+    pthread_mutex_unlock(&pool->lock);
+}
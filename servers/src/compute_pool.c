@@ -0,0 +1,335 @@
+#include "compute_pool.h"
+#include "result_cache.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static bool queue_init(const struct dc_env *env, struct dc_error *err, struct compute_queue *queue, size_t capacity);
+static void queue_destroy(const struct dc_env *env, struct compute_queue *queue);
+static bool queue_push(struct compute_queue *queue, const struct compute_job *job);
+static bool queue_pop(struct compute_queue *queue, struct compute_job *job);
+static void *thread_main(void *arg);
+static void process_job(struct dc_env *env, struct dc_error *err, struct compute_job *job);
+static void notify(struct compute_pool *pool);
+
+
+bool compute_pool_start(const struct dc_env *env, struct dc_error *err, struct compute_pool *pool, int num_threads, size_t depth, int notify_fd)
+{
+    size_t capacity;
+
+    DC_TRACE(env);
+    dc_memset(env, pool, 0, sizeof(*pool));
+    pool->notify_fd = notify_fd;
+    atomic_init(&pool->stopping, false);
+    atomic_init(&pool->notified, false);
+    capacity = 2;
+
+    while(capacity < depth)
+    {
+        capacity *= 2;
+    }
+
+    if(!queue_init(env, err, &pool->requests, capacity) || !queue_init(env, err, &pool->results, capacity))
+    {
+        return false;
+    }
+
+    sem_init(&pool->pending, 0, 0);
+    pool->threads = (pthread_t *)dc_malloc(env, err, num_threads * sizeof(pthread_t));
+
+    if(pool->threads == NULL)
+    {
+        return false;
+    }
+
+    for(int i = 0; i < num_threads; i++)
+    {
+        if(pthread_create(&pool->threads[i], NULL, thread_main, pool) != 0)
+        {
+            DC_ERROR_RAISE_USER(err, "Could not start a compute thread", -1);
+            return false;
+        }
+
+        pool->num_threads++;
+    }
+
+    return true;
+}
+
+size_t compute_pool_depth(const struct compute_pool *pool)
+{
+    return pool->requests.mask + 1;
+}
+
+bool compute_pool_submit(struct compute_pool *pool, const struct compute_job *job)
+{
+    if(!queue_push(&pool->requests, job))
+    {
+        return false;
+    }
+
+    sem_post(&pool->pending);
+
+    return true;
+}
+
+bool compute_pool_complete(struct compute_pool *pool, struct compute_job *job)
+{
+    return queue_pop(&pool->results, job);
+}
+
+void compute_pool_rearm(struct compute_pool *pool)
+{
+    atomic_store_explicit(&pool->notified, false, memory_order_seq_cst);
+}
+
+void compute_pool_stop(const struct dc_env *env, struct compute_pool *pool)
+{
+    struct compute_job job;
+
+    DC_TRACE(env);
+    atomic_store(&pool->stopping, true);
+
+    // one extra token per thread, each thread exits on the first token that finds the queue empty
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        sem_post(&pool->pending);
+    }
+
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    if(pool->threads)
+    {
+        dc_free(env, pool->threads);
+        sem_destroy(&pool->pending);
+    }
+
+    // requests still queued when a thread failed to start, and results nobody collected
+    while(pool->requests.cells && queue_pop(&pool->requests, &job))
+    {
+        dc_free(env, job.data);
+    }
+
+    while(pool->results.cells && queue_pop(&pool->results, &job))
+    {
+        if(job.data)
+        {
+            dc_free(env, job.data);
+        }
+    }
+
+    queue_destroy(env, &pool->requests);
+    queue_destroy(env, &pool->results);
+}
+
+static bool queue_init(const struct dc_env *env, struct dc_error *err, struct compute_queue *queue, size_t capacity)
+{
+    DC_TRACE(env);
+    queue->cells = (struct compute_cell *)dc_malloc(env, err, capacity * sizeof(struct compute_cell));
+
+    if(queue->cells == NULL)
+    {
+        return false;
+    }
+
+    for(size_t i = 0; i < capacity; i++)
+    {
+        atomic_init(&queue->cells[i].sequence, i);
+    }
+
+    queue->mask = capacity - 1;
+    atomic_init(&queue->enqueue_pos, 0);
+    atomic_init(&queue->dequeue_pos, 0);
+
+    return true;
+}
+
+static void queue_destroy(const struct dc_env *env, struct compute_queue *queue)
+{
+    DC_TRACE(env);
+
+    if(queue->cells)
+    {
+        dc_free(env, queue->cells);
+        queue->cells = NULL;
+    }
+}
+
+static bool queue_push(struct compute_queue *queue, const struct compute_job *job)
+{
+    struct compute_cell *cell;
+    size_t pos;
+
+    pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+
+    for(;;)
+    {
+        size_t sequence;
+
+        cell = &queue->cells[pos & queue->mask];
+        sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+
+        if(sequence == pos)
+        {
+            // the cell is free for this lap, claim the position
+            if(atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(sequence < pos)
+        {
+            // still holds the job from the previous lap
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    cell->job = *job;
+    atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+
+    return true;
+}
+
+static bool queue_pop(struct compute_queue *queue, struct compute_job *job)
+{
+    struct compute_cell *cell;
+    size_t pos;
+
+    pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+
+    for(;;)
+    {
+        size_t sequence;
+
+        cell = &queue->cells[pos & queue->mask];
+        sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+
+        if(sequence == pos + 1)
+        {
+            if(atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if(sequence < pos + 1)
+        {
+            // empty, or the producer of this position has not finished writing it
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+        }
+    }
+
+    *job = cell->job;
+    // free for the producer one lap later
+    atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+
+    return true;
+}
+
+static void *thread_main(void *arg)
+{
+    struct compute_pool *pool;
+    struct dc_error *err;
+    struct dc_env *env;
+
+    pool = (struct compute_pool *)arg;
+
+    // dc_error records the last failure, so every thread needs its own
+    err = dc_error_create(false);
+    env = dc_env_create(err, false, NULL);
+
+    for(;;)
+    {
+        struct compute_job job;
+
+        if(sem_wait(&pool->pending) != 0)
+        {
+            continue;
+        }
+
+        // the event loop is the only producer, so a token always finds its request already published
+        if(!queue_pop(&pool->requests, &job))
+        {
+            if(atomic_load(&pool->stopping))
+            {
+                break;
+            }
+
+            continue;
+        }
+
+        process_job(env, err, &job);
+
+        // at most depth requests are in flight, so there is always room for the result
+        while(!queue_push(&pool->results, &job))
+        {
+            sched_yield();
+        }
+
+        notify(pool);
+    }
+
+    dc_error_reset(err);
+    free(err);
+    free(env);
+
+    return NULL;
+}
+
+static void process_job(struct dc_env *env, struct dc_error *err, struct compute_job *job)
+{
+    uint8_t *processed_data;
+    size_t processed_data_length;
+
+    processed_data = NULL;
+    processed_data_length = result_cache_process(env, err, job->processor, job->data, &processed_data, job->length);
+    dc_free(env, job->data);
+    job->failed = dc_error_has_error(err);
+
+    if(job->failed)
+    {
+        dc_error_reset(err);
+
+        if(processed_data)
+        {
+            dc_free(env, processed_data);
+        }
+
+        processed_data = NULL;
+        processed_data_length = 0;
+    }
+
+    job->data = processed_data;
+    job->length = (ssize_t)processed_data_length;
+}
+
+static void notify(struct compute_pool *pool)
+{
+    unsigned char wakeup;
+
+    // the loop clears the flag before draining the results, so a result published after that writes a new byte
+    if(atomic_exchange(&pool->notified, true))
+    {
+        return;
+    }
+
+    wakeup = 1;
+
+    if(write(pool->notify_fd, &wakeup, sizeof(wakeup)) != sizeof(wakeup))
+    {
+        perror("compute pool notify");
+    }
+}
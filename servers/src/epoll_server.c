@@ -0,0 +1,29 @@
+#include "event_server.h"
+#include "server.h"
+
+int run_epoll_server(struct dc_env * env, struct dc_error * error, struct options *opts) {
+    DC_TRACE(env);
+
+    struct event_server_config config;
+
+    // the select server's shape without the FD_SETSIZE limit or the O(n) scan per wakeup
+    config.name = "Epoll Server";
+    config.backend = EVENT_BACKEND_EPOLL;
+    // c=N moves the processor onto N compute threads, reading and sending stay on the loop
+    // y runs each request in a fiber instead, so a reply that fills the socket buffer does not hold up the loop
+    config.dispatch = opts->compute_threads > 0 ? DISPATCH_COMPUTE : (opts->fibers ? DISPATCH_FIBERS : DISPATCH_INLINE);
+    config.threads = opts->compute_threads;
+    config.compute_depth = (size_t)opts->config.compute_depth;
+    config.backlog = opts->config.backlog;
+    config.max_connections = (uint32_t)opts->config.max_connections;
+    config.accept_rate = 0;
+    config.accept_burst = 0;
+    config.max_in_flight_per_worker = 0;
+    config.header_timeout_ms = (uint32_t)opts->config.header_timeout_ms;
+    config.idle_timeout_ms = (uint32_t)opts->config.idle_timeout_ms;
+    config.stall_timeout_ms = EVENT_SERVER_STALL_TIMEOUT_MS;
+    config.shutdown_timeout_ms = EVENT_SERVER_SHUTDOWN_TIMEOUT_MS;
+    config.verbose = opts->config.verbose;
+
+    return run_event_server(env, error, opts, &config);
+}
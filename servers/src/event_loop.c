@@ -0,0 +1,750 @@
+#include "event_loop.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_poll.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_select.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/poll.h>
+#include <sys/select.h>
+
+#define MS_PER_SEC 1000
+#define US_PER_MS 1000
+#define EPOLL_SILENT ((uint64_t)1 << 32)   // in epoll_event data above the fd, the descriptor's events are dropped
+
+struct event_backend
+{
+    const char *name;
+    void *(*create)(const struct dc_env *env, struct dc_error *err);
+    void (*destroy)(const struct dc_env *env, struct dc_error *err, void *state);
+    bool (*add)(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events);
+    void (*modify)(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events);
+    void (*remove)(const struct dc_env *env, struct dc_error *err, void *state, int fd);
+    int (*wait)(const struct dc_env *env, struct dc_error *err, void *state, struct event *events, int max_events, int timeout_ms);
+};
+
+struct select_state
+{
+    fd_set registered;
+    fd_set read_fds;
+    fd_set write_fds;
+    int max_fd;
+    /**
+     * Where the next scan of the ready set starts, so a full events array does not always cut off the same fds.
+     */
+    int next_fd;
+};
+
+struct poll_state
+{
+    /**
+     * Packed interest set, a silent descriptor is stored as -1 - fd so poll skips it.
+     */
+    struct pollfd *fds;
+    int num_fds;
+    int capacity;
+    /**
+     * Position of each descriptor in fds, indexed by fd, -1 when not registered.
+     */
+    int *slots;
+    int num_slots;
+    /**
+     * Where the next scan of fds starts, as for select.
+     */
+    int next_slot;
+};
+
+struct epoll_state
+{
+    int epoll_fd;
+    struct epoll_event *ready;
+    int capacity;
+};
+
+static void *select_create(const struct dc_env *env, struct dc_error *err);
+static void select_destroy(const struct dc_env *env, struct dc_error *err, void *state);
+static bool select_add(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events);
+static void select_modify(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events);
+static void select_remove(const struct dc_env *env, struct dc_error *err, void *state, int fd);
+static int select_wait(const struct dc_env *env, struct dc_error *err, void *state, struct event *events, int max_events, int timeout_ms);
+static void *poll_create(const struct dc_env *env, struct dc_error *err);
+static void poll_destroy(const struct dc_env *env, struct dc_error *err, void *state);
+static bool poll_add(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events);
+static void poll_modify(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events);
+static void poll_remove(const struct dc_env *env, struct dc_error *err, void *state, int fd);
+static int poll_wait(const struct dc_env *env, struct dc_error *err, void *state, struct event *events, int max_events, int timeout_ms);
+static void *epoll_create_state(const struct dc_env *env, struct dc_error *err);
+static void epoll_destroy(const struct dc_env *env, struct dc_error *err, void *state);
+static bool epoll_add(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events);
+static void epoll_modify(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events);
+static void epoll_remove(const struct dc_env *env, struct dc_error *err, void *state, int fd);
+static int epoll_wait_events(const struct dc_env *env, struct dc_error *err, void *state, struct event *events, int max_events, int timeout_ms);
+static void epoll_interest(int fd, unsigned int events, struct epoll_event *event);
+static short poll_events(unsigned int events);
+static void raise_errno(const struct dc_env *env, struct dc_error *err);
+
+
+static const struct event_backend select_backend = {"select", select_create, select_destroy, select_add, select_modify, select_remove, select_wait};
+static const struct event_backend poll_backend = {"poll", poll_create, poll_destroy, poll_add, poll_modify, poll_remove, poll_wait};
+static const struct event_backend epoll_backend = {"epoll", epoll_create_state, epoll_destroy, epoll_add, epoll_modify, epoll_remove, epoll_wait_events};
+
+const char *event_backend_name(enum event_backend_type type)
+{
+    switch(type)
+    {
+        case EVENT_BACKEND_SELECT:
+            return select_backend.name;
+        case EVENT_BACKEND_POLL:
+            return poll_backend.name;
+        case EVENT_BACKEND_EPOLL:
+            return epoll_backend.name;
+        default:
+            return "unknown";
+    }
+}
+
+bool event_loop_init(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, enum event_backend_type type)
+{
+    DC_TRACE(env);
+
+    switch(type)
+    {
+        case EVENT_BACKEND_SELECT:
+            loop->backend = &select_backend;
+            break;
+        case EVENT_BACKEND_POLL:
+            loop->backend = &poll_backend;
+            break;
+        case EVENT_BACKEND_EPOLL:
+            loop->backend = &epoll_backend;
+            break;
+        default:
+            DC_ERROR_RAISE_USER(err, "Unknown event backend", -1);
+            return false;
+    }
+
+    loop->state = loop->backend->create(env, err);
+
+    return loop->state != NULL;
+}
+
+void event_loop_destroy(const struct dc_env *env, struct dc_error *err, struct event_loop *loop)
+{
+    DC_TRACE(env);
+
+    if(loop->state)
+    {
+        loop->backend->destroy(env, err, loop->state);
+        loop->state = NULL;
+    }
+}
+
+bool event_loop_add(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, int fd, unsigned int events)
+{
+    DC_TRACE(env);
+
+    return loop->backend->add(env, err, loop->state, fd, events);
+}
+
+void event_loop_modify(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, int fd, unsigned int events)
+{
+    DC_TRACE(env);
+    loop->backend->modify(env, err, loop->state, fd, events);
+}
+
+void event_loop_remove(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, int fd)
+{
+    DC_TRACE(env);
+    loop->backend->remove(env, err, loop->state, fd);
+}
+
+int event_loop_wait(const struct dc_env *env, struct dc_error *err, struct event_loop *loop, struct event *events, int max_events, int timeout_ms)
+{
+    DC_TRACE(env);
+
+    return loop->backend->wait(env, err, loop->state, events, max_events, timeout_ms);
+}
+
+static void *select_create(const struct dc_env *env, struct dc_error *err)
+{
+    struct select_state *state;
+
+    DC_TRACE(env);
+    state = (struct select_state *)dc_malloc(env, err, sizeof(*state));
+
+    if(state)
+    {
+        FD_ZERO(&state->registered);
+        FD_ZERO(&state->read_fds);
+        FD_ZERO(&state->write_fds);
+        state->max_fd = -1;
+        state->next_fd = 0;
+    }
+
+    return state;
+}
+
+static void select_destroy(const struct dc_env *env, __attribute__((unused)) struct dc_error *err, void *state)
+{
+    DC_TRACE(env);
+    dc_free(env, state);
+}
+
+static bool select_add(const struct dc_env *env, __attribute__((unused)) struct dc_error *err, void *state, int fd, unsigned int events)
+{
+    struct select_state *select_state;
+
+    DC_TRACE(env);
+    select_state = (struct select_state *)state;
+
+    // fd_set is a fixed size bitmap
+    if(fd < 0 || fd >= FD_SETSIZE)
+    {
+        return false;
+    }
+
+    FD_SET(fd, &select_state->registered);
+
+    if(events & (unsigned int)EVENT_READ)
+    {
+        FD_SET(fd, &select_state->read_fds);
+    }
+
+    if(events & (unsigned int)EVENT_WRITE)
+    {
+        FD_SET(fd, &select_state->write_fds);
+    }
+
+    if(fd > select_state->max_fd)
+    {
+        select_state->max_fd = fd;
+    }
+
+    return true;
+}
+
+static void select_modify(const struct dc_env *env, __attribute__((unused)) struct dc_error *err, void *state, int fd, unsigned int events)
+{
+    struct select_state *select_state;
+
+    DC_TRACE(env);
+    select_state = (struct select_state *)state;
+
+    if(events & (unsigned int)EVENT_READ)
+    {
+        FD_SET(fd, &select_state->read_fds);
+    }
+    else
+    {
+        FD_CLR(fd, &select_state->read_fds);
+    }
+
+    if(events & (unsigned int)EVENT_WRITE)
+    {
+        FD_SET(fd, &select_state->write_fds);
+    }
+    else
+    {
+        FD_CLR(fd, &select_state->write_fds);
+    }
+}
+
+static void select_remove(const struct dc_env *env, __attribute__((unused)) struct dc_error *err, void *state, int fd)
+{
+    struct select_state *select_state;
+
+    DC_TRACE(env);
+    select_state = (struct select_state *)state;
+    FD_CLR(fd, &select_state->registered);
+    FD_CLR(fd, &select_state->read_fds);
+    FD_CLR(fd, &select_state->write_fds);
+
+    while(select_state->max_fd >= 0 && !FD_ISSET(select_state->max_fd, &select_state->registered))
+    {
+        select_state->max_fd--;
+    }
+}
+
+static int select_wait(const struct dc_env *env, struct dc_error *err, void *state, struct event *events, int max_events, int timeout_ms)
+{
+    struct select_state *select_state;
+    fd_set ready;
+    fd_set writable;
+    struct timeval timeout;
+    int result;
+    int count;
+
+    DC_TRACE(env);
+    select_state = (struct select_state *)state;
+    ready = select_state->read_fds;
+    writable = select_state->write_fds;
+
+    if(timeout_ms >= 0)
+    {
+        timeout.tv_sec = timeout_ms / MS_PER_SEC;
+        timeout.tv_usec = (timeout_ms % MS_PER_SEC) * US_PER_MS;
+    }
+
+    result = dc_select(env, err, select_state->max_fd + 1, &ready, &writable, NULL, timeout_ms >= 0 ? &timeout : NULL);
+
+    if(result < 0)
+    {
+        if(errno == EINTR)
+        {
+            dc_error_reset(err);
+            return 0;
+        }
+
+        return -1;
+    }
+
+    count = 0;
+
+    // start where the last scan stopped, so with more ready fds than max_events the low fds do not always win
+    for(int i = 0; i <= select_state->max_fd && count < result && count < max_events; i++)
+    {
+        int fd;
+
+        fd = (select_state->next_fd + i) % (select_state->max_fd + 1);
+
+        // result counts a descriptor once per set it is in, the scan may stop later than it needs to but never early
+        if(FD_ISSET(fd, &ready) || FD_ISSET(fd, &writable))
+        {
+            events[count].fd = fd;
+            events[count].events = (FD_ISSET(fd, &ready) ? (unsigned int)EVENT_READ : 0) | (FD_ISSET(fd, &writable) ? (unsigned int)EVENT_WRITE : 0);
+            count++;
+        }
+    }
+
+    if(count > 0)
+    {
+        select_state->next_fd = (events[count - 1].fd + 1) % (select_state->max_fd + 1);
+    }
+
+    return count;
+}
+
+static void *poll_create(const struct dc_env *env, struct dc_error *err)
+{
+    struct poll_state *state;
+
+    DC_TRACE(env);
+    state = (struct poll_state *)dc_malloc(env, err, sizeof(*state));
+
+    if(state)
+    {
+        dc_memset(env, state, 0, sizeof(*state));
+    }
+
+    return state;
+}
+
+static void poll_destroy(const struct dc_env *env, __attribute__((unused)) struct dc_error *err, void *state)
+{
+    struct poll_state *poll_state;
+
+    DC_TRACE(env);
+    poll_state = (struct poll_state *)state;
+
+    if(poll_state->fds)
+    {
+        dc_free(env, poll_state->fds);
+    }
+
+    if(poll_state->slots)
+    {
+        dc_free(env, poll_state->slots);
+    }
+
+    dc_free(env, poll_state);
+}
+
+static bool poll_add(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events)
+{
+    struct poll_state *poll_state;
+    struct pollfd *pfd;
+
+    DC_TRACE(env);
+    poll_state = (struct poll_state *)state;
+
+    if(fd >= poll_state->num_slots)
+    {
+        int *slots;
+        int num_slots;
+
+        num_slots = poll_state->num_slots == 0 ? fd + 1 : poll_state->num_slots;
+
+        while(num_slots <= fd)
+        {
+            num_slots *= 2;
+        }
+
+        slots = (int *)dc_realloc(env, err, poll_state->slots, num_slots * sizeof(int));
+
+        if(slots == NULL)
+        {
+            return false;
+        }
+
+        for(int i = poll_state->num_slots; i < num_slots; i++)
+        {
+            slots[i] = -1;
+        }
+
+        poll_state->slots = slots;
+        poll_state->num_slots = num_slots;
+    }
+
+    if(poll_state->num_fds == poll_state->capacity)
+    {
+        struct pollfd *fds;
+        int capacity;
+
+        capacity = poll_state->capacity == 0 ? 16 : poll_state->capacity * 2;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        fds = (struct pollfd *)dc_realloc(env, err, poll_state->fds, capacity * sizeof(struct pollfd));
+
+        if(fds == NULL)
+        {
+            return false;
+        }
+
+        poll_state->fds = fds;
+        poll_state->capacity = capacity;
+    }
+
+    pfd = &poll_state->fds[poll_state->num_fds];
+    pfd->fd = events ? fd : -1 - fd;
+    pfd->events = poll_events(events);
+    pfd->revents = 0;
+    poll_state->slots[fd] = poll_state->num_fds;
+    poll_state->num_fds++;
+
+    return true;
+}
+
+static void poll_modify(const struct dc_env *env, __attribute__((unused)) struct dc_error *err, void *state, int fd, unsigned int events)
+{
+    struct poll_state *poll_state;
+
+    DC_TRACE(env);
+    poll_state = (struct poll_state *)state;
+
+    // POLLHUP is reported even with no events requested, so a silent descriptor is hidden from poll instead
+    if(fd < poll_state->num_slots && poll_state->slots[fd] >= 0)
+    {
+        poll_state->fds[poll_state->slots[fd]].fd = events ? fd : -1 - fd;
+        poll_state->fds[poll_state->slots[fd]].events = poll_events(events);
+    }
+}
+
+static void poll_remove(const struct dc_env *env, __attribute__((unused)) struct dc_error *err, void *state, int fd)
+{
+    struct poll_state *poll_state;
+    int slot;
+
+    DC_TRACE(env);
+    poll_state = (struct poll_state *)state;
+
+    if(fd >= poll_state->num_slots || poll_state->slots[fd] < 0)
+    {
+        return;
+    }
+
+    // the last entry fills the hole so the set stays packed
+    slot = poll_state->slots[fd];
+    poll_state->slots[fd] = -1;
+    poll_state->num_fds--;
+
+    if(slot != poll_state->num_fds)
+    {
+        int moved;
+
+        poll_state->fds[slot] = poll_state->fds[poll_state->num_fds];
+        moved = poll_state->fds[slot].fd < 0 ? -1 - poll_state->fds[slot].fd : poll_state->fds[slot].fd;
+        poll_state->slots[moved] = slot;
+    }
+}
+
+static int poll_wait(const struct dc_env *env, struct dc_error *err, void *state, struct event *events, int max_events, int timeout_ms)
+{
+    struct poll_state *poll_state;
+    int result;
+    int count;
+    int start;
+
+    DC_TRACE(env);
+    poll_state = (struct poll_state *)state;
+    result = dc_poll(env, err, poll_state->fds, poll_state->num_fds, timeout_ms);
+
+    if(result < 0)
+    {
+        if(errno == EINTR)
+        {
+            dc_error_reset(err);
+            return 0;
+        }
+
+        return -1;
+    }
+
+    count = 0;
+    start = poll_state->next_slot;
+
+    // rotated like select_wait, fds keeps insertion order so early connections would otherwise always go first; the
+    // start is fixed for the whole scan, moving it mid-scan would visit some slots twice and report their fd twice
+    for(int n = 0; n < poll_state->num_fds && count < result && count < max_events; n++)
+    {
+        unsigned int revents;
+        int i;
+
+        i = (start + n) % poll_state->num_fds;
+        revents = (unsigned int)poll_state->fds[i].revents;
+
+        if(revents != 0)
+        {
+            poll_state->next_slot = (i + 1) % poll_state->num_fds;
+            events[count].fd = poll_state->fds[i].fd;
+            events[count].events = 0;
+
+            if(revents & (unsigned int)POLLIN)
+            {
+                events[count].events |= (unsigned int)EVENT_READ;
+            }
+
+            if(revents & (unsigned int)POLLOUT)
+            {
+                events[count].events |= (unsigned int)EVENT_WRITE;
+            }
+
+            if(revents & (unsigned int)(POLLHUP | POLLERR | POLLNVAL))
+            {
+                events[count].events |= (unsigned int)EVENT_HANGUP;
+            }
+
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static void *epoll_create_state(const struct dc_env *env, struct dc_error *err)
+{
+    struct epoll_state *state;
+
+    DC_TRACE(env);
+    state = (struct epoll_state *)dc_malloc(env, err, sizeof(*state));
+
+    if(state == NULL)
+    {
+        return NULL;
+    }
+
+    state->ready = NULL;
+    state->capacity = 0;
+    state->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    if(state->epoll_fd < 0)
+    {
+        raise_errno(env, err);
+        dc_free(env, state);
+        return NULL;
+    }
+
+    return state;
+}
+
+static void epoll_destroy(const struct dc_env *env, struct dc_error *err, void *state)
+{
+    struct epoll_state *epoll_state;
+
+    DC_TRACE(env);
+    epoll_state = (struct epoll_state *)state;
+    dc_close(env, err, epoll_state->epoll_fd);
+
+    if(epoll_state->ready)
+    {
+        dc_free(env, epoll_state->ready);
+    }
+
+    dc_free(env, epoll_state);
+}
+
+static bool epoll_add(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events)
+{
+    struct epoll_state *epoll_state;
+    struct epoll_event event;
+
+    DC_TRACE(env);
+    epoll_state = (struct epoll_state *)state;
+
+    // epoll reports hangups even with no events requested, a silent descriptor stays out of the set
+    if(events == 0)
+    {
+        return true;
+    }
+
+    epoll_interest(fd, events, &event);
+
+    if(epoll_ctl(epoll_state->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        raise_errno(env, err);
+        return false;
+    }
+
+    return true;
+}
+
+static void epoll_modify(const struct dc_env *env, struct dc_error *err, void *state, int fd, unsigned int events)
+{
+    struct epoll_state *epoll_state;
+    struct epoll_event event;
+
+    DC_TRACE(env);
+    epoll_state = (struct epoll_state *)state;
+
+    // one system call per toggle, the pools silence a connection and re-arm it on every request
+    epoll_interest(fd, events, &event);
+
+    if(epoll_ctl(epoll_state->epoll_fd, EPOLL_CTL_MOD, fd, &event) == 0)
+    {
+        return;
+    }
+
+    // only a descriptor added while silent is not in the set yet
+    if(errno != ENOENT)
+    {
+        raise_errno(env, err);
+    }
+    else if(events != 0)
+    {
+        epoll_add(env, err, state, fd, events);
+    }
+}
+
+static void epoll_remove(const struct dc_env *env, __attribute__((unused)) struct dc_error *err, void *state, int fd)
+{
+    struct epoll_state *epoll_state;
+
+    DC_TRACE(env);
+    epoll_state = (struct epoll_state *)state;
+
+    // silent descriptors were never added, and closed ones are dropped by the kernel
+    epoll_ctl(epoll_state->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+static int epoll_wait_events(const struct dc_env *env, struct dc_error *err, void *state, struct event *events, int max_events, int timeout_ms)
+{
+    struct epoll_state *epoll_state;
+    int result;
+    int count;
+
+    DC_TRACE(env);
+    epoll_state = (struct epoll_state *)state;
+
+    if(max_events > epoll_state->capacity)
+    {
+        struct epoll_event *ready;
+
+        ready = (struct epoll_event *)dc_realloc(env, err, epoll_state->ready, max_events * sizeof(struct epoll_event));
+
+        if(ready == NULL)
+        {
+            return -1;
+        }
+
+        epoll_state->ready = ready;
+        epoll_state->capacity = max_events;
+    }
+
+    result = epoll_wait(epoll_state->epoll_fd, epoll_state->ready, max_events, timeout_ms);
+
+    if(result < 0)
+    {
+        if(errno == EINTR)
+        {
+            return 0;
+        }
+
+        raise_errno(env, err);
+        return -1;
+    }
+
+    count = 0;
+
+    for(int i = 0; i < result; i++)
+    {
+        uint32_t ready;
+
+        // the edge of a hangup on a silent descriptor, whoever owns it finds out on its own
+        if(epoll_state->ready[i].data.u64 & EPOLL_SILENT)
+        {
+            continue;
+        }
+
+        ready = epoll_state->ready[i].events;
+        events[count].fd = (int)(uint32_t)epoll_state->ready[i].data.u64;
+        events[count].events = 0;
+
+        if(ready & (uint32_t)EPOLLIN)
+        {
+            events[count].events |= (unsigned int)EVENT_READ;
+        }
+
+        if(ready & (uint32_t)EPOLLOUT)
+        {
+            events[count].events |= (unsigned int)EVENT_WRITE;
+        }
+
+        if(ready & (uint32_t)(EPOLLHUP | EPOLLERR))
+        {
+            events[count].events |= (unsigned int)EVENT_HANGUP;
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+static void epoll_interest(int fd, unsigned int events, struct epoll_event *event)
+{
+    // epoll reports hangups whatever is asked for; edge triggered, a silent descriptor wakes the wait once at most
+    if(events == 0)
+    {
+        event->events = (uint32_t)EPOLLET;
+        event->data.u64 = (uint32_t)fd | EPOLL_SILENT;
+        return;
+    }
+
+    event->events = (events & (unsigned int)EVENT_READ ? (uint32_t)EPOLLIN : 0) | (events & (unsigned int)EVENT_WRITE ? (uint32_t)EPOLLOUT : 0);
+    event->data.u64 = (uint32_t)fd;
+}
+
+static short poll_events(unsigned int events)
+{
+    short poll_flags;
+
+    poll_flags = 0;
+
+    if(events & (unsigned int)EVENT_READ)
+    {
+        poll_flags |= POLLIN;
+    }
+
+    if(events & (unsigned int)EVENT_WRITE)
+    {
+        poll_flags |= POLLOUT;
+    }
+
+    return poll_flags;
+}
+
+static void raise_errno(const struct dc_env *env, struct dc_error *err)
+{
+    char *error_message;
+
+    error_message = dc_strerror(env, err, errno);
+    DC_ERROR_RAISE_SYSTEM(err, error_message, errno);
+}
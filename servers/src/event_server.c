@@ -0,0 +1,1976 @@
+#include "admission.h"
+#include "compute_pool.h"
+#include "event_server.h"
+#include "accept_stats.h"
+#include "fairness.h"
+#include "fiber.h"
+#include "file_server.h"
+#include "listener.h"
+#include "message_handler.h"
+#include "process_pool.h"
+#include "result_cache.h"
+#include "shm_ring.h"
+#include "spin_wait.h"
+#include "thread_pool.h"
+#include "timer_wheel.h"
+#include "upgrade.h"
+#include <arpa/inet.h>
+#include <dc_c/dc_stdio.h>
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_signal.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+// one per descriptor slot, idle or not, so it is kept small: the fd is the slot's index, the flags are bits and no
+// I/O buffer lives here (reads borrow one from the shared read pool)
+struct event_connection
+{
+    struct timer timer;
+    union
+    {
+        int next_deferred; // DISPATCH_COMPUTE and DISPATCH_PROCESSES
+        int fiber; // DISPATCH_FIBERS, the id of the request's fiber while one is in progress, -1 between requests
+        int worker; // DISPATCH_THREADS, the pool thread that served its last request, -1 before the first
+        int ring; // shared, the index in rings, in the slots of both the socket and the eventfd
+    };
+    uint32_t start_time; // low bits of clock(), differences stay right for connections under 71 CPU minutes
+    uint32_t wakeup_us; // low bits of the wakeup that handed the request to a pool, for its service time
+    uint8_t class_id; // fairness class, from the client address
+    uint8_t open : 1;
+    uint8_t busy : 1; // handed to a pool thread or worker process, the loop is not watching it
+    uint8_t deferred : 1; // readable while the processor stage or the workers were full, waiting unread
+    uint8_t writing : 1; // its fiber waits for room in the send buffer, the loop watches for writable
+    uint8_t shared : 1; // a shared memory ring client, its requests come through the ring and not the socket
+};
+
+_Static_assert(sizeof(struct event_connection) <= sizeof(struct timer) + 16, "event connections stay small");    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+enum shutdown_state
+{
+    SHUTDOWN_NONE,
+    SHUTDOWN_DRAINING, // not accepting, requests in progress are finishing
+    SHUTDOWN_FORCED    // deadline passed or a second signal arrived
+};
+
+/**
+ * A client on the ring listener. Its socket only carries the handshake and tells the loop when the client is gone.
+ */
+struct ring_client
+{
+    struct shm_ring ring;
+    int socket;
+};
+
+struct event_server
+{
+    struct dc_env *env; // for fibers, whose body only gets the server
+    const struct event_server_config *config;
+    struct options *opts;
+    struct event_loop loop;
+    struct timer_wheel timers;
+    struct message_handler message_handler;
+    struct thread_pool pool;
+    bool pool_started;
+    struct compute_pool compute;
+    bool compute_started;
+    struct process_pool processes;
+    bool processes_started;
+    struct timer pool_timer; // resizes the process pool
+    size_t in_flight; // requests with the compute threads or the worker processes
+    int deferred_head; // FIFO of deferred connections, -1 when empty
+    int deferred_tail;
+    uint32_t num_deferred;
+    struct admission admission;
+    int listener;
+    int unix_listener; // -1 unless opts->unix_path is set
+    int ring_listener; // -1 unless opts->ring_path is set
+    struct ring_client *rings; // slots whose ring is unmapped are free
+    int num_rings;
+    struct accept_stats accept_stats;
+    int signal_fds[2]; // self-pipe the signal handler writes to
+    int completion_fds[2]; // pool or compute threads report finished requests here
+    struct event_connection *connections; // indexed by fd
+    int num_slots;
+    uint32_t num_connections;
+    struct event *events;
+    int max_events;
+    uint64_t wakeup_ns; // when the current wait returned
+    struct spin_wait spin;
+    struct fairness fairness;
+    struct fiber_pool fibers;
+    int upgrade_socket; // channel to the new process while upgrading, or from the old one after starting, -1 otherwise
+    bool upgrading; // the listeners went to a new process, connections follow as their requests finish
+    enum shutdown_state shutdown;
+    uint64_t shutdown_deadline_ms;
+    struct timer shutdown_timer;
+    bool stopping;
+};
+
+struct event_timeout_context
+{
+    struct dc_env *env;
+    struct dc_error *err;
+    struct event_server *server;
+};
+
+
+static void signal_handler(int signal);
+static bool open_pipe(int fds[2], int flags);
+static bool start_server(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static void stop_server(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static void server_loop(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static int wait_for_events(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static void handle_event(struct dc_env *env, struct dc_error *err, struct event_server *server, const struct event *event);
+static void handle_signals(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static void reload_handlers(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static void begin_shutdown(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static void shutdown_deadline(struct timer *timer, void *context);
+static void start_upgrade(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static int receive_listener(struct dc_env *env, struct dc_error *err, struct event_server *server, enum upgrade_kind expected);
+static void close_listeners(struct dc_env *env, struct dc_error *err, struct event_server *server, bool unlink_paths);
+static void adopt_connection(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static void handoff_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static bool keep_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static bool is_idle(const struct event_server *server, const struct event_connection *connection);
+static void accept_connections(struct dc_env *env, struct dc_error *err, struct event_server *server, int listener);
+static bool accept_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int listener);
+static bool open_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd, const struct sockaddr_storage *address, uint32_t timeout_ms);
+static void serve_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static bool serve_requests(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static void run_fiber(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static int fiber_main(void *arg, int fd, struct dc_error *err);
+static void finish_fiber(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static bool open_ring(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static void serve_ring(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static void close_ring(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static void complete_requests(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static void offload_request(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static void complete_computed(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static void send_computed(struct dc_env *env, struct dc_error *err, struct event_server *server, const struct compute_job *job);
+static void dispatch_process(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static void submit_process(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static void complete_processes(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static void forked_worker(struct dc_env *env, struct dc_error *err, void *context);
+static void pool_tick(struct timer *timer, void *context);
+static void defer_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static int take_deferred(struct event_server *server);
+static void resume_deferred(struct dc_env *env, struct dc_error *err, struct event_server *server);
+static const char *dispatch_name(enum dispatch_strategy dispatch);
+static uint32_t default_max_connections(void);
+static void close_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static void forget_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static bool grow_connections(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd);
+static void arm_timeout(struct event_server *server, int fd, uint32_t timeout_ms);
+static void connection_timeout(struct timer *timer, void *context);
+static void record_offloaded(struct event_server *server, const struct event_connection *connection);
+static uint64_t now_ns(void);
+
+
+#define NS_PER_US 1000
+#define NS_PER_SEC 1000000000
+#define RING_REPLY_SIZE sizeof(uint16_t)   // the byte count the built-in sender replies with
+#define FIBER_POOL_MAX_FREE 256     // stacks kept for reuse, a burst beyond this maps new ones and unmaps them after
+#define RESERVED_FDS 64     // left for the listeners, pipes, log files and a handoff in flight below the descriptor limit
+
+static volatile sig_atomic_t signal_pipe_fd = -1;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+int run_event_server(struct dc_env *env, struct dc_error *err, struct options *opts, const struct event_server_config *config)
+{
+    struct event_server server;
+
+    DC_TRACE(env);
+    dc_memset(env, &server, 0, sizeof(server));
+    server.env = env;
+    server.config = config;
+    server.opts = opts;
+
+    if(!start_server(env, err, &server))
+    {
+        stop_server(env, err, &server);
+        return EXIT_FAILURE;
+    }
+
+    printf("Setup %s (%s backend, %s dispatch) and awaiting connections\n", config->name, event_backend_name(config->backend), dispatch_name(config->dispatch));
+    server_loop(env, err, &server);
+    stop_server(env, err, &server);
+
+    return EXIT_SUCCESS;
+}
+
+static void signal_handler(int signal)
+{
+    int saved_errno;
+    unsigned char signal_number;
+
+    saved_errno = errno;
+    signal_number = (unsigned char)signal;
+
+    if(signal_pipe_fd >= 0 && write(signal_pipe_fd, &signal_number, sizeof(signal_number)) < 0)
+    {
+        // the pipe is full, there is already a wakeup pending
+    }
+
+    errno = saved_errno;
+}
+
+static bool open_pipe(int fds[2], int flags)
+{
+    // the read end never blocks so the loop can drain it until EAGAIN
+    if(pipe2(fds, O_CLOEXEC | flags) != 0)
+    {
+        fds[0] = -1;
+        fds[1] = -1;
+        return false;
+    }
+
+    return fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0;
+}
+
+static bool start_server(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    const struct event_server_config *config;
+    struct sigaction act;
+    uint32_t max_connections;
+
+    DC_TRACE(env);
+    config = server->config;
+    server->listener = -1;
+    server->unix_listener = -1;
+    server->ring_listener = -1;
+    server->signal_fds[0] = server->signal_fds[1] = -1;
+    server->completion_fds[0] = server->completion_fds[1] = -1;
+    server->deferred_head = server->deferred_tail = -1;
+    server->shutdown = SHUTDOWN_NONE;
+    accept_stats_init(&server->accept_stats);
+    timer_wheel_init(&server->timers, timer_now_ms());
+    timer_init(&server->shutdown_timer, shutdown_deadline, server);
+    timer_init(&server->pool_timer, pool_tick, server);
+    max_connections = config->max_connections != 0 ? config->max_connections : default_max_connections();
+    admission_init(&server->admission, max_connections, config->max_in_flight_per_worker, config->accept_rate, config->accept_burst, timer_now_ms());
+    fiber_pool_init(&server->fibers, (size_t)server->opts->config.fiber_stack_size, FIBER_POOL_MAX_FREE);
+    spin_wait_init(&server->spin, (uint32_t)server->opts->config.spin_us);
+    fairness_init(&server->fairness, (uint32_t)server->opts->config.fair_requests, (uint32_t)server->opts->config.fair_bytes);
+    // taken before anything can fail, so stop_server closes it either way
+    server->upgrade_socket = upgrade_inherited_channel(env);
+
+    if(server->opts->fair_classes && !fairness_add_classes(&server->fairness, server->opts->fair_classes))
+    {
+        DC_ERROR_RAISE_USER(err, "Invalid fairness classes, expected ADDRESS/PREFIX=WEIGHT[,...]", -1);
+        return false;
+    }
+
+    // ring requests are served on the loop, which never runs a handler when workers do
+    if(server->opts->ring_path && config->dispatch == DISPATCH_PROCESSES)
+    {
+        DC_ERROR_RAISE_USER(err, "Shared memory rings are not served by worker processes", -1);
+        return false;
+    }
+
+    if(server->opts->handler_path && !message_handler_load(env, err, server->opts->handler_path))
+    {
+        return false;
+    }
+
+    // worker processes see one another's results only if the cache is mapped shared before they are forked
+    if(server->opts->cache_bytes > 0 && !result_cache_init(env, err, server->opts->cache_bytes, config->dispatch == DISPATCH_PROCESSES))
+    {
+        return false;
+    }
+
+    message_handler_current(&server->message_handler);
+
+    // worker processes attach for themselves once forked
+    if(config->dispatch != DISPATCH_PROCESSES && !message_handler_attach())
+    {
+        printf("Message handler init failed\n");
+        return false;
+    }
+
+    // started by a hot upgrade with the same arguments, the old process hands over the same listeners in this order
+    if(!server->opts->unix_only)
+    {
+        server->listener = server->upgrade_socket >= 0 ? receive_listener(env, err, server, UPGRADE_LISTENER) : listener_open(env, err, server->opts->ip_address, server->opts->config.port, config->backlog);
+
+        if(server->listener < 0)
+        {
+            return false;
+        }
+    }
+
+    if(server->opts->unix_path)
+    {
+        server->unix_listener = server->upgrade_socket >= 0 ? receive_listener(env, err, server, UPGRADE_UNIX_LISTENER) : listener_open_unix(env, err, server->opts->unix_path, config->backlog);
+
+        if(server->unix_listener < 0)
+        {
+            return false;
+        }
+    }
+
+    if(server->opts->ring_path)
+    {
+        server->ring_listener = server->upgrade_socket >= 0 ? receive_listener(env, err, server, UPGRADE_RING_LISTENER) : listener_open_unix(env, err, server->opts->ring_path, config->backlog);
+
+        if(server->ring_listener < 0)
+        {
+            return false;
+        }
+    }
+
+    if(server->upgrade_socket >= 0)
+    {
+        printf("Took over the listeners from the previous server\n");
+    }
+
+    // the handler writes to the signal pipe, a full pipe must not block it
+    if(!open_pipe(server->signal_fds, O_NONBLOCK) || !open_pipe(server->completion_fds, 0))
+    {
+        dc_perror(env, "pipe");
+        return false;
+    }
+
+    server->max_events = server->opts->config.event_batch;
+    server->events = (struct event *)dc_malloc(env, err, server->max_events * sizeof(struct event));
+
+    if(server->events == NULL || !event_loop_init(env, err, &server->loop, config->backend))
+    {
+        return false;
+    }
+
+    if(server->listener >= 0)
+    {
+        event_loop_add(env, err, &server->loop, server->listener, EVENT_READ);
+    }
+
+    if(server->unix_listener >= 0)
+    {
+        event_loop_add(env, err, &server->loop, server->unix_listener, EVENT_READ);
+    }
+
+    if(server->ring_listener >= 0)
+    {
+        event_loop_add(env, err, &server->loop, server->ring_listener, EVENT_READ);
+    }
+
+    event_loop_add(env, err, &server->loop, server->signal_fds[0], EVENT_READ);
+
+    // connections the old process hands over arrive on the channel until it exits
+    if(server->upgrade_socket >= 0)
+    {
+        event_loop_add(env, err, &server->loop, server->upgrade_socket, EVENT_READ);
+    }
+
+    if(config->dispatch == DISPATCH_THREADS)
+    {
+        event_loop_add(env, err, &server->loop, server->completion_fds[0], EVENT_READ);
+        server->pool_started = thread_pool_start(env, err, &server->pool, config->threads, &server->message_handler, server->completion_fds[1]);
+
+        if(!server->pool_started)
+        {
+            return false;
+        }
+    }
+    else if(config->dispatch == DISPATCH_COMPUTE)
+    {
+        event_loop_add(env, err, &server->loop, server->completion_fds[0], EVENT_READ);
+        server->compute_started = true;
+
+        if(!compute_pool_start(env, err, &server->compute, config->threads, config->compute_depth, server->completion_fds[1]))
+        {
+            return false;
+        }
+    }
+    else if(config->dispatch == DISPATCH_PROCESSES)
+    {
+        event_loop_add(env, err, &server->loop, server->completion_fds[0], EVENT_READ);
+        server->processes_started = true;
+
+        if(!process_pool_start(env, err, &server->processes, config->threads, server->opts, server->completion_fds[1], forked_worker, server))
+        {
+            return false;
+        }
+
+        timer_wheel_add(&server->timers, &server->pool_timer, timer_now_ms() + PROCESS_POOL_INTERVAL_MS);
+    }
+
+    signal_pipe_fd = server->signal_fds[1];
+    act.sa_handler = signal_handler;
+    dc_sigemptyset(env, err, &act.sa_mask);
+    act.sa_flags = SA_RESTART;
+    dc_sigaction(env, err, SIGINT, &act, NULL);
+    dc_sigaction(env, err, SIGTERM, &act, NULL);
+    dc_sigaction(env, err, SIGHUP, &act, NULL);
+    dc_sigaction(env, err, SIGUSR2, &act, NULL);
+    // a client may hang up while a reply waits to be written, sendfile and splice must see EPIPE rather than kill us
+    act.sa_handler = SIG_IGN;
+    dc_sigaction(env, err, SIGPIPE, &act, NULL);
+
+    return dc_error_has_no_error(err);
+}
+
+static void stop_server(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    DC_TRACE(env);
+    dc_error_reset(err);
+    signal_pipe_fd = -1;
+    close_listeners(env, err, server, true);
+
+    if(server->upgrade_socket >= 0)
+    {
+        dc_close(env, err, server->upgrade_socket);
+        server->upgrade_socket = -1;
+    }
+
+    if(server->shutdown != SHUTDOWN_NONE)
+    {
+        printf("Shutdown %s with %u connections open and %zu requests in flight\n", server->shutdown == SHUTDOWN_FORCED ? "forced" : "drained", server->num_connections, server->in_flight);
+    }
+
+    // the threads finish what is already queued before the connections are closed under them
+    if(server->pool_started)
+    {
+        thread_pool_stop(env, &server->pool);
+        server->pool_started = false;
+    }
+
+    // results still queued are dropped, their connections are closed below
+    if(server->compute_started)
+    {
+        compute_pool_stop(env, &server->compute);
+        server->compute_started = false;
+    }
+
+    // idle workers exit at once, busy ones when their request is done or the shutdown deadline passes
+    if(server->processes_started)
+    {
+        if(server->shutdown_deadline_ms == 0)
+        {
+            server->shutdown_deadline_ms = timer_now_ms() + server->config->shutdown_timeout_ms;
+        }
+
+        process_pool_stop(env, err, &server->processes, server->shutdown_deadline_ms);
+        server->processes_started = false;
+    }
+
+    message_handler_detach();
+    accept_stats_report(&server->accept_stats, stdout);
+    admission_report(&server->admission, stdout);
+    fairness_report(&server->fairness, stdout);
+    thread_pool_report(&server->pool, stdout);
+    process_pool_report(&server->processes, stdout);
+    fiber_pool_report(&server->fibers, stdout);
+    spin_wait_report(&server->spin, stdout);
+    read_buffer_report(stdout);
+    file_server_report(stdout);
+    result_cache_report(stdout);
+    result_cache_destroy();
+
+    for(int fd = 0; fd < server->num_slots; fd++)
+    {
+        if(server->connections[fd].open)
+        {
+            close_connection(env, err, server, fd);
+        }
+    }
+
+    thread_pool_destroy(env, &server->pool);
+    process_pool_destroy(env, err, &server->processes);
+    fiber_pool_destroy(&server->fibers);
+    event_loop_destroy(env, err, &server->loop);
+
+    for(int i = 0; i < 2; i++)
+    {
+        if(server->signal_fds[i] >= 0)
+        {
+            dc_close(env, err, server->signal_fds[i]);
+        }
+
+        if(server->completion_fds[i] >= 0)
+        {
+            dc_close(env, err, server->completion_fds[i]);
+        }
+    }
+
+    if(server->connections)
+    {
+        dc_free(env, server->connections);
+    }
+
+    if(server->rings)
+    {
+        dc_free(env, server->rings);
+    }
+
+    if(server->events)
+    {
+        dc_free(env, server->events);
+    }
+}
+
+static void server_loop(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    struct event_timeout_context context;
+
+    DC_TRACE(env);
+    context.env = env;
+    context.err = err;
+    context.server = server;
+
+    while(!server->stopping)
+    {
+        int ready;
+
+        ready = wait_for_events(env, err, server);
+
+        if(ready < 0)
+        {
+            dc_perror(env, event_backend_name(server->config->backend));
+            break;
+        }
+
+        for(int i = 0; i < ready; i++)
+        {
+            handle_event(env, err, server, &server->events[i]);
+        }
+
+        timer_wheel_advance(&server->timers, timer_now_ms(), &context);
+
+        // every connection has been answered and closed, or handed to the new process
+        if((server->shutdown == SHUTDOWN_DRAINING || server->upgrading) && server->num_connections == 0)
+        {
+            if(server->upgrading)
+            {
+                printf("Upgrade complete, old server (%d) exiting\n", getpid());
+            }
+
+            server->stopping = true;
+        }
+
+        if(server->shutdown == SHUTDOWN_FORCED)
+        {
+            server->stopping = true;
+        }
+    }
+}
+
+static int wait_for_events(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    uint64_t start_ns;
+    uint64_t budget_ns;
+    uint64_t spun_ns;
+    int timeout_ms;
+    int ready;
+
+    DC_TRACE(env);
+    timeout_ms = timer_wheel_timeout(&server->timers, timer_now_ms());
+    start_ns = now_ns();
+    budget_ns = spin_wait_budget(&server->spin, start_ns);
+    server->wakeup_ns = start_ns;
+    ready = 0;
+
+    // a zero timeout finds events without the scheduler round trip; a due deadline ends the spin like events would
+    while(budget_ns > 0 && timeout_ms != 0 && server->wakeup_ns - start_ns < budget_ns && timer_wheel_timeout(&server->timers, timer_now_ms()) != 0)
+    {
+        ready = event_loop_wait(env, err, &server->loop, server->events, server->max_events, 0);
+        server->wakeup_ns = now_ns();
+
+        if(ready != 0)
+        {
+            spin_wait_woke(&server->spin, server->wakeup_ns - start_ns, 0, ready > 0, server->wakeup_ns);
+            return ready;
+        }
+    }
+
+    spun_ns = server->wakeup_ns - start_ns;
+
+    if(spun_ns > 0)
+    {
+        timeout_ms = timer_wheel_timeout(&server->timers, timer_now_ms());
+    }
+
+    // sleep no longer than the nearest connection deadline
+    ready = event_loop_wait(env, err, &server->loop, server->events, server->max_events, timeout_ms);
+    server->wakeup_ns = now_ns();
+    spin_wait_woke(&server->spin, spun_ns, server->wakeup_ns - start_ns - spun_ns, false, server->wakeup_ns);
+
+    return ready;
+}
+
+static void handle_event(struct dc_env *env, struct dc_error *err, struct event_server *server, const struct event *event)
+{
+    DC_TRACE(env);
+
+    if(event->fd == server->listener || event->fd == server->unix_listener || event->fd == server->ring_listener)
+    {
+        accept_connections(env, err, server, event->fd);
+    }
+    else if(event->fd == server->signal_fds[0])
+    {
+        handle_signals(env, err, server);
+    }
+    else if(event->fd == server->upgrade_socket && !server->upgrading)
+    {
+        // read before honouring a hangup, the old process may have queued descriptors and exited
+        adopt_connection(env, err, server);
+    }
+    else if(event->fd == server->completion_fds[0])
+    {
+        if(server->config->dispatch == DISPATCH_COMPUTE)
+        {
+            complete_computed(env, err, server);
+        }
+        else if(server->config->dispatch == DISPATCH_PROCESSES)
+        {
+            complete_processes(env, err, server);
+        }
+        else
+        {
+            complete_requests(env, err, server);
+        }
+    }
+    else if(event->fd < server->num_slots && server->connections[event->fd].open && server->connections[event->fd].shared)
+    {
+        struct ring_client *client;
+
+        // requests only come through the ring, the socket turns readable when the client hangs up
+        client = &server->rings[server->connections[event->fd].ring];
+
+        if(event->fd == client->ring.wake_fd)
+        {
+            serve_ring(env, err, server, client->socket);
+        }
+        else
+        {
+            close_connection(env, err, server, event->fd);
+        }
+    }
+    else if(event->fd < server->num_slots && server->connections[event->fd].open)
+    {
+        // a hangup with data still buffered is read first, the reader sees end of file after it
+        if(event->events & (unsigned int)(EVENT_READ | EVENT_WRITE))
+        {
+            serve_connection(env, err, server, event->fd);
+        }
+        else
+        {
+            close_connection(env, err, server, event->fd);
+        }
+    }
+
+    // one client's failure does not stop the server
+    if(dc_error_has_error(err))
+    {
+        printf("%s\n", dc_error_get_message(err));
+        dc_error_reset(err);
+    }
+}
+
+static void handle_signals(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    unsigned char signals[16];  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    ssize_t count;
+
+    DC_TRACE(env);
+
+    while((count = read(server->signal_fds[0], signals, sizeof(signals))) > 0)
+    {
+        for(ssize_t i = 0; i < count; i++)
+        {
+            if(signals[i] == SIGUSR2)
+            {
+                start_upgrade(env, err, server);
+            }
+            else if(signals[i] == SIGHUP)
+            {
+                reload_handlers(env, err, server);
+            }
+            else
+            {
+                begin_shutdown(env, err, server);
+            }
+        }
+    }
+}
+
+static void reload_handlers(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    DC_TRACE(env);
+
+    if(server->shutdown != SHUTDOWN_NONE || server->upgrading)
+    {
+        return;
+    }
+
+    if(!message_handler_reload(env, err))
+    {
+        printf("Message handlers not reloaded, keeping the current ones\n");
+        dc_error_reset(err);
+        return;
+    }
+
+    // each worker finishes its current request and is replaced by one forked with the reloaded handlers
+    if(server->processes_started)
+    {
+        message_handler_current(&server->message_handler);
+        process_pool_reload(env, err, &server->processes);
+        return;
+    }
+
+    // requests already running keep the old code, which stays mapped
+    message_handler_detach();
+
+    if(!message_handler_attach())
+    {
+        printf("Message handler init failed after reload\n");
+    }
+
+    message_handler_current(&server->message_handler);
+
+    if(server->pool_started)
+    {
+        thread_pool_set_handler(&server->pool, &server->message_handler);
+    }
+}
+
+static void begin_shutdown(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    DC_TRACE(env);
+
+    if(server->shutdown != SHUTDOWN_NONE)
+    {
+        // a second signal means the operator does not want to wait for the drain
+        printf("Shutdown forced\n");
+        server->shutdown = SHUTDOWN_FORCED;
+        server->shutdown_deadline_ms = timer_now_ms();
+        return;
+    }
+
+    printf("Shutting down (%d): %u connections open, %zu requests in flight, %u waiting\n", getpid(), server->num_connections, server->in_flight, server->num_deferred);
+    server->shutdown = SHUTDOWN_DRAINING;
+    server->shutdown_deadline_ms = timer_now_ms() + server->config->shutdown_timeout_ms;
+    timer_wheel_add(&server->timers, &server->shutdown_timer, server->shutdown_deadline_ms);
+    close_listeners(env, err, server, true);
+
+    // idle connections close now, the others once their request has been answered
+    for(int fd = 0; fd < server->num_slots; fd++)
+    {
+        if(is_idle(server, &server->connections[fd]))
+        {
+            close_connection(env, err, server, fd);
+        }
+    }
+}
+
+static void shutdown_deadline(__attribute__((unused)) struct timer *timer, void *context)
+{
+    struct event_timeout_context *deadline;
+
+    deadline = (struct event_timeout_context *)context;
+    printf("Shutdown deadline passed with %u connections open and %zu requests in flight\n", deadline->server->num_connections, deadline->server->in_flight);
+    deadline->server->shutdown = SHUTDOWN_FORCED;
+}
+
+static void start_upgrade(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    pid_t pid;
+    int channel;
+
+    DC_TRACE(env);
+
+    if(server->upgrading || server->shutdown != SHUTDOWN_NONE)
+    {
+        return;
+    }
+
+    channel = upgrade_start(env, err, server->opts->argv, &pid);
+
+    if(channel < 0)
+    {
+        printf("Upgrade failed, still serving\n");
+        dc_error_reset(err);
+        return;
+    }
+
+    printf("Upgrading to new server (%d)\n", pid);
+
+    // the new process accepts from the same listen queues, so no connection is refused
+    if(server->listener >= 0)
+    {
+        upgrade_send_descriptor(env, err, channel, UPGRADE_LISTENER, server->listener);
+    }
+
+    if(server->unix_listener >= 0 && dc_error_has_no_error(err))
+    {
+        upgrade_send_descriptor(env, err, channel, UPGRADE_UNIX_LISTENER, server->unix_listener);
+    }
+
+    if(server->ring_listener >= 0 && dc_error_has_no_error(err))
+    {
+        upgrade_send_descriptor(env, err, channel, UPGRADE_RING_LISTENER, server->ring_listener);
+    }
+
+    if(dc_error_has_error(err))
+    {
+        printf("Upgrade failed, still serving: %s\n", dc_error_get_message(err));
+        dc_error_reset(err);
+        dc_close(env, err, channel);
+        return;
+    }
+
+    // the new process owns the paths now, so they stay
+    close_listeners(env, err, server, false);
+
+    // a server started by an upgrade no longer waits for handoffs once it hands off itself
+    if(server->upgrade_socket >= 0)
+    {
+        event_loop_remove(env, err, &server->loop, server->upgrade_socket);
+        dc_close(env, err, server->upgrade_socket);
+    }
+
+    server->upgrade_socket = channel;
+    server->upgrading = true;
+
+    // idle connections move now, the others as their requests finish; a ring's mapping cannot move, its client reconnects
+    for(int fd = 0; fd < server->num_slots; fd++)
+    {
+        if(server->connections[fd].open && server->connections[fd].shared)
+        {
+            close_connection(env, err, server, fd);
+        }
+        else if(is_idle(server, &server->connections[fd]))
+        {
+            handoff_connection(env, err, server, fd);
+        }
+    }
+}
+
+static int receive_listener(struct dc_env *env, struct dc_error *err, struct event_server *server, enum upgrade_kind expected)
+{
+    enum upgrade_kind kind;
+    int fd;
+
+    DC_TRACE(env);
+    fd = upgrade_receive_descriptor(env, err, server->upgrade_socket, &kind);
+
+    if(fd >= 0 && kind != expected)
+    {
+        dc_close(env, err, fd);
+        fd = -1;
+    }
+
+    if(fd < 0 && dc_error_has_no_error(err))
+    {
+        DC_ERROR_RAISE_USER(err, "Upgrade channel did not provide the listeners this server was started with", -1);
+    }
+
+    return fd;
+}
+
+static void close_listeners(struct dc_env *env, struct dc_error *err, struct event_server *server, bool unlink_paths)
+{
+    DC_TRACE(env);
+
+    if(server->listener >= 0)
+    {
+        event_loop_remove(env, err, &server->loop, server->listener);
+        dc_close(env, err, server->listener);
+        server->listener = -1;
+    }
+
+    if(server->unix_listener >= 0)
+    {
+        event_loop_remove(env, err, &server->loop, server->unix_listener);
+    }
+
+    if(server->ring_listener >= 0)
+    {
+        event_loop_remove(env, err, &server->loop, server->ring_listener);
+    }
+
+    listener_close_unix(env, err, server->unix_listener, unlink_paths ? server->opts->unix_path : NULL);
+    server->unix_listener = -1;
+    listener_close_unix(env, err, server->ring_listener, unlink_paths ? server->opts->ring_path : NULL);
+    server->ring_listener = -1;
+}
+
+static void adopt_connection(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    struct sockaddr_storage address;
+    socklen_t address_length;
+    enum upgrade_kind kind;
+    int fd;
+
+    DC_TRACE(env);
+    fd = upgrade_receive_descriptor(env, err, server->upgrade_socket, &kind);
+
+    if(fd < 0)
+    {
+        // the old process has exited
+        dc_error_reset(err);
+        event_loop_remove(env, err, &server->loop, server->upgrade_socket);
+        dc_close(env, err, server->upgrade_socket);
+        server->upgrade_socket = -1;
+        return;
+    }
+
+    address_length = sizeof(address);
+
+    // still non-blocking from the old process's accept, but received without close-on-exec
+    if(kind != UPGRADE_CONNECTION || fcntl(fd, F_SETFD, FD_CLOEXEC) != 0 || getpeername(fd, (struct sockaddr *)&address, &address_length) != 0 ||
+       !open_connection(env, err, server, fd, &address, server->config->idle_timeout_ms))
+    {
+        dc_close(env, err, fd);
+        return;
+    }
+
+    if(server->config->verbose)
+    {
+        printf("Adopted client %d from the previous server\n", fd);
+    }
+}
+
+static void handoff_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    DC_TRACE(env);
+
+    if(server->config->verbose)
+    {
+        printf("Handing off client %d\n", fd);
+    }
+
+    upgrade_send_descriptor(env, err, server->upgrade_socket, UPGRADE_CONNECTION, fd);
+
+    // the new process may have gone, the client is dropped either way
+    if(dc_error_has_error(err))
+    {
+        printf("Could not hand off client %d: %s\n", fd, dc_error_get_message(err));
+        dc_error_reset(err);
+    }
+
+    forget_connection(env, err, server, fd);
+}
+
+static bool keep_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    DC_TRACE(env);
+
+    // its request has been answered, which is as far as a connection goes while the server is going away
+    if(server->upgrading)
+    {
+        handoff_connection(env, err, server, fd);
+        return false;
+    }
+
+    if(server->shutdown != SHUTDOWN_NONE)
+    {
+        close_connection(env, err, server, fd);
+        return false;
+    }
+
+    return true;
+}
+
+static bool is_idle(const struct event_server *server, const struct event_connection *connection)
+{
+    if(!connection->open || connection->busy || connection->deferred)
+    {
+        return false;
+    }
+
+    // a ring client goes through its socket's slot, not its eventfd's
+    if(connection->shared)
+    {
+        return (int)(connection - server->connections) == server->rings[connection->ring].socket;
+    }
+
+    return server->config->dispatch != DISPATCH_FIBERS || connection->fiber < 0;
+}
+
+static void accept_connections(struct dc_env *env, struct dc_error *err, struct event_server *server, int listener)
+{
+    uint32_t batch;
+    uint32_t accepted;
+
+    DC_TRACE(env);
+    batch = (uint32_t)server->opts->config.accept_batch;
+    accept_stats_wakeup(&server->accept_stats, listener);
+
+    // empty the queue while a storm is arriving, but give the ready connections a turn every batch
+    for(accepted = 0; accepted < batch; accepted++)
+    {
+        if(!accept_connection(env, err, server, listener))
+        {
+            break;
+        }
+    }
+
+    accept_stats_batch(&server->accept_stats, accepted, accepted == batch);
+}
+
+static bool accept_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int listener)
+{
+    struct sockaddr_storage client_addr;
+    int client_fd;
+    enum admission_verdict verdict;
+
+    DC_TRACE(env);
+    // non-blocking, so a read on a stale readiness returns instead of stalling the loop
+    client_fd = listener_accept(env, err, listener, &client_addr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+
+    if(client_fd < 0)
+    {
+        return false;
+    }
+
+    accept_stats_connection(&server->accept_stats, client_fd, client_addr.ss_family);
+    // shed load before the connection costs a slot
+    verdict = admission_accept(&server->admission, server->num_connections, timer_now_ms());
+
+    if(verdict != ADMIT)
+    {
+        if(server->config->verbose && verdict == REJECT_CONNECTIONS)
+        {
+            printf("Rejected connection, %u clients already connected\n", server->num_connections);
+        }
+        else if(server->config->verbose)
+        {
+            printf("Rejected connection, over the accept rate of %u per second\n", server->admission.accept_rate);
+        }
+
+        admission_reject(client_fd);
+        return true;
+    }
+
+    // out of memory for a slot is reported with the error, a backend that is full is not an error
+    if(!open_connection(env, err, server, client_fd, &client_addr, server->config->header_timeout_ms))
+    {
+        if(server->config->verbose && dc_error_has_no_error(err))
+        {
+            printf("Rejected connection, the %s backend cannot watch descriptor %d\n", event_backend_name(server->config->backend), client_fd);
+        }
+
+        admission_reject(client_fd);
+        return dc_error_has_no_error(err);
+    }
+
+    if(server->config->verbose && client_addr.ss_family == AF_INET)
+    {
+        const struct sockaddr_in *peer = (const struct sockaddr_in *)&client_addr;
+
+        printf("New connection from %s:%d\n", inet_ntoa(peer->sin_addr), ntohs(peer->sin_port));    // NOLINT(concurrency-mt-unsafe)
+    }
+    else if(server->config->verbose)
+    {
+        printf("New connection on %s\n", listener == server->ring_listener ? server->opts->ring_path : server->opts->unix_path);
+    }
+
+    if(listener == server->ring_listener && !open_ring(env, err, server, client_fd))
+    {
+        printf("Could not set up a shared memory ring: %s\n", dc_error_get_message(err));
+        dc_error_reset(err);
+        close_connection(env, err, server, client_fd);
+    }
+
+    return true;
+}
+
+static bool open_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd, const struct sockaddr_storage *address, uint32_t timeout_ms)
+{
+    struct event_connection *connection;
+
+    DC_TRACE(env);
+
+    if((fd >= server->num_slots && !grow_connections(env, err, server, fd)) || !event_loop_add(env, err, &server->loop, fd, EVENT_READ))
+    {
+        return false;
+    }
+
+    connection = &server->connections[fd];
+    connection->open = true;
+    connection->busy = false;
+    connection->deferred = false;
+    connection->writing = false;
+    connection->shared = false;
+    connection->fiber = -1;
+    connection->start_time = (uint32_t)clock();
+    connection->class_id = fairness_classify(&server->fairness, address);
+    server->num_connections++;
+    arm_timeout(server, fd, timeout_ms);
+
+    return true;
+}
+
+static void serve_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct event_connection *connection;
+
+    DC_TRACE(env);
+    connection = &server->connections[fd];
+    timer_wheel_cancel(&server->timers, &connection->timer);
+    connection->wakeup_us = (uint32_t)(server->wakeup_ns / NS_PER_US);
+
+    if(server->config->dispatch == DISPATCH_THREADS)
+    {
+        // stop watching until the thread is done so no second thread picks up the same socket
+        event_loop_modify(env, err, &server->loop, fd, 0);
+        connection->busy = true;
+        thread_pool_submit(env, err, &server->pool, fd, connection->worker);
+        arm_timeout(server, fd, server->config->stall_timeout_ms);
+        return;
+    }
+
+    if(server->config->dispatch == DISPATCH_COMPUTE)
+    {
+        offload_request(env, err, server, fd);
+        return;
+    }
+
+    if(server->config->dispatch == DISPATCH_PROCESSES)
+    {
+        dispatch_process(env, err, server, fd);
+        return;
+    }
+
+    if(server->config->dispatch == DISPATCH_FIBERS)
+    {
+        run_fiber(env, err, server, fd);
+        return;
+    }
+
+    if(serve_requests(env, err, server, fd))
+    {
+        close_connection(env, err, server, fd);
+    }
+    else if(keep_connection(env, err, server, fd))
+    {
+        arm_timeout(server, fd, server->config->idle_timeout_ms);
+    }
+}
+
+static bool serve_requests(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    uint8_t class_id;
+    uint32_t request_budget;
+    uint32_t byte_budget;
+    uint32_t bytes;
+    int pending;
+    bool batched;
+    bool closed;
+
+    DC_TRACE(env);
+    // copied, not pointed to: in a fiber the loop runs while a request waits, and an accept may move connections
+    class_id = server->connections[fd].class_id;
+
+    // a client with requests queued up gets at most its budget before the next ready connection has a turn, the rest
+    // waits in the socket and the loop comes back to it on the next wakeup
+    request_budget = fairness_request_budget(&server->fairness, class_id);
+    byte_budget = fairness_byte_budget(&server->fairness, class_id);
+    batched = request_budget > 1;
+    bytes = 0;
+    pending = 0;
+
+    if(batched && ioctl(fd, FIONREAD, &pending) != 0)
+    {
+        pending = 0;
+    }
+
+    for(uint32_t served = 1;; served++)
+    {
+        closed = message_handler_run(env, err, &server->message_handler, fd);
+        fairness_record(&server->fairness, class_id, now_ns() - server->wakeup_ns);
+        bytes += (uint32_t)(pending < server->opts->config.read_buffer_size ? pending : server->opts->config.read_buffer_size);
+
+        if(closed || dc_error_has_error(err) || !batched || ioctl(fd, FIONREAD, &pending) != 0 || pending <= 0)
+        {
+            break;
+        }
+
+        if(served >= request_budget || (byte_budget != 0 && bytes >= byte_budget))
+        {
+            fairness_exhausted(&server->fairness, class_id);
+            break;
+        }
+    }
+
+    if(dc_error_has_error(err))
+    {
+        dc_error_reset(err);
+        closed = true;
+    }
+
+    return closed;
+}
+
+static void run_fiber(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct event_connection *connection;
+
+    DC_TRACE(env);
+    connection = &server->connections[fd];
+
+    // a fiber per request rather than per connection, so an idle connection holds no stack
+    if(connection->fiber < 0)
+    {
+        connection->fiber = fiber_create(env, err, &server->fibers, fiber_main, server, fd);
+
+        if(connection->fiber < 0)
+        {
+            close_connection(env, err, server, fd);
+            return;
+        }
+    }
+
+    if(fiber_resume(&server->fibers, connection->fiber))
+    {
+        finish_fiber(env, err, server, fd);
+        return;
+    }
+
+    // it waits for its socket: watch for what it needs, and give it the idle timeout to get it
+    if((fiber_waiting_for(&server->fibers, connection->fiber) & POLLOUT) != 0)
+    {
+        event_loop_modify(env, err, &server->loop, fd, EVENT_WRITE);
+        connection->writing = true;
+    }
+    else if(connection->writing)
+    {
+        event_loop_modify(env, err, &server->loop, fd, EVENT_READ);
+        connection->writing = false;
+    }
+
+    arm_timeout(server, fd, server->config->idle_timeout_ms);
+}
+
+static int fiber_main(void *arg, int fd, struct dc_error *err)
+{
+    struct event_server *server;
+
+    server = (struct event_server *)arg;
+
+    return serve_requests(server->env, err, server, fd);
+}
+
+static void finish_fiber(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct event_connection *connection;
+    bool closed;
+
+    DC_TRACE(env);
+    connection = &server->connections[fd];
+    closed = fiber_result(&server->fibers, connection->fiber) != 0;
+    fiber_release(&server->fibers, connection->fiber);
+    connection->fiber = -1;
+
+    if(closed)
+    {
+        close_connection(env, err, server, fd);
+        return;
+    }
+
+    if(connection->writing)
+    {
+        event_loop_modify(env, err, &server->loop, fd, EVENT_READ);
+        connection->writing = false;
+    }
+
+    if(keep_connection(env, err, server, fd))
+    {
+        arm_timeout(server, fd, server->config->idle_timeout_ms);
+    }
+}
+
+static bool open_ring(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct ring_client *client;
+    struct event_connection *wake;
+    int id;
+
+    DC_TRACE(env);
+
+    for(id = 0; id < server->num_rings && server->rings[id].ring.header != NULL; id++)
+    {
+    }
+
+    if(id == server->num_rings)
+    {
+        struct ring_client *rings;
+
+        rings = (struct ring_client *)dc_realloc(env, err, server->rings, (size_t)(server->num_rings + 1) * sizeof(*rings));
+
+        if(rings == NULL)
+        {
+            return false;
+        }
+
+        server->rings = rings;
+        server->rings[id].ring.header = NULL;
+        server->num_rings++;
+    }
+
+    client = &server->rings[id];
+    client->socket = fd;
+
+    if(!shm_ring_create(env, err, &client->ring, (size_t)server->opts->config.ring_size, (size_t)server->opts->config.read_buffer_size))
+    {
+        return false;
+    }
+
+    if(!shm_ring_send_hello(env, err, &client->ring, fd) ||
+       (client->ring.wake_fd >= server->num_slots && !grow_connections(env, err, server, client->ring.wake_fd)) ||
+       !event_loop_add(env, err, &server->loop, client->ring.wake_fd, EVENT_READ))
+    {
+        shm_ring_destroy(&client->ring);
+        return false;
+    }
+
+    // the eventfd gets a slot of its own so the loop can find the client from either descriptor
+    wake = &server->connections[client->ring.wake_fd];
+    wake->open = true;
+    wake->busy = false;
+    wake->deferred = false;
+    wake->writing = false;
+    wake->shared = true;
+    wake->ring = id;
+    server->connections[fd].shared = true;
+    server->connections[fd].ring = id;
+
+    return true;
+}
+
+static void serve_ring(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct event_connection *connection;
+    struct shm_ring *ring;
+    uint32_t request_budget;
+    uint32_t served;
+
+    DC_TRACE(env);
+    connection = &server->connections[fd];
+    ring = &server->rings[connection->ring].ring;
+    timer_wheel_cancel(&server->timers, &connection->timer);
+    shm_ring_clear_wakeup(ring);
+    request_budget = fairness_request_budget(&server->fairness, connection->class_id);
+
+    // the same processor stage and cache as a socket request, only the reader and sender are the ring's
+    for(served = 0; served < request_budget && shm_ring_can_write(ring, RING_REPLY_SIZE); served++)
+    {
+        uint8_t *raw_data;
+        uint8_t *processed_data;
+        ssize_t raw_data_length;
+        size_t processed_data_length;
+        uint16_t reply;
+
+        raw_data_length = shm_ring_read(env, err, ring, &raw_data);
+
+        if(raw_data_length <= 0)
+        {
+            if(raw_data_length < 0)
+            {
+                printf("Client %d wrote an invalid ring record\n", fd);
+                close_connection(env, err, server, fd);
+                return;
+            }
+
+            break;
+        }
+
+        processed_data = NULL;
+        processed_data_length = result_cache_process(env, err, server->message_handler.processor, raw_data, &processed_data, raw_data_length);
+        dc_free(env, raw_data);
+
+        if(processed_data)
+        {
+            dc_free(env, processed_data);
+        }
+
+        if(dc_error_has_error(err))
+        {
+            close_connection(env, err, server, fd);
+            return;
+        }
+
+        reply = htons((uint16_t)processed_data_length);
+        shm_ring_write(ring, &reply, sizeof(reply));
+        fairness_record(&server->fairness, connection->class_id, now_ns() - server->wakeup_ns);
+    }
+
+    // asleep, the client's next request wakes the loop; still awake, the loop comes back after the others had a turn
+    if(!shm_ring_sleep(ring, RING_REPLY_SIZE))
+    {
+        if(served == request_budget)
+        {
+            fairness_exhausted(&server->fairness, connection->class_id);
+        }
+
+        shm_ring_wake_self(ring);
+    }
+
+    arm_timeout(server, fd, server->config->idle_timeout_ms);
+}
+
+static void close_ring(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct event_connection *connection;
+    struct ring_client *client;
+    struct event_connection *wake;
+
+    DC_TRACE(env);
+    connection = &server->connections[fd];
+    client = &server->rings[connection->ring];
+    wake = &server->connections[client->ring.wake_fd];
+    event_loop_remove(env, err, &server->loop, client->ring.wake_fd);
+    wake->open = false;
+    wake->shared = false;
+    wake->ring = -1;
+    // the client keeps its mapping until it exits, the memory goes when both sides have let go
+    shm_ring_destroy(&client->ring);
+    connection->shared = false;
+    connection->ring = -1;
+}
+
+static void complete_requests(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    struct thread_pool_completion completion;
+
+    DC_TRACE(env);
+
+    while(read(server->completion_fds[0], &completion, sizeof(completion)) == sizeof(completion))
+    {
+        if(completion.fd < 0 || completion.fd >= server->num_slots || !server->connections[completion.fd].open)
+        {
+            continue;
+        }
+
+        server->connections[completion.fd].busy = false;
+        server->connections[completion.fd].worker = completion.worker;
+        record_offloaded(server, &server->connections[completion.fd]);
+
+        if(completion.closed)
+        {
+            close_connection(env, err, server, completion.fd);
+        }
+        else if(keep_connection(env, err, server, completion.fd))
+        {
+            event_loop_modify(env, err, &server->loop, completion.fd, EVENT_READ);
+            arm_timeout(server, completion.fd, server->config->idle_timeout_ms);
+        }
+    }
+}
+
+static void offload_request(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct compute_job job;
+
+    DC_TRACE(env);
+
+    // leave the request in the socket buffer until a result frees a slot, the client sees the backpressure
+    if(server->in_flight >= compute_pool_depth(&server->compute))
+    {
+        defer_connection(env, err, server, fd);
+        return;
+    }
+
+    dc_memset(env, &job, 0, sizeof(job));
+    job.fd = fd;
+    job.processor = server->message_handler.processor;
+    job.length = server->message_handler.reader(env, err, &job.data, fd);
+
+    if(dc_error_has_error(err) || job.length <= 0)
+    {
+        if(job.data)
+        {
+            dc_free(env, job.data);
+        }
+
+        dc_error_reset(err);
+        close_connection(env, err, server, fd);
+        return;
+    }
+
+    // cannot fail, in_flight is below the queue depth
+    event_loop_modify(env, err, &server->loop, fd, 0);
+    server->connections[fd].busy = true;
+    compute_pool_submit(&server->compute, &job);
+    server->in_flight++;
+    arm_timeout(server, fd, server->config->stall_timeout_ms);
+}
+
+static void complete_computed(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    unsigned char wakeups[16];  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    struct compute_job job;
+
+    DC_TRACE(env);
+
+    while(read(server->completion_fds[0], wakeups, sizeof(wakeups)) > 0)
+    {
+    }
+
+    compute_pool_rearm(&server->compute);
+
+    while(compute_pool_complete(&server->compute, &job))
+    {
+        server->in_flight--;
+        send_computed(env, err, server, &job);
+
+        if(job.data)
+        {
+            dc_free(env, job.data);
+        }
+
+        resume_deferred(env, err, server);
+    }
+}
+
+static void send_computed(struct dc_env *env, struct dc_error *err, struct event_server *server, const struct compute_job *job)
+{
+    struct event_connection *connection;
+    bool closed;
+
+    DC_TRACE(env);
+    connection = &server->connections[job->fd];
+
+    if(!connection->open)
+    {
+        return;
+    }
+
+    connection->busy = false;
+    closed = true;
+
+    if(!job->failed)
+    {
+        message_handler_send(env, err, &server->message_handler, job->data, (size_t)job->length, job->fd, &closed);
+    }
+
+    record_offloaded(server, connection);
+
+    if(closed || dc_error_has_error(err))
+    {
+        dc_error_reset(err);
+        close_connection(env, err, server, job->fd);
+    }
+    else if(keep_connection(env, err, server, job->fd))
+    {
+        event_loop_modify(env, err, &server->loop, job->fd, EVENT_READ);
+        arm_timeout(server, job->fd, server->config->idle_timeout_ms);
+    }
+}
+
+static void dispatch_process(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    DC_TRACE(env);
+
+    // behind the ones already waiting, and unread while every worker has its share, the client sees the backpressure
+    if(server->deferred_head >= 0 || !admission_can_dispatch(&server->admission, (int)server->in_flight, process_pool_active(&server->processes)))
+    {
+        defer_connection(env, err, server, fd);
+        server->admission.deferred++;
+        return;
+    }
+
+    submit_process(env, err, server, fd);
+}
+
+static void submit_process(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    DC_TRACE(env);
+    // the worker owns the socket until its completion arrives
+    event_loop_modify(env, err, &server->loop, fd, 0);
+
+    if(!process_pool_submit(env, err, &server->processes, fd, server->wakeup_ns))
+    {
+        dc_error_reset(err);
+        close_connection(env, err, server, fd);
+        return;
+    }
+
+    server->connections[fd].busy = true;
+    server->in_flight++;
+    arm_timeout(server, fd, server->config->stall_timeout_ms);
+}
+
+static void complete_processes(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    struct process_pool_completion completion;
+
+    DC_TRACE(env);
+
+    while(read(server->completion_fds[0], &completion, sizeof(completion)) == sizeof(completion))
+    {
+        struct event_connection *connection;
+
+        process_pool_revived(&server->processes, &completion);
+        server->in_flight--;
+
+        if(completion.fd < 0 || completion.fd >= server->num_slots || !server->connections[completion.fd].busy)
+        {
+            continue;
+        }
+
+        connection = &server->connections[completion.fd];
+        connection->busy = false;
+        record_offloaded(server, connection);
+
+        if(completion.closed)
+        {
+            close_connection(env, err, server, completion.fd);
+        }
+        else if(keep_connection(env, err, server, completion.fd))
+        {
+            event_loop_modify(env, err, &server->loop, completion.fd, EVENT_READ);
+            arm_timeout(server, completion.fd, server->config->idle_timeout_ms);
+        }
+    }
+
+    // the freed workers go to the connections that waited longest, their requests are still in the socket
+    while(server->deferred_head >= 0 && admission_can_dispatch(&server->admission, (int)server->in_flight, process_pool_active(&server->processes)))
+    {
+        submit_process(env, err, server, take_deferred(server));
+    }
+}
+
+static void forked_worker(struct dc_env *env, struct dc_error *err, void *context)
+{
+    struct event_server *server;
+
+    server = (struct event_server *)context;
+    // the worker must not hold the signal pipe or the listeners, and of the completion pipe it only writes
+    signal_pipe_fd = -1;
+
+    if(server->listener >= 0)
+    {
+        dc_close(env, err, server->listener);
+    }
+
+    listener_close_unix(env, err, server->unix_listener, NULL);
+    listener_close_unix(env, err, server->ring_listener, NULL);
+
+    if(server->upgrade_socket >= 0)
+    {
+        dc_close(env, err, server->upgrade_socket);
+    }
+
+    dc_close(env, err, server->signal_fds[0]);
+    dc_close(env, err, server->signal_fds[1]);
+    dc_close(env, err, server->completion_fds[0]);
+
+    for(int fd = 0; fd < server->num_slots; fd++)
+    {
+        if(server->connections[fd].open)
+        {
+            dc_close(env, err, fd);
+        }
+    }
+
+    event_loop_destroy(env, err, &server->loop);
+    dc_free(env, server->events);
+
+    if(server->connections)
+    {
+        dc_free(env, server->connections);
+    }
+}
+
+static void pool_tick(struct timer *timer, void *context)
+{
+    struct event_timeout_context *pool;
+
+    pool = (struct event_timeout_context *)context;
+    process_pool_resize(pool->env, pool->err, &pool->server->processes, (int)pool->server->in_flight, (int)pool->server->num_deferred);
+    timer_wheel_add(&pool->server->timers, timer, timer_now_ms() + PROCESS_POOL_INTERVAL_MS);
+}
+
+static void defer_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct event_connection *connection;
+
+    DC_TRACE(env);
+    connection = &server->connections[fd];
+    event_loop_modify(env, err, &server->loop, fd, 0);
+    connection->deferred = true;
+    connection->next_deferred = -1;
+
+    if(server->deferred_tail < 0)
+    {
+        server->deferred_head = fd;
+    }
+    else
+    {
+        server->connections[server->deferred_tail].next_deferred = fd;
+    }
+
+    server->deferred_tail = fd;
+    server->num_deferred++;
+    // the stall deadline also bounds how long a request may wait here
+    arm_timeout(server, fd, server->config->stall_timeout_ms);
+}
+
+static int take_deferred(struct event_server *server)
+{
+    struct event_connection *connection;
+    int fd;
+
+    fd = server->deferred_head;
+    connection = &server->connections[fd];
+    server->deferred_head = connection->next_deferred;
+
+    if(server->deferred_head < 0)
+    {
+        server->deferred_tail = -1;
+    }
+
+    connection->deferred = false;
+    server->num_deferred--;
+
+    return fd;
+}
+
+static void resume_deferred(struct dc_env *env, struct dc_error *err, struct event_server *server)
+{
+    int fd;
+
+    DC_TRACE(env);
+
+    if(server->deferred_head < 0)
+    {
+        return;
+    }
+
+    // the oldest deferred connection gets the freed slot, its request is still waiting in the socket
+    fd = take_deferred(server);
+    timer_wheel_cancel(&server->timers, &server->connections[fd].timer);
+    event_loop_modify(env, err, &server->loop, fd, EVENT_READ);
+}
+
+static const char *dispatch_name(enum dispatch_strategy dispatch)
+{
+    switch(dispatch)
+    {
+        case DISPATCH_THREADS:
+            return "thread pool";
+        case DISPATCH_COMPUTE:
+            return "compute pool";
+        case DISPATCH_FIBERS:
+            return "fiber";
+        case DISPATCH_PROCESSES:
+            return "process pool";
+        case DISPATCH_INLINE:
+        default:
+            return "inline";
+    }
+}
+
+static uint32_t default_max_connections(void)
+{
+    struct rlimit limit;
+
+    // an accept that runs out of descriptors fails for every connection behind it, a rejection only for the one
+    if(getrlimit(RLIMIT_NOFILE, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur <= RESERVED_FDS)
+    {
+        return 0;
+    }
+
+    return limit.rlim_cur - RESERVED_FDS > UINT32_MAX ? UINT32_MAX : (uint32_t)(limit.rlim_cur - RESERVED_FDS);
+}
+
+static void close_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct event_connection *connection;
+    double time_spent;
+
+    DC_TRACE(env);
+    connection = &server->connections[fd];
+
+    // a ring client is closed through its socket, whichever of its descriptors the loop saw
+    if(connection->shared && server->rings[connection->ring].socket != fd)
+    {
+        close_connection(env, err, server, server->rings[connection->ring].socket);
+        return;
+    }
+
+    time_spent = ((double)((uint32_t)clock() - connection->start_time) / CLOCKS_PER_SEC) * CONVERT_TO_MS;
+    write_to_file(server->opts, server->config->name, "handled connection", time_spent);
+    forget_connection(env, err, server, fd);
+}
+
+static void forget_connection(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct event_connection *connection;
+
+    DC_TRACE(env);
+    connection = &server->connections[fd];
+
+    if(connection->shared)
+    {
+        close_ring(env, err, server, fd);
+    }
+
+    // the request in progress sees its waits fail and unwinds, freeing what it holds, before the socket goes
+    if(server->config->dispatch == DISPATCH_FIBERS && connection->fiber >= 0)
+    {
+        int fiber;
+
+        fiber = connection->fiber;
+        connection->fiber = -1;
+
+        if(fiber_cancel(&server->fibers, fiber))
+        {
+            fiber_release(&server->fibers, fiber);
+        }
+    }
+
+    timer_wheel_cancel(&server->timers, &connection->timer);
+    event_loop_remove(env, err, &server->loop, fd);
+    dc_close(env, err, fd);
+    connection->open = false;
+    connection->busy = false;
+    connection->deferred = false;
+    connection->writing = false;
+    server->num_connections--;
+}
+
+static bool grow_connections(struct dc_env *env, struct dc_error *err, struct event_server *server, int fd)
+{
+    struct event_connection *connections;
+    int num_slots;
+
+    DC_TRACE(env);
+    num_slots = server->num_slots == 0 ? fd + 1 : server->num_slots;
+
+    while(num_slots <= fd)
+    {
+        num_slots *= 2;
+    }
+
+    connections = (struct event_connection *)dc_malloc(env, err, num_slots * sizeof(struct event_connection));
+
+    if(connections == NULL)
+    {
+        return false;
+    }
+
+    // the timers are intrusive, so each pending one is moved onto the wheel from its new address
+    for(int i = 0; i < num_slots; i++)
+    {
+        timer_init(&connections[i].timer, connection_timeout, &connections[i]);
+        connections[i].open = false;
+        connections[i].busy = false;
+        connections[i].deferred = false;
+        connections[i].writing = false;
+        connections[i].shared = false;
+        connections[i].next_deferred = -1;
+        connections[i].start_time = 0;
+        connections[i].wakeup_us = 0;
+        connections[i].class_id = FAIR_DEFAULT_CLASS;
+
+        if(i < server->num_slots)
+        {
+            struct timer *old;
+
+            old = &server->connections[i].timer;
+            connections[i].open = server->connections[i].open;
+            connections[i].busy = server->connections[i].busy;
+            connections[i].deferred = server->connections[i].deferred;
+            connections[i].writing = server->connections[i].writing;
+            connections[i].shared = server->connections[i].shared;
+            connections[i].next_deferred = server->connections[i].next_deferred;
+            connections[i].start_time = server->connections[i].start_time;
+            connections[i].wakeup_us = server->connections[i].wakeup_us;
+            connections[i].class_id = server->connections[i].class_id;
+
+            if(timer_pending(old))
+            {
+                timer_wheel_cancel(&server->timers, old);
+                timer_wheel_add(&server->timers, &connections[i].timer, old->expires_ms);
+            }
+        }
+    }
+
+    if(server->connections)
+    {
+        dc_free(env, server->connections);
+    }
+
+    server->connections = connections;
+    server->num_slots = num_slots;
+
+    return true;
+}
+
+static void arm_timeout(struct event_server *server, int fd, uint32_t timeout_ms)
+{
+    // a disabled timeout must not leave the previous state's deadline behind
+    if(timeout_ms == 0)
+    {
+        timer_wheel_cancel(&server->timers, &server->connections[fd].timer);
+    }
+    else
+    {
+        timer_wheel_add(&server->timers, &server->connections[fd].timer, timer_now_ms() + timeout_ms);
+    }
+}
+
+static void connection_timeout(struct timer *timer, void *context)
+{
+    struct event_connection *connection;
+    struct event_timeout_context *timeout;
+    int fd;
+
+    connection = (struct event_connection *)timer->data;
+    timeout = (struct event_timeout_context *)context;
+
+    if(!connection->open)
+    {
+        return;
+    }
+
+    fd = (int)(connection - timeout->server->connections);
+
+    // a pool owns a busy socket and a deferred one is still queued, so it is shut down rather than closed: the request
+    // fails, or is found at end of file once its turn comes, and its completion closes it
+    if(connection->busy || connection->deferred)
+    {
+        if(timeout->server->config->verbose)
+        {
+            printf("Client %d stalled, shutting it down\n", fd);
+        }
+
+        shutdown(fd, SHUT_RDWR);
+        return;
+    }
+
+    if(timeout->server->config->verbose)
+    {
+        printf("Client %d timed out\n", fd);
+    }
+
+    close_connection(timeout->env, timeout->err, timeout->server, fd);
+}
+
+static void record_offloaded(struct event_server *server, const struct event_connection *connection)
+{
+    uint32_t elapsed_us;
+
+    // the 32-bit difference stays right for requests under 71 minutes
+    elapsed_us = (uint32_t)(now_ns() / NS_PER_US) - connection->wakeup_us;
+    fairness_record(&server->fairness, connection->class_id, (uint64_t)elapsed_us * NS_PER_US);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+}
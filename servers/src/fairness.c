@@ -0,0 +1,226 @@
+#include "fairness.h"
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned int bucket_index(uint64_t value);
+static uint64_t percentile(struct fair_stats *stats, uint64_t count, unsigned int per_mille);
+
+
+#define NS_PER_US 1000
+#define MAX_WEIGHT 64
+#define MAX_PREFIX 32
+#define CLASS_SPEC_SIZE 64
+#define PER_MILLE 1000
+
+void fairness_init(struct fairness *fairness, uint32_t request_budget, uint32_t byte_budget)
+{
+    memset(fairness, 0, sizeof(*fairness));
+    fairness->request_budget = request_budget == 0 ? 1 : request_budget;
+    fairness->byte_budget = byte_budget;
+    fairness->classes[FAIR_DEFAULT_CLASS].weight = 1;
+    fairness->num_classes = 1;
+}
+
+bool fairness_add_classes(struct fairness *fairness, const char *spec)
+{
+    const char *entry;
+
+    // NETWORK/PREFIX=WEIGHT[,NETWORK/PREFIX=WEIGHT...]
+    for(entry = spec; *entry != '\0';)
+    {
+        char text[CLASS_SPEC_SIZE];
+        struct in_addr network;
+        struct fair_class *fair_class;
+        const char *end;
+        char *slash;
+        char *equals;
+        char *number_end;
+        long prefix;
+        long weight;
+
+        end = strchr(entry, ',');
+        end = end ? end : entry + strlen(entry);
+
+        if(fairness->num_classes == FAIR_MAX_CLASSES || (size_t)(end - entry) >= sizeof(text))
+        {
+            return false;
+        }
+
+        memcpy(text, entry, (size_t)(end - entry));
+        text[end - entry] = '\0';
+        slash = strchr(text, '/');
+        equals = strchr(text, '=');
+
+        if(slash == NULL || equals == NULL || equals < slash)
+        {
+            return false;
+        }
+
+        *slash = '\0';
+        *equals = '\0';
+        prefix = strtol(slash + 1, &number_end, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+        if(*number_end != '\0' || prefix < 0 || prefix > MAX_PREFIX || inet_pton(AF_INET, text, &network) != 1)
+        {
+            return false;
+        }
+
+        weight = strtol(equals + 1, &number_end, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+        if(*number_end != '\0' || weight < 1 || weight > MAX_WEIGHT)
+        {
+            return false;
+        }
+
+        fair_class = &fairness->classes[fairness->num_classes];
+        fair_class->mask = prefix == 0 ? 0 : htonl(~(uint32_t)0 << (MAX_PREFIX - prefix));
+        fair_class->network = network.s_addr & fair_class->mask;
+        fair_class->weight = (uint32_t)weight;
+        fairness->num_classes++;
+        entry = *end == ',' ? end + 1 : end;
+    }
+
+    return true;
+}
+
+uint8_t fairness_classify(const struct fairness *fairness, const struct sockaddr_storage *peer)
+{
+    in_addr_t address;
+
+    if(peer->ss_family != AF_INET)
+    {
+        return FAIR_DEFAULT_CLASS;
+    }
+
+    address = ((const struct sockaddr_in *)peer)->sin_addr.s_addr;
+
+    for(uint8_t i = FAIR_DEFAULT_CLASS + 1; i < fairness->num_classes; i++)
+    {
+        if((address & fairness->classes[i].mask) == fairness->classes[i].network)
+        {
+            return i;
+        }
+    }
+
+    return FAIR_DEFAULT_CLASS;
+}
+
+uint32_t fairness_request_budget(const struct fairness *fairness, uint8_t class_id)
+{
+    return fairness->request_budget * fairness->classes[class_id].weight;
+}
+
+uint32_t fairness_byte_budget(const struct fairness *fairness, uint8_t class_id)
+{
+    return fairness->byte_budget * fairness->classes[class_id].weight;
+}
+
+void fairness_record(struct fairness *fairness, uint8_t class_id, uint64_t service_ns)
+{
+    struct fair_stats *stats;
+    uint64_t max;
+
+    stats = &fairness->stats[class_id];
+    atomic_fetch_add_explicit(&stats->requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->buckets[bucket_index(service_ns)], 1, memory_order_relaxed);
+    max = atomic_load_explicit(&stats->max_ns, memory_order_relaxed);
+
+    while(service_ns > max && !atomic_compare_exchange_weak_explicit(&stats->max_ns, &max, service_ns, memory_order_relaxed, memory_order_relaxed))
+    {
+    }
+}
+
+void fairness_exhausted(struct fairness *fairness, uint8_t class_id)
+{
+    atomic_fetch_add_explicit(&fairness->stats[class_id].budget_exhausted, 1, memory_order_relaxed);
+}
+
+void fairness_report(struct fairness *fairness, FILE *out)
+{
+    bool header;
+
+    header = false;
+
+    for(uint8_t i = 0; i < fairness->num_classes; i++)
+    {
+        struct fair_stats *stats;
+        const struct fair_class *fair_class;
+        char network[INET_ADDRSTRLEN];
+        uint64_t count;
+
+        stats = &fairness->stats[i];
+        fair_class = &fairness->classes[i];
+        count = atomic_load_explicit(&stats->requests, memory_order_relaxed);
+
+        if(count == 0)
+        {
+            continue;
+        }
+
+        if(!header)
+        {
+            fprintf(out, "Service time per class (us, wakeup to reply sent): class weight requests p50 p99 p99.9 max, budget stops\n");    // NOLINT(cert-err33-c)
+            header = true;
+        }
+
+        if(i == FAIR_DEFAULT_CLASS)
+        {
+            snprintf(network, sizeof(network), "default");    // NOLINT(cert-err33-c)
+        }
+        else
+        {
+            inet_ntop(AF_INET, &fair_class->network, network, sizeof(network));
+        }
+
+        fprintf(out, "%s/%d %u %llu %.1f %.1f %.1f %.1f, %llu\n",    // NOLINT(cert-err33-c)
+                network, i == FAIR_DEFAULT_CLASS ? 0 : __builtin_popcount(fair_class->mask), fair_class->weight, (unsigned long long)count,
+                (double)percentile(stats, count, 500) / NS_PER_US,    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                (double)percentile(stats, count, 990) / NS_PER_US,    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                (double)percentile(stats, count, 999) / NS_PER_US,    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+                (double)atomic_load_explicit(&stats->max_ns, memory_order_relaxed) / NS_PER_US,
+                (unsigned long long)atomic_load_explicit(&stats->budget_exhausted, memory_order_relaxed));
+    }
+}
+
+static unsigned int bucket_index(uint64_t value)
+{
+    unsigned int index;
+
+    if(value == 0)
+    {
+        return 0;
+    }
+
+    index = (unsigned int)(64 - __builtin_clzll(value)) - 1;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return index < FAIR_BUCKETS ? index : FAIR_BUCKETS - 1;
+}
+
+static uint64_t percentile(struct fair_stats *stats, uint64_t count, unsigned int per_mille)
+{
+    uint64_t target;
+    uint64_t seen;
+    uint64_t max;
+
+    // the upper bound of the bucket holding the percentile, so within a factor of two and never below the truth
+    target = (count * per_mille + PER_MILLE - 1) / PER_MILLE;
+    seen = 0;
+    max = atomic_load_explicit(&stats->max_ns, memory_order_relaxed);
+
+    for(unsigned int i = 0; i < FAIR_BUCKETS; i++)
+    {
+        seen += atomic_load_explicit(&stats->buckets[i], memory_order_relaxed);
+
+        if(seen >= target)
+        {
+            uint64_t upper;
+
+            upper = (1ULL << (i + 1)) - 1;
+
+            return upper < max ? upper : max;
+        }
+    }
+
+    return max;
+}
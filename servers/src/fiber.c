@@ -0,0 +1,345 @@
+#include "fiber.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+struct fiber
+{
+    ucontext_t context;
+    struct fiber_pool *pool;
+    struct fiber *next_free;
+    /**
+     * The whole mapping, guard page first since stacks grow down, NULL when the stack went back to the system.
+     */
+    uint8_t *stack;
+    struct dc_error *err;
+    fiber_func func;
+    void *arg;
+    int fd;
+    int id;
+    int result;
+    short wait_events;
+    bool finished;
+    bool cancelled;
+};
+
+static bool map_stack(const struct dc_env *env, struct dc_error *err, struct fiber_pool *pool, struct fiber *fiber);
+static void unmap_stack(const struct fiber_pool *pool, struct fiber *fiber);
+static struct fiber *new_fiber(const struct dc_env *env, struct dc_error *err, struct fiber_pool *pool);
+static void prepare_context(struct fiber_pool *pool, struct fiber *fiber);
+static void fiber_entry(void);
+static size_t page_size(void);
+
+
+#define INITIAL_FIBERS 16
+#define BYTES_PER_KB 1024
+
+static _Thread_local struct fiber *current_fiber = NULL;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+void fiber_pool_init(struct fiber_pool *pool, size_t stack_size, size_t max_free)
+{
+    size_t page;
+
+    memset(pool, 0, sizeof(*pool));
+    page = page_size();
+    pool->stack_size = (stack_size + page - 1) / page * page;
+    pool->max_free = max_free;
+}
+
+void fiber_pool_destroy(struct fiber_pool *pool)
+{
+    for(int id = 0; id < pool->num_fibers; id++)
+    {
+        struct fiber *fiber;
+
+        fiber = pool->fibers[id];
+        unmap_stack(pool, fiber);
+        dc_error_reset(fiber->err);
+        free(fiber->err);
+        free(fiber);
+    }
+
+    free((void *)pool->fibers);
+    pool->fibers = NULL;
+    pool->num_fibers = 0;
+    pool->capacity = 0;
+    pool->free_list = NULL;
+    pool->spare_list = NULL;
+    pool->num_free = 0;
+}
+
+int fiber_create(const struct dc_env *env, struct dc_error *err, struct fiber_pool *pool, fiber_func func, void *arg, int fd)
+{
+    struct fiber *fiber;
+
+    DC_TRACE(env);
+
+    if(pool->free_list)
+    {
+        fiber = pool->free_list;
+        pool->free_list = fiber->next_free;
+        pool->num_free--;
+    }
+    else if(pool->spare_list)
+    {
+        fiber = pool->spare_list;
+        pool->spare_list = fiber->next_free;
+    }
+    else
+    {
+        fiber = new_fiber(env, err, pool);
+
+        if(fiber == NULL)
+        {
+            return -1;
+        }
+    }
+
+    if(fiber->stack == NULL && !map_stack(env, err, pool, fiber))
+    {
+        fiber->next_free = pool->spare_list;
+        pool->spare_list = fiber;
+        return -1;
+    }
+
+    fiber->func = func;
+    fiber->arg = arg;
+    fiber->fd = fd;
+    fiber->result = 0;
+    fiber->wait_events = 0;
+    fiber->finished = false;
+    fiber->cancelled = false;
+    dc_error_reset(fiber->err);
+    prepare_context(pool, fiber);
+    pool->stats.started++;
+    pool->stats.live++;
+
+    if(pool->stats.live > pool->stats.peak_live)
+    {
+        pool->stats.peak_live = pool->stats.live;
+    }
+
+    return fiber->id;
+}
+
+bool fiber_resume(struct fiber_pool *pool, int id)
+{
+    struct fiber *fiber;
+
+    fiber = pool->fibers[id];
+    current_fiber = fiber;
+    swapcontext(&pool->scheduler, &fiber->context);
+    current_fiber = NULL;
+
+    return fiber->finished;
+}
+
+bool fiber_cancel(struct fiber_pool *pool, int id)
+{
+    struct fiber *fiber;
+
+    fiber = pool->fibers[id];
+
+    if(fiber->finished)
+    {
+        return true;
+    }
+
+    fiber->cancelled = true;
+    pool->stats.cancelled++;
+
+    return fiber_resume(pool, id);
+}
+
+short fiber_waiting_for(const struct fiber_pool *pool, int id)
+{
+    return pool->fibers[id]->wait_events;
+}
+
+int fiber_result(const struct fiber_pool *pool, int id)
+{
+    return pool->fibers[id]->result;
+}
+
+void fiber_release(struct fiber_pool *pool, int id)
+{
+    struct fiber *fiber;
+
+    fiber = pool->fibers[id];
+    pool->stats.live--;
+
+    // the next start takes the stack touched last, its pages are the likeliest to still be resident
+    if(pool->num_free < pool->max_free)
+    {
+        fiber->next_free = pool->free_list;
+        pool->free_list = fiber;
+        pool->num_free++;
+    }
+    else
+    {
+        unmap_stack(pool, fiber);
+        fiber->next_free = pool->spare_list;
+        pool->spare_list = fiber;
+    }
+}
+
+bool fiber_wait_fd(int fd, short events, int timeout_ms)
+{
+    struct fiber *fiber;
+
+    fiber = current_fiber;
+
+    if(fiber == NULL || fd != fiber->fd)
+    {
+        struct pollfd ready;
+
+        ready.fd = fd;
+        ready.events = events;
+        ready.revents = 0;
+
+        return poll(&ready, 1, timeout_ms) > 0 && (ready.revents & events) != 0;
+    }
+
+    if(fiber->cancelled)
+    {
+        return false;
+    }
+
+    fiber->wait_events = events;
+    fiber->pool->stats.waits++;
+    swapcontext(&fiber->context, &fiber->pool->scheduler);
+    fiber->wait_events = 0;
+
+    return !fiber->cancelled;
+}
+
+bool fiber_running(void)
+{
+    return current_fiber != NULL;
+}
+
+void fiber_pool_report(const struct fiber_pool *pool, FILE *out)
+{
+    if(pool->stats.started == 0)
+    {
+        return;
+    }
+
+    fprintf(out, "Fibers: %llu started, %llu waits, %llu cancelled, peak %u live, %llu stacks of %zuKiB mapped with a guard page each\n",    // NOLINT(cert-err33-c)
+            (unsigned long long)pool->stats.started, (unsigned long long)pool->stats.waits, (unsigned long long)pool->stats.cancelled,
+            pool->stats.peak_live, (unsigned long long)pool->stats.stacks_mapped, pool->stack_size / BYTES_PER_KB);
+}
+
+static bool map_stack(const struct dc_env *env, struct dc_error *err, struct fiber_pool *pool, struct fiber *fiber)
+{
+    void *mapping;
+
+    DC_TRACE(env);
+
+    // reserved only, pages are backed as the fiber first touches them
+    mapping = mmap(NULL, pool->stack_size + page_size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+
+    if(mapping == MAP_FAILED)
+    {
+        DC_ERROR_RAISE_SYSTEM(err, "mmap fiber stack", errno);
+        return false;
+    }
+
+    // an overflow faults on the guard page instead of running into whatever is mapped below
+    if(mprotect(mapping, page_size(), PROT_NONE) != 0)
+    {
+        DC_ERROR_RAISE_SYSTEM(err, "mprotect fiber guard page", errno);
+        munmap(mapping, pool->stack_size + page_size());
+        return false;
+    }
+
+    fiber->stack = (uint8_t *)mapping;
+    pool->stats.stacks_mapped++;
+
+    return true;
+}
+
+static void unmap_stack(const struct fiber_pool *pool, struct fiber *fiber)
+{
+    if(fiber->stack != NULL)
+    {
+        munmap(fiber->stack, pool->stack_size + page_size());
+        fiber->stack = NULL;
+    }
+}
+
+static struct fiber *new_fiber(const struct dc_env *env, struct dc_error *err, struct fiber_pool *pool)
+{
+    struct fiber *fiber;
+
+    DC_TRACE(env);
+
+    if(pool->num_fibers == pool->capacity)
+    {
+        struct fiber **fibers;
+        int capacity;
+
+        capacity = pool->capacity == 0 ? INITIAL_FIBERS : pool->capacity * 2;
+        fibers = (struct fiber **)dc_realloc(env, err, (void *)pool->fibers, (size_t)capacity * sizeof(*fibers));
+
+        if(fibers == NULL)
+        {
+            return NULL;
+        }
+
+        pool->fibers = fibers;
+        pool->capacity = capacity;
+    }
+
+    fiber = (struct fiber *)dc_malloc(env, err, sizeof(*fiber));
+
+    if(fiber == NULL)
+    {
+        return NULL;
+    }
+
+    dc_memset(env, fiber, 0, sizeof(*fiber));
+    fiber->pool = pool;
+    fiber->id = pool->num_fibers;
+    // dc_error records the last failure, a fiber that waits mid-request must not share the loop's
+    fiber->err = dc_error_create(false);
+    pool->fibers[pool->num_fibers] = fiber;
+    pool->num_fibers++;
+
+    return fiber;
+}
+
+// kept out of line, getcontext returns twice and the caller's locals would not survive that in registers
+__attribute__((noinline)) static void prepare_context(struct fiber_pool *pool, struct fiber *fiber)
+{
+    // a fresh context on the old stack every time, whatever the last fiber left there is dead
+    getcontext(&fiber->context);
+    fiber->context.uc_stack.ss_sp = fiber->stack + page_size();
+    fiber->context.uc_stack.ss_size = pool->stack_size;
+    fiber->context.uc_link = &pool->scheduler;
+    makecontext(&fiber->context, fiber_entry, 0);
+}
+
+static void fiber_entry(void)
+{
+    struct fiber *fiber;
+
+    fiber = current_fiber;
+    fiber->result = fiber->func(fiber->arg, fiber->fd, fiber->err);
+    fiber->finished = true;
+    // returning switches to uc_link, the pool's scheduler context
+}
+
+static size_t page_size(void)
+{
+    long size;
+
+    size = sysconf(_SC_PAGESIZE);
+
+    return size > 0 ? (size_t)size : 4096;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+}
@@ -0,0 +1,762 @@
+#include "file_server.h"
+#include "fiber.h"
+#include "timer_wheel.h"
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <linux/openat2.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define FILE_CACHE_BUCKETS 64
+#define FILE_CACHE_WAYS 4               // descriptors a name may be cached in, probed and evicted as one bucket
+#define FILE_NAME_SIZE 128              // longer names are served without caching their descriptor
+#define FILE_REVALIDATE_MS 1000         // a cached file is stat'ed again this long after it was last checked
+#define FILE_SEND_TIMEOUT_MS 10000      // a client that takes no bytes for this long loses the rest of its reply
+#define FILE_PIPE_SIZE (1024 * 1024)    // bytes a splice moves per round trip through the pipe
+#define FILE_COPY_SIZE (64 * 1024)
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/**
+ * An open descriptor for one name below the root.
+ */
+struct file_entry
+{
+    char name[FILE_NAME_SIZE];
+    uint64_t hash;
+    /**
+     * -1 for an empty way.
+     */
+    int fd;
+    off_t size;
+    dev_t device;
+    ino_t inode;
+    uint64_t checked_ms;
+    /**
+     * Replies being sent from fd, it is not closed or replaced until they finish.
+     */
+    uint32_t refs;
+    /**
+     * CLOCK bit, set on every hit and cleared as eviction passes.
+     */
+    bool referenced;
+};
+
+/**
+ * A descriptor lent out for one reply, from the cache or opened just for it.
+ */
+struct file_lease
+{
+    int fd;
+    off_t size;
+    struct file_entry *entry;
+};
+
+struct file_counters
+{
+    _Atomic uint64_t requests;
+    _Atomic uint64_t rejected;
+    _Atomic uint64_t not_found;
+    _Atomic uint64_t hits;
+    _Atomic uint64_t opens;
+    _Atomic uint64_t evictions;
+    _Atomic uint64_t bytes_sent;
+    _Atomic uint64_t aborted;
+};
+
+static bool clean_name(uint8_t *buffer, size_t count, char *name);
+static bool acquire_file(const char *name, struct file_lease *lease);
+static void release_file(struct file_lease *lease);
+static void cache_file(const char *name, uint64_t hash, struct file_lease *lease, const struct stat *info);
+static struct file_entry *find_entry(uint64_t hash, const char *name);
+static struct file_entry *choose_victim(uint64_t hash);
+static void take_entry(struct file_entry *entry, struct file_lease *lease);
+static uint64_t hash_name(const char *name);
+static int open_beneath(const char *name);
+static bool send_all(int socket, const void *data, size_t length, int flags);
+static bool send_body(int socket, const struct file_lease *lease);
+static bool sendfile_body(int socket, const struct file_lease *lease, bool *unsupported);
+static bool splice_body(int socket, const struct file_lease *lease);
+static bool open_splice_pipe(int pipe_fds[2]);
+static bool splice_through(int socket, const struct file_lease *lease, int pipe_fds[2]);
+static bool copy_body(int socket, const struct file_lease *lease);
+static bool copy_through(int socket, const struct file_lease *lease, uint8_t *buffer);
+static bool wait_writable(int socket);
+
+
+static int root_fd = -1;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static enum file_transfer transfer_mode = FILE_TRANSFER_SENDFILE;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static struct file_entry cache[FILE_CACHE_BUCKETS][FILE_CACHE_WAYS];     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static struct file_counters counters;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static _Thread_local int splice_pipe[2] = {-1, -1};     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static _Thread_local bool splice_pipe_busy = false;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static _Thread_local uint8_t *copy_buffer = NULL;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static _Thread_local bool copy_buffer_busy = false;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+bool file_server_init(const struct dc_env *env, struct dc_error *err, const char *root, enum file_transfer transfer)
+{
+    DC_TRACE(env);
+    root_fd = open(root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+    if(root_fd < 0)
+    {
+        DC_ERROR_RAISE_USER(err, "Cannot open the file root", -1);
+        return false;
+    }
+
+    transfer_mode = transfer;
+
+    for(size_t bucket = 0; bucket < FILE_CACHE_BUCKETS; bucket++)
+    {
+        for(size_t way = 0; way < FILE_CACHE_WAYS; way++)
+        {
+            memset(&cache[bucket][way], 0, sizeof(cache[bucket][way]));
+            cache[bucket][way].fd = -1;
+        }
+    }
+
+    return true;
+}
+
+void send_file_handler(const struct dc_env *env, __attribute__((unused)) struct dc_error *err, uint8_t *buffer, size_t count, int client_socket, bool *closed)
+{
+    struct file_lease lease;
+    char name[PATH_MAX];
+    uint64_t header;
+
+    DC_TRACE(env);
+    atomic_fetch_add_explicit(&counters.requests, 1, memory_order_relaxed);
+    *closed = false;
+
+    if(!clean_name(buffer, count, name))
+    {
+        atomic_fetch_add_explicit(&counters.rejected, 1, memory_order_relaxed);
+        header = htobe64(FILE_NOT_FOUND);
+        *closed = !send_all(client_socket, &header, sizeof(header), 0);
+        return;
+    }
+
+    if(!acquire_file(name, &lease))
+    {
+        atomic_fetch_add_explicit(&counters.not_found, 1, memory_order_relaxed);
+        header = htobe64(FILE_NOT_FOUND);
+        *closed = !send_all(client_socket, &header, sizeof(header), 0);
+        return;
+    }
+
+    // MSG_MORE holds the header back so it leaves in the same segment as the start of the body
+    header = htobe64((uint64_t)lease.size);
+
+    // the length is promised up front, so a reply that cannot be finished can only be ended by closing
+    if(!send_all(client_socket, &header, sizeof(header), lease.size > 0 ? MSG_MORE : 0) || !send_body(client_socket, &lease))
+    {
+        atomic_fetch_add_explicit(&counters.aborted, 1, memory_order_relaxed);
+        *closed = true;
+    }
+
+    release_file(&lease);
+}
+
+bool file_server_stats(struct file_server_stats *stats)
+{
+    if(root_fd < 0)
+    {
+        return false;
+    }
+
+    stats->requests = atomic_load_explicit(&counters.requests, memory_order_relaxed);
+    stats->rejected = atomic_load_explicit(&counters.rejected, memory_order_relaxed);
+    stats->not_found = atomic_load_explicit(&counters.not_found, memory_order_relaxed);
+    stats->hits = atomic_load_explicit(&counters.hits, memory_order_relaxed);
+    stats->opens = atomic_load_explicit(&counters.opens, memory_order_relaxed);
+    stats->evictions = atomic_load_explicit(&counters.evictions, memory_order_relaxed);
+    stats->bytes_sent = atomic_load_explicit(&counters.bytes_sent, memory_order_relaxed);
+    stats->aborted = atomic_load_explicit(&counters.aborted, memory_order_relaxed);
+
+    return true;
+}
+
+void file_server_report(FILE *out)
+{
+    static const char *const transfer_names[] = {"sendfile", "splice", "read/write"};
+    struct file_server_stats stats;
+
+    if(!file_server_stats(&stats) || stats.requests == 0)
+    {
+        return;
+    }
+
+    fprintf(out, "Files (%s): %" PRIu64 " requests, %" PRIu64 " bytes sent, %" PRIu64 " cache hits, %" PRIu64 " opens, %" PRIu64 " evictions, "    // NOLINT(cert-err33-c)
+                 "%" PRIu64 " not found, %" PRIu64 " rejected, %" PRIu64 " aborted\n",
+            transfer_names[transfer_mode], stats.requests, stats.bytes_sent, stats.hits, stats.opens, stats.evictions, stats.not_found,
+            stats.rejected, stats.aborted);
+}
+
+void file_server_destroy(void)
+{
+    for(size_t bucket = 0; bucket < FILE_CACHE_BUCKETS; bucket++)
+    {
+        for(size_t way = 0; way < FILE_CACHE_WAYS; way++)
+        {
+            if(cache[bucket][way].fd >= 0)
+            {
+                close(cache[bucket][way].fd);     // NOLINT(cert-err33-c)
+                cache[bucket][way].fd = -1;
+            }
+        }
+    }
+
+    if(root_fd >= 0)
+    {
+        close(root_fd);     // NOLINT(cert-err33-c)
+        root_fd = -1;
+    }
+}
+
+static bool clean_name(uint8_t *buffer, size_t count, char *name)
+{
+    const char *component;
+
+    // a name typed into the interactive client ends in a newline
+    while(count > 0 && (buffer[count - 1] == '\n' || buffer[count - 1] == '\r' || buffer[count - 1] == '\0'))
+    {
+        count--;
+    }
+
+    if(count == 0 || count >= PATH_MAX || buffer[0] == '/' || memchr(buffer, '\0', count) != NULL)
+    {
+        return false;
+    }
+
+    memcpy(name, buffer, count);
+    name[count] = '\0';
+
+    // openat2 refuses to leave the root on its own, this also covers kernels without it
+    for(component = name; component != NULL; component = strchr(component, '/'))
+    {
+        if(*component == '/')
+        {
+            component++;
+        }
+
+        if(strncmp(component, "..", 2) == 0 && (component[2] == '/' || component[2] == '\0'))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool acquire_file(const char *name, struct file_lease *lease)
+{
+    struct file_entry *entry;
+    struct stat info;
+    uint64_t hash;
+    uint64_t now;
+    bool cached;
+
+    hash = hash_name(name);
+    now = timer_now_ms();
+    pthread_mutex_lock(&cache_lock);
+    entry = find_entry(hash, name);
+    cached = entry != NULL;
+
+    if(entry && now - entry->checked_ms < FILE_REVALIDATE_MS)
+    {
+        take_entry(entry, lease);
+        pthread_mutex_unlock(&cache_lock);
+        atomic_fetch_add_explicit(&counters.hits, 1, memory_order_relaxed);
+        return true;
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+
+    // a stat without an open is enough to tell the cached file is still the one at that name
+    if(cached && fstatat(root_fd, name, &info, 0) == 0 && S_ISREG(info.st_mode))
+    {
+        pthread_mutex_lock(&cache_lock);
+        entry = find_entry(hash, name);
+
+        if(entry && entry->device == info.st_dev && entry->inode == info.st_ino)
+        {
+            entry->size = info.st_size;
+            entry->checked_ms = now;
+            take_entry(entry, lease);
+            pthread_mutex_unlock(&cache_lock);
+            atomic_fetch_add_explicit(&counters.hits, 1, memory_order_relaxed);
+            return true;
+        }
+
+        pthread_mutex_unlock(&cache_lock);
+    }
+
+    lease->fd = open_beneath(name);
+    lease->entry = NULL;
+
+    if(lease->fd < 0)
+    {
+        return false;
+    }
+
+    if(fstat(lease->fd, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        close(lease->fd);     // NOLINT(cert-err33-c)
+        return false;
+    }
+
+    atomic_fetch_add_explicit(&counters.opens, 1, memory_order_relaxed);
+    lease->size = info.st_size;
+    cache_file(name, hash, lease, &info);
+
+    return true;
+}
+
+static void release_file(struct file_lease *lease)
+{
+    if(lease->entry == NULL)
+    {
+        close(lease->fd);     // NOLINT(cert-err33-c)
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    lease->entry->refs--;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static void cache_file(const char *name, uint64_t hash, struct file_lease *lease, const struct stat *info)
+{
+    struct file_entry *entry;
+
+    if(strlen(name) >= FILE_NAME_SIZE)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+
+    // a stale entry for the name is replaced in place, unless a reply is still being sent from it
+    entry = find_entry(hash, name);
+
+    if(entry == NULL)
+    {
+        entry = choose_victim(hash);
+    }
+
+    if(entry != NULL && entry->refs == 0)
+    {
+        if(entry->fd >= 0)
+        {
+            close(entry->fd);     // NOLINT(cert-err33-c)
+
+            if(entry->hash != hash || strcmp(entry->name, name) != 0)
+            {
+                atomic_fetch_add_explicit(&counters.evictions, 1, memory_order_relaxed);
+            }
+        }
+
+        strcpy(entry->name, name);
+        entry->hash = hash;
+        entry->fd = lease->fd;
+        entry->size = info->st_size;
+        entry->device = info->st_dev;
+        entry->inode = info->st_ino;
+        entry->checked_ms = timer_now_ms();
+        entry->refs = 1;
+        entry->referenced = true;
+        lease->entry = entry;
+    }
+
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static struct file_entry *find_entry(uint64_t hash, const char *name)
+{
+    struct file_entry *bucket;
+
+    bucket = cache[hash % FILE_CACHE_BUCKETS];
+
+    for(size_t way = 0; way < FILE_CACHE_WAYS; way++)
+    {
+        if(bucket[way].fd >= 0 && bucket[way].hash == hash && strcmp(bucket[way].name, name) == 0)
+        {
+            return &bucket[way];
+        }
+    }
+
+    return NULL;
+}
+
+static struct file_entry *choose_victim(uint64_t hash)
+{
+    struct file_entry *bucket;
+
+    bucket = cache[hash % FILE_CACHE_BUCKETS];
+
+    for(size_t way = 0; way < FILE_CACHE_WAYS; way++)
+    {
+        if(bucket[way].fd < 0)
+        {
+            return &bucket[way];
+        }
+    }
+
+    // two passes of the CLOCK hand: the first clears the bits of recently used entries, the second takes one of them
+    for(size_t pass = 0; pass < 2; pass++)
+    {
+        for(size_t way = 0; way < FILE_CACHE_WAYS; way++)
+        {
+            if(bucket[way].refs > 0)
+            {
+                continue;
+            }
+
+            if(!bucket[way].referenced)
+            {
+                return &bucket[way];
+            }
+
+            bucket[way].referenced = false;
+        }
+    }
+
+    // every way is sending a reply, this file goes uncached
+    return NULL;
+}
+
+static void take_entry(struct file_entry *entry, struct file_lease *lease)
+{
+    entry->refs++;
+    entry->referenced = true;
+    lease->fd = entry->fd;
+    lease->size = entry->size;
+    lease->entry = entry;
+}
+
+static uint64_t hash_name(const char *name)
+{
+    uint64_t hash;
+
+    hash = FNV_OFFSET;
+
+    for(const char *c = name; *c != '\0'; c++)
+    {
+        hash = (hash ^ (uint8_t)*c) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static int open_beneath(const char *name)
+{
+    struct open_how how;
+    int fd;
+
+    // O_NONBLOCK so a FIFO placed under the root cannot hang the open, it is turned away as not a regular file
+    memset(&how, 0, sizeof(how));
+    how.flags = O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK;
+    how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+    fd = (int)syscall(SYS_openat2, root_fd, name, &how, sizeof(how));
+
+    if(fd >= 0 || errno != ENOSYS)
+    {
+        return fd;
+    }
+
+    // before Linux 5.6 only the .. check in clean_name and O_NOFOLLOW on the last component keep the name below the root
+    return openat(root_fd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK | O_NOFOLLOW);
+}
+
+static bool send_all(int socket, const void *data, size_t length, int flags)
+{
+    const uint8_t *bytes;
+
+    bytes = (const uint8_t *)data;
+
+    while(length > 0)
+    {
+        ssize_t sent;
+
+        sent = send(socket, bytes, length, flags | MSG_NOSIGNAL);
+
+        if(sent > 0)
+        {
+            bytes += sent;
+            length -= (size_t)sent;
+        }
+        else if(sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(socket))
+        {
+            continue;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool send_body(int socket, const struct file_lease *lease)
+{
+    bool unsupported;
+
+    switch(transfer_mode)
+    {
+        case FILE_TRANSFER_SPLICE:
+            return splice_body(socket, lease);
+        case FILE_TRANSFER_COPY:
+            return copy_body(socket, lease);
+        case FILE_TRANSFER_SENDFILE:
+        default:
+            unsupported = false;
+
+            if(sendfile_body(socket, lease, &unsupported))
+            {
+                return true;
+            }
+
+            return unsupported && splice_body(socket, lease);
+    }
+}
+
+static bool sendfile_body(int socket, const struct file_lease *lease, bool *unsupported)
+{
+    off_t offset;
+
+    offset = 0;
+
+    // the offset is passed in, so replies from the same cached descriptor never share a file position
+    while(offset < lease->size)
+    {
+        ssize_t sent;
+
+        sent = sendfile(socket, lease->fd, &offset, (size_t)(lease->size - offset));
+
+        if(sent > 0)
+        {
+            atomic_fetch_add_explicit(&counters.bytes_sent, (uint64_t)sent, memory_order_relaxed);
+            continue;
+        }
+
+        if(sent < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if(sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(socket))
+        {
+            continue;
+        }
+
+        // a file system without splice support for sendfile, nothing has gone out yet
+        *unsupported = sent < 0 && offset == 0 && (errno == EINVAL || errno == ENOSYS);
+
+        // 0 means the file shrank after its size was sent
+        return false;
+    }
+
+    return true;
+}
+
+static bool splice_body(int socket, const struct file_lease *lease)
+{
+    int own_pipe[2];
+    int *pipe_fds;
+    bool sent;
+
+    // one pipe per thread, kept for the life of the thread, unless a fiber that waited mid-reply still has bytes in it
+    if(splice_pipe_busy)
+    {
+        if(!open_splice_pipe(own_pipe))
+        {
+            return false;
+        }
+
+        pipe_fds = own_pipe;
+    }
+    else
+    {
+        if(splice_pipe[0] < 0 && !open_splice_pipe(splice_pipe))
+        {
+            return false;
+        }
+
+        pipe_fds = splice_pipe;
+        splice_pipe_busy = true;
+    }
+
+    sent = splice_through(socket, lease, pipe_fds);
+
+    if(pipe_fds == splice_pipe)
+    {
+        splice_pipe_busy = false;
+    }
+    else if(own_pipe[0] >= 0)
+    {
+        close(own_pipe[0]);     // NOLINT(cert-err33-c)
+        close(own_pipe[1]);     // NOLINT(cert-err33-c)
+    }
+
+    return sent;
+}
+
+static bool open_splice_pipe(int pipe_fds[2])
+{
+    if(pipe2(pipe_fds, O_CLOEXEC) != 0)
+    {
+        pipe_fds[0] = -1;
+        pipe_fds[1] = -1;
+        return false;
+    }
+
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, FILE_PIPE_SIZE);     // NOLINT(cert-err33-c)
+
+    return true;
+}
+
+static bool splice_through(int socket, const struct file_lease *lease, int pipe_fds[2])
+{
+    off_t offset;
+
+    offset = 0;
+
+    while(offset < lease->size)
+    {
+        ssize_t in_pipe;
+
+        in_pipe = splice(lease->fd, &offset, pipe_fds[1], NULL, (size_t)(lease->size - offset), SPLICE_F_MOVE);
+
+        if(in_pipe < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if(in_pipe <= 0)
+        {
+            return false;
+        }
+
+        while(in_pipe > 0)
+        {
+            ssize_t sent;
+
+            // like MSG_MORE, SPLICE_F_MORE on the last bytes would leave them waiting for data that never comes
+            sent = splice(pipe_fds[0], NULL, socket, NULL, (size_t)in_pipe, SPLICE_F_MOVE | (offset < lease->size ? SPLICE_F_MORE : 0));
+
+            if(sent > 0)
+            {
+                in_pipe -= sent;
+                atomic_fetch_add_explicit(&counters.bytes_sent, (uint64_t)sent, memory_order_relaxed);
+            }
+            else if((sent < 0 && errno == EINTR) || (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && wait_writable(socket)))
+            {
+                continue;
+            }
+            else
+            {
+                // the pipe still holds part of this reply, the next one gets a fresh pipe
+                close(pipe_fds[0]);     // NOLINT(cert-err33-c)
+                close(pipe_fds[1]);     // NOLINT(cert-err33-c)
+                pipe_fds[0] = -1;
+                pipe_fds[1] = -1;
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool copy_body(int socket, const struct file_lease *lease)
+{
+    uint8_t *buffer;
+    bool sent;
+
+    // the thread's buffer, unless a fiber that waited mid-reply is still sending from it
+    if(copy_buffer_busy)
+    {
+        buffer = (uint8_t *)malloc(FILE_COPY_SIZE);
+    }
+    else
+    {
+        if(copy_buffer == NULL)
+        {
+            copy_buffer = (uint8_t *)malloc(FILE_COPY_SIZE);
+        }
+
+        buffer = copy_buffer;
+        copy_buffer_busy = buffer != NULL;
+    }
+
+    if(buffer == NULL)
+    {
+        return false;
+    }
+
+    sent = copy_through(socket, lease, buffer);
+
+    if(buffer == copy_buffer)
+    {
+        copy_buffer_busy = false;
+    }
+    else
+    {
+        free(buffer);
+    }
+
+    return sent;
+}
+
+static bool copy_through(int socket, const struct file_lease *lease, uint8_t *buffer)
+{
+    off_t offset;
+
+    offset = 0;
+
+    while(offset < lease->size)
+    {
+        ssize_t got;
+
+        got = pread(lease->fd, buffer, FILE_COPY_SIZE, offset);
+
+        if(got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if(got <= 0 || !send_all(socket, buffer, (size_t)got, offset + got < lease->size ? MSG_MORE : 0))
+        {
+            return false;
+        }
+
+        offset += got;
+        atomic_fetch_add_explicit(&counters.bytes_sent, (uint64_t)got, memory_order_relaxed);
+    }
+
+    return true;
+}
+
+static bool wait_writable(int socket)
+{
+    // client sockets are non-blocking in the event servers, a reply larger than the send buffer waits here, or in a
+    // fiber goes back to the loop until the socket drains
+    return fiber_wait_fd(socket, POLLOUT, FILE_SEND_TIMEOUT_MS);
+}
@@ -0,0 +1,154 @@
+#include "instrument.h"
+#include <string.h>
+#include <time.h>
+
+#define NS_PER_SEC 1000000000ULL
+#define NS_PER_US 1000
+#define PERCENTILE_50 50
+#define PERCENTILE_99 99
+#define PERCENT 100
+
+static const char *const STAGE_NAMES[STAGE_COUNT] = {
+    "dispatch",
+    "handoff",
+    "read",
+    "process",
+    "send",
+    "revive",
+    "total",
+};
+
+static unsigned int bucket_index(uint64_t value);
+static uint64_t percentile(const struct stage_histogram *histogram, unsigned int percent);
+
+void instrument_init(struct instrument *instrument, bool enabled)
+{
+    memset(instrument, 0, sizeof(*instrument));
+    instrument->enabled = enabled;
+
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        instrument->stages[i].min_ns = UINT64_MAX;
+    }
+}
+
+uint64_t instrument_stamp(const struct instrument *instrument)
+{
+    struct timespec now;
+
+    if(!instrument->enabled)
+    {
+        return 0;
+    }
+
+    // CLOCK_MONOTONIC is served from the vDSO and is comparable across the parent and the workers
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+}
+
+void instrument_record(struct instrument *instrument, enum instrument_stage stage, uint64_t start_ns, uint64_t end_ns)
+{
+    struct stage_histogram *histogram;
+    uint64_t elapsed;
+
+    // a zero timestamp means the other end of the pipeline was not instrumented
+    if(!instrument->enabled || start_ns == 0 || end_ns < start_ns)
+    {
+        return;
+    }
+
+    histogram = &instrument->stages[stage];
+    elapsed = end_ns - start_ns;
+    histogram->buckets[bucket_index(elapsed)]++;
+    histogram->count++;
+    histogram->sum_ns += elapsed;
+
+    if(elapsed < histogram->min_ns)
+    {
+        histogram->min_ns = elapsed;
+    }
+
+    if(elapsed > histogram->max_ns)
+    {
+        histogram->max_ns = elapsed;
+    }
+}
+
+void instrument_report(const struct instrument *instrument, FILE *stream, const char *label)
+{
+    if(!instrument->enabled)
+    {
+        return;
+    }
+
+    fprintf(stream, "%s stage latency (us): stage count min p50 p99 max mean\n", label);   // NOLINT(cert-err33-c)
+
+    for(int i = 0; i < STAGE_COUNT; i++)
+    {
+        const struct stage_histogram *histogram;
+
+        histogram = &instrument->stages[i];
+
+        if(histogram->count == 0)
+        {
+            continue;
+        }
+
+        fprintf(stream, "%s %s %llu %.3f %.3f %.3f %.3f %.3f\n",     // NOLINT(cert-err33-c)
+                label,
+                STAGE_NAMES[i],
+                (unsigned long long)histogram->count,
+                (double)histogram->min_ns / NS_PER_US,
+                (double)percentile(histogram, PERCENTILE_50) / NS_PER_US,
+                (double)percentile(histogram, PERCENTILE_99) / NS_PER_US,
+                (double)histogram->max_ns / NS_PER_US,
+                (double)histogram->sum_ns / (double)histogram->count / NS_PER_US);
+    }
+}
+
+static unsigned int bucket_index(uint64_t value)
+{
+    if(value == 0)
+    {
+        return 0;
+    }
+
+    return (unsigned int)(INSTRUMENT_BUCKETS - __builtin_clzll(value)) - 1;
+}
+
+static uint64_t percentile(const struct stage_histogram *histogram, unsigned int percent)
+{
+    uint64_t target;
+    uint64_t seen;
+
+    // report the upper bound of the bucket holding the percentile, clamped to the observed range
+    target = (histogram->count * percent + PERCENT - 1) / PERCENT;
+    seen = 0;
+
+    for(unsigned int i = 0; i < INSTRUMENT_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+
+        if(seen >= target)
+        {
+            uint64_t upper;
+
+            upper = (i + 1 < INSTRUMENT_BUCKETS) ? (1ULL << (i + 1)) - 1 : UINT64_MAX;
+
+            if(upper > histogram->max_ns)
+            {
+                upper = histogram->max_ns;
+            }
+
+            if(upper < histogram->min_ns)
+            {
+                upper = histogram->min_ns;
+            }
+
+            return upper;
+        }
+    }
+
+    return histogram->max_ns;
+}
@@ -0,0 +1,123 @@
+#include "kernels.h"
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <x86intrin.h>
+#define BENCH_UNIT "bytes/cycle"
+#else
+#define BENCH_UNIT "bytes/ns"
+#endif
+
+enum bench_kernel
+{
+    BENCH_CRC32C,
+    BENCH_SCAN,
+    BENCH_NORMALIZE
+};
+
+static double measure(const struct kernel_set *set, enum bench_kernel kernel, const uint8_t *data, uint8_t *out, size_t size);
+static uint64_t bench_clock(void);
+
+
+#define BENCH_BYTES (64U * 1024U * 1024U)    // per measurement, so small payloads run enough iterations
+#define BENCH_MAX_SIZE (64U * 1024U)
+
+static const size_t bench_sizes[] = {64, 256, 1024, 4096, 16384, BENCH_MAX_SIZE};    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+static const char *bench_names[] = {"crc32c", "scan", "normalize"};
+static volatile size_t bench_sink;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+void kernels_benchmark(FILE *out)
+{
+    const struct kernel_set *sets[KERNEL_MAX_SETS];
+    size_t num_sets;
+    uint8_t *data;
+    uint8_t *output;
+
+    data = (uint8_t *)malloc(BENCH_MAX_SIZE);
+    output = (uint8_t *)malloc(BENCH_MAX_SIZE);
+
+    if(data == NULL || output == NULL)
+    {
+        free(data);
+        free(output);
+        return;
+    }
+
+    // mixed case text with a record separator every 64 bytes or so
+    srand(1);
+
+    for(size_t i = 0; i < BENCH_MAX_SIZE; i++)
+    {
+        data[i] = (uint8_t)(rand() % 64 == 0 ? '\n' : ' ' + rand() % ('~' - ' '));    // NOLINT(cert-msc30-c,cert-msc50-cpp,concurrency-mt-unsafe,cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+
+    num_sets = kernels_supported(sets);
+    fprintf(out, "Active kernel set: %s\n", kernels_active()->name);    // NOLINT(cert-err33-c)
+    fprintf(out, "%-10s %-8s %8s %12s\n", "kernel", "set", "size", BENCH_UNIT);     // NOLINT(cert-err33-c)
+
+    for(int kernel = BENCH_CRC32C; kernel <= BENCH_NORMALIZE; kernel++)
+    {
+        for(size_t s = 0; s < sizeof(bench_sizes) / sizeof(bench_sizes[0]); s++)
+        {
+            for(size_t i = 0; i < num_sets; i++)
+            {
+                double rate;
+
+                rate = measure(sets[i], (enum bench_kernel)kernel, data, output, bench_sizes[s]);
+                fprintf(out, "%-10s %-8s %8zu %12.3f\n", bench_names[kernel], sets[i]->name, bench_sizes[s], rate);     // NOLINT(cert-err33-c)
+            }
+        }
+    }
+
+    free(data);
+    free(output);
+}
+
+static double measure(const struct kernel_set *set, enum bench_kernel kernel, const uint8_t *data, uint8_t *out, size_t size)
+{
+    size_t iterations;
+    uint64_t start;
+    uint64_t elapsed;
+    size_t last;
+
+    iterations = BENCH_BYTES / size;
+    start = bench_clock();
+
+    for(size_t i = 0; i < iterations; i++)
+    {
+        switch(kernel)
+        {
+            case BENCH_CRC32C:
+                bench_sink = set->crc32c(~0U, data, size);
+                break;
+            case BENCH_SCAN:
+                bench_sink = set->scan(data, size, '\n', &last);
+                break;
+            case BENCH_NORMALIZE:
+                set->normalize(data, out, size);
+                bench_sink = out[size - 1];
+                break;
+            default:
+                break;
+        }
+    }
+
+    elapsed = bench_clock() - start;
+
+    return elapsed == 0 ? 0 : (double)(iterations * size) / (double)elapsed;
+}
+
+static uint64_t bench_clock(void)
+{
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    // reference cycles, the same as core cycles when frequency scaling is off
+    return __rdtsc();
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000U + (uint64_t)now.tv_nsec;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+#endif
+}
@@ -0,0 +1,408 @@
+#include "kernels.h"
+#include <arpa/inet.h>
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+static void init_kernels(void);
+static uint32_t crc32c_scalar(uint32_t crc, const uint8_t *data, size_t length);
+static size_t scan_scalar(const uint8_t *data, size_t length, uint8_t delimiter, size_t *last);
+static void normalize_scalar(const uint8_t *data, uint8_t *out, size_t length);
+static uint8_t normalize_byte(uint8_t byte);
+#ifdef KERNELS_X86
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t length);
+static size_t scan_sse42(const uint8_t *data, size_t length, uint8_t delimiter, size_t *last);
+static void normalize_sse42(const uint8_t *data, uint8_t *out, size_t length);
+static size_t scan_avx2(const uint8_t *data, size_t length, uint8_t delimiter, size_t *last);
+static void normalize_avx2(const uint8_t *data, uint8_t *out, size_t length);
+#endif
+
+
+#define CRC32C_POLYNOMIAL 0x82F63B78U   // Castagnoli, bit reversed
+#define CRC_TRAILER_SIZE 4
+
+static uint32_t crc32c_table[256];  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables,cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+static const struct kernel_set *active_set = NULL;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static const struct kernel_set *supported_sets[KERNEL_MAX_SETS];  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static size_t num_supported_sets = 0;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+static const struct kernel_set scalar_set = {"scalar", crc32c_scalar, scan_scalar, normalize_scalar};
+#ifdef KERNELS_X86
+static const struct kernel_set sse42_set = {"sse4.2", crc32c_sse42, scan_sse42, normalize_sse42};
+// there is no wider CRC32 instruction, the AVX2 set keeps the SSE4.2 one
+static const struct kernel_set avx2_set = {"avx2", crc32c_sse42, scan_avx2, normalize_avx2};
+#endif
+
+const struct kernel_set *kernels_active(void)
+{
+    pthread_once(&kernels_once, init_kernels);
+
+    return active_set;
+}
+
+size_t kernels_supported(const struct kernel_set *sets[KERNEL_MAX_SETS])
+{
+    pthread_once(&kernels_once, init_kernels);
+
+    for(size_t i = 0; i < num_supported_sets; i++)
+    {
+        sets[i] = supported_sets[i];
+    }
+
+    return num_supported_sets;
+}
+
+uint32_t kernel_crc32c(const uint8_t *data, size_t length)
+{
+    return ~kernels_active()->crc32c(~0U, data, length);
+}
+
+size_t process_crc32c_handler(const struct dc_env *env, struct dc_error *err, const uint8_t *raw_data, uint8_t **processed_data, ssize_t count)
+{
+    size_t length;
+    uint32_t expected;
+
+    DC_TRACE(env);
+
+    if(count < CRC_TRAILER_SIZE)
+    {
+        DC_ERROR_RAISE_USER(err, "Message too short for a CRC32C trailer", -1);
+        return 0;
+    }
+
+    length = (size_t)count - CRC_TRAILER_SIZE;
+    dc_memcpy(env, &expected, &raw_data[length], sizeof(expected));
+
+    if(kernel_crc32c(raw_data, length) != ntohl(expected))
+    {
+        DC_ERROR_RAISE_USER(err, "CRC32C mismatch", -1);
+        return 0;
+    }
+
+    *processed_data = dc_malloc(env, err, (size_t)count);
+
+    if(*processed_data == NULL)
+    {
+        return 0;
+    }
+
+    dc_memcpy(env, *processed_data, raw_data, length);
+
+    return length;
+}
+
+size_t process_lines_handler(const struct dc_env *env, struct dc_error *err, const uint8_t *raw_data, uint8_t **processed_data, ssize_t count)
+{
+    size_t last;
+    size_t length;
+
+    DC_TRACE(env);
+    *processed_data = dc_malloc(env, err, (size_t)count);
+
+    if(*processed_data == NULL)
+    {
+        return 0;
+    }
+
+    kernels_active()->scan(raw_data, (size_t)count, '\n', &last);
+    length = last == KERNEL_NOT_FOUND ? 0 : last + 1;
+    dc_memcpy(env, *processed_data, raw_data, length);
+
+    return length;
+}
+
+size_t process_normalize_handler(const struct dc_env *env, struct dc_error *err, const uint8_t *raw_data, uint8_t **processed_data, ssize_t count)
+{
+    DC_TRACE(env);
+    *processed_data = dc_malloc(env, err, (size_t)count);
+
+    if(*processed_data == NULL)
+    {
+        return 0;
+    }
+
+    kernels_active()->normalize(raw_data, *processed_data, (size_t)count);
+
+    return (size_t)count;
+}
+
+process_message_func kernel_processor(const char *name)
+{
+    if(strcmp(name, "crc32c") == 0)
+    {
+        return process_crc32c_handler;
+    }
+
+    if(strcmp(name, "lines") == 0)
+    {
+        return process_lines_handler;
+    }
+
+    if(strcmp(name, "normalize") == 0)
+    {
+        return process_normalize_handler;
+    }
+
+    return NULL;
+}
+
+static void init_kernels(void)
+{
+    for(uint32_t i = 0; i < sizeof(crc32c_table) / sizeof(crc32c_table[0]); i++)
+    {
+        uint32_t crc;
+
+        crc = i;
+
+        for(int bit = 0; bit < 8; bit++)  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        {
+            crc = (crc & 1U) ? (crc >> 1U) ^ CRC32C_POLYNOMIAL : crc >> 1U;
+        }
+
+        crc32c_table[i] = crc;
+    }
+
+    supported_sets[num_supported_sets++] = &scalar_set;
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("sse4.2"))
+    {
+        supported_sets[num_supported_sets++] = &sse42_set;
+
+        if(__builtin_cpu_supports("avx2"))
+        {
+            supported_sets[num_supported_sets++] = &avx2_set;
+        }
+    }
+#endif
+    active_set = supported_sets[num_supported_sets - 1];
+}
+
+static uint32_t crc32c_scalar(uint32_t crc, const uint8_t *data, size_t length)
+{
+    for(size_t i = 0; i < length; i++)
+    {
+        crc = crc32c_table[(crc ^ data[i]) & 0xFFU] ^ (crc >> 8U);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    }
+
+    return crc;
+}
+
+static size_t scan_scalar(const uint8_t *data, size_t length, uint8_t delimiter, size_t *last)
+{
+    size_t count;
+
+    count = 0;
+    *last = KERNEL_NOT_FOUND;
+
+    for(size_t i = 0; i < length; i++)
+    {
+        if(data[i] == delimiter)
+        {
+            count++;
+            *last = i;
+        }
+    }
+
+    return count;
+}
+
+static void normalize_scalar(const uint8_t *data, uint8_t *out, size_t length)
+{
+    for(size_t i = 0; i < length; i++)
+    {
+        out[i] = normalize_byte(data[i]);
+    }
+}
+
+static uint8_t normalize_byte(uint8_t byte)
+{
+    if(byte >= 'A' && byte <= 'Z')
+    {
+        return (uint8_t)(byte + ('a' - 'A'));
+    }
+
+    if(byte >= '\t' && byte <= '\r')
+    {
+        return ' ';
+    }
+
+    return byte;
+}
+
+#ifdef KERNELS_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *data, size_t length)
+{
+    uint64_t crc64;
+    size_t i;
+
+    crc64 = crc;
+
+    for(i = 0; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+
+        memcpy(&word, &data[i], sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+
+    crc = (uint32_t)crc64;
+
+    for(; i < length; i++)
+    {
+        crc = _mm_crc32_u8(crc, data[i]);
+    }
+
+    return crc;
+}
+
+__attribute__((target("sse4.2")))
+static size_t scan_sse42(const uint8_t *data, size_t length, uint8_t delimiter, size_t *last)
+{
+    __m128i needle;
+    size_t count;
+    size_t i;
+    size_t tail_last;
+
+    needle = _mm_set1_epi8((char)delimiter);
+    count = 0;
+    *last = KERNEL_NOT_FOUND;
+
+    for(i = 0; i + sizeof(__m128i) <= length; i += sizeof(__m128i))
+    {
+        unsigned int mask;
+
+        mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&data[i]), needle));
+
+        if(mask != 0)
+        {
+            count += (size_t)__builtin_popcount(mask);
+            *last = i + (size_t)(31 - __builtin_clz(mask));    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        }
+    }
+
+    count += scan_scalar(&data[i], length - i, delimiter, &tail_last);
+
+    if(tail_last != KERNEL_NOT_FOUND)
+    {
+        *last = i + tail_last;
+    }
+
+    return count;
+}
+
+__attribute__((target("sse4.2")))
+static void normalize_sse42(const uint8_t *data, uint8_t *out, size_t length)
+{
+    __m128i before_upper;
+    __m128i after_upper;
+    __m128i before_space;
+    __m128i after_space;
+    __m128i case_bit;
+    __m128i spaces;
+    size_t i;
+
+    // signed compares, so bytes >= 0x80 are below every bound and pass through
+    before_upper = _mm_set1_epi8('A' - 1);
+    after_upper = _mm_set1_epi8('Z' + 1);
+    before_space = _mm_set1_epi8('\t' - 1);
+    after_space = _mm_set1_epi8('\r' + 1);
+    case_bit = _mm_set1_epi8('a' - 'A');
+    spaces = _mm_set1_epi8(' ');
+
+    for(i = 0; i + sizeof(__m128i) <= length; i += sizeof(__m128i))
+    {
+        __m128i bytes;
+        __m128i upper;
+        __m128i space;
+
+        bytes = _mm_loadu_si128((const __m128i *)&data[i]);
+        upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, before_upper), _mm_cmplt_epi8(bytes, after_upper));
+        space = _mm_and_si128(_mm_cmpgt_epi8(bytes, before_space), _mm_cmplt_epi8(bytes, after_space));
+        bytes = _mm_add_epi8(bytes, _mm_and_si128(upper, case_bit));
+        bytes = _mm_or_si128(_mm_andnot_si128(space, bytes), _mm_and_si128(space, spaces));
+        _mm_storeu_si128((__m128i *)&out[i], bytes);
+    }
+
+    normalize_scalar(&data[i], &out[i], length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2(const uint8_t *data, size_t length, uint8_t delimiter, size_t *last)
+{
+    __m256i needle;
+    size_t count;
+    size_t i;
+    size_t tail_last;
+
+    needle = _mm256_set1_epi8((char)delimiter);
+    count = 0;
+    *last = KERNEL_NOT_FOUND;
+
+    for(i = 0; i + sizeof(__m256i) <= length; i += sizeof(__m256i))
+    {
+        unsigned int mask;
+
+        mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&data[i]), needle));
+
+        if(mask != 0)
+        {
+            count += (size_t)__builtin_popcount(mask);
+            *last = i + (size_t)(31 - __builtin_clz(mask));    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        }
+    }
+
+    count += scan_sse42(&data[i], length - i, delimiter, &tail_last);
+
+    if(tail_last != KERNEL_NOT_FOUND)
+    {
+        *last = i + tail_last;
+    }
+
+    return count;
+}
+
+__attribute__((target("avx2")))
+static void normalize_avx2(const uint8_t *data, uint8_t *out, size_t length)
+{
+    __m256i before_upper;
+    __m256i after_upper;
+    __m256i before_space;
+    __m256i after_space;
+    __m256i case_bit;
+    __m256i spaces;
+    size_t i;
+
+    before_upper = _mm256_set1_epi8('A' - 1);
+    after_upper = _mm256_set1_epi8('Z' + 1);
+    before_space = _mm256_set1_epi8('\t' - 1);
+    after_space = _mm256_set1_epi8('\r' + 1);
+    case_bit = _mm256_set1_epi8('a' - 'A');
+    spaces = _mm256_set1_epi8(' ');
+
+    for(i = 0; i + sizeof(__m256i) <= length; i += sizeof(__m256i))
+    {
+        __m256i bytes;
+        __m256i upper;
+        __m256i space;
+
+        bytes = _mm256_loadu_si256((const __m256i *)&data[i]);
+        upper = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, before_upper), _mm256_cmpgt_epi8(after_upper, bytes));
+        space = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, before_space), _mm256_cmpgt_epi8(after_space, bytes));
+        bytes = _mm256_add_epi8(bytes, _mm256_and_si256(upper, case_bit));
+        bytes = _mm256_blendv_epi8(bytes, spaces, space);
+        _mm256_storeu_si256((__m256i *)&out[i], bytes);
+    }
+
+    normalize_sse42(&data[i], &out[i], length - i);
+}
+#endif
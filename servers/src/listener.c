@@ -0,0 +1,158 @@
+#include "listener.h"
+#include "socket_tuning.h"
+#include <arpa/inet.h>
+#include <dc_c/dc_stdio.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+int listener_open(const struct dc_env *env, struct dc_error *err, const char *address, in_port_t port, int backlog)
+{
+    int listener;
+    int option_value;
+    struct sockaddr_in server_addr;
+
+    DC_TRACE(env);
+    listener = dc_socket(env, err, AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    if(listener < 0)
+    {
+        dc_perror(env, "socket");
+        return -1;
+    }
+
+    option_value = 1;
+    dc_setsockopt(env, err, listener, SOL_SOCKET, SO_REUSEADDR, &option_value, sizeof(option_value));
+    socket_tuning_listener(env, listener, AF_INET);
+
+    dc_memset(env, &server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = inet_addr(address);
+    server_addr.sin_port = htons(port);
+
+    if(dc_bind(env, err, listener, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        dc_perror(env, "bind");
+        dc_close(env, err, listener);
+        return -1;
+    }
+
+    if(dc_listen(env, err, listener, backlog) < 0)
+    {
+        dc_perror(env, "listen");
+        dc_close(env, err, listener);
+        return -1;
+    }
+
+    return listener;
+}
+
+int listener_open_unix(const struct dc_env *env, struct dc_error *err, const char *path, int backlog)
+{
+    int listener;
+    struct sockaddr_un server_addr;
+    struct stat existing;
+    size_t length;
+
+    DC_TRACE(env);
+    length = dc_strlen(env, path);
+
+    if(length >= sizeof(server_addr.sun_path))
+    {
+        DC_ERROR_RAISE_USER(err, "Unix socket path is too long", -1);
+        return -1;
+    }
+
+    // a socket left behind by a server that did not shut down cleanly, never remove anything else
+    if(stat(path, &existing) == 0)
+    {
+        if(!S_ISSOCK(existing.st_mode))
+        {
+            DC_ERROR_RAISE_USER(err, "Unix socket path exists and is not a socket", -1);
+            return -1;
+        }
+
+        unlink(path);
+    }
+
+    listener = dc_socket(env, err, AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+    if(listener < 0)
+    {
+        dc_perror(env, "socket");
+        return -1;
+    }
+
+    socket_tuning_listener(env, listener, AF_UNIX);
+    dc_memset(env, &server_addr, 0, sizeof(server_addr));
+    server_addr.sun_family = AF_UNIX;
+    dc_memcpy(env, server_addr.sun_path, path, length);
+
+    if(dc_bind(env, err, listener, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+        dc_perror(env, "bind");
+        dc_close(env, err, listener);
+        return -1;
+    }
+
+    if(dc_listen(env, err, listener, backlog) < 0)
+    {
+        dc_perror(env, "listen");
+        dc_close(env, err, listener);
+        unlink(path);
+        return -1;
+    }
+
+    return listener;
+}
+
+void listener_close_unix(const struct dc_env *env, struct dc_error *err, int listener, const char *path)
+{
+    DC_TRACE(env);
+
+    if(listener < 0)
+    {
+        return;
+    }
+
+    dc_close(env, err, listener);
+
+    if(path && unlink(path) != 0 && errno != ENOENT)
+    {
+        dc_perror(env, "unlink");
+    }
+}
+
+int listener_accept(const struct dc_env *env, struct dc_error *err, int listener, struct sockaddr_storage *address, int flags)
+{
+    socklen_t address_len;
+    int client_fd;
+
+    DC_TRACE(env);
+    address_len = sizeof(*address);
+
+    // flags set atomically, so no fork or exec in between sees a descriptor without them
+    client_fd = accept4(listener, (struct sockaddr *)address, &address_len, flags);
+
+    if(client_fd < 0)
+    {
+        // nothing left in the queue, or the client gave up before it was accepted
+        if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+        {
+            char *error_message;
+
+            error_message = dc_strerror(env, err, errno);
+            DC_ERROR_RAISE_SYSTEM(err, error_message, errno);
+        }
+
+        return -1;
+    }
+
+    socket_tuning_connection(env, client_fd, address->ss_family);
+
+    return client_fd;
+}
@@ -1,4 +1,8 @@
+#include "file_server.h"
+#include "kernels.h"
 #include "server.h"
+#include "server_config.h"
+#include "socket_tuning.h"
 #include "util.h"
 #include <arpa/inet.h>
 #include <dc_c/dc_string.h>
@@ -8,8 +12,12 @@
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 
-#define DEFAULT_PORT 5000
+#define METRICS_PATH "metrics.bin"
+#define MAX_COMPUTE_THREADS 1024
+#define MAX_CACHE_MB 65536
+#define BYTES_PER_MB (1024 * 1024)
 
 /**
  * Parse the cmd line arguments and setup the options struct.
@@ -39,6 +47,10 @@ static int run_corresponding_server(struct dc_env * env, struct dc_error * error
  * @param error Error object.
  */
 static void close_server(struct dc_error * error);
+/**
+ * Raise the soft descriptor limit to the hard one, every connection costs a descriptor.
+ */
+static void raise_file_limit(void);
 
 int main(int argc, char * argv[])
 {
@@ -66,6 +78,9 @@ int main(int argc, char * argv[])
         run_corresponding_server(env, err, &opts);
     }
 
+    metrics_log_close(&opts.metrics);
+    file_server_destroy();
+
     close_server(err);
 
     // Free memory
@@ -79,6 +94,31 @@ int main(int argc, char * argv[])
 static int run_corresponding_server(struct dc_env * env, struct dc_error * error, struct options *opts) {
     int exit_status = -1;
 
+    if (opts->kernel && !message_handler_use_kernel(opts->kernel)) {
+        DC_ERROR_RAISE_USER(error, "Unknown kernel (crc32c, lines, normalize)\n", 1);
+        return exit_status;
+    }
+
+    if (opts->file_root && !message_handler_use_files(env, error, opts->file_root, (enum file_transfer)opts->config.file_transfer)) {
+        return exit_status;
+    }
+
+    if (!socket_tuning_configure(opts->socket_tuning)) {
+        DC_ERROR_RAISE_USER(error, "Invalid socket tuning (nodelay|cork, defer=S, rcvbuf=B, sndbuf=B, busypoll=US, fastopen=N)\n", 1);
+        return exit_status;
+    }
+
+    if (opts->socket_tuning) {
+        socket_tuning_report(stdout);
+    }
+
+    set_read_size((size_t)opts->config.read_buffer_size);
+    raise_file_limit();
+
+    if (opts->tune_path) {
+        return run_autotune(env, error, opts);
+    }
+
     switch (opts->server_to_run)
     {
         case ONE_TO_ONE: {
@@ -100,6 +140,21 @@ static int run_corresponding_server(struct dc_env * env, struct dc_error * error
             exit_status = run_thread_poll_server(env, error, opts);
             return exit_status;
         }
+        case EPOLL_SERVER:
+        {
+            exit_status = run_epoll_server(env, error, opts);
+            return exit_status;
+        }
+        case UDP_SERVER:
+        {
+            exit_status = run_udp_server(env, error, opts);
+            return exit_status;
+        }
+        case KERNEL_BENCHMARK:
+        {
+            kernels_benchmark(stdout);
+            return EXIT_SUCCESS;
+        }
         default:{
             DC_ERROR_RAISE_USER(error, "Invalid Specified Server Type\n", 1);
             return exit_status;
@@ -107,18 +162,37 @@ static int run_corresponding_server(struct dc_env * env, struct dc_error * error
     }
 }
 
+static void raise_file_limit(void)
+{
+    struct rlimit limit;
+
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
 static void options_init(struct dc_env * env, struct options *opts)
 {
     dc_memset(env, opts, 0, sizeof(struct options));
-    opts->port_out = DEFAULT_PORT;
+    server_config_defaults(&opts->config);
+    opts->metrics.fd = -1;
 }
 
 static int parse_arguments(struct dc_env * env, struct dc_error * error, int argc, char *argv[], struct options *opts)
 {
+    bool truncate_metrics = false;
+
+    // Measure the processor kernels instead of serving
+    if (argc == 2 && dc_strcmp(env, argv[1], "bench") == 0) {
+        opts->server_to_run = KERNEL_BENCHMARK;
+        return 0;
+    }
+
     // Ensure ip address and run flag is given in order to run
     if (argc <= 2) {
         DC_ERROR_RAISE_USER(error, "Please give an IP Address as first argument and the run flag as the second "
-                                   "(o -> one-to-one server, p -> poll server, s -> select server) [t -> truncate csv file]\n", 1);
+                                   "(o -> one-to-one server, p -> poll server, s -> select server, t -> thread pool server, e -> epoll server, u -> udp server) [t -> truncate metrics log] [i -> instrument] [a -> pin to CPUs] [g -> UDP GRO/GSO] [y -> fibers] [h=handler.so] [c=compute threads] [k=crc32c|lines|normalize] [m=cache MiB] [x=unix socket path, X=path without TCP] [q=shared memory ring socket path] [n=socket tuning] [r=file root] [w=fairness classes] [f=config file] [key=value, e.g. workers=8] [tune=output file], or bench to measure the kernels\n", 1);
         return -1;
     }
 
@@ -128,8 +202,7 @@ static int parse_arguments(struct dc_env * env, struct dc_error * error, int arg
         return -1;
     }
 
-    printf("Listening on ip address: %s \n", argv[1]);
-    printf("Port number: %d \n\n", opts->port_out);
+    opts->argv = argv;
     opts->ip_address = argv[1];
 
     // Check to see what server to run
@@ -141,21 +214,97 @@ static int parse_arguments(struct dc_env * env, struct dc_error * error, int arg
         opts->server_to_run = SELECT_SERVER;
     } else if (dc_strcmp(env, argv[2], "t") == 0) {
         opts->server_to_run = THREAD_POLL_SERVER;
+    } else if (dc_strcmp(env, argv[2], "e") == 0) {
+        opts->server_to_run = EPOLL_SERVER;
+    } else if (dc_strcmp(env, argv[2], "u") == 0) {
+        opts->server_to_run = UDP_SERVER;
     } else {
         DC_ERROR_RAISE_USER(error, "Invalid Server Type (o -> one-to-one server, p -> poll server)\n", -1);
         return -1;
     }
 
-    // Optional truncate csv file
-    if (argc == 4) {
-        if (dc_strcmp(env, argv[3], "t") == 0) {
-            opts->csv_file = fopen("states.csv", "we");
+    // f=path -> configuration file, read first so key=value arguments override it wherever they appear
+    for (int i = 3; i < argc; i++) {
+        if (dc_strncmp(env, argv[i], "f=", 2) == 0 && !server_config_load(env, error, &opts->config, &argv[i][2])) {
+            return -1;
+        }
+    }
+
+    // Optional flags: t -> truncate the metrics log, i -> instrument the request pipeline, a -> pin to CPUs, y -> fibers,
+    // h=path -> handler plugin, c=N -> compute threads, k=name -> processor kernel, m=MiB -> result cache,
+    // x=path / X=path -> Unix domain socket, q=path -> shared memory ring clients, n=profile -> socket tuning,
+    // r=path -> serve files, w=classes -> fairness weights, tune=path -> sweep the configuration, key=value -> configuration
+    for (int i = 3; i < argc; i++) {
+        if (dc_strcmp(env, argv[i], "t") == 0) {
+            truncate_metrics = true;
+        } else if (dc_strcmp(env, argv[i], "i") == 0) {
+            opts->instrument = true;
+        } else if (dc_strcmp(env, argv[i], "a") == 0) {
+            opts->pin_cpus = true;
+        } else if (dc_strcmp(env, argv[i], "g") == 0) {
+            opts->udp_segmentation = true;
+        } else if (dc_strcmp(env, argv[i], "y") == 0) {
+            opts->fibers = true;
+        } else if (dc_strncmp(env, argv[i], "h=", 2) == 0 && argv[i][2] != '\0') {
+            opts->handler_path = &argv[i][2];
+        } else if (dc_strncmp(env, argv[i], "c=", 2) == 0) {
+            long threads = strtol(&argv[i][2], NULL, 10);
+
+            if (threads <= 0 || threads > MAX_COMPUTE_THREADS) {
+                DC_ERROR_RAISE_USER(error, "Invalid number of compute threads", -1);
+                return -1;
+            }
+
+            opts->compute_threads = (int)threads;
+        } else if (dc_strncmp(env, argv[i], "k=", 2) == 0 && argv[i][2] != '\0') {
+            opts->kernel = &argv[i][2];
+        } else if (dc_strncmp(env, argv[i], "m=", 2) == 0) {
+            long megabytes = strtol(&argv[i][2], NULL, 10);
+
+            if (megabytes <= 0 || megabytes > MAX_CACHE_MB) {
+                DC_ERROR_RAISE_USER(error, "Invalid result cache size", -1);
+                return -1;
+            }
+
+            opts->cache_bytes = (size_t)megabytes * BYTES_PER_MB;
+        } else if ((dc_strncmp(env, argv[i], "x=", 2) == 0 || dc_strncmp(env, argv[i], "X=", 2) == 0) && argv[i][2] != '\0') {
+            opts->unix_path = &argv[i][2];
+            opts->unix_only = argv[i][0] == 'X';
+        } else if (dc_strncmp(env, argv[i], "q=", 2) == 0 && argv[i][2] != '\0') {
+            opts->ring_path = &argv[i][2];
+        } else if (dc_strncmp(env, argv[i], "n=", 2) == 0 && argv[i][2] != '\0') {
+            opts->socket_tuning = &argv[i][2];
+        } else if (dc_strncmp(env, argv[i], "r=", 2) == 0 && argv[i][2] != '\0') {
+            opts->file_root = &argv[i][2];
+        } else if (dc_strncmp(env, argv[i], "w=", 2) == 0 && argv[i][2] != '\0') {
+            opts->fair_classes = &argv[i][2];
+        } else if (dc_strncmp(env, argv[i], "tune=", 5) == 0 && argv[i][5] != '\0') {    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            opts->tune_path = &argv[i][5];    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        } else if (server_config_set(&opts->config, argv[i]) == SERVER_CONFIG_INVALID) {
+            fprintf(stderr, "Invalid setting %s\n", argv[i]);    // NOLINT(cert-err33-c)
+            DC_ERROR_RAISE_USER(error, "Invalid configuration value", -1);
+            return -1;
         }
     }
 
-    // Open CSV File if not already open
-    if (!opts->csv_file) {
-        opts->csv_file = fopen("states.csv", "ae");
+    if (!opts->unix_only) {
+        printf("Listening on ip address: %s \n", argv[1]);
+        printf("Port number: %d \n", opts->config.port);
+    }
+
+    if (opts->unix_path) {
+        printf("Listening on Unix domain socket: %s \n", opts->unix_path);
+    }
+
+    if (opts->ring_path) {
+        printf("Shared memory ring clients connect to: %s \n", opts->ring_path);
+    }
+
+    printf("\n");
+
+    // Open the metrics log, without it the server still runs and only prints its states
+    if (!metrics_log_open(&opts->metrics, METRICS_PATH, truncate_metrics)) {
+        perror(METRICS_PATH);
     }
 
     return 0;
@@ -0,0 +1,232 @@
+#include "kernels.h"
+#include "message_handler.h"
+#include "result_cache.h"
+#include "socket_tuning.h"
+#include "util.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_dlfcn.h>
+#include <dlfcn.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+struct plugin
+{
+    char path[PATH_MAX];
+    void *library;
+    struct message_handler message_handler;
+    handler_init_func init;
+    handler_teardown_func teardown;
+};
+
+
+static struct message_handler builtin_handler = {read_message_handler, process_message_handler, send_message_handler};  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static struct plugin current_plugin = {"", NULL, {read_message_handler, process_message_handler, send_message_handler}, NULL, NULL};  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static handler_teardown_func attached_teardown = NULL;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+void message_handler_default(struct message_handler *message_handler)
+{
+    message_handler->reader = read_message_handler;
+    message_handler->processor = process_message_handler;
+    message_handler->sender = send_message_handler;
+}
+
+bool message_handler_use_kernel(const char *name)
+{
+    process_message_func processor;
+
+    processor = kernel_processor(name);
+
+    if(processor == NULL)
+    {
+        return false;
+    }
+
+    builtin_handler.processor = processor;
+
+    if(current_plugin.library == NULL)
+    {
+        current_plugin.message_handler.processor = processor;
+    }
+
+    printf("Processing with the %s kernel (%s)\n", name, kernels_active()->name);
+
+    return true;
+}
+
+bool message_handler_use_files(const struct dc_env *env, struct dc_error *err, const char *root, enum file_transfer transfer)
+{
+    DC_TRACE(env);
+
+    if(!file_server_init(env, err, root, transfer))
+    {
+        return false;
+    }
+
+    builtin_handler.sender = send_file_handler;
+
+    if(current_plugin.library == NULL)
+    {
+        current_plugin.message_handler.sender = send_file_handler;
+    }
+
+    printf("Serving files under %s\n", root);
+
+    return true;
+}
+
+bool message_handler_load(const struct dc_env *env, struct dc_error *err, const char *path)
+{
+    struct plugin plugin;
+    void *symbol;
+
+    DC_TRACE(env);
+
+    if(strlen(path) >= sizeof(plugin.path))
+    {
+        DC_ERROR_RAISE_USER(err, "Handler path is too long", -1);
+        return false;
+    }
+
+    // a file replaced at the same path has a new inode, so dlopen maps it instead of returning the old handle
+    plugin.library = dc_dlopen(env, err, path, RTLD_NOW | RTLD_LOCAL);
+
+    if(plugin.library == NULL)
+    {
+        return false;
+    }
+
+    strcpy(plugin.path, path);
+    plugin.message_handler = builtin_handler;
+
+    // every symbol is optional, the built-in handlers (including a chosen kernel) fill in for missing ones
+    if((symbol = dlsym(plugin.library, "handler_read")) != NULL)
+    {
+        dc_memcpy(env, &plugin.message_handler.reader, &symbol, sizeof(symbol));
+    }
+
+    if((symbol = dlsym(plugin.library, "handler_process")) != NULL)
+    {
+        dc_memcpy(env, &plugin.message_handler.processor, &symbol, sizeof(symbol));
+    }
+
+    if((symbol = dlsym(plugin.library, "handler_send")) != NULL)
+    {
+        dc_memcpy(env, &plugin.message_handler.sender, &symbol, sizeof(symbol));
+    }
+
+    plugin.init = NULL;
+    plugin.teardown = NULL;
+
+    if((symbol = dlsym(plugin.library, "handler_init")) != NULL)
+    {
+        dc_memcpy(env, &plugin.init, &symbol, sizeof(symbol));
+    }
+
+    if((symbol = dlsym(plugin.library, "handler_teardown")) != NULL)
+    {
+        dc_memcpy(env, &plugin.teardown, &symbol, sizeof(symbol));
+    }
+
+    if(plugin.library == current_plugin.library)
+    {
+        // the same object is still installed, drop the extra reference dlopen took
+        dc_dlclose(env, err, plugin.library);
+    }
+
+    current_plugin = plugin;
+    printf("(pid=%d) Loaded message handlers from %s\n", getpid(), path);
+
+    return true;
+}
+
+bool message_handler_reload(const struct dc_env *env, struct dc_error *err)
+{
+    char path[PATH_MAX];
+
+    DC_TRACE(env);
+
+    if(current_plugin.library == NULL)
+    {
+        return false;
+    }
+
+    // load() overwrites current_plugin.path
+    strcpy(path, current_plugin.path);
+
+    return message_handler_load(env, err, path);
+}
+
+void message_handler_current(struct message_handler *message_handler)
+{
+    *message_handler = current_plugin.message_handler;
+}
+
+bool message_handler_attach(void)
+{
+    if(current_plugin.init && current_plugin.init() != 0)
+    {
+        return false;
+    }
+
+    attached_teardown = current_plugin.teardown;
+
+    return true;
+}
+
+void message_handler_detach(void)
+{
+    if(attached_teardown)
+    {
+        attached_teardown();
+        attached_teardown = NULL;
+    }
+}
+
+bool message_handler_run(const struct dc_env *env, struct dc_error *err, const struct message_handler *message_handler, int client_socket)
+{
+    uint8_t *raw_data;
+    ssize_t raw_data_length;
+    bool closed;
+
+    DC_TRACE(env);
+    raw_data = NULL;
+    raw_data_length = message_handler->reader(env, err, &raw_data, client_socket);
+    closed = true;  // a handler that forgets to set it, or fails, closes the connection
+
+    if(dc_error_has_no_error(err) && raw_data_length > 0)
+    {
+        uint8_t *processed_data;
+        size_t processed_data_length;
+
+        processed_data = NULL;
+        processed_data_length = result_cache_process(env, err, message_handler->processor, raw_data, &processed_data, raw_data_length);
+
+        if(dc_error_has_no_error(err))
+        {
+            message_handler_send(env, err, message_handler, processed_data, processed_data_length, client_socket, &closed);
+        }
+
+        if(processed_data)
+        {
+            dc_free(env, processed_data);
+        }
+    }
+
+    if(raw_data)
+    {
+        dc_free(env, raw_data);
+    }
+
+    return closed;
+}
+
+void message_handler_send(const struct dc_env *env, struct dc_error *err, const struct message_handler *message_handler, uint8_t *buffer, size_t count, int client_socket, bool *closed)
+{
+    DC_TRACE(env);
+    socket_tuning_begin_reply(client_socket);
+    message_handler->sender(env, err, buffer, count, client_socket, closed);
+    socket_tuning_end_reply(client_socket);
+}
@@ -0,0 +1,290 @@
+#include "metrics_log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static bool prepare_header(int fd);
+static bool valid_header(const struct metrics_header *header, size_t size);
+static int intern(struct metrics_log *log, const char *name);
+static int find_string(const struct metrics_header *header, uint32_t count, const char *name);
+
+
+#define NS_PER_SEC 1000000000ULL
+#define LOG_MODE 0644
+
+static const char SCHEMA[] = "timestamp_ns:u64 value:f64 server_id:u16 event_id:u16 pid:u32 reserved:u64";
+
+bool metrics_log_open(struct metrics_log *log, const char *path, bool truncate)
+{
+    void *header;
+
+    log->header = NULL;
+    log->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0), LOG_MODE);
+
+    if(log->fd < 0)
+    {
+        return false;
+    }
+
+    // the process that finds the file empty writes the header, every other one waits for it
+    if(flock(log->fd, LOCK_EX) != 0 || !prepare_header(log->fd))
+    {
+        close(log->fd);     // NOLINT(cert-err33-c)
+        log->fd = -1;
+        return false;
+    }
+
+    flock(log->fd, LOCK_UN);
+    header = mmap(NULL, METRICS_HEADER_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+
+    if(header == MAP_FAILED)
+    {
+        close(log->fd);     // NOLINT(cert-err33-c)
+        log->fd = -1;
+        return false;
+    }
+
+    log->header = (struct metrics_header *)header;
+
+    return true;
+}
+
+bool metrics_log_append(struct metrics_log *log, const char *server, const char *event, double value)
+{
+    struct metrics_record record;
+    struct timespec now;
+    int server_id;
+    int event_id;
+
+    if(log->header == NULL)
+    {
+        return false;
+    }
+
+    server_id = intern(log, server);
+    event_id = intern(log, event);
+
+    if(server_id < 0 || event_id < 0)
+    {
+        return false;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    record.timestamp_ns = (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+    record.value = value;
+    record.server_id = (uint16_t)server_id;
+    record.event_id = (uint16_t)event_id;
+    record.pid = (uint32_t)getpid();
+    record.reserved = 0;
+
+    // O_APPEND places the whole record at the end even with other writers
+    return write(log->fd, &record, sizeof(record)) == (ssize_t)sizeof(record);
+}
+
+void metrics_log_close(struct metrics_log *log)
+{
+    if(log->header)
+    {
+        munmap(log->header, METRICS_HEADER_SIZE);
+        log->header = NULL;
+    }
+
+    if(log->fd >= 0)
+    {
+        close(log->fd);     // NOLINT(cert-err33-c)
+        log->fd = -1;
+    }
+}
+
+bool metrics_view_open(struct metrics_view *view, const char *path)
+{
+    struct stat info;
+    void *mapped;
+    int fd;
+
+    memset(view, 0, sizeof(*view));
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(fd < 0)
+    {
+        return false;
+    }
+
+    if(fstat(fd, &info) != 0 || info.st_size < METRICS_HEADER_SIZE)
+    {
+        close(fd);     // NOLINT(cert-err33-c)
+        errno = EINVAL;
+        return false;
+    }
+
+    mapped = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);     // NOLINT(cert-err33-c)
+
+    if(mapped == MAP_FAILED)
+    {
+        return false;
+    }
+
+    view->header = (const struct metrics_header *)mapped;
+    view->mapped_size = (size_t)info.st_size;
+
+    if(!valid_header(view->header, view->mapped_size))
+    {
+        metrics_view_close(view);
+        errno = EINVAL;
+        return false;
+    }
+
+    // records are read front to back once, so read ahead aggressively and drop pages behind the cursor early
+    madvise(mapped, view->mapped_size, MADV_SEQUENTIAL);
+    view->records = (const struct metrics_record *)((const uint8_t *)mapped + view->header->header_size);
+    view->num_records = (view->mapped_size - view->header->header_size) / sizeof(struct metrics_record);
+
+    return true;
+}
+
+const char *metrics_view_string(const struct metrics_view *view, uint16_t id)
+{
+    if(id >= view->header->num_strings || id >= METRICS_MAX_STRINGS)
+    {
+        return "?";
+    }
+
+    return view->header->strings[id];
+}
+
+void metrics_view_release(const struct metrics_view *view, size_t index)
+{
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t page;
+
+    page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    start = (uintptr_t)view->records;
+    end = ((uintptr_t)&view->records[index]) & ~(page - 1);
+
+    // the pages are clean file pages, dropping them only costs a re-read if they are touched again
+    if(end > start)
+    {
+        madvise((void *)start, end - start, MADV_DONTNEED);
+    }
+}
+
+void metrics_view_close(struct metrics_view *view)
+{
+    if(view->header)
+    {
+        munmap((void *)(uintptr_t)view->header, view->mapped_size);
+    }
+
+    memset(view, 0, sizeof(*view));
+}
+
+static bool prepare_header(int fd)
+{
+    struct metrics_header header;
+    struct stat info;
+    ssize_t got;
+
+    if(fstat(fd, &info) != 0)
+    {
+        return false;
+    }
+
+    if(info.st_size > 0)
+    {
+        got = pread(fd, &header, sizeof(header), 0);
+
+        if(got != (ssize_t)sizeof(header) || !valid_header(&header, (size_t)info.st_size))
+        {
+            errno = EINVAL;
+            return false;
+        }
+
+        return true;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, METRICS_MAGIC, sizeof(header.magic));
+    header.version = METRICS_VERSION;
+    header.header_size = METRICS_HEADER_SIZE;
+    header.record_size = sizeof(struct metrics_record);
+    header.string_size = METRICS_STRING_SIZE;
+    header.max_strings = METRICS_MAX_STRINGS;
+    header.num_strings = 0;
+    memcpy(header.schema, SCHEMA, sizeof(SCHEMA));
+
+    // the file is opened O_APPEND, so the header goes in with write on the empty file and the rest is a hole
+    return write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) && ftruncate(fd, METRICS_HEADER_SIZE) == 0;
+}
+
+static bool valid_header(const struct metrics_header *header, size_t size)
+{
+    return memcmp(header->magic, METRICS_MAGIC, sizeof(header->magic)) == 0 &&
+           header->version == METRICS_VERSION &&
+           header->header_size == METRICS_HEADER_SIZE &&
+           header->record_size == sizeof(struct metrics_record) &&
+           header->string_size == METRICS_STRING_SIZE &&
+           header->max_strings == METRICS_MAX_STRINGS &&
+           header->num_strings <= METRICS_MAX_STRINGS &&
+           size >= METRICS_HEADER_SIZE;
+}
+
+static int intern(struct metrics_log *log, const char *name)
+{
+    struct metrics_header *header;
+    uint32_t count;
+    int id;
+
+    header = log->header;
+    count = *(volatile uint32_t *)&header->num_strings;
+    // pairs with the release fence in front of the count update below
+    atomic_thread_fence(memory_order_acquire);
+    id = find_string(header, count, name);
+
+    if(id >= 0)
+    {
+        return id;
+    }
+
+    if(flock(log->fd, LOCK_EX) != 0)
+    {
+        return -1;
+    }
+
+    // another process may have added it since the unlocked lookup
+    count = header->num_strings;
+    id = find_string(header, count, name);
+
+    if(id < 0 && count < METRICS_MAX_STRINGS)
+    {
+        snprintf(header->strings[count], METRICS_STRING_SIZE, "%s", name);    // NOLINT(cert-err33-c)
+        atomic_thread_fence(memory_order_release);
+        *(volatile uint32_t *)&header->num_strings = count + 1;
+        id = (int)count;
+    }
+
+    flock(log->fd, LOCK_UN);
+
+    return id;
+}
+
+static int find_string(const struct metrics_header *header, uint32_t count, const char *name)
+{
+    for(uint32_t i = 0; i < count; i++)
+    {
+        if(strncmp(header->strings[i], name, METRICS_STRING_SIZE - 1) == 0)
+        {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,379 @@
+#include "metrics_log.h"
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKETS (1U << SUB_BUCKET_BITS)     // each power of two split in 16, percentiles are within 1/32
+#define HISTOGRAM_BUCKETS ((64U - SUB_BUCKET_BITS + 1U) * SUB_BUCKETS)
+#define RELEASE_EVERY 32768                      // records walked between dropping the pages behind the cursor
+#define NS_PER_SEC ((uint64_t)1000000000)
+#define DEFAULT_WINDOW_S 1
+#define PERCENT_SCALE 1000
+
+/**
+ * Everything summary needs about one server and event pair, in constant memory however many records it has.
+ */
+struct pair_stats
+{
+    uint64_t count;
+    double sum;
+    double min;
+    double max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+};
+
+/**
+ * The window series is building, flushed when a record past its end arrives.
+ */
+struct window_stats
+{
+    uint64_t count;
+    double sum;
+};
+
+static int report_summary(const struct metrics_view *view);
+static int report_series(const struct metrics_view *view, uint64_t window_s);
+static int report_csv(const struct metrics_view *view);
+static void flush_window(const struct metrics_view *view, struct window_stats **windows, uint64_t start_ns, uint64_t window_s);
+static unsigned int bucket_index(double value);
+static double bucket_value(unsigned int index);
+static double percentile(const struct pair_stats *stats, unsigned int per_mille);
+static size_t pair_index(const struct metrics_record *record);
+static void usage(const char *program);
+
+
+#define NUM_PAIRS ((size_t)METRICS_MAX_STRINGS * METRICS_MAX_STRINGS)
+
+static const double VALUE_SCALE = 1000;     // histogram units per value unit, microseconds for timings in ms
+
+int main(int argc, char *argv[])
+{
+    struct metrics_view view;
+    const char *command;
+    int status;
+
+    if(argc < 2)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    command = argc > 2 ? argv[2] : "summary";
+
+    if(!metrics_view_open(&view, argv[1]))
+    {
+        fprintf(stderr, "%s: %s\n", argv[1], errno == EINVAL ? "not a metrics log of this version" : strerror(errno));    // NOLINT(cert-err33-c,concurrency-mt-unsafe)
+        return EXIT_FAILURE;
+    }
+
+    if(strcmp(command, "summary") == 0)
+    {
+        status = report_summary(&view);
+    }
+    else if(strcmp(command, "series") == 0)
+    {
+        long window_s;
+
+        window_s = argc > 3 ? strtol(argv[3], NULL, 10) : DEFAULT_WINDOW_S;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        status = window_s > 0 ? report_series(&view, (uint64_t)window_s) : EXIT_FAILURE;
+    }
+    else if(strcmp(command, "csv") == 0)
+    {
+        status = report_csv(&view);
+    }
+    else
+    {
+        usage(argv[0]);
+        status = EXIT_FAILURE;
+    }
+
+    metrics_view_close(&view);
+
+    return status;
+}
+
+static int report_summary(const struct metrics_view *view)
+{
+    static const unsigned int per_mille[] = {500, 900, 990, 999};    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    struct pair_stats **pairs;
+    uint64_t first_ns;
+    uint64_t last_ns;
+
+    // a table of pointers indexed by the two string ids, only pairs that occur get their histogram
+    pairs = (struct pair_stats **)calloc(NUM_PAIRS, sizeof(*pairs));
+
+    if(pairs == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    first_ns = UINT64_MAX;
+    last_ns = 0;
+
+    for(size_t i = 0; i < view->num_records; i++)
+    {
+        const struct metrics_record *record;
+        struct pair_stats *stats;
+        size_t index;
+
+        record = &view->records[i];
+        index = pair_index(record);
+
+        if(pairs[index] == NULL)
+        {
+            pairs[index] = (struct pair_stats *)calloc(1, sizeof(struct pair_stats));
+
+            if(pairs[index] == NULL)
+            {
+                continue;
+            }
+
+            pairs[index]->min = record->value;
+            pairs[index]->max = record->value;
+        }
+
+        stats = pairs[index];
+        stats->count++;
+        stats->sum += record->value;
+        stats->min = record->value < stats->min ? record->value : stats->min;
+        stats->max = record->value > stats->max ? record->value : stats->max;
+        stats->buckets[bucket_index(record->value)]++;
+        first_ns = record->timestamp_ns < first_ns ? record->timestamp_ns : first_ns;
+        last_ns = record->timestamp_ns > last_ns ? record->timestamp_ns : last_ns;
+
+        if(i % RELEASE_EVERY == 0)
+        {
+            metrics_view_release(view, i);
+        }
+    }
+
+    printf("%zu records over %" PRIu64 "s\n", view->num_records, view->num_records == 0 ? 0 : (last_ns - first_ns) / NS_PER_SEC);
+    printf("%-20s %-20s %10s %10s %10s %10s %10s %10s %10s %10s\n", "server", "event", "count", "min", "p50", "p90", "p99", "p99.9", "max", "mean");
+
+    for(size_t index = 0; index < NUM_PAIRS; index++)
+    {
+        const struct pair_stats *stats;
+
+        stats = pairs[index];
+
+        if(stats == NULL)
+        {
+            continue;
+        }
+
+        printf("%-20s %-20s %10" PRIu64 " %10.3f", metrics_view_string(view, (uint16_t)(index / METRICS_MAX_STRINGS)),
+               metrics_view_string(view, (uint16_t)(index % METRICS_MAX_STRINGS)), stats->count, stats->min);
+
+        for(size_t p = 0; p < sizeof(per_mille) / sizeof(per_mille[0]); p++)
+        {
+            printf(" %10.3f", percentile(stats, per_mille[p]));
+        }
+
+        printf(" %10.3f %10.3f\n", stats->max, stats->sum / (double)stats->count);
+        free(pairs[index]);
+    }
+
+    free((void *)pairs);
+
+    return EXIT_SUCCESS;
+}
+
+static int report_series(const struct metrics_view *view, uint64_t window_s)
+{
+    struct window_stats **windows;
+    uint64_t window_ns;
+    uint64_t start_ns;
+
+    windows = (struct window_stats **)calloc(NUM_PAIRS, sizeof(*windows));
+
+    if(windows == NULL)
+    {
+        return EXIT_FAILURE;
+    }
+
+    window_ns = window_s * NS_PER_SEC;
+    start_ns = 0;
+    printf("time_s,server,event,count,per_second,mean\n");
+
+    // records are appended in time order by each process, a record from another process that lands after a later
+    // one is counted in the window being built instead of reopening an old one
+    for(size_t i = 0; i < view->num_records; i++)
+    {
+        const struct metrics_record *record;
+        size_t index;
+
+        record = &view->records[i];
+
+        if(record->timestamp_ns >= start_ns + window_ns || start_ns == 0)
+        {
+            if(start_ns != 0)
+            {
+                flush_window(view, windows, start_ns, window_s);
+            }
+
+            start_ns = record->timestamp_ns - record->timestamp_ns % window_ns;
+        }
+
+        index = pair_index(record);
+
+        if(windows[index] == NULL)
+        {
+            windows[index] = (struct window_stats *)calloc(1, sizeof(struct window_stats));
+
+            if(windows[index] == NULL)
+            {
+                continue;
+            }
+        }
+
+        windows[index]->count++;
+        windows[index]->sum += record->value;
+
+        if(i % RELEASE_EVERY == 0)
+        {
+            metrics_view_release(view, i);
+        }
+    }
+
+    if(start_ns != 0)
+    {
+        flush_window(view, windows, start_ns, window_s);
+    }
+
+    for(size_t index = 0; index < NUM_PAIRS; index++)
+    {
+        free(windows[index]);
+    }
+
+    free((void *)windows);
+
+    return EXIT_SUCCESS;
+}
+
+static void flush_window(const struct metrics_view *view, struct window_stats **windows, uint64_t start_ns, uint64_t window_s)
+{
+    for(size_t index = 0; index < NUM_PAIRS; index++)
+    {
+        struct window_stats *window;
+
+        window = windows[index];
+
+        if(window == NULL || window->count == 0)
+        {
+            continue;
+        }
+
+        printf("%" PRIu64 ",%s,%s,%" PRIu64 ",%.3f,%.3f\n", start_ns / NS_PER_SEC, metrics_view_string(view, (uint16_t)(index / METRICS_MAX_STRINGS)),
+               metrics_view_string(view, (uint16_t)(index % METRICS_MAX_STRINGS)), window->count, (double)window->count / (double)window_s,
+               window->sum / (double)window->count);
+        window->count = 0;
+        window->sum = 0;
+    }
+}
+
+static int report_csv(const struct metrics_view *view)
+{
+    printf("timestamp_ns,pid,server_name,function_name,time\n");
+
+    for(size_t i = 0; i < view->num_records; i++)
+    {
+        const struct metrics_record *record;
+
+        record = &view->records[i];
+        printf("%" PRIu64 ",%" PRIu32 ",%s,%s,%f\n", record->timestamp_ns, record->pid, metrics_view_string(view, record->server_id),
+               metrics_view_string(view, record->event_id), record->value);
+
+        if(i % RELEASE_EVERY == 0)
+        {
+            metrics_view_release(view, i);
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static unsigned int bucket_index(double value)
+{
+    uint64_t scaled;
+    unsigned int power;
+
+    // values below one unit of VALUE_SCALE share bucket 0, negative ones included
+    if(value * VALUE_SCALE < 1)
+    {
+        return 0;
+    }
+
+    scaled = value * VALUE_SCALE >= (double)UINT64_MAX ? UINT64_MAX : (uint64_t)(value * VALUE_SCALE);
+
+    if(scaled < SUB_BUCKETS)
+    {
+        return (unsigned int)scaled;
+    }
+
+    // the top SUB_BUCKET_BITS bits below the leading one pick the sub-bucket within the power of two
+    power = 63U - (unsigned int)__builtin_clzll(scaled);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return (power - SUB_BUCKET_BITS + 1U) * SUB_BUCKETS + (unsigned int)((scaled >> (power - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1U));
+}
+
+static double bucket_value(unsigned int index)
+{
+    unsigned int power;
+    uint64_t sub;
+
+    if(index < SUB_BUCKETS)
+    {
+        return (double)index / VALUE_SCALE;
+    }
+
+    power = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1U;
+    sub = index % SUB_BUCKETS;
+
+    // the middle of the bucket, within 1/32 of every value in it
+    return ((double)((1ULL << power) + (sub << (power - SUB_BUCKET_BITS))) + (double)(1ULL << (power - SUB_BUCKET_BITS)) / 2) / VALUE_SCALE;
+}
+
+static double percentile(const struct pair_stats *stats, unsigned int per_mille)
+{
+    uint64_t target;
+    uint64_t seen;
+
+    target = (stats->count * per_mille + PERCENT_SCALE - 1) / PERCENT_SCALE;
+    seen = 0;
+
+    for(unsigned int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += stats->buckets[i];
+
+        if(seen >= target && seen > 0)
+        {
+            double value;
+
+            value = bucket_value(i);
+
+            return value < stats->min ? stats->min : (value > stats->max ? stats->max : value);
+        }
+    }
+
+    return stats->max;
+}
+
+static size_t pair_index(const struct metrics_record *record)
+{
+    size_t server;
+    size_t event;
+
+    // ids from a damaged record land on the last pair instead of outside the table
+    server = record->server_id < METRICS_MAX_STRINGS ? record->server_id : METRICS_MAX_STRINGS - 1;
+    event = record->event_id < METRICS_MAX_STRINGS ? record->event_id : METRICS_MAX_STRINGS - 1;
+
+    return server * METRICS_MAX_STRINGS + event;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s <metrics.bin> [summary | series [seconds] | csv]\n", program);    // NOLINT(cert-err33-c)
+}
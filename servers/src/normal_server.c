@@ -1,3 +1,7 @@
+#include "file_server.h"
+#include "listener.h"
+#include "message_handler.h"
+#include "result_cache.h"
 #include "server.h"
 #include "util.h"
 #include <arpa/inet.h>
@@ -9,144 +13,206 @@
 #include <dc_posix/sys/dc_socket.h>
 #include <dc_util/io.h>
 #include <netinet/in.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 
 static volatile sig_atomic_t running;   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static volatile sig_atomic_t reload_requested;   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
 
-static int setup_server(struct dc_env *env, struct dc_error *err, struct options *opts);
-void handle_connection(struct dc_env *env, struct dc_error *error, int socket_fd);
-static int handle_client_data(struct dc_env *env, struct dc_error *err, int clients);
+void handle_connection(struct dc_env *env, struct dc_error *error, int socket_fd, const struct message_handler *message_handler);
+static void reload_handler(__attribute__((unused)) int signal);
+static void reload_message_handler(struct dc_env *env, struct dc_error *error, struct message_handler *message_handler);
+static int wait_for_listener(struct dc_env *env, const int listeners[2]);
+static void close_listeners(struct dc_env *env, struct dc_error *error, const int listeners[2], const struct options *opts);
 
 int run_normal_server(struct dc_env * env, struct dc_error * error, struct options *opts) {
     // Trace this function
     DC_TRACE(env);
 
-    int listen_fd;
+    int listeners[2];
+    struct message_handler message_handler;
+    struct sigaction act;
 
+    listeners[0] = opts->unix_only ? -1 : listener_open(env, error, opts->ip_address, opts->config.port, opts->config.backlog);
+    listeners[1] = opts->unix_path ? listener_open_unix(env, error, opts->unix_path, opts->config.backlog) : -1;
 
-    listen_fd = setup_server(env, error, opts);
+    if((!opts->unix_only && listeners[0] < 0) || (opts->unix_path && listeners[1] < 0))
+    {
+        close_listeners(env, error, listeners, opts);
+        return EXIT_FAILURE;
+    }
 
+    if((opts->handler_path && !message_handler_load(env, error, opts->handler_path)) ||
+       (opts->cache_bytes > 0 && !result_cache_init(env, error, opts->cache_bytes, false)))
+    {
+        close_listeners(env, error, listeners, opts);
+        return EXIT_FAILURE;
+    }
+
+    message_handler_current(&message_handler);
+
+    if(!message_handler_attach())
+    {
+        printf("Message handler init failed\n");
+        close_listeners(env, error, listeners, opts);
+        return EXIT_FAILURE;
+    }
+
+    // no SA_RESTART, so a reload interrupts the wait for a connection
+    dc_memset(env, &act, 0, sizeof(act));
+    act.sa_handler = reload_handler;
+    dc_sigemptyset(env, error, &act.sa_mask);
+    dc_sigaction(env, error, SIGHUP, &act, NULL);
     running = 1;
 
     while(running)
     {
+        if(reload_requested)
+        {
+            reload_message_handler(env, error, &message_handler);
+        }
+
         // Log the time each client took to be handled
         clock_t beginning_connection = clock();
+        int listen_fd = wait_for_listener(env, listeners);
+
+        if(listen_fd < 0)
+        {
+            continue;
+        }
 
-        handle_connection(env, error, listen_fd);
+        handle_connection(env, error, listen_fd, &message_handler);
 
         clock_t end = clock();
         double time_spent = ((double)(end - beginning_connection) / CLOCKS_PER_SEC) * CONVERT_TO_MS;
         write_to_file(opts, "Normal Server", "handle_connection", time_spent);
     }
 
+    message_handler_detach();
+    read_buffer_report(stdout);
+    file_server_report(stdout);
+    result_cache_report(stdout);
+    result_cache_destroy();
+    close_listeners(env, error, listeners, opts);
+
     return 0;
 }
 
-static int setup_server(struct dc_env *env, struct dc_error *err, struct options *opts)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static void reload_handler(__attribute__((unused)) int signal)
+{
+    reload_requested = 1;
+}
+#pragma GCC diagnostic pop
+
+static void reload_message_handler(struct dc_env *env, struct dc_error *error, struct message_handler *message_handler)
 {
     DC_TRACE(env);
+    reload_requested = 0;
 
-    int listener;
-    int option_value;
-    struct sockaddr_in server_addr;
+    // only one client is served at a time, so between connections nothing runs the old handlers
+    if(!message_handler_reload(env, error))
+    {
+        printf("Message handlers not reloaded, keeping the current ones\n");
+        dc_error_reset(error);
+        return;
+    }
 
-    listener = dc_socket(env, err, AF_INET, SOCK_STREAM, 0);
+    message_handler_detach();
 
-    if (listener < 0)
+    if(!message_handler_attach())
     {
-        dc_perror(env, "socket");
-        return -1;
+        printf("Message handler init failed, using the built-in handlers\n");
+        message_handler_default(message_handler);
+        return;
     }
 
-    option_value = 1;
-    dc_setsockopt(env, err, listener, SOL_SOCKET, SO_REUSEADDR, &option_value, sizeof(option_value));
+    message_handler_current(message_handler);
+}
+
+static int wait_for_listener(struct dc_env *env, const int listeners[2])
+{
+    struct pollfd fds[2];
 
-    dc_memset(env, &server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = inet_addr(opts->ip_address);
-    server_addr.sin_port = htons(opts->port_out);
+    DC_TRACE(env);
 
-    if(dc_bind(env, err, listener, (struct sockaddr*) &server_addr, sizeof(server_addr)) < 0)
+    // listeners are non-blocking, so poll does the waiting; it skips a negative fd, and a reload interrupts it
+    for(int i = 0; i < 2; i++)
     {
-        dc_perror(env, "bind");
-        dc_close(env, err, listener);
-        return -1;
+        fds[i].fd = listeners[i];
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
     }
 
-    if(dc_listen(env, err, listener, BACKLOG) < 0)
+    if(poll(fds, 2, -1) <= 0)
     {
-        dc_perror(env, "listen");
-        dc_close(env, err, listener);
         return -1;
     }
 
-    return listener;
+    return fds[0].revents ? fds[0].fd : fds[1].fd;
 }
 
-void handle_connection(struct dc_env *env, struct dc_error *error, int socket_fd)
+static void close_listeners(struct dc_env *env, struct dc_error *error, const int listeners[2], const struct options *opts)
 {
     DC_TRACE(env);
 
-    struct sockaddr_in client_addr;
-    socklen_t client_len;
+    if(listeners[0] >= 0)
+    {
+        close(listeners[0]);
+    }
+
+    listener_close_unix(env, error, listeners[1], opts->unix_path);
+}
+
+void handle_connection(struct dc_env *env, struct dc_error *error, int socket_fd, const struct message_handler *message_handler)
+{
+    DC_TRACE(env);
+
+    struct sockaddr_storage client_addr;
     int client_fd;
+    bool closed;
 
     printf("Setup 1-1 Server and awaiting connection\n");
 
     // Accept connection
+    // blocking, the handler waits in read for the client's next request
     dc_memset(env, &client_addr, 0, sizeof(client_addr));
-    client_len = sizeof(client_addr);
-    client_fd = dc_accept(env, error, socket_fd, (struct sockaddr*) &client_addr, &client_len);
+    client_fd = listener_accept(env, error, socket_fd, &client_addr, SOCK_CLOEXEC);
     if(client_fd < 0)
     {
-        dc_perror(env, "accept");
+        if(dc_error_has_error(error))
+        {
+            dc_perror(env, "accept");
+        }
+
+        dc_error_reset(error);
         return;
     }
 
     // Get connection information
-    printf("New connection from %s:%d\n", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));    // NOLINT(concurrency-mt-unsafe)
-    int socket_error = 0;
+    if(client_addr.ss_family == AF_INET)
+    {
+        const struct sockaddr_in *peer = (const struct sockaddr_in *)&client_addr;
 
-    while (socket_error == 0) {
-        if (recv(client_fd, NULL, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
-            close(client_fd);
-            return;
-        }
-        socket_error = handle_client_data(env, error, client_fd);
-        if (socket_error != 0) {
-            close(client_fd);
-        }
+        printf("New connection from %s:%d\n", inet_ntoa(peer->sin_addr), ntohs(peer->sin_port));    // NOLINT(concurrency-mt-unsafe)
     }
-    close(client_fd);
-}
-
-static int handle_client_data(struct dc_env *env, struct dc_error *err, int clients) {
-    DC_TRACE(env);
-
-    if (recv(clients, NULL, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
-        return -1;
+    else
+    {
+        printf("New connection on a Unix domain socket\n");
     }
-    ssize_t bytes_read;
-    char buffer[READ_BUFFER_SIZE];
-    bytes_read = dc_read(env, err, clients, buffer, (READ_BUFFER_SIZE-1));
-    buffer[bytes_read] = '\0';
 
-    if(bytes_read <= 0 && recv(clients, NULL, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+    // Serve this client's requests one after another until it disconnects
+    do
     {
-        printf("Client disconnected\n");
-        close(clients);
-        return -1;
+        closed = message_handler_run(env, error, message_handler, client_fd);
     }
+    while(!closed && dc_error_has_no_error(error));
 
-    printf("Read from client\n");
-    dc_write(env, err, STDOUT_FILENO, buffer, bytes_read);
-
-    printf("Writing to client\n");
-    uint16_t write_number = ntohs(bytes_read);
-    dc_write(env, err, clients, &write_number, sizeof(write_number));
-    return 0;
+    printf("Client disconnected\n");
+    dc_error_reset(error);
+    close(client_fd);
 }
@@ -0,0 +1,851 @@
+#include "process_pool.h"
+#include "affinity.h"
+#include "file_server.h"
+#include "message_handler.h"
+#include "result_cache.h"
+#include "timer_wheel.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_semaphore.h>
+#include <dc_posix/dc_signal.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * What a worker keeps of its own, the pool it was forked with is a copy of the parent's.
+ */
+struct worker
+{
+    struct process_pool *pool;
+    struct message_handler message_handler;
+    struct instrument instrument;
+    int cpu; // CPU the worker is pinned to, -1 when not pinned
+    uint8_t *read_buffer; // allocated on the worker's NUMA node after pinning
+    uint64_t local_receives; // requests whose receive softirq ran on the worker's CPU
+    uint64_t remote_receives;
+    sigset_t wait_signals; // SIGUSR1 and SIGHUP, blocked except while the worker waits for a socket
+    sigset_t wait_mask; // the mask those waits run with
+};
+
+struct dispatch_message
+{
+    int fd;
+    uint64_t wakeup_ns;
+    uint64_t sent_ns;
+};
+
+
+static void reload_handler(__attribute__((unused)) int signal);
+static void retire_handler(__attribute__((unused)) int signal);
+static bool spawn_worker(struct dc_env *env, struct dc_error *err, struct process_pool *pool, int slot);
+static int run_worker(struct dc_env *env, struct dc_error *err, struct process_pool *pool, int slot);
+static void pin_worker(struct worker *worker, int slot);
+static bool acquire_select_sem(struct worker *worker);
+static bool receive_socket(const struct dc_env *env, struct dc_error *err, struct worker *worker, int *client_socket, struct dispatch_message *dispatch);
+static void serve_socket(const struct dc_env *env, struct dc_error *err, struct worker *worker);
+static void send_completion(const struct dc_env *env, struct dc_error *err, struct worker *worker, int client_socket, const struct dispatch_message *dispatch, bool closed, uint64_t finished_ns);
+static bool forget_worker(struct process_pool *pool, pid_t pid);
+static bool forget_retiring(struct process_pool *pool, pid_t pid);
+static bool is_retiring(const struct process_pool *pool, pid_t pid);
+static void reap_workers(struct dc_env *env, struct dc_error *err, struct process_pool *pool);
+static void retire_worker(const struct dc_env *env, struct dc_error *err, struct process_pool *pool);
+static void print_fd(const char *message, int fd, bool display);
+
+
+#define GROWTH_FACTOR 4
+#define COOLDOWN_MS 5000
+#define SHRINK_UTILIZATION 25  // percent
+#define SMOOTHING 20           // percent of each new sample in the moving average
+#define PERCENT 100
+#define WORKER_RELOADED 3      // exit status of a worker replaced to pick up reloaded handlers
+#define SELECT_SEM_RECHECK_SECONDS 1
+#define STOP_POLL_MS 10
+#define SEM_NAME_SIZE 64
+
+static volatile sig_atomic_t done = 0;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static volatile sig_atomic_t reload_requested = 0;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static volatile sig_atomic_t retire_requested = 0;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+bool process_pool_start(struct dc_env *env, struct dc_error *err, struct process_pool *pool, int num_workers, const struct options *opts, int completion_fd, process_pool_forked_func forked, void *context)
+{
+    int domain_sockets[2];
+    int shutdown_fds[2];
+    char sem_name[SEM_NAME_SIZE];
+
+    DC_TRACE(env);
+    dc_memset(env, pool, 0, sizeof(*pool));
+    pool->domain_socket = pool->worker_domain_socket = -1;
+    pool->shutdown_fd = pool->worker_shutdown_fd = -1;
+    pool->select_sem = SEM_FAILED;
+    pool->completion_fd = completion_fd;
+    pool->min_workers = num_workers > 1 ? num_workers / 2 : 1;
+    pool->max_workers = num_workers * GROWTH_FACTOR > UINT8_MAX ? UINT8_MAX : num_workers * GROWTH_FACTOR;
+    pool->last_scale_ms = timer_now_ms();
+    pool->verbose = opts->config.verbose;
+    pool->pin_cpus = opts->pin_cpus;
+    pool->read_buffer_size = (size_t)opts->config.read_buffer_size;
+    pool->forked = forked;
+    pool->context = context;
+    instrument_init(&pool->instrument, opts->instrument);
+    pool->workers = (pid_t *)dc_malloc(env, err, (size_t)pool->max_workers * sizeof(pid_t));
+
+    if(pool->workers == NULL)
+    {
+        return false;
+    }
+
+    if(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, domain_sockets) != 0 || pipe2(shutdown_fds, O_CLOEXEC) != 0)
+    {
+        DC_ERROR_RAISE_SYSTEM(err, "Could not create the worker channels", errno);
+        return false;
+    }
+
+    pool->domain_socket = domain_sockets[1];
+    pool->worker_domain_socket = domain_sockets[0];
+    pool->shutdown_fd = shutdown_fds[1];
+    pool->worker_shutdown_fd = shutdown_fds[0];
+
+    // forked workers share the mapping, so the name is not needed once it is open
+    snprintf(sem_name, sizeof(sem_name), "/sem-%d-select", getpid());    // NOLINT(cert-err33-c)
+    pool->select_sem = sem_open(sem_name, O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, 1);
+
+    if(pool->select_sem == SEM_FAILED)
+    {
+        DC_ERROR_RAISE_SYSTEM(err, "Could not create the worker semaphore", errno);
+        return false;
+    }
+
+    sem_unlink(sem_name);
+
+    if(pool->pin_cpus)
+    {
+        pool->cpus = (int *)dc_malloc(env, err, CPU_SETSIZE * sizeof(int));
+
+        if(pool->cpus == NULL)
+        {
+            return false;
+        }
+
+        pool->num_cpus = affinity_available_cpus(pool->cpus, CPU_SETSIZE);
+
+        if(pool->num_cpus > 0 && affinity_pin(pool->cpus[0]) == 0)
+        {
+            printf("Dispatcher (%d) pinned to CPU %d\n", getpid(), pool->cpus[0]);
+        }
+    }
+
+    for(int i = 0; i < num_workers; i++)
+    {
+        if(!spawn_worker(env, err, pool, i))
+        {
+            process_pool_stop(env, err, pool, timer_now_ms());
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool process_pool_submit(const struct dc_env *env, struct dc_error *err, struct process_pool *pool, int client_socket, uint64_t wakeup_ns)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct dispatch_message dispatch;
+    char control_buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+
+    DC_TRACE(env);
+    dc_memset(env, &msg, 0, sizeof(msg));
+    dc_memset(env, &iov, 0, sizeof(iov));
+    dc_memset(env, control_buf, 0, sizeof(control_buf));
+    dc_memset(env, &dispatch, 0, sizeof(dispatch));
+    dispatch.fd = client_socket;
+    dispatch.wakeup_ns = wakeup_ns;
+    dispatch.sent_ns = instrument_stamp(&pool->instrument);
+    instrument_record(&pool->instrument, STAGE_DISPATCH, dispatch.wakeup_ns, dispatch.sent_ns);
+    iov.iov_base = &dispatch;
+    iov.iov_len = sizeof(dispatch);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_buf;
+    msg.msg_controllen = sizeof(control_buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    *((int *) CMSG_DATA(cmsg)) = client_socket;
+    print_fd("Sending to a worker", client_socket, pool->verbose);
+    dc_sendmsg(env, err, pool->domain_socket, &msg, 0);
+
+    return dc_error_has_no_error(err);
+}
+
+void process_pool_revived(struct process_pool *pool, const struct process_pool_completion *completion)
+{
+    uint64_t revived_ns;
+
+    revived_ns = instrument_stamp(&pool->instrument);
+    instrument_record(&pool->instrument, STAGE_REVIVE, completion->finished_ns, revived_ns);
+    instrument_record(&pool->instrument, STAGE_TOTAL, completion->wakeup_ns, revived_ns);
+}
+
+int process_pool_active(const struct process_pool *pool)
+{
+    return pool->num_workers - pool->retiring;
+}
+
+void process_pool_resize(struct dc_env *env, struct dc_error *err, struct process_pool *pool, int in_flight, int queued)
+{
+    int active;
+    int backlog;
+    int sample;
+    uint64_t now;
+
+    DC_TRACE(env);
+    reap_workers(env, err, pool);
+    active = process_pool_active(pool);
+
+    if(active <= 0 || pool->stopping)
+    {
+        return;
+    }
+
+    now = timer_now_ms();
+    backlog = in_flight + queued - active;
+    sample = (in_flight < active ? in_flight : active) * PERCENT / active;
+    pool->utilization = (pool->utilization * (PERCENT - SMOOTHING) + sample * SMOOTHING) / PERCENT;
+
+    if(backlog > 0)
+    {
+        // requests wait behind busy workers, add a worker for each one up to the limit
+        while(backlog > 0 && pool->num_workers < pool->max_workers && spawn_worker(env, err, pool, pool->num_workers))
+        {
+            backlog--;
+        }
+
+        pool->last_scale_ms = now;
+    }
+    else if(pool->utilization < SHRINK_UTILIZATION && active > pool->min_workers && now - pool->last_scale_ms >= COOLDOWN_MS)
+    {
+        retire_worker(env, err, pool);
+        pool->last_scale_ms = now;
+    }
+}
+
+void process_pool_reload(const struct dc_env *env, struct dc_error *err, struct process_pool *pool)
+{
+    DC_TRACE(env);
+
+    // each worker finishes its current request and exits, reap_workers forks a replacement from the reloaded parent
+    for(int i = 0; i < pool->num_workers; i++)
+    {
+        dc_kill(env, err, pool->workers[i], SIGHUP);
+    }
+}
+
+void process_pool_stop(const struct dc_env *env, struct dc_error *err, struct process_pool *pool, uint64_t deadline_ms)
+{
+    DC_TRACE(env);
+    pool->stopping = true;
+
+    // every worker selects on the other end, end of file wakes them all whether idle or waiting on select_sem
+    if(pool->shutdown_fd >= 0)
+    {
+        dc_close(env, err, pool->shutdown_fd);
+        pool->shutdown_fd = -1;
+    }
+
+    while(pool->num_workers > 0)
+    {
+        pid_t pid;
+        int status;
+
+        pid = waitpid(-1, &status, WNOHANG);
+
+        if(pid > 0)
+        {
+            forget_worker(pool, pid);
+        }
+        else if(pid == 0 && timer_now_ms() >= deadline_ms)
+        {
+            // whoever is still stuck in a request is not going to finish in time
+            printf("Killing %d workers that did not exit in time\n", pool->num_workers);
+
+            for(int i = 0; i < pool->num_workers; i++)
+            {
+                dc_kill(env, err, pool->workers[i], SIGKILL);
+                waitpid(pool->workers[i], &status, 0);
+            }
+
+            pool->num_workers = 0;
+        }
+        else if(pid == 0)
+        {
+            poll(NULL, 0, STOP_POLL_MS);
+        }
+        else if(errno != EINTR)
+        {
+            break;
+        }
+    }
+}
+
+void process_pool_report(const struct process_pool *pool, FILE *out)
+{
+    instrument_report(&pool->instrument, out, "parent");
+}
+
+void process_pool_destroy(const struct dc_env *env, struct dc_error *err, struct process_pool *pool)
+{
+    DC_TRACE(env);
+
+    if(pool->workers == NULL)
+    {
+        return;
+    }
+
+    if(pool->select_sem != SEM_FAILED)
+    {
+        sem_close(pool->select_sem);
+    }
+
+    if(pool->domain_socket >= 0)
+    {
+        dc_close(env, err, pool->domain_socket);
+        dc_close(env, err, pool->worker_domain_socket);
+    }
+
+    if(pool->worker_shutdown_fd >= 0)
+    {
+        dc_close(env, err, pool->worker_shutdown_fd);
+    }
+
+    if(pool->shutdown_fd >= 0)
+    {
+        dc_close(env, err, pool->shutdown_fd);
+    }
+
+    if(pool->cpus)
+    {
+        dc_free(env, pool->cpus);
+    }
+
+    dc_free(env, pool->workers);
+    pool->workers = NULL;
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+static void reload_handler(__attribute__((unused)) int signal)
+{
+    reload_requested = true;
+}
+
+static void retire_handler(__attribute__((unused)) int signal)
+{
+    retire_requested = true;
+}
+#pragma GCC diagnostic pop
+
+static bool spawn_worker(struct dc_env *env, struct dc_error *err, struct process_pool *pool, int slot)
+{
+    pid_t pid;
+
+    DC_TRACE(env);
+
+    // don't let the worker flush output the parent already buffered
+    fflush(stdout);     // NOLINT(cert-err33-c)
+    pid = dc_fork(env, err);
+
+    if(pid == 0)
+    {
+        int status;
+
+        // drop everything the parent owns before becoming a worker
+        pool->forked(env, err, pool->context);
+        dc_close(env, err, pool->domain_socket);
+        dc_close(env, err, pool->shutdown_fd);
+        dc_error_reset(err);
+        status = run_worker(env, err, pool, slot);
+        fflush(stdout);     // NOLINT(cert-err33-c)
+
+        // the parent's stack is still below us, so leave without unwinding into its event loop
+        _exit(status);
+    }
+
+    if(pid < 0)
+    {
+        return false;
+    }
+
+    pool->workers[pool->num_workers] = pid;
+    pool->num_workers++;
+
+    return true;
+}
+
+static int run_worker(struct dc_env *env, struct dc_error *err, struct process_pool *pool, int slot)
+{
+    struct sigaction act;
+    struct worker worker;
+    pid_t pid;
+
+    DC_TRACE(env);
+    // a Ctrl-C reaches the whole process group, the parent decides when workers stop so they can finish their requests
+    act.sa_handler = SIG_IGN;
+    dc_sigemptyset(env, err, &act.sa_mask);
+    act.sa_flags = 0;
+    dc_sigaction(env, err, SIGINT, &act, NULL);
+    dc_sigaction(env, err, SIGTERM, &act, NULL);
+    dc_sigaction(env, err, SIGUSR2, &act, NULL);
+    // a stalled socket may be shut down by the parent while the worker is writing to it
+    dc_sigaction(env, err, SIGPIPE, &act, NULL);
+    // no SA_RESTART, so a worker waiting in select or on select_sem notices the reload right away
+    act.sa_handler = reload_handler;
+    dc_sigaction(env, err, SIGHUP, &act, NULL);
+    // the parent retires a worker it picked by pid; blocked outside the waits, so it only ever interrupts a wait
+    act.sa_handler = retire_handler;
+    dc_sigaction(env, err, SIGUSR1, &act, NULL);
+
+    if(dc_error_has_error(err))
+    {
+        return EXIT_FAILURE;
+    }
+
+    dc_memset(env, &worker, 0, sizeof(worker));
+    worker.pool = pool;
+    worker.cpu = -1;
+    // a signal sent before the worker reaches its first wait stays pending until then
+    sigemptyset(&worker.wait_signals);
+    sigaddset(&worker.wait_signals, SIGUSR1);
+    sigaddset(&worker.wait_signals, SIGHUP);
+    sigprocmask(SIG_BLOCK, &worker.wait_signals, &worker.wait_mask);
+    sigdelset(&worker.wait_mask, SIGUSR1);
+    sigdelset(&worker.wait_mask, SIGHUP);
+    instrument_init(&worker.instrument, pool->instrument.enabled);
+    pin_worker(&worker, slot);
+    message_handler_current(&worker.message_handler);
+    pid = getpid();
+
+    if(!message_handler_attach())
+    {
+        printf("Worker (%d) message handler init failed\n", pid);
+        return EXIT_FAILURE;
+    }
+
+    printf("Started worker (%d)\n", pid);
+
+    while(!done && !retire_requested && !reload_requested)
+    {
+        serve_socket(env, err, &worker);
+
+        if(dc_error_has_error(err))
+        {
+            if(!reload_requested && !retire_requested)
+            {
+                printf("%d : %s\n", pid, dc_error_get_message(err));
+            }
+
+            dc_error_reset(err);
+        }
+    }
+
+    if(retire_requested && pool->verbose)
+    {
+        printf("(pid=%d) Retiring\n", pid);
+    }
+
+    instrument_report(&worker.instrument, stdout, "worker");
+    file_server_report(stdout);
+
+    if(worker.cpu >= 0)
+    {
+        printf("Worker (%d) on CPU %d: %llu receives on this CPU, %llu on others\n", pid, worker.cpu, (unsigned long long)worker.local_receives, (unsigned long long)worker.remote_receives);
+    }
+
+    message_handler_detach();
+
+    if(worker.read_buffer)
+    {
+        set_read_buffer(NULL, 0);
+        affinity_free_local(worker.read_buffer, pool->read_buffer_size);
+    }
+
+    // the parent forks a replacement, which inherits the reloaded handlers
+    return reload_requested && !retire_requested ? WORKER_RELOADED : EXIT_SUCCESS;
+}
+
+static void pin_worker(struct worker *worker, int slot)
+{
+    int cpu;
+
+    if(!worker->pool->pin_cpus)
+    {
+        return;
+    }
+
+    cpu = affinity_worker_cpu(worker->pool->cpus, worker->pool->num_cpus, slot);
+
+    if(affinity_pin(cpu) != 0)
+    {
+        printf("Worker (%d) could not be pinned to CPU %d\n", getpid(), cpu);
+        return;
+    }
+
+    // allocate after pinning so first touch puts the buffer on this CPU's node
+    worker->cpu = cpu;
+    worker->read_buffer = (uint8_t *)affinity_alloc_local(worker->pool->read_buffer_size);
+
+    if(worker->read_buffer)
+    {
+        set_read_buffer(worker->read_buffer, worker->pool->read_buffer_size);
+    }
+
+    printf("Worker (%d) pinned to CPU %d on node %d\n", getpid(), cpu, affinity_current_node());
+}
+
+static bool acquire_select_sem(struct worker *worker)
+{
+    struct timespec deadline;
+    bool acquired;
+
+    acquired = false;
+    // there is no sem_wait that unblocks signals atomically, the timeout catches a signal that lands just before the wait
+    sigprocmask(SIG_SETMASK, &worker->wait_mask, NULL);
+
+    while(!acquired && !done && !reload_requested && !retire_requested)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += SELECT_SEM_RECHECK_SECONDS;
+
+        if(sem_timedwait(worker->pool->select_sem, &deadline) == 0)
+        {
+            acquired = true;
+        }
+        else if(errno != ETIMEDOUT && errno != EINTR)
+        {
+            perror("worker select semaphore");
+            break;
+        }
+    }
+
+    sigprocmask(SIG_BLOCK, &worker->wait_signals, NULL);
+
+    return acquired;
+}
+
+static bool receive_socket(const struct dc_env *env, struct dc_error *err, struct worker *worker, int *client_socket, struct dispatch_message *dispatch)
+{
+    struct msghdr msg;
+    char buf[CMSG_SPACE(sizeof(int) * 2)];
+    struct iovec io;
+    struct cmsghdr *cmsg;
+    fd_set read_fds;
+    int domain_socket;
+    int shutdown_fd;
+    int result;
+    bool got_message;
+
+    DC_TRACE(env);
+    dc_memset(env, &msg, 0, sizeof(msg));
+    dc_memset(env, &io, 0, sizeof(io));
+    dc_memset(env, buf, '\0', sizeof(buf));
+    io.iov_base = dispatch;
+    io.iov_len = sizeof(*dispatch);
+
+    msg.msg_iov = &io;
+    msg.msg_iovlen = 1;
+    msg.msg_control = buf;
+    msg.msg_controllen = sizeof(buf);
+
+    domain_socket = worker->pool->worker_domain_socket;
+    shutdown_fd = worker->pool->worker_shutdown_fd;
+    FD_ZERO(&read_fds);
+    FD_SET(domain_socket, &read_fds);
+    FD_SET(shutdown_fd, &read_fds);
+
+    if(!acquire_select_sem(worker))
+    {
+        // interrupted before getting the semaphore, e.g. by a reload request
+        got_message = false;
+    }
+    else if(done || reload_requested || retire_requested)
+    {
+        dc_sem_post(env, err, worker->pool->select_sem);
+        got_message = false;
+    }
+    else
+    {
+        // the flags were checked with the signals blocked, pselect unblocks them atomically so none is lost in between
+        result = pselect((domain_socket > shutdown_fd ? domain_socket : shutdown_fd) + 1, &read_fds, NULL, NULL, NULL, &worker->wait_mask);
+
+        // the parent only closes the shutdown pipe once nothing is left on the domain socket
+        if(result > 0 && FD_ISSET(shutdown_fd, &read_fds))
+        {
+            done = true;
+            got_message = false;
+        }
+        else if(result > 0)
+        {
+            dc_recvmsg(env, err, domain_socket, &msg, MSG_CMSG_CLOEXEC);
+            got_message = true;
+        }
+        else
+        {
+            if(result < 0 && errno != EINTR)
+            {
+                perror("worker select");
+            }
+
+            got_message = false;
+        }
+
+        dc_sem_post(env, err, worker->pool->select_sem);
+
+        if(got_message)
+        {
+            cmsg = CMSG_FIRSTHDR(&msg);
+            (*client_socket) = cmsg ? *((int *) CMSG_DATA(cmsg)) : -1;
+        }
+    }
+
+    return got_message;
+}
+
+static void serve_socket(const struct dc_env *env, struct dc_error *err, struct worker *worker)
+{
+    int client_socket;
+    struct dispatch_message dispatch;
+    uint8_t *raw_data;
+    ssize_t raw_data_length;
+    bool closed;
+    uint64_t stage_ns;
+    uint64_t now_ns;
+
+    client_socket = -1;
+
+    // a retire arriving now stays pending until the next wait, the request's reads and writes are not cut short
+    if(!receive_socket(env, err, worker, &client_socket, &dispatch) || client_socket < 0 || dc_error_has_error(err))
+    {
+        return;
+    }
+
+    stage_ns = instrument_stamp(&worker->instrument);
+    instrument_record(&worker->instrument, STAGE_HANDOFF, dispatch.sent_ns, stage_ns);
+
+    if(worker->cpu >= 0)
+    {
+        int incoming_cpu;
+
+        // how often the NIC queue's softirq CPU lines up with the worker that ends up serving the request
+        incoming_cpu = affinity_incoming_cpu(client_socket);
+
+        if(incoming_cpu == worker->cpu)
+        {
+            worker->local_receives++;
+        }
+        else if(incoming_cpu >= 0)
+        {
+            worker->remote_receives++;
+        }
+    }
+
+    print_fd("Started working on", dispatch.fd, worker->pool->verbose);
+    raw_data = NULL;
+    raw_data_length = worker->message_handler.reader(env, err, &raw_data, client_socket);
+    now_ns = instrument_stamp(&worker->instrument);
+    instrument_record(&worker->instrument, STAGE_READ, stage_ns, now_ns);
+    stage_ns = now_ns;
+    // a handler that forgets to set it closes the connection, which gets noticed; so does a failed read or write
+    closed = true;
+
+    if(dc_error_has_no_error(err) && raw_data_length > 0)
+    {
+        uint8_t *processed_data;
+        size_t processed_data_length;
+
+        processed_data = NULL;
+        processed_data_length = result_cache_process(env, err, worker->message_handler.processor, raw_data, &processed_data, raw_data_length);
+        now_ns = instrument_stamp(&worker->instrument);
+        instrument_record(&worker->instrument, STAGE_PROCESS, stage_ns, now_ns);
+        stage_ns = now_ns;
+
+        if(dc_error_has_no_error(err))
+        {
+            message_handler_send(env, err, &worker->message_handler, processed_data, processed_data_length, client_socket, &closed);
+            now_ns = instrument_stamp(&worker->instrument);
+            instrument_record(&worker->instrument, STAGE_SEND, stage_ns, now_ns);
+            stage_ns = now_ns;
+        }
+
+        if(processed_data)
+        {
+            dc_free(env, processed_data);
+        }
+    }
+
+    if(raw_data)
+    {
+        dc_free(env, raw_data);
+    }
+
+    print_fd("Done working on", dispatch.fd, worker->pool->verbose);
+
+    // the parent closes the connection for a failed request, the error itself stays with the worker
+    if(dc_error_has_error(err))
+    {
+        closed = true;
+    }
+
+    send_completion(env, err, worker, client_socket, &dispatch, closed, stage_ns);
+}
+
+static void send_completion(const struct dc_env *env, struct dc_error *err, struct worker *worker, int client_socket, const struct dispatch_message *dispatch, bool closed, uint64_t finished_ns)
+{
+    struct process_pool_completion completion;
+
+    DC_TRACE(env);
+    dc_memset(env, &completion, 0, sizeof(completion));
+    completion.fd = dispatch->fd;
+    completion.closed = closed;
+    completion.wakeup_ns = dispatch->wakeup_ns;
+    completion.finished_ns = finished_ns;
+
+    // shorter than PIPE_BUF, so workers writing at once never interleave
+    if(write(worker->pool->completion_fd, &completion, sizeof(completion)) < 0)
+    {
+        perror("worker completion");
+    }
+
+    dc_close(env, err, client_socket);
+}
+
+static bool forget_worker(struct process_pool *pool, pid_t pid)
+{
+    for(int i = 0; i < pool->num_workers; i++)
+    {
+        if(pool->workers[i] == pid)
+        {
+            pool->workers[i] = pool->workers[pool->num_workers - 1];
+            pool->num_workers--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool forget_retiring(struct process_pool *pool, pid_t pid)
+{
+    for(int i = 0; i < pool->retiring; i++)
+    {
+        if(pool->retiring_pids[i] == pid)
+        {
+            pool->retiring_pids[i] = pool->retiring_pids[pool->retiring - 1];
+            pool->retiring--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool is_retiring(const struct process_pool *pool, pid_t pid)
+{
+    for(int i = 0; i < pool->retiring; i++)
+    {
+        if(pool->retiring_pids[i] == pid)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void reap_workers(struct dc_env *env, struct dc_error *err, struct process_pool *pool)
+{
+    pid_t pid;
+    int status;
+
+    DC_TRACE(env);
+
+    // any child, the one a hot upgrade started included, so only the pool's own are replaced
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        if(!forget_worker(pool, pid))
+        {
+            continue;
+        }
+
+        // the pool meant to lose this one, however it ended
+        if(forget_retiring(pool, pid) || pool->stopping)
+        {
+            continue;
+        }
+
+        // anything else lost capacity that has to be replaced, a worker that exited cleanly on its own included
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != WORKER_RELOADED)
+        {
+            printf("Worker (%d) died, respawning\n", pid);
+        }
+
+        spawn_worker(env, err, pool, pool->num_workers);
+    }
+}
+
+static void retire_worker(const struct dc_env *env, struct dc_error *err, struct process_pool *pool)
+{
+    pid_t pid;
+
+    DC_TRACE(env);
+    pid = -1;
+
+    // the newest worker not already on its way out, reap_workers knows it by this pid
+    for(int i = 0; i < pool->num_workers; i++)
+    {
+        if(!is_retiring(pool, pool->workers[i]))
+        {
+            pid = pool->workers[i];
+        }
+    }
+
+    if(pid < 0)
+    {
+        return;
+    }
+
+    dc_kill(env, err, pid, SIGUSR1);
+
+    if(dc_error_has_no_error(err))
+    {
+        pool->retiring_pids[pool->retiring] = pid;
+        pool->retiring++;
+
+        if(pool->verbose)
+        {
+            printf("Retiring a worker, %d left\n", process_pool_active(pool));
+        }
+    }
+}
+
+static void print_fd(const char *message, int fd, bool display)
+{
+    if(display)
+    {
+        printf("(pid=%d) %s with FD %d\n", getpid(), message, fd);
+    }
+}
@@ -0,0 +1,378 @@
+#include "result_cache.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define CACHE_SLOT_SIZE 1024    // entry header, request and result; larger pairs are not cached
+#define CACHE_WAYS 8            // slots a key may live in, probed and evicted as one bucket
+#define CACHE_LOCKS 64
+#define CACHE_ALIGNMENT 64
+
+/**
+ * Header of a slot, followed by the request bytes and then the result bytes.
+ */
+struct cache_entry
+{
+    uint64_t hash;
+    /**
+     * Processor that produced the result, so a reload or another kernel never serves a stale result.
+     */
+    uintptr_t processor;
+    uint32_t raw_length;
+    uint32_t result_length;
+    /**
+     * Cleared while the entry is rewritten, so a worker dying mid-write leaves no half entry behind.
+     */
+    uint8_t used;
+    /**
+     * CLOCK bit, set on every hit and cleared as the hand passes.
+     */
+    uint8_t referenced;
+};
+
+struct cache_header
+{
+    /**
+     * Striped by bucket, robust so a killed worker cannot wedge the others.
+     */
+    pthread_mutex_t locks[CACHE_LOCKS];
+    size_t num_buckets;
+    size_t mapping_size;
+    size_t slots_offset;
+    _Atomic uint64_t hits;
+    _Atomic uint64_t misses;
+    _Atomic uint64_t bypassed;
+    _Atomic uint64_t insertions;
+    _Atomic uint64_t evictions;
+    /**
+     * Rotates where the CLOCK hand starts within a bucket.
+     */
+    _Atomic uint32_t hand;
+};
+
+static size_t cached_process(const struct dc_env *env, struct dc_error *err, process_message_func processor, const uint8_t *raw_data, uint8_t **processed_data, size_t count);
+static bool lookup(const struct dc_env *env, struct dc_error *err, size_t bucket, uint64_t hash, uintptr_t processor, const uint8_t *raw_data, size_t count, uint8_t **processed_data, size_t *length);
+static void insert(size_t bucket, uint64_t hash, uintptr_t processor, const uint8_t *raw_data, size_t count, const uint8_t *processed_data, size_t length);
+static struct cache_entry *find(size_t bucket, uint64_t hash, uintptr_t processor, const uint8_t *raw_data, size_t count);
+static struct cache_entry *slot(size_t bucket, size_t way);
+static void lock_bucket(size_t bucket);
+static void unlock_bucket(size_t bucket);
+static uint64_t hash_bytes(const uint8_t *data, size_t length, uint64_t seed);
+static uint64_t mix(uint64_t value);
+
+
+#define CACHE_PAYLOAD_SIZE (CACHE_SLOT_SIZE - sizeof(struct cache_entry))
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_SHIFT 31U
+
+static struct cache_header *cache = NULL;  // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+bool result_cache_init(const struct dc_env *env, struct dc_error *err, size_t max_bytes, bool shared)
+{
+    pthread_mutexattr_t attr;
+    size_t slots_offset;
+    size_t num_buckets;
+    size_t mapping_size;
+    void *mapping;
+
+    DC_TRACE(env);
+    slots_offset = (sizeof(struct cache_header) + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+    num_buckets = max_bytes / (CACHE_SLOT_SIZE * CACHE_WAYS);
+
+    if(num_buckets == 0)
+    {
+        DC_ERROR_RAISE_USER(err, "Result cache is smaller than one bucket", -1);
+        return false;
+    }
+
+    mapping_size = slots_offset + num_buckets * CACHE_WAYS * CACHE_SLOT_SIZE;
+    // anonymous memory starts zeroed, so every slot starts unused
+    mapping = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, (shared ? MAP_SHARED : MAP_PRIVATE) | MAP_ANONYMOUS, -1, 0);
+
+    if(mapping == MAP_FAILED)
+    {
+        DC_ERROR_RAISE_SYSTEM(err, "Could not map the result cache", errno);
+        return false;
+    }
+
+    cache = (struct cache_header *)mapping;
+    cache->num_buckets = num_buckets;
+    cache->mapping_size = mapping_size;
+    cache->slots_offset = slots_offset;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, shared ? PTHREAD_PROCESS_SHARED : PTHREAD_PROCESS_PRIVATE);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+
+    for(int i = 0; i < CACHE_LOCKS; i++)
+    {
+        pthread_mutex_init(&cache->locks[i], &attr);
+    }
+
+    pthread_mutexattr_destroy(&attr);
+    printf("Result cache: %zu entries of up to %zu bytes, %s\n", num_buckets * CACHE_WAYS, CACHE_PAYLOAD_SIZE, shared ? "shared between workers" : "private");
+
+    return true;
+}
+
+size_t result_cache_process(const struct dc_env *env, struct dc_error *err, process_message_func processor, const uint8_t *raw_data, uint8_t **processed_data, ssize_t count)
+{
+    if(cache == NULL)
+    {
+        return processor(env, err, raw_data, processed_data, count);
+    }
+
+    if(count <= 0 || (size_t)count >= CACHE_PAYLOAD_SIZE)
+    {
+        atomic_fetch_add_explicit(&cache->bypassed, 1, memory_order_relaxed);
+        return processor(env, err, raw_data, processed_data, count);
+    }
+
+    return cached_process(env, err, processor, raw_data, processed_data, (size_t)count);
+}
+
+bool result_cache_stats(struct result_cache_stats *stats)
+{
+    if(cache == NULL)
+    {
+        return false;
+    }
+
+    stats->hits = atomic_load(&cache->hits);
+    stats->misses = atomic_load(&cache->misses);
+    stats->bypassed = atomic_load(&cache->bypassed);
+    stats->insertions = atomic_load(&cache->insertions);
+    stats->evictions = atomic_load(&cache->evictions);
+    stats->capacity = cache->num_buckets * CACHE_WAYS;
+
+    return true;
+}
+
+void result_cache_report(FILE *out)
+{
+    struct result_cache_stats stats;
+    uint64_t lookups;
+
+    if(!result_cache_stats(&stats))
+    {
+        return;
+    }
+
+    lookups = stats.hits + stats.misses;
+    fprintf(out, "Result cache: %" PRIu64 " hits, %" PRIu64 " misses (%" PRIu64 "%% hit rate), %" PRIu64 " bypassed, %" PRIu64 " insertions, %" PRIu64 " evictions, %zu entries\n",    // NOLINT(cert-err33-c)
+            stats.hits, stats.misses, lookups == 0 ? 0 : stats.hits * 100 / lookups,    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+            stats.bypassed, stats.insertions, stats.evictions, stats.capacity);
+}
+
+void result_cache_destroy(void)
+{
+    if(cache)
+    {
+        munmap(cache, cache->mapping_size);
+        cache = NULL;
+    }
+}
+
+static size_t cached_process(const struct dc_env *env, struct dc_error *err, process_message_func processor, const uint8_t *raw_data, uint8_t **processed_data, size_t count)
+{
+    uintptr_t processor_id;
+    uint64_t hash;
+    size_t bucket;
+    size_t length;
+
+    processor_id = (uintptr_t)processor;
+    hash = hash_bytes(raw_data, count, mix((uint64_t)processor_id));
+    bucket = (size_t)(hash % cache->num_buckets);
+
+    if(lookup(env, err, bucket, hash, processor_id, raw_data, count, processed_data, &length))
+    {
+        atomic_fetch_add_explicit(&cache->hits, 1, memory_order_relaxed);
+        return length;
+    }
+
+    // the processor runs outside the lock, a concurrent miss on the same request just computes it twice
+    atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+    length = processor(env, err, raw_data, processed_data, (ssize_t)count);
+
+    if(dc_error_has_no_error(err) && (length == 0 || *processed_data != NULL) && count + length < CACHE_PAYLOAD_SIZE)
+    {
+        insert(bucket, hash, processor_id, raw_data, count, *processed_data, length);
+    }
+
+    return length;
+}
+
+static bool lookup(const struct dc_env *env, struct dc_error *err, size_t bucket, uint64_t hash, uintptr_t processor, const uint8_t *raw_data, size_t count, uint8_t **processed_data, size_t *length)
+{
+    struct cache_entry *entry;
+    bool hit;
+
+    hit = false;
+    lock_bucket(bucket);
+    entry = find(bucket, hash, processor, raw_data, count);
+
+    if(entry)
+    {
+        // the caller frees the result like any processor's
+        *length = entry->result_length;
+        *processed_data = dc_malloc(env, err, *length == 0 ? 1 : *length);
+
+        if(*processed_data)
+        {
+            dc_memcpy(env, *processed_data, (const uint8_t *)(entry + 1) + entry->raw_length, *length);
+            entry->referenced = 1;
+            hit = true;
+        }
+    }
+
+    unlock_bucket(bucket);
+
+    return hit;
+}
+
+static void insert(size_t bucket, uint64_t hash, uintptr_t processor, const uint8_t *raw_data, size_t count, const uint8_t *processed_data, size_t length)
+{
+    struct cache_entry *victim;
+    size_t start;
+
+    lock_bucket(bucket);
+
+    if(find(bucket, hash, processor, raw_data, count) != NULL)
+    {
+        unlock_bucket(bucket);
+        return;
+    }
+
+    victim = NULL;
+
+    for(size_t way = 0; way < CACHE_WAYS && victim == NULL; way++)
+    {
+        if(!slot(bucket, way)->used)
+        {
+            victim = slot(bucket, way);
+        }
+    }
+
+    // CLOCK: give every referenced entry a second chance, the second lap always finds one
+    start = atomic_fetch_add_explicit(&cache->hand, 1, memory_order_relaxed);
+
+    for(size_t i = 0; i < 2 * CACHE_WAYS && victim == NULL; i++)
+    {
+        struct cache_entry *entry;
+
+        entry = slot(bucket, (start + i) % CACHE_WAYS);
+
+        if(entry->referenced)
+        {
+            entry->referenced = 0;
+        }
+        else
+        {
+            victim = entry;
+            atomic_fetch_add_explicit(&cache->evictions, 1, memory_order_relaxed);
+        }
+    }
+
+    if(victim)
+    {
+        victim->used = 0;
+        victim->hash = hash;
+        victim->processor = processor;
+        victim->raw_length = (uint32_t)count;
+        victim->result_length = (uint32_t)length;
+        memcpy(victim + 1, raw_data, count);
+
+        if(length > 0)
+        {
+            memcpy((uint8_t *)(victim + 1) + count, processed_data, length);
+        }
+
+        victim->referenced = 0;
+        victim->used = 1;
+        atomic_fetch_add_explicit(&cache->insertions, 1, memory_order_relaxed);
+    }
+
+    unlock_bucket(bucket);
+}
+
+static struct cache_entry *find(size_t bucket, uint64_t hash, uintptr_t processor, const uint8_t *raw_data, size_t count)
+{
+    for(size_t way = 0; way < CACHE_WAYS; way++)
+    {
+        struct cache_entry *entry;
+
+        entry = slot(bucket, way);
+
+        // the hash only narrows it down, a hit needs the same bytes
+        if(entry->used && entry->hash == hash && entry->processor == processor && entry->raw_length == count && memcmp(entry + 1, raw_data, count) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static struct cache_entry *slot(size_t bucket, size_t way)
+{
+    return (struct cache_entry *)((uint8_t *)cache + cache->slots_offset + (bucket * CACHE_WAYS + way) * CACHE_SLOT_SIZE);
+}
+
+static void lock_bucket(size_t bucket)
+{
+    pthread_mutex_t *lock;
+
+    lock = &cache->locks[bucket % CACHE_LOCKS];
+
+    // the previous owner died holding it, an entry it was writing is still marked unused
+    if(pthread_mutex_lock(lock) == EOWNERDEAD)
+    {
+        pthread_mutex_consistent(lock);
+    }
+}
+
+static void unlock_bucket(size_t bucket)
+{
+    pthread_mutex_unlock(&cache->locks[bucket % CACHE_LOCKS]);
+}
+
+static uint64_t hash_bytes(const uint8_t *data, size_t length, uint64_t seed)
+{
+    uint64_t hash;
+    uint64_t word;
+    size_t i;
+
+    hash = seed ^ (length * HASH_PRIME_1);
+
+    // one multiply per 8 bytes, the tail is packed into a final word
+    for(i = 0; i + sizeof(word) <= length; i += sizeof(word))
+    {
+        memcpy(&word, &data[i], sizeof(word));
+        word *= HASH_PRIME_2;
+        word ^= word >> HASH_SHIFT;
+        hash = (hash ^ word) * HASH_PRIME_1;
+    }
+
+    word = 0;
+    memcpy(&word, &data[i], length - i);
+    hash = (hash ^ (word * HASH_PRIME_2)) * HASH_PRIME_1;
+
+    return mix(hash);
+}
+
+static uint64_t mix(uint64_t value)
+{
+    // murmur3 finalizer
+    value ^= value >> 33U;                  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    value *= 0xFF51AFD7ED558CCDULL;         // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    value ^= value >> 33U;                  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    value *= 0xC4CEB9FE1A85EC53ULL;         // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    value ^= value >> 33U;                  // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return value;
+}
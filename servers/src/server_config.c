@@ -0,0 +1,296 @@
+#include "server_config.h"
+#include "file_server.h"
+#include "listener.h"
+#include "util.h"
+#include <libconfig.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum config_type
+{
+    TYPE_INT,
+    TYPE_PORT,
+    TYPE_BOOL
+};
+
+struct config_key
+{
+    const char *name;
+    enum config_type type;
+    size_t offset;
+    long min;
+    long max;
+};
+
+static const struct config_key *find_key(const char *name, size_t length);
+static bool store(struct server_config *config, const struct config_key *key, long value);
+static long fetch(const struct server_config *config, const struct config_key *key);
+
+
+#define DEFAULT_PORT 5000
+#define DEFAULT_EVENT_BATCH 64
+#define DEFAULT_UDP_BATCH 32     // also the most the UDP server's receive arrays hold
+#define DEFAULT_COMPUTE_DEPTH 256
+#define DEFAULT_HEADER_TIMEOUT_MS 10000
+#define DEFAULT_IDLE_TIMEOUT_MS 60000
+#define MAX_WORKERS 255          // the poll server counts its processes in a uint8_t
+#define MIN_READ_BUFFER 64
+#define MAX_READ_BUFFER (16 * 1024 * 1024)
+#define MAX_BATCH 4096
+#define MAX_COMPUTE_DEPTH 65536
+#define DEFAULT_FIBER_STACK (64 * 1024)
+#define MIN_FIBER_STACK (16 * 1024)
+#define MAX_FIBER_STACK (8 * 1024 * 1024)
+#define DEFAULT_RING_SIZE (64 * 1024)
+#define MIN_RING_SIZE 4096
+#define MAX_RING_SIZE (16 * 1024 * 1024)
+#define MAX_SPIN_US 10000
+
+static const struct config_key config_keys[] = {    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    {"port",              TYPE_PORT, offsetof(struct server_config, port),              1, UINT16_MAX},
+    {"backlog",           TYPE_INT,  offsetof(struct server_config, backlog),           1, INT_MAX},
+    {"workers",           TYPE_INT,  offsetof(struct server_config, workers),           0, MAX_WORKERS},
+    {"read_buffer_size",  TYPE_INT,  offsetof(struct server_config, read_buffer_size),  MIN_READ_BUFFER, MAX_READ_BUFFER},
+    {"accept_batch",      TYPE_INT,  offsetof(struct server_config, accept_batch),      1, MAX_BATCH},
+    {"event_batch",       TYPE_INT,  offsetof(struct server_config, event_batch),       1, MAX_BATCH},
+    {"udp_batch",         TYPE_INT,  offsetof(struct server_config, udp_batch),         1, DEFAULT_UDP_BATCH},
+    {"compute_depth",     TYPE_INT,  offsetof(struct server_config, compute_depth),     1, MAX_COMPUTE_DEPTH},
+    {"max_connections",   TYPE_INT,  offsetof(struct server_config, max_connections),   0, INT_MAX},
+    {"header_timeout_ms", TYPE_INT,  offsetof(struct server_config, header_timeout_ms), 0, INT_MAX},
+    {"idle_timeout_ms",   TYPE_INT,  offsetof(struct server_config, idle_timeout_ms),   0, INT_MAX},
+    {"file_transfer",     TYPE_INT,  offsetof(struct server_config, file_transfer),     FILE_TRANSFER_SENDFILE, FILE_TRANSFER_COPY},
+    {"fair_requests",     TYPE_INT,  offsetof(struct server_config, fair_requests),     1, MAX_BATCH},
+    {"fair_bytes",        TYPE_INT,  offsetof(struct server_config, fair_bytes),        0, INT_MAX},
+    {"fiber_stack_size",  TYPE_INT,  offsetof(struct server_config, fiber_stack_size),  MIN_FIBER_STACK, MAX_FIBER_STACK},
+    {"ring_size",         TYPE_INT,  offsetof(struct server_config, ring_size),         MIN_RING_SIZE, MAX_RING_SIZE},
+    {"spin_us",           TYPE_INT,  offsetof(struct server_config, spin_us),           0, MAX_SPIN_US},
+    {"verbose",           TYPE_BOOL, offsetof(struct server_config, verbose),           0, 1},
+};
+
+#define NUM_CONFIG_KEYS (sizeof(config_keys) / sizeof(config_keys[0]))
+
+void server_config_defaults(struct server_config *config)
+{
+    config->port = DEFAULT_PORT;
+    config->backlog = SOMAXCONN;
+    config->workers = 0;
+    config->read_buffer_size = BLOCK_SIZE;
+    config->accept_batch = LISTENER_ACCEPT_BATCH;
+    config->event_batch = DEFAULT_EVENT_BATCH;
+    config->udp_batch = DEFAULT_UDP_BATCH;
+    config->compute_depth = DEFAULT_COMPUTE_DEPTH;
+    config->max_connections = 0;
+    config->header_timeout_ms = DEFAULT_HEADER_TIMEOUT_MS;
+    config->idle_timeout_ms = DEFAULT_IDLE_TIMEOUT_MS;
+    config->file_transfer = FILE_TRANSFER_SENDFILE;
+    config->fair_requests = 1;
+    config->fair_bytes = 0;
+    config->fiber_stack_size = DEFAULT_FIBER_STACK;
+    config->ring_size = DEFAULT_RING_SIZE;
+    config->spin_us = 0;
+    config->verbose = true;
+}
+
+bool server_config_load(const struct dc_env *env, struct dc_error *err, struct server_config *config, const char *path)
+{
+    config_t file;
+    bool valid;
+
+    DC_TRACE(env);
+    config_init(&file);
+
+    if(config_read_file(&file, path) != CONFIG_TRUE)
+    {
+        fprintf(stderr, "%s:%d: %s\n", path, config_error_line(&file), config_error_text(&file));    // NOLINT(cert-err33-c)
+        config_destroy(&file);
+        DC_ERROR_RAISE_USER(err, "Could not read the configuration file", -1);
+        return false;
+    }
+
+    valid = true;
+
+    // keys missing from the file keep their current value
+    for(size_t i = 0; i < NUM_CONFIG_KEYS && valid; i++)
+    {
+        long long value;
+        int flag;
+
+        if(config_keys[i].type == TYPE_BOOL)
+        {
+            if(config_lookup_bool(&file, config_keys[i].name, &flag) == CONFIG_TRUE)
+            {
+                valid = store(config, &config_keys[i], flag);
+            }
+        }
+        else if(config_lookup_int64(&file, config_keys[i].name, &value) == CONFIG_TRUE)
+        {
+            valid = value >= LONG_MIN && value <= LONG_MAX && store(config, &config_keys[i], (long)value);
+        }
+
+        if(!valid)
+        {
+            fprintf(stderr, "%s: %s must be between %ld and %ld\n", path, config_keys[i].name, config_keys[i].min, config_keys[i].max);    // NOLINT(cert-err33-c)
+        }
+    }
+
+    config_destroy(&file);
+
+    if(!valid)
+    {
+        DC_ERROR_RAISE_USER(err, "Invalid value in the configuration file", -1);
+    }
+
+    return valid;
+}
+
+enum server_config_result server_config_set(struct server_config *config, const char *assignment)
+{
+    const struct config_key *key;
+    const char *equals;
+    char *end;
+    long value;
+
+    equals = strchr(assignment, '=');
+
+    if(equals == NULL)
+    {
+        return SERVER_CONFIG_UNKNOWN_KEY;
+    }
+
+    key = find_key(assignment, (size_t)(equals - assignment));
+
+    if(key == NULL)
+    {
+        return SERVER_CONFIG_UNKNOWN_KEY;
+    }
+
+    if(key->type == TYPE_BOOL && (strcmp(equals + 1, "true") == 0 || strcmp(equals + 1, "false") == 0))
+    {
+        value = equals[1] == 't';
+    }
+    else
+    {
+        value = strtol(equals + 1, &end, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+        if(end == equals + 1 || *end != '\0')
+        {
+            return SERVER_CONFIG_INVALID;
+        }
+    }
+
+    return store(config, key, value) ? SERVER_CONFIG_SET : SERVER_CONFIG_INVALID;
+}
+
+bool server_config_write(const struct dc_env *env, struct dc_error *err, const struct server_config *config, const char *path)
+{
+    config_t file;
+    config_setting_t *root;
+    bool written;
+
+    DC_TRACE(env);
+    config_init(&file);
+    root = config_root_setting(&file);
+
+    for(size_t i = 0; i < NUM_CONFIG_KEYS; i++)
+    {
+        config_setting_t *setting;
+
+        if(config_keys[i].type == TYPE_BOOL)
+        {
+            setting = config_setting_add(root, config_keys[i].name, CONFIG_TYPE_BOOL);
+            config_setting_set_bool(setting, (int)fetch(config, &config_keys[i]));
+        }
+        else
+        {
+            setting = config_setting_add(root, config_keys[i].name, CONFIG_TYPE_INT);
+            config_setting_set_int(setting, (int)fetch(config, &config_keys[i]));
+        }
+    }
+
+    written = config_write_file(&file, path) == CONFIG_TRUE;
+    config_destroy(&file);
+
+    if(!written)
+    {
+        DC_ERROR_RAISE_USER(err, "Could not write the configuration file", -1);
+    }
+
+    return written;
+}
+
+void server_config_print(const struct server_config *config, FILE *out)
+{
+    for(size_t i = 0; i < NUM_CONFIG_KEYS; i++)
+    {
+        if(config_keys[i].type == TYPE_BOOL)
+        {
+            fprintf(out, "%s%s=%s", i == 0 ? "" : " ", config_keys[i].name, fetch(config, &config_keys[i]) ? "true" : "false");    // NOLINT(cert-err33-c)
+        }
+        else
+        {
+            fprintf(out, "%s%s=%ld", i == 0 ? "" : " ", config_keys[i].name, fetch(config, &config_keys[i]));    // NOLINT(cert-err33-c)
+        }
+    }
+
+    fprintf(out, "\n");    // NOLINT(cert-err33-c)
+}
+
+static const struct config_key *find_key(const char *name, size_t length)
+{
+    for(size_t i = 0; i < NUM_CONFIG_KEYS; i++)
+    {
+        if(strlen(config_keys[i].name) == length && strncmp(config_keys[i].name, name, length) == 0)
+        {
+            return &config_keys[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool store(struct server_config *config, const struct config_key *key, long value)
+{
+    uint8_t *field;
+
+    if(value < key->min || value > key->max)
+    {
+        return false;
+    }
+
+    field = (uint8_t *)config + key->offset;
+
+    switch(key->type)
+    {
+        case TYPE_PORT:
+            *(in_port_t *)field = (in_port_t)value;
+            break;
+        case TYPE_BOOL:
+            *(bool *)field = value != 0;
+            break;
+        case TYPE_INT:
+        default:
+            *(int *)field = (int)value;
+            break;
+    }
+
+    return true;
+}
+
+static long fetch(const struct server_config *config, const struct config_key *key)
+{
+    const uint8_t *field;
+
+    field = (const uint8_t *)config + key->offset;
+
+    switch(key->type)
+    {
+        case TYPE_PORT:
+            return *(const in_port_t *)field;
+        case TYPE_BOOL:
+            return *(const bool *)field;
+        case TYPE_INT:
+        default:
+            return *(const int *)field;
+    }
+}
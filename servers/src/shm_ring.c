@@ -0,0 +1,307 @@
+#include "shm_ring.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static uint32_t record_size(size_t length);
+static void copy_out(const uint8_t *ring, uint32_t capacity, uint32_t position, uint8_t *data, size_t length);
+static void copy_in(uint8_t *ring, uint32_t capacity, uint32_t position, const uint8_t *data, size_t length);
+static void wake(_Atomic uint32_t *sleeping, int fd);
+
+
+#define LENGTH_SIZE sizeof(uint32_t)
+
+bool shm_ring_create(const struct dc_env *env, struct dc_error *err, struct shm_ring *ring, size_t capacity, size_t max_message)
+{
+    void *mapping;
+    uint32_t size;
+
+    DC_TRACE(env);
+    dc_memset(env, ring, 0, sizeof(*ring));
+    ring->memfd = ring->wake_fd = ring->client_wake_fd = -1;
+
+    // a power of two so positions map to offsets with a mask, and at least one record of the longest request
+    for(size = SHM_RING_RECORD_ALIGN; size < capacity || size < record_size(max_message); size *= 2)
+    {
+    }
+
+    ring->capacity = size;
+    ring->max_message = (uint32_t)max_message;
+    ring->map_size = sizeof(struct shm_ring_header) + 2 * (size_t)size;
+    ring->memfd = memfd_create("scalable_server_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    // sealed at its size, a client that truncates the file would otherwise make the server fault on the mapping
+    if(ring->memfd < 0 || ftruncate(ring->memfd, (off_t)ring->map_size) != 0 ||
+       fcntl(ring->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0)
+    {
+        DC_ERROR_RAISE_SYSTEM(err, "memfd for shared memory ring", errno);
+        shm_ring_destroy(ring);
+        return false;
+    }
+
+    mapping = mmap(NULL, ring->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, ring->memfd, 0);
+
+    if(mapping == MAP_FAILED)
+    {
+        DC_ERROR_RAISE_SYSTEM(err, "mmap shared memory ring", errno);
+        shm_ring_destroy(ring);
+        return false;
+    }
+
+    ring->header = (struct shm_ring_header *)mapping;
+    ring->requests = (uint8_t *)mapping + sizeof(struct shm_ring_header);
+    ring->replies = ring->requests + size;
+    ring->header->magic = SHM_RING_MAGIC;
+    ring->header->version = SHM_RING_VERSION;
+    ring->header->capacity = size;
+    ring->header->max_message = (uint32_t)max_message;
+    // the loop only hears about the first request through the eventfd
+    atomic_store_explicit(&ring->header->server_sleeping, 1, memory_order_relaxed);
+
+    // the loop drains its own without blocking, the client blocks on its own
+    ring->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ring->client_wake_fd = eventfd(0, EFD_CLOEXEC);
+
+    if(ring->wake_fd < 0 || ring->client_wake_fd < 0)
+    {
+        DC_ERROR_RAISE_SYSTEM(err, "eventfd for shared memory ring", errno);
+        shm_ring_destroy(ring);
+        return false;
+    }
+
+    return true;
+}
+
+bool shm_ring_send_hello(const struct dc_env *env, struct dc_error *err, const struct shm_ring *ring, int socket)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct shm_ring_hello hello;
+    char control_buf[CMSG_SPACE(SHM_RING_FDS * sizeof(int))];
+    struct cmsghdr *cmsg;
+    int fds[SHM_RING_FDS];
+
+    DC_TRACE(env);
+    dc_memset(env, &msg, 0, sizeof(msg));
+    dc_memset(env, &iov, 0, sizeof(iov));
+    dc_memset(env, control_buf, 0, sizeof(control_buf));
+    dc_memset(env, &hello, 0, sizeof(hello));
+    hello.magic = SHM_RING_MAGIC;
+    hello.version = SHM_RING_VERSION;
+    hello.map_size = ring->map_size;
+    fds[0] = ring->memfd;
+    fds[1] = ring->wake_fd;
+    fds[2] = ring->client_wake_fd;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_buf;
+    msg.msg_controllen = sizeof(control_buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+
+    if(cmsg == NULL)
+    {
+        DC_ERROR_RAISE_SYSTEM(err, "shared memory ring hello", EINVAL);
+        return false;
+    }
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    dc_memcpy(env, CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    // a fresh socket's send buffer is empty, so the one small message goes out even though the socket is non-blocking
+    dc_sendmsg(env, err, socket, &msg, MSG_NOSIGNAL);
+
+    return dc_error_has_no_error(err);
+}
+
+void shm_ring_destroy(struct shm_ring *ring)
+{
+    if(ring->header != NULL)
+    {
+        munmap(ring->header, ring->map_size);
+        ring->header = NULL;
+    }
+
+    if(ring->memfd >= 0)
+    {
+        close(ring->memfd);
+        ring->memfd = -1;
+    }
+
+    if(ring->wake_fd >= 0)
+    {
+        close(ring->wake_fd);
+        ring->wake_fd = -1;
+    }
+
+    if(ring->client_wake_fd >= 0)
+    {
+        close(ring->client_wake_fd);
+        ring->client_wake_fd = -1;
+    }
+}
+
+ssize_t shm_ring_read(const struct dc_env *env, struct dc_error *err, struct shm_ring *ring, uint8_t **data)
+{
+    uint32_t tail;
+    uint32_t available;
+    uint32_t length;
+
+    DC_TRACE(env);
+    *data = NULL;
+    tail = atomic_load_explicit(&ring->header->requests.tail, memory_order_acquire);
+    available = tail - ring->request_head;
+
+    if(available == 0)
+    {
+        return 0;
+    }
+
+    // the client owns tail and the length, so both are checked against what a valid client could have written
+    if(available > ring->capacity || available % SHM_RING_RECORD_ALIGN != 0)
+    {
+        return -1;
+    }
+
+    dc_memcpy(env, &length, ring->requests + (ring->request_head & (ring->capacity - 1)), LENGTH_SIZE);
+
+    if(length == 0 || length > ring->max_message || record_size(length) > available)
+    {
+        return -1;
+    }
+
+    *data = (uint8_t *)dc_malloc(env, err, length);
+
+    if(*data == NULL)
+    {
+        return -1;
+    }
+
+    copy_out(ring->requests, ring->capacity, ring->request_head + (uint32_t)LENGTH_SIZE, *data, length);
+    ring->request_head += record_size(length);
+    atomic_store_explicit(&ring->header->requests.head, ring->request_head, memory_order_release);
+
+    // a client that filled the ring may be asleep waiting for this room
+    wake(&ring->header->client_sleeping, ring->client_wake_fd);
+
+    return (ssize_t)length;
+}
+
+bool shm_ring_can_write(const struct shm_ring *ring, size_t length)
+{
+    uint32_t used;
+
+    used = ring->reply_tail - atomic_load_explicit(&ring->header->replies.head, memory_order_acquire);
+
+    // a head moved past the tail is the client's mistake, it gets no more replies
+    return used <= ring->capacity && record_size(length) <= ring->capacity - used;
+}
+
+void shm_ring_write(struct shm_ring *ring, const void *data, size_t length)
+{
+    uint32_t length32;
+
+    length32 = (uint32_t)length;
+    memcpy(ring->replies + (ring->reply_tail & (ring->capacity - 1)), &length32, LENGTH_SIZE);
+    copy_in(ring->replies, ring->capacity, ring->reply_tail + (uint32_t)LENGTH_SIZE, (const uint8_t *)data, length);
+    ring->reply_tail += record_size(length);
+    atomic_store_explicit(&ring->header->replies.tail, ring->reply_tail, memory_order_release);
+    wake(&ring->header->client_sleeping, ring->client_wake_fd);
+}
+
+void shm_ring_clear_wakeup(const struct shm_ring *ring)
+{
+    uint64_t count;
+
+    // EAGAIN, another wakeup was already consumed
+    if(read(ring->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        perror("shared memory ring wakeup");
+    }
+}
+
+bool shm_ring_sleep(struct shm_ring *ring, size_t reply_length)
+{
+    atomic_store_explicit(&ring->header->server_sleeping, 1, memory_order_seq_cst);
+
+    // pairs with the fence in the client's wake: either it sees the flag, or this sees its request
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if(atomic_load_explicit(&ring->header->requests.tail, memory_order_acquire) != ring->request_head && shm_ring_can_write(ring, reply_length))
+    {
+        atomic_store_explicit(&ring->header->server_sleeping, 0, memory_order_relaxed);
+        return false;
+    }
+
+    return true;
+}
+
+void shm_ring_wake_self(const struct shm_ring *ring)
+{
+    uint64_t one;
+
+    one = 1;
+
+    // EAGAIN, the counter is saturated and a wakeup is pending anyway
+    if(write(ring->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+    {
+        perror("shared memory ring wakeup");
+    }
+}
+
+static uint32_t record_size(size_t length)
+{
+    return (uint32_t)((LENGTH_SIZE + length + SHM_RING_RECORD_ALIGN - 1) & ~(size_t)(SHM_RING_RECORD_ALIGN - 1));
+}
+
+static void copy_out(const uint8_t *ring, uint32_t capacity, uint32_t position, uint8_t *data, size_t length)
+{
+    uint32_t offset;
+    size_t first;
+
+    offset = position & (capacity - 1);
+    first = length < capacity - offset ? length : capacity - offset;
+    memcpy(data, ring + offset, first);
+    memcpy(data + first, ring, length - first);
+}
+
+static void copy_in(uint8_t *ring, uint32_t capacity, uint32_t position, const uint8_t *data, size_t length)
+{
+    uint32_t offset;
+    size_t first;
+
+    offset = position & (capacity - 1);
+    first = length < capacity - offset ? length : capacity - offset;
+    memcpy(ring + offset, data, first);
+    memcpy(ring, data + first, length - first);
+}
+
+static void wake(_Atomic uint32_t *sleeping, int fd)
+{
+    // the store that published the record must be visible before the flag is read, or both sides could sleep
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if(atomic_load_explicit(sleeping, memory_order_relaxed) != 0 && atomic_exchange_explicit(sleeping, 0, memory_order_acq_rel) != 0)
+    {
+        uint64_t one;
+
+        one = 1;
+
+        // EAGAIN, the counter is saturated and the client has wakeups pending anyway
+        if(write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        {
+            perror("shared memory ring wakeup");
+        }
+    }
+}
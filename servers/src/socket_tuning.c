@@ -0,0 +1,191 @@
+#include "socket_tuning.h"
+#include <limits.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool parse_option(struct socket_tuning *tuning, const char *option, size_t length);
+static bool parse_value(const char *option, size_t length, const char *name, int *value);
+static void set_option(const struct dc_env *env, int fd, int level, int name, int value, const char *label);
+
+
+static struct socket_tuning active_tuning = {REPLY_DEFAULT, 0, 0, 0, 0, 0};    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+bool socket_tuning_configure(const char *spec)
+{
+    struct socket_tuning tuning;
+    const char *option;
+
+    memset(&tuning, 0, sizeof(tuning));
+    option = spec;
+
+    while(option && *option != '\0')
+    {
+        const char *end;
+
+        end = strchr(option, ',');
+
+        if(end == NULL)
+        {
+            end = option + strlen(option);
+        }
+
+        if(!parse_option(&tuning, option, (size_t)(end - option)))
+        {
+            return false;
+        }
+
+        option = *end == ',' ? end + 1 : end;
+    }
+
+    active_tuning = tuning;
+
+    return true;
+}
+
+const struct socket_tuning *socket_tuning_active(void)
+{
+    return &active_tuning;
+}
+
+void socket_tuning_listener(const struct dc_env *env, int listener, sa_family_t family)
+{
+    DC_TRACE(env);
+
+    // accepted sockets inherit the buffer sizes and busy poll time from the listener
+    if(active_tuning.rcvbuf > 0)
+    {
+        set_option(env, listener, SOL_SOCKET, SO_RCVBUF, active_tuning.rcvbuf, "SO_RCVBUF");
+    }
+
+    if(active_tuning.sndbuf > 0)
+    {
+        set_option(env, listener, SOL_SOCKET, SO_SNDBUF, active_tuning.sndbuf, "SO_SNDBUF");
+    }
+
+    if(active_tuning.busy_poll_us > 0)
+    {
+        set_option(env, listener, SOL_SOCKET, SO_BUSY_POLL, active_tuning.busy_poll_us, "SO_BUSY_POLL");
+    }
+
+    if(family != AF_INET)
+    {
+        return;
+    }
+
+    if(active_tuning.defer_accept_s > 0)
+    {
+        set_option(env, listener, IPPROTO_TCP, TCP_DEFER_ACCEPT, active_tuning.defer_accept_s, "TCP_DEFER_ACCEPT");
+    }
+
+    if(active_tuning.fastopen_queue > 0)
+    {
+        set_option(env, listener, IPPROTO_TCP, TCP_FASTOPEN, active_tuning.fastopen_queue, "TCP_FASTOPEN");
+    }
+}
+
+void socket_tuning_connection(const struct dc_env *env, int fd, sa_family_t family)
+{
+    DC_TRACE(env);
+
+    // Nagle is per connection, it is not inherited from the listener
+    if(family == AF_INET && active_tuning.reply == REPLY_NODELAY)
+    {
+        set_option(env, fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+}
+
+void socket_tuning_begin_reply(int fd)
+{
+    int on;
+
+    if(active_tuning.reply != REPLY_CORK)
+    {
+        return;
+    }
+
+    // fails on Unix domain sockets, which have nothing to cork
+    on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+void socket_tuning_end_reply(int fd)
+{
+    int off;
+
+    if(active_tuning.reply != REPLY_CORK)
+    {
+        return;
+    }
+
+    off = 0;
+    setsockopt(fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+}
+
+void socket_tuning_report(FILE *out)
+{
+    static const char *reply_names[] = {"nagle", "nodelay", "cork"};
+
+    fprintf(out, "Socket tuning: %s, defer accept %ds, rcvbuf %d, sndbuf %d, busy poll %dus, fastopen %d\n",     // NOLINT(cert-err33-c)
+            reply_names[active_tuning.reply], active_tuning.defer_accept_s, active_tuning.rcvbuf, active_tuning.sndbuf,
+            active_tuning.busy_poll_us, active_tuning.fastopen_queue);
+}
+
+static bool parse_option(struct socket_tuning *tuning, const char *option, size_t length)
+{
+    if(length == strlen("nodelay") && strncmp(option, "nodelay", length) == 0)
+    {
+        tuning->reply = REPLY_NODELAY;
+        return true;
+    }
+
+    if(length == strlen("cork") && strncmp(option, "cork", length) == 0)
+    {
+        tuning->reply = REPLY_CORK;
+        return true;
+    }
+
+    return parse_value(option, length, "defer=", &tuning->defer_accept_s) ||
+           parse_value(option, length, "rcvbuf=", &tuning->rcvbuf) ||
+           parse_value(option, length, "sndbuf=", &tuning->sndbuf) ||
+           parse_value(option, length, "busypoll=", &tuning->busy_poll_us) ||
+           parse_value(option, length, "fastopen=", &tuning->fastopen_queue);
+}
+
+static bool parse_value(const char *option, size_t length, const char *name, int *value)
+{
+    size_t name_length;
+    char *end;
+    long parsed;
+
+    name_length = strlen(name);
+
+    if(length <= name_length || strncmp(option, name, name_length) != 0)
+    {
+        return false;
+    }
+
+    parsed = strtol(option + name_length, &end, 10);    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    // the value has to run exactly to the next comma
+    if(end != option + length || parsed <= 0 || parsed > INT_MAX)
+    {
+        return false;
+    }
+
+    *value = (int)parsed;
+
+    return true;
+}
+
+static void set_option(const struct dc_env *env, int fd, int level, int name, int value, const char *label)
+{
+    DC_TRACE(env);
+
+    // a refused option (SO_BUSY_POLL needs CAP_NET_ADMIN above net.core.busy_read) leaves the kernel default
+    if(setsockopt(fd, level, name, &value, sizeof(value)) != 0)
+    {
+        perror(label);
+    }
+}
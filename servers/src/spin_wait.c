@@ -0,0 +1,128 @@
+#include "spin_wait.h"
+#include <string.h>
+
+static void record_gap(struct spin_wait *spin, uint64_t gap_ns);
+
+
+#define NS_PER_US 1000
+#define NS_PER_MS 1000000
+#define GAP_SHIFT 3         // each gap moves the average an eighth of the way
+#define GAP_CLAMP 4         // a long idle spell counts as this many limits, so the average recovers in a few wakeups
+#define MAX_BACKOFF 64      // most waits skipped after a run of misses
+#define PERCENT 100
+
+void spin_wait_init(struct spin_wait *spin, uint32_t max_us)
+{
+    memset(spin, 0, sizeof(*spin));
+    spin->max_ns = (uint64_t)max_us * NS_PER_US;
+    // optimistic until the first gaps are in
+    spin->gap_ns = spin->max_ns / 2;
+}
+
+uint64_t spin_wait_budget(struct spin_wait *spin, uint64_t now_ns)
+{
+    uint64_t budget;
+
+    if(spin->busy_since_ns != 0)
+    {
+        spin->stats.busy_ns += now_ns - spin->busy_since_ns;
+    }
+
+    if(spin->max_ns == 0 || spin->gap_ns > spin->max_ns)
+    {
+        return 0;
+    }
+
+    if(spin->skip > 0)
+    {
+        spin->skip--;
+        return 0;
+    }
+
+    budget = spin->gap_ns * 2;
+
+    return budget < spin->max_ns ? budget : spin->max_ns;
+}
+
+void spin_wait_woke(struct spin_wait *spin, uint64_t spun_ns, uint64_t blocked_ns, bool caught, uint64_t now_ns)
+{
+    spin->stats.waits++;
+    spin->stats.blocked_ns += blocked_ns;
+
+    if(caught)
+    {
+        spin->stats.caught++;
+        spin->stats.caught_ns += spun_ns;
+        spin->backoff = 0;
+    }
+    else if(spun_ns > 0)
+    {
+        spin->stats.missed++;
+        spin->stats.missed_ns += spun_ns;
+        spin->backoff = spin->backoff == 0 ? 1 : spin->backoff * 2;
+
+        if(spin->backoff > MAX_BACKOFF)
+        {
+            spin->backoff = MAX_BACKOFF;
+        }
+
+        spin->skip = spin->backoff;
+    }
+    else
+    {
+        spin->stats.blocked++;
+    }
+
+    // sampled whether the loop spun or not, so a loop that stopped spinning starts again when the load comes back
+    if(spin->max_ns > 0)
+    {
+        record_gap(spin, spun_ns + blocked_ns);
+    }
+
+    spin->busy_since_ns = now_ns;
+}
+
+void spin_wait_report(const struct spin_wait *spin, FILE *out)
+{
+    const struct spin_wait_stats *stats;
+    uint64_t spun_ns;
+    uint64_t total_ns;
+
+    if(spin->max_ns == 0)
+    {
+        return;
+    }
+
+    stats = &spin->stats;
+    spun_ns = stats->caught_ns + stats->missed_ns;
+    total_ns = spun_ns + stats->blocked_ns + stats->busy_ns;
+
+    fprintf(out, "Spin: %llu waits, %llu caught while spinning, %llu spun then blocked, %llu blocked at once; gap estimate %lluus of %lluus\n",    // NOLINT(cert-err33-c)
+            (unsigned long long)stats->waits, (unsigned long long)stats->caught, (unsigned long long)stats->missed, (unsigned long long)stats->blocked,
+            (unsigned long long)(spin->gap_ns / NS_PER_US), (unsigned long long)(spin->max_ns / NS_PER_US));
+
+    if(total_ns > 0)
+    {
+        fprintf(out, "Spin: %llums handling events, %llums spinning (%llums of it wasted), %llums blocked; %llu%% of the loop's time spent spinning\n",    // NOLINT(cert-err33-c)
+                (unsigned long long)(stats->busy_ns / NS_PER_MS), (unsigned long long)(spun_ns / NS_PER_MS), (unsigned long long)(stats->missed_ns / NS_PER_MS),
+                (unsigned long long)(stats->blocked_ns / NS_PER_MS), (unsigned long long)(spun_ns * PERCENT / total_ns));
+    }
+}
+
+static void record_gap(struct spin_wait *spin, uint64_t gap_ns)
+{
+    if(gap_ns > spin->max_ns * GAP_CLAMP)
+    {
+        gap_ns = spin->max_ns * GAP_CLAMP;
+    }
+
+    // unsigned, so the step toward a smaller gap is taken as a subtraction
+    if(gap_ns >= spin->gap_ns)
+    {
+        spin->gap_ns += (gap_ns - spin->gap_ns) >> GAP_SHIFT;
+    }
+    else
+    {
+        spin->gap_ns -= (spin->gap_ns - gap_ns) >> GAP_SHIFT;
+    }
+}
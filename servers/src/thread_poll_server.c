@@ -1,11 +1,33 @@
-#include "../include/server.h"
+#include "event_server.h"
+#include "server.h"
+#include <dc_util/system.h>
+
+#define DEFAULT_N_THREADS 2
 
 int run_thread_poll_server(struct dc_env * env, struct dc_error * error, struct options *opts)
 {
     DC_TRACE(env);
-    printf("Running poll thread pool server on %s\n", opts->ip_address);
-    if (dc_error_has_error(error)) {
-        return -1;
-    }
-    return 0;
+
+    struct event_server_config config;
+
+    // the poll server's shape with threads instead of processes, so no descriptor passing
+    config.name = "Thread Poll Server";
+    config.backend = EVENT_BACKEND_POLL;
+    config.dispatch = DISPATCH_THREADS;
+    // workers=N fixes the pool size, 0 sizes it to the machine
+    config.threads = opts->config.workers > 0 ? opts->config.workers : (int)dc_get_number_of_processors(env, error, DEFAULT_N_THREADS);
+    config.compute_depth = 0;
+    config.backlog = opts->config.backlog;
+    config.max_connections = (uint32_t)opts->config.max_connections;
+    config.accept_rate = 0;
+    config.accept_burst = 0;
+    config.max_in_flight_per_worker = 0;
+    config.header_timeout_ms = (uint32_t)opts->config.header_timeout_ms;
+    config.idle_timeout_ms = (uint32_t)opts->config.idle_timeout_ms;
+    config.stall_timeout_ms = EVENT_SERVER_STALL_TIMEOUT_MS;
+    config.shutdown_timeout_ms = EVENT_SERVER_SHUTDOWN_TIMEOUT_MS;
+    config.verbose = opts->config.verbose;
+    printf("Running poll thread pool server on %s with %d threads\n", opts->ip_address, config.threads);
+
+    return run_event_server(env, error, opts, &config);
 }
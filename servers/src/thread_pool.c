@@ -0,0 +1,498 @@
+#include "thread_pool.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static void *thread_main(void *arg);
+static bool next_request(struct thread_pool_worker *worker, int *client_socket);
+static bool find_work(struct thread_pool_worker *worker, int *client_socket);
+static int take(struct thread_pool_worker *victim);
+static bool push(const struct dc_env *env, struct dc_error *err, struct thread_pool_worker *worker, int client_socket);
+static struct thread_pool_slots *new_slots(const struct dc_env *env, struct dc_error *err, int64_t capacity);
+static bool wake(struct thread_pool_worker *worker);
+static void copy_handler(struct thread_pool *pool, struct message_handler *message_handler, uint32_t *generation);
+static void join_threads(struct thread_pool *pool);
+static void free_workers(const struct dc_env *env, struct thread_pool *pool, int num_workers);
+static uint32_t next_random(uint32_t *seed);
+static uint64_t now_ns(void);
+
+
+#define INITIAL_SLOTS 64
+#define TAKE_EMPTY (-1)
+#define TAKE_RETRY (-2)     // lost the race for head to another thread, the queue may hold more
+#define NS_PER_SEC 1000000000
+#define PERCENT 100
+#define WORKER_SEARCHING 0
+#define WORKER_PARKED 1
+#define WORKER_SERVING 2
+
+bool thread_pool_start(const struct dc_env *env, struct dc_error *err, struct thread_pool *pool, int num_threads, const struct message_handler *message_handler, int completion_fd)
+{
+    DC_TRACE(env);
+    dc_memset(env, pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->message_handler = *message_handler;
+    pool->completion_fd = completion_fd;
+    pool->start_ns = now_ns();
+    // each queue's hot indexes sit on cache lines of their own, so the array is aligned like its members
+    pool->workers = (struct thread_pool_worker *)aligned_alloc(THREAD_POOL_CACHE_LINE, (size_t)num_threads * sizeof(*pool->workers));
+
+    if(pool->workers == NULL)
+    {
+        DC_ERROR_RAISE_USER(err, "Could not allocate the pool threads", -1);
+        return false;
+    }
+
+    dc_memset(env, pool->workers, 0, (size_t)num_threads * sizeof(*pool->workers));
+
+    for(int i = 0; i < num_threads; i++)
+    {
+        struct thread_pool_worker *worker;
+
+        worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->id = i;
+        worker->seed = (uint32_t)i * 2654435761U + 1;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+        atomic_init(&worker->slots, new_slots(env, err, INITIAL_SLOTS));
+
+        if(atomic_load_explicit(&worker->slots, memory_order_relaxed) == NULL)
+        {
+            free_workers(env, pool, i);
+            pthread_mutex_destroy(&pool->lock);
+            return false;
+        }
+    }
+
+    for(int i = 0; i < num_threads; i++)
+    {
+        if(pthread_create(&pool->workers[i].thread, NULL, thread_main, &pool->workers[i]) != 0)
+        {
+            DC_ERROR_RAISE_USER(err, "Could not start a pool thread", -1);
+            join_threads(pool);
+            free_workers(env, pool, num_threads);
+            pthread_mutex_destroy(&pool->lock);
+            return false;
+        }
+
+        pool->num_threads++;
+    }
+
+    return true;
+}
+
+void thread_pool_submit(const struct dc_env *env, struct dc_error *err, struct thread_pool *pool, int client_socket, int worker)
+{
+    DC_TRACE(env);
+
+    if(worker < 0 || worker >= pool->num_threads)
+    {
+        worker = pool->next_worker;
+        pool->next_worker = (pool->next_worker + 1) % pool->num_threads;
+    }
+
+    if(!push(env, err, &pool->workers[worker], client_socket))
+    {
+        return;
+    }
+
+    // pairs with the fence in next_request: either the thread sees the socket, or this sees it parked
+    atomic_thread_fence(memory_order_seq_cst);
+
+    // a thread looking for work finds it without help
+    if(wake(&pool->workers[worker]) || atomic_load_explicit(&pool->workers[worker].state, memory_order_relaxed) != WORKER_SERVING)
+    {
+        return;
+    }
+
+    // its thread is busy, maybe with one slow request, so the first one found idle steals the socket instead
+    for(int i = 1; i < pool->num_threads; i++)
+    {
+        if(wake(&pool->workers[(worker + i) % pool->num_threads]))
+        {
+            return;
+        }
+    }
+}
+
+void thread_pool_set_handler(struct thread_pool *pool, const struct message_handler *message_handler)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->message_handler = *message_handler;
+    atomic_fetch_add_explicit(&pool->handler_generation, 1, memory_order_release);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_stop(const struct dc_env *env, struct thread_pool *pool)
+{
+    DC_TRACE(env);
+    join_threads(pool);
+    pool->stop_ns = now_ns();
+}
+
+void thread_pool_report(const struct thread_pool *pool, FILE *out)
+{
+    uint64_t requests;
+    uint64_t stolen;
+    uint64_t elapsed_ns;
+
+    if(pool->num_threads == 0)
+    {
+        return;
+    }
+
+    requests = 0;
+    stolen = 0;
+    elapsed_ns = pool->stop_ns > pool->start_ns ? pool->stop_ns - pool->start_ns : 1;
+
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        requests += pool->workers[i].stats.requests;
+        stolen += pool->workers[i].stats.stolen;
+    }
+
+    fprintf(out, "Thread pool: %d threads served %llu requests, %llu of them stolen from another thread's queue\n",    // NOLINT(cert-err33-c)
+            pool->num_threads, (unsigned long long)requests, (unsigned long long)stolen);
+
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        const struct thread_pool_stats *stats;
+
+        stats = &pool->workers[i].stats;
+        fprintf(out, "Thread pool: thread %d served %llu (%llu stolen), parked %llu times, busy %llu%%\n",    // NOLINT(cert-err33-c)
+                i, (unsigned long long)stats->requests, (unsigned long long)stats->stolen, (unsigned long long)stats->parks,
+                (unsigned long long)(stats->busy_ns * PERCENT / elapsed_ns));
+    }
+}
+
+void thread_pool_destroy(const struct dc_env *env, struct thread_pool *pool)
+{
+    DC_TRACE(env);
+
+    if(pool->workers == NULL)
+    {
+        return;
+    }
+
+    free_workers(env, pool, pool->num_threads);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+static void *thread_main(void *arg)
+{
+    struct thread_pool_worker *worker;
+    struct dc_error *err;
+    struct dc_env *env;
+    int client_socket;
+    struct message_handler message_handler;
+    uint32_t generation;
+
+    worker = (struct thread_pool_worker *)arg;
+
+    // dc_error records the last failure, so every thread needs its own
+    err = dc_error_create(false);
+    env = dc_env_create(err, false, NULL);
+    generation = 0;
+    copy_handler(worker->pool, &message_handler, &generation);
+
+    while(next_request(worker, &client_socket))
+    {
+        struct thread_pool_completion completion;
+        uint64_t start_ns;
+
+        if(atomic_load_explicit(&worker->pool->handler_generation, memory_order_acquire) != generation)
+        {
+            copy_handler(worker->pool, &message_handler, &generation);
+        }
+
+        atomic_store_explicit(&worker->state, WORKER_SERVING, memory_order_relaxed);
+        start_ns = now_ns();
+        dc_memset(env, &completion, 0, sizeof(completion));
+        completion.fd = client_socket;
+        completion.worker = worker->id;
+        completion.closed = message_handler_run(env, err, &message_handler, client_socket);
+
+        if(dc_error_has_error(err))
+        {
+            completion.closed = true;
+            dc_error_reset(err);
+        }
+
+        worker->stats.requests++;
+        worker->stats.busy_ns += now_ns() - start_ns;
+        atomic_store_explicit(&worker->state, WORKER_SEARCHING, memory_order_relaxed);
+
+        // smaller than PIPE_BUF, so completions from different threads never interleave
+        if(write(worker->pool->completion_fd, &completion, sizeof(completion)) != sizeof(completion))
+        {
+            perror("thread pool completion");
+        }
+    }
+
+    dc_error_reset(err);
+    free(err);
+    free(env);
+
+    return NULL;
+}
+
+static bool next_request(struct thread_pool_worker *worker, int *client_socket)
+{
+    while(true)
+    {
+        if(find_work(worker, client_socket))
+        {
+            return true;
+        }
+
+        atomic_store_explicit(&worker->state, WORKER_PARKED, memory_order_seq_cst);
+
+        // pairs with the fence in thread_pool_submit: a socket pushed before the flag was seen is found here
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if(find_work(worker, client_socket))
+        {
+            atomic_store_explicit(&worker->state, WORKER_SEARCHING, memory_order_relaxed);
+            return true;
+        }
+
+        // the queued requests are finished first, stopping only ends a thread that found none
+        if(atomic_load_explicit(&worker->pool->stopping, memory_order_seq_cst))
+        {
+            atomic_store_explicit(&worker->state, WORKER_SEARCHING, memory_order_relaxed);
+            return false;
+        }
+
+        worker->stats.parks++;
+
+        // returns at once if a waker already cleared the flag
+        syscall(SYS_futex, &worker->state, FUTEX_WAIT_PRIVATE, WORKER_PARKED, NULL, NULL, 0);
+        atomic_store_explicit(&worker->state, WORKER_SEARCHING, memory_order_relaxed);
+    }
+}
+
+static bool find_work(struct thread_pool_worker *worker, int *client_socket)
+{
+    struct thread_pool *pool;
+    bool contended;
+
+    pool = worker->pool;
+
+    do
+    {
+        int others;
+        int start;
+
+        // its own queue first, the loop put the connections this thread served last there
+        do
+        {
+            *client_socket = take(worker);
+        }
+        while(*client_socket == TAKE_RETRY);
+
+        if(*client_socket >= 0)
+        {
+            return true;
+        }
+
+        contended = false;
+        others = pool->num_threads - 1;
+        start = others > 0 ? (int)(next_random(&worker->seed) % (uint32_t)others) : 0;
+
+        // from a random thread on, so idle threads do not all line up behind the same busy one
+        for(int i = 0; i < others; i++)
+        {
+            struct thread_pool_worker *victim;
+
+            victim = &pool->workers[(worker->id + 1 + (start + i) % others) % pool->num_threads];
+            *client_socket = take(victim);
+
+            if(*client_socket >= 0)
+            {
+                worker->stats.stolen++;
+                return true;
+            }
+
+            if(*client_socket == TAKE_RETRY)
+            {
+                contended = true;
+            }
+        }
+    }
+    while(contended);
+
+    return false;
+}
+
+static int take(struct thread_pool_worker *victim)
+{
+    struct thread_pool_slots *slots;
+    int64_t head;
+    int64_t tail;
+    int client_socket;
+
+    head = atomic_load_explicit(&victim->head, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    tail = atomic_load_explicit(&victim->tail, memory_order_acquire);
+
+    if(head >= tail)
+    {
+        return TAKE_EMPTY;
+    }
+
+    slots = atomic_load_explicit(&victim->slots, memory_order_acquire);
+    client_socket = atomic_load_explicit(&slots->fds[head & slots->mask], memory_order_relaxed);
+
+    if(!atomic_compare_exchange_strong_explicit(&victim->head, &head, head + 1, memory_order_seq_cst, memory_order_relaxed))
+    {
+        return TAKE_RETRY;
+    }
+
+    return client_socket;
+}
+
+static bool push(const struct dc_env *env, struct dc_error *err, struct thread_pool_worker *worker, int client_socket)
+{
+    struct thread_pool_slots *slots;
+    int64_t head;
+    int64_t tail;
+
+    DC_TRACE(env);
+    tail = atomic_load_explicit(&worker->tail, memory_order_relaxed);
+    head = atomic_load_explicit(&worker->head, memory_order_acquire);
+    slots = atomic_load_explicit(&worker->slots, memory_order_relaxed);
+
+    if(tail - head > slots->mask)
+    {
+        struct thread_pool_slots *grown;
+
+        grown = new_slots(env, err, (slots->mask + 1) * 2);
+
+        if(grown == NULL)
+        {
+            return false;
+        }
+
+        for(int64_t i = head; i < tail; i++)
+        {
+            atomic_store_explicit(&grown->fds[i & grown->mask], atomic_load_explicit(&slots->fds[i & slots->mask], memory_order_relaxed), memory_order_relaxed);
+        }
+
+        grown->retired = slots;
+        atomic_store_explicit(&worker->slots, grown, memory_order_release);
+        slots = grown;
+    }
+
+    atomic_store_explicit(&slots->fds[tail & slots->mask], client_socket, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&worker->tail, tail + 1, memory_order_relaxed);
+
+    return true;
+}
+
+static struct thread_pool_slots *new_slots(const struct dc_env *env, struct dc_error *err, int64_t capacity)
+{
+    struct thread_pool_slots *slots;
+
+    DC_TRACE(env);
+    slots = (struct thread_pool_slots *)dc_malloc(env, err, sizeof(*slots) + (size_t)capacity * sizeof(slots->fds[0]));
+
+    if(slots == NULL)
+    {
+        return NULL;
+    }
+
+    slots->retired = NULL;
+    slots->mask = capacity - 1;
+
+    return slots;
+}
+
+static bool wake(struct thread_pool_worker *worker)
+{
+    uint32_t expected;
+
+    expected = WORKER_PARKED;
+
+    // a plain look first, so a busy thread's line is not pulled over exclusive for nothing
+    if(atomic_load_explicit(&worker->state, memory_order_relaxed) != WORKER_PARKED ||
+       !atomic_compare_exchange_strong_explicit(&worker->state, &expected, WORKER_SEARCHING, memory_order_seq_cst, memory_order_relaxed))
+    {
+        return false;
+    }
+
+    syscall(SYS_futex, &worker->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+
+    return true;
+}
+
+static void copy_handler(struct thread_pool *pool, struct message_handler *message_handler, uint32_t *generation)
+{
+    pthread_mutex_lock(&pool->lock);
+    *message_handler = pool->message_handler;
+    *generation = atomic_load_explicit(&pool->handler_generation, memory_order_relaxed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void join_threads(struct thread_pool *pool)
+{
+    atomic_store_explicit(&pool->stopping, true, memory_order_seq_cst);
+
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        wake(&pool->workers[i]);
+    }
+
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+}
+
+static void free_workers(const struct dc_env *env, struct thread_pool *pool, int num_workers)
+{
+    DC_TRACE(env);
+
+    for(int i = 0; i < num_workers; i++)
+    {
+        struct thread_pool_slots *slots;
+
+        slots = atomic_load_explicit(&pool->workers[i].slots, memory_order_relaxed);
+
+        while(slots)
+        {
+            struct thread_pool_slots *retired;
+
+            retired = slots->retired;
+            dc_free(env, slots);
+            slots = retired;
+        }
+    }
+
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->num_threads = 0;
+}
+
+static uint32_t next_random(uint32_t *seed)
+{
+    // xorshift32, only spreads the victims
+    *seed ^= *seed << 13;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *seed ^= *seed >> 17;    // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+    *seed ^= *seed << 5;     // NOLINT(cppcoreguidelines-avoid-magic-numbers,readability-magic-numbers)
+
+    return *seed;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * NS_PER_SEC + (uint64_t)now.tv_nsec;
+}
@@ -0,0 +1,259 @@
+#include "timer_wheel.h"
+#include <limits.h>
+#include <time.h>
+
+#define MS_PER_SEC 1000ULL
+#define NS_PER_MS 1000000ULL
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define LEVEL_SHIFT(level) ((unsigned int)(level) * TIMER_WHEEL_BITS)
+#define MAX_DELTA ((1ULL << LEVEL_SHIFT(TIMER_WHEEL_LEVELS)) - 1)
+
+static void list_init(struct timer *head);
+static bool list_empty(const struct timer *head);
+static void list_append(struct timer *head, struct timer *timer);
+static void list_unlink(struct timer *timer);
+static void list_splice(struct timer *from, struct timer *to);
+static void place(struct timer_wheel *wheel, struct timer *timer);
+static void cascade(struct timer_wheel *wheel, unsigned int level);
+
+uint64_t timer_now_ms(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * MS_PER_SEC + (uint64_t)now.tv_nsec / NS_PER_MS;
+}
+
+void timer_wheel_init(struct timer_wheel *wheel, uint64_t now_ms)
+{
+    wheel->now_ms = now_ms;
+    wheel->active = 0;
+
+    for(unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        for(unsigned int slot = 0; slot < TIMER_WHEEL_SLOTS; slot++)
+        {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+}
+
+void timer_init(struct timer *timer, timer_callback callback, void *data)
+{
+    timer->next = NULL;
+    timer->prev = NULL;
+    timer->expires_ms = 0;
+    timer->callback = callback;
+    timer->data = data;
+}
+
+bool timer_pending(const struct timer *timer)
+{
+    return timer->next != NULL;
+}
+
+void timer_wheel_add(struct timer_wheel *wheel, struct timer *timer, uint64_t expires_ms)
+{
+    if(timer_pending(timer))
+    {
+        timer_wheel_cancel(wheel, timer);
+    }
+
+    // the slot for now_ms has already fired, the earliest a new timer can go off is the next tick
+    if(expires_ms <= wheel->now_ms)
+    {
+        expires_ms = wheel->now_ms + 1;
+    }
+
+    timer->expires_ms = expires_ms;
+    place(wheel, timer);
+    wheel->active++;
+}
+
+void timer_wheel_cancel(struct timer_wheel *wheel, struct timer *timer)
+{
+    if(timer_pending(timer))
+    {
+        list_unlink(timer);
+        wheel->active--;
+    }
+}
+
+void timer_wheel_advance(struct timer_wheel *wheel, uint64_t now_ms, void *context)
+{
+    while(wheel->now_ms < now_ms)
+    {
+        struct timer expired;
+        unsigned int top;
+
+        if(wheel->active == 0)
+        {
+            wheel->now_ms = now_ms;
+            break;
+        }
+
+        wheel->now_ms++;
+
+        // find the highest level whose slot boundary is crossed by this tick and cascade down from it
+        top = 0;
+
+        while(top + 1 < TIMER_WHEEL_LEVELS && (wheel->now_ms & ((1ULL << LEVEL_SHIFT(top + 1)) - 1)) == 0)
+        {
+            top++;
+        }
+
+        for(unsigned int level = top; level > 0; level--)
+        {
+            cascade(wheel, level);
+        }
+
+        list_init(&expired);
+        list_splice(&wheel->slots[0][wheel->now_ms & SLOT_MASK], &expired);
+
+        while(!list_empty(&expired))
+        {
+            struct timer *timer;
+
+            timer = expired.next;
+            list_unlink(timer);
+            wheel->active--;
+            timer->callback(timer, context);
+        }
+    }
+}
+
+int timer_wheel_timeout(const struct timer_wheel *wheel, uint64_t now_ms)
+{
+    uint64_t due;
+
+    if(wheel->active == 0)
+    {
+        return -1;
+    }
+
+    due = UINT64_MAX;
+
+    // level 0 gives the exact expiry, higher levels give the tick at which their slot cascades
+    for(unsigned int level = 0; level < TIMER_WHEEL_LEVELS; level++)
+    {
+        unsigned int shift;
+        uint64_t base;
+
+        shift = LEVEL_SHIFT(level);
+        base = wheel->now_ms >> shift;
+
+        for(uint64_t i = 1; i <= TIMER_WHEEL_SLOTS; i++)
+        {
+            if(!list_empty(&wheel->slots[level][(base + i) & SLOT_MASK]))
+            {
+                uint64_t tick;
+
+                tick = (base + i) << shift;
+
+                if(tick < due)
+                {
+                    due = tick;
+                }
+
+                break;
+            }
+        }
+    }
+
+    if(due <= now_ms)
+    {
+        return 0;
+    }
+
+    if(due - now_ms > INT_MAX)
+    {
+        return INT_MAX;
+    }
+
+    return (int)(due - now_ms);
+}
+
+static void list_init(struct timer *head)
+{
+    head->next = head;
+    head->prev = head;
+}
+
+static bool list_empty(const struct timer *head)
+{
+    return head->next == head;
+}
+
+static void list_append(struct timer *head, struct timer *timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+}
+
+static void list_unlink(struct timer *timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+static void list_splice(struct timer *from, struct timer *to)
+{
+    if(list_empty(from))
+    {
+        return;
+    }
+
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    list_init(from);
+}
+
+static void place(struct timer_wheel *wheel, struct timer *timer)
+{
+    uint64_t slot_ms;
+    uint64_t delta;
+    unsigned int level;
+
+    // timers further out than the wheel covers are parked in the last level and re-cascaded
+    slot_ms = timer->expires_ms;
+    delta = slot_ms - wheel->now_ms;
+
+    if(delta > MAX_DELTA)
+    {
+        slot_ms = wheel->now_ms + MAX_DELTA;
+        delta = MAX_DELTA;
+    }
+
+    level = 0;
+
+    while(level + 1 < TIMER_WHEEL_LEVELS && delta >= (1ULL << LEVEL_SHIFT(level + 1)))
+    {
+        level++;
+    }
+
+    list_append(&wheel->slots[level][(slot_ms >> LEVEL_SHIFT(level)) & SLOT_MASK], timer);
+}
+
+static void cascade(struct timer_wheel *wheel, unsigned int level)
+{
+    struct timer pending;
+
+    list_init(&pending);
+    list_splice(&wheel->slots[level][(wheel->now_ms >> LEVEL_SHIFT(level)) & SLOT_MASK], &pending);
+
+    while(!list_empty(&pending))
+    {
+        struct timer *timer;
+
+        timer = pending.next;
+        list_unlink(timer);
+        place(wheel, timer);
+    }
+}
@@ -0,0 +1,603 @@
+#include "message_handler.h"
+#include "result_cache.h"
+#include "server.h"
+#include "util.h"
+#include <arpa/inet.h>
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_signal.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <dc_util/system.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <netinet/udp.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+#define DEFAULT_N_THREADS 2
+#define UDP_BATCH 32
+#define UDP_MAX_DATAGRAM 65536
+#define UDP_MAX_SEGMENTS 64     // the kernel coalesces at most this many datagrams with GRO
+#define UDP_REPLY_SIZE 2        // the processed length, as send_message_handler writes it
+#define UDP_RECEIVE_TIMEOUT_US 250000
+#define UDP_CONTROL_SIZE 64
+
+/**
+ * One thread with its own SO_REUSEPORT socket, the kernel spreads flows across them.
+ */
+struct udp_worker
+{
+    pthread_t thread;
+    struct udp_server *server;
+    int fd;
+    bool started;
+    struct mmsghdr messages[UDP_BATCH];
+    struct iovec iovecs[UDP_BATCH];
+    struct sockaddr_storage addresses[UDP_BATCH];
+    uint8_t controls[UDP_BATCH][UDP_CONTROL_SIZE];
+    uint8_t *buffers;
+    struct mmsghdr replies[UDP_BATCH];
+    struct iovec reply_iovecs[UDP_BATCH];
+    uint8_t reply_data[UDP_BATCH][UDP_MAX_SEGMENTS * UDP_REPLY_SIZE];
+    uint8_t reply_controls[UDP_BATCH][UDP_CONTROL_SIZE];
+    _Atomic uint64_t received;
+    _Atomic uint64_t sent;
+    /**
+     * Datagrams dropped here: truncated, failed in the processor or not sent.
+     */
+    _Atomic uint64_t dropped;
+    /**
+     * Datagrams the kernel dropped on this socket's full receive queue, from SO_RXQ_OVFL.
+     */
+    _Atomic uint32_t kernel_dropped;
+};
+
+struct udp_server
+{
+    struct options *opts;
+    struct udp_worker *workers;
+    int num_workers;
+    int batch; // datagrams per recvmmsg, at most UDP_BATCH
+    bool segmentation; // receive with UDP_GRO and reply with UDP_SEGMENT
+    pthread_mutex_t handler_lock;
+    struct message_handler message_handler;
+};
+
+static bool start_udp_server(struct dc_env *env, struct dc_error *err, struct udp_server *server);
+static void stop_udp_server(struct dc_env *env, struct dc_error *err, struct udp_server *server);
+static int open_udp_socket(struct dc_env *env, struct dc_error *err, const struct udp_server *server);
+static void *udp_worker_main(void *arg);
+static void receive_batch(struct dc_env *env, struct dc_error *err, struct udp_worker *worker, process_message_func processor);
+static size_t serve_datagram(struct dc_env *env, struct dc_error *err, struct udp_worker *worker, process_message_func processor, int index, size_t length);
+static uint16_t segment_size(struct msghdr *message, uint32_t *kernel_dropped);
+static void send_replies(struct udp_worker *worker, int count);
+static void report_rates(struct udp_server *server, uint64_t *last_received, uint64_t *last_sent);
+static void udp_signal_handler(int signal);
+
+
+static volatile sig_atomic_t udp_running = 0;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static volatile sig_atomic_t udp_reload = 0;      // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+int run_udp_server(struct dc_env *env, struct dc_error *error, struct options *opts)
+{
+    struct udp_server server;
+    uint64_t last_received;
+    uint64_t last_sent;
+
+    DC_TRACE(env);
+    dc_memset(env, &server, 0, sizeof(server));
+    server.opts = opts;
+    server.segmentation = opts->udp_segmentation;
+    server.batch = opts->config.udp_batch < UDP_BATCH ? opts->config.udp_batch : UDP_BATCH;
+
+    if(!start_udp_server(env, error, &server))
+    {
+        stop_udp_server(env, error, &server);
+        return EXIT_FAILURE;
+    }
+
+    printf("Setup UDP Server on %s:%d with %d sockets%s\n", opts->ip_address, opts->config.port, server.num_workers, server.segmentation ? " (GRO/GSO)" : "");
+    last_received = 0;
+    last_sent = 0;
+
+    // the workers block the signals, this thread only reports and reloads
+    while(udp_running)
+    {
+        struct timespec interval;
+
+        interval.tv_sec = 1;
+        interval.tv_nsec = 0;
+
+        if(nanosleep(&interval, NULL) == 0)
+        {
+            report_rates(&server, &last_received, &last_sent);
+        }
+
+        if(udp_reload)
+        {
+            udp_reload = 0;
+
+            if(message_handler_reload(env, error))
+            {
+                pthread_mutex_lock(&server.handler_lock);
+                message_handler_current(&server.message_handler);
+                pthread_mutex_unlock(&server.handler_lock);
+            }
+            else
+            {
+                printf("Message handlers not reloaded, keeping the current ones\n");
+                dc_error_reset(error);
+            }
+        }
+    }
+
+    stop_udp_server(env, error, &server);
+
+    return EXIT_SUCCESS;
+}
+
+static bool start_udp_server(struct dc_env *env, struct dc_error *err, struct udp_server *server)
+{
+    struct sigaction act;
+    int num_workers;
+
+    DC_TRACE(env);
+    pthread_mutex_init(&server->handler_lock, NULL);
+
+    if((server->opts->handler_path && !message_handler_load(env, err, server->opts->handler_path)) ||
+       (server->opts->cache_bytes > 0 && !result_cache_init(env, err, server->opts->cache_bytes, false)))
+    {
+        return false;
+    }
+
+    // datagrams have no stream to read from or write to, only the processor stage is the handler's
+    message_handler_current(&server->message_handler);
+
+    if(!message_handler_attach())
+    {
+        printf("Message handler init failed\n");
+        return false;
+    }
+
+    num_workers = server->opts->config.workers > 0 ? server->opts->config.workers : (int)dc_get_number_of_processors(env, err, DEFAULT_N_THREADS);
+    server->workers = (struct udp_worker *)dc_malloc(env, err, num_workers * sizeof(struct udp_worker));
+
+    if(server->workers == NULL)
+    {
+        return false;
+    }
+
+    dc_memset(env, server->workers, 0, num_workers * sizeof(struct udp_worker));
+    udp_running = 1;
+    act.sa_handler = udp_signal_handler;
+    dc_sigemptyset(env, err, &act.sa_mask);
+    act.sa_flags = 0;
+    dc_sigaction(env, err, SIGINT, &act, NULL);
+    dc_sigaction(env, err, SIGTERM, &act, NULL);
+    dc_sigaction(env, err, SIGHUP, &act, NULL);
+
+    for(int i = 0; i < num_workers; i++)
+    {
+        struct udp_worker *worker;
+
+        worker = &server->workers[i];
+        worker->server = server;
+        worker->fd = open_udp_socket(env, err, server);
+        server->num_workers++;
+
+        if(worker->fd < 0)
+        {
+            return false;
+        }
+
+        worker->buffers = (uint8_t *)dc_malloc(env, err, (size_t)UDP_BATCH * UDP_MAX_DATAGRAM);
+
+        if(worker->buffers == NULL)
+        {
+            return false;
+        }
+
+        if(pthread_create(&worker->thread, NULL, udp_worker_main, worker) != 0)
+        {
+            DC_ERROR_RAISE_USER(err, "Could not start a UDP thread", -1);
+            return false;
+        }
+
+        worker->started = true;
+    }
+
+    return dc_error_has_no_error(err);
+}
+
+static void stop_udp_server(struct dc_env *env, struct dc_error *err, struct udp_server *server)
+{
+    struct udp_worker *worker;
+    uint64_t received;
+    uint64_t sent;
+    uint64_t dropped;
+    uint64_t kernel_dropped;
+
+    DC_TRACE(env);
+    dc_error_reset(err);
+    udp_running = 0;
+    received = sent = dropped = kernel_dropped = 0;
+
+    for(int i = 0; i < server->num_workers; i++)
+    {
+        worker = &server->workers[i];
+
+        // the receive timeout wakes the thread to see udp_running cleared
+        if(worker->started)
+        {
+            pthread_join(worker->thread, NULL);
+        }
+
+        if(worker->fd >= 0)
+        {
+            dc_close(env, err, worker->fd);
+        }
+
+        if(worker->buffers)
+        {
+            dc_free(env, worker->buffers);
+        }
+
+        received += atomic_load(&worker->received);
+        sent += atomic_load(&worker->sent);
+        dropped += atomic_load(&worker->dropped);
+        kernel_dropped += atomic_load(&worker->kernel_dropped);
+    }
+
+    printf("UDP Server: %" PRIu64 " datagrams received, %" PRIu64 " replies sent, %" PRIu64 " dropped by the server, %" PRIu64 " dropped by the kernel\n", received, sent, dropped, kernel_dropped);
+    message_handler_detach();
+    result_cache_report(stdout);
+    result_cache_destroy();
+
+    if(server->workers)
+    {
+        dc_free(env, server->workers);
+    }
+
+    pthread_mutex_destroy(&server->handler_lock);
+}
+
+static int open_udp_socket(struct dc_env *env, struct dc_error *err, const struct udp_server *server)
+{
+    struct sockaddr_in address;
+    struct timeval timeout;
+    int fd;
+    int option_value;
+
+    DC_TRACE(env);
+    fd = dc_socket(env, err, AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+
+    if(fd < 0)
+    {
+        dc_perror(env, "socket");
+        return -1;
+    }
+
+    // every thread binds the same address, SO_REUSEPORT hashes each flow to one of the sockets
+    option_value = 1;
+    dc_setsockopt(env, err, fd, SOL_SOCKET, SO_REUSEADDR, &option_value, sizeof(option_value));
+    dc_setsockopt(env, err, fd, SOL_SOCKET, SO_REUSEPORT, &option_value, sizeof(option_value));
+    dc_setsockopt(env, err, fd, SOL_SOCKET, SO_RXQ_OVFL, &option_value, sizeof(option_value));
+    timeout.tv_sec = 0;
+    timeout.tv_usec = UDP_RECEIVE_TIMEOUT_US;
+    dc_setsockopt(env, err, fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if(server->segmentation && setsockopt(fd, SOL_UDP, UDP_GRO, &option_value, sizeof(option_value)) != 0)
+    {
+        // an older kernel just delivers the datagrams one by one
+        perror("UDP_GRO");
+    }
+
+    dc_memset(env, &address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = inet_addr(server->opts->ip_address);
+    address.sin_port = htons(server->opts->config.port);
+
+    if(dc_error_has_error(err) || dc_bind(env, err, fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        dc_perror(env, "bind");
+        dc_close(env, err, fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void *udp_worker_main(void *arg)
+{
+    struct udp_worker *worker;
+    struct dc_error *err;
+    struct dc_env *env;
+    sigset_t signals;
+
+    worker = (struct udp_worker *)arg;
+
+    // SIGINT, SIGTERM and SIGHUP are for the reporting thread
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    err = dc_error_create(false);
+    env = dc_env_create(err, false, NULL);
+
+    while(udp_running)
+    {
+        process_message_func processor;
+
+        // read once per batch, so a reload takes effect on the next one
+        pthread_mutex_lock(&worker->server->handler_lock);
+        processor = worker->server->message_handler.processor;
+        pthread_mutex_unlock(&worker->server->handler_lock);
+        receive_batch(env, err, worker, processor);
+    }
+
+    dc_error_reset(err);
+    free(err);
+    free(env);
+
+    return NULL;
+}
+
+static void receive_batch(struct dc_env *env, struct dc_error *err, struct udp_worker *worker, process_message_func processor)
+{
+    int count;
+    uint64_t datagrams;
+
+    for(int i = 0; i < worker->server->batch; i++)
+    {
+        worker->iovecs[i].iov_base = &worker->buffers[(size_t)i * UDP_MAX_DATAGRAM];
+        worker->iovecs[i].iov_len = UDP_MAX_DATAGRAM;
+        dc_memset(env, &worker->messages[i], 0, sizeof(worker->messages[i]));
+        worker->messages[i].msg_hdr.msg_iov = &worker->iovecs[i];
+        worker->messages[i].msg_hdr.msg_iovlen = 1;
+        worker->messages[i].msg_hdr.msg_name = &worker->addresses[i];
+        worker->messages[i].msg_hdr.msg_namelen = sizeof(worker->addresses[i]);
+        worker->messages[i].msg_hdr.msg_control = worker->controls[i];
+        worker->messages[i].msg_hdr.msg_controllen = sizeof(worker->controls[i]);
+    }
+
+    // block for the first datagram, then take whatever else is already queued
+    count = recvmmsg(worker->fd, worker->messages, (unsigned int)worker->server->batch, MSG_WAITFORONE, NULL);
+
+    if(count <= 0)
+    {
+        if(count < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            perror("recvmmsg");
+        }
+
+        return;
+    }
+
+    datagrams = 0;
+
+    for(int i = 0; i < count; i++)
+    {
+        datagrams += serve_datagram(env, err, worker, processor, i, worker->messages[i].msg_len);
+    }
+
+    atomic_fetch_add_explicit(&worker->received, datagrams, memory_order_relaxed);
+    send_replies(worker, count);
+}
+
+static size_t serve_datagram(struct dc_env *env, struct dc_error *err, struct udp_worker *worker, process_message_func processor, int index, size_t length)
+{
+    struct msghdr *message;
+    struct msghdr *reply;
+    uint32_t kernel_dropped;
+    uint16_t segment;
+    size_t segments;
+    size_t offset;
+
+    message = &worker->messages[index].msg_hdr;
+    reply = &worker->replies[index].msg_hdr;
+    dc_memset(env, reply, 0, sizeof(*reply));
+    reply->msg_name = message->msg_name;
+    reply->msg_namelen = message->msg_namelen;
+    reply->msg_iov = &worker->reply_iovecs[index];
+    reply->msg_iovlen = 1;
+    worker->reply_iovecs[index].iov_base = worker->reply_data[index];
+    worker->reply_iovecs[index].iov_len = 0;
+    kernel_dropped = 0;
+    segment = segment_size(message, &kernel_dropped);
+
+    if(kernel_dropped != 0)
+    {
+        atomic_store_explicit(&worker->kernel_dropped, kernel_dropped, memory_order_relaxed);
+    }
+
+    if(message->msg_flags & MSG_TRUNC)
+    {
+        atomic_fetch_add_explicit(&worker->dropped, 1, memory_order_relaxed);
+        return 1;
+    }
+
+    // with GRO one buffer holds several datagrams of segment bytes from the same sender, the last may be shorter
+    segments = 0;
+
+    for(offset = 0; offset < length && segments < UDP_MAX_SEGMENTS; offset += segment == 0 ? length : segment)
+    {
+        size_t datagram_length;
+        uint8_t *processed_data;
+        size_t processed_length;
+        uint16_t reply_length;
+
+        datagram_length = segment == 0 || length - offset < segment ? length - offset : segment;
+        processed_data = NULL;
+        processed_length = result_cache_process(env, err, processor, &((uint8_t *)message->msg_iov->iov_base)[offset], &processed_data, (ssize_t)datagram_length);
+
+        if(processed_data)
+        {
+            dc_free(env, processed_data);
+        }
+
+        segments++;
+
+        if(dc_error_has_error(err))
+        {
+            atomic_fetch_add_explicit(&worker->dropped, 1, memory_order_relaxed);
+            dc_error_reset(err);
+            continue;
+        }
+
+        reply_length = htons((uint16_t)processed_length);
+        dc_memcpy(env, &worker->reply_data[index][worker->reply_iovecs[index].iov_len], &reply_length, sizeof(reply_length));
+        worker->reply_iovecs[index].iov_len += UDP_REPLY_SIZE;
+    }
+
+    // every reply is the same size, so the kernel can split one buffer back into one datagram per request
+    if(worker->server->segmentation && worker->reply_iovecs[index].iov_len > UDP_REPLY_SIZE)
+    {
+        struct cmsghdr *control;
+        uint16_t reply_segment;
+
+        reply->msg_control = worker->reply_controls[index];
+        reply->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+        control = CMSG_FIRSTHDR(reply);
+        control->cmsg_level = SOL_UDP;
+        control->cmsg_type = UDP_SEGMENT;
+        control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        reply_segment = UDP_REPLY_SIZE;
+        dc_memcpy(env, CMSG_DATA(control), &reply_segment, sizeof(reply_segment));
+    }
+    else if(worker->reply_iovecs[index].iov_len > UDP_REPLY_SIZE)
+    {
+        // without GSO the coalesced replies would arrive as one datagram, so send only the first
+        atomic_fetch_add_explicit(&worker->dropped, worker->reply_iovecs[index].iov_len / UDP_REPLY_SIZE - 1, memory_order_relaxed);
+        worker->reply_iovecs[index].iov_len = UDP_REPLY_SIZE;
+    }
+
+    return segments;
+}
+
+static uint16_t segment_size(struct msghdr *message, uint32_t *kernel_dropped)
+{
+    uint16_t segment;
+
+    segment = 0;
+
+    for(struct cmsghdr *control = CMSG_FIRSTHDR(message); control != NULL; control = CMSG_NXTHDR(message, control))
+    {
+        if(control->cmsg_level == SOL_UDP && control->cmsg_type == UDP_GRO)
+        {
+            int size;
+
+            memcpy(&size, CMSG_DATA(control), sizeof(size));
+            segment = (uint16_t)size;
+        }
+        else if(control->cmsg_level == SOL_SOCKET && control->cmsg_type == SO_RXQ_OVFL)
+        {
+            memcpy(kernel_dropped, CMSG_DATA(control), sizeof(*kernel_dropped));
+        }
+    }
+
+    return segment;
+}
+
+static void send_replies(struct udp_worker *worker, int count)
+{
+    int first;
+    int packed;
+
+    // requests that failed in the processor have no reply, pack the rest to the front
+    packed = 0;
+
+    for(int i = 0; i < count; i++)
+    {
+        if(worker->reply_iovecs[i].iov_len > 0)
+        {
+            if(packed != i)
+            {
+                worker->replies[packed] = worker->replies[i];
+            }
+
+            packed++;
+        }
+    }
+
+    first = 0;
+
+    while(first < packed)
+    {
+        int sent;
+
+        sent = sendmmsg(worker->fd, &worker->replies[first], (unsigned int)(packed - first), 0);
+
+        if(sent <= 0)
+        {
+            if(sent < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            atomic_fetch_add_explicit(&worker->dropped, (uint64_t)(packed - first), memory_order_relaxed);
+            break;
+        }
+
+        for(int i = first; i < first + sent; i++)
+        {
+            atomic_fetch_add_explicit(&worker->sent, worker->replies[i].msg_hdr.msg_iov->iov_len / UDP_REPLY_SIZE, memory_order_relaxed);
+        }
+
+        first += sent;
+    }
+}
+
+static void report_rates(struct udp_server *server, uint64_t *last_received, uint64_t *last_sent)
+{
+    uint64_t received;
+    uint64_t sent;
+    uint64_t dropped;
+    uint64_t kernel_dropped;
+
+    received = sent = dropped = kernel_dropped = 0;
+
+    for(int i = 0; i < server->num_workers; i++)
+    {
+        received += atomic_load_explicit(&server->workers[i].received, memory_order_relaxed);
+        sent += atomic_load_explicit(&server->workers[i].sent, memory_order_relaxed);
+        dropped += atomic_load_explicit(&server->workers[i].dropped, memory_order_relaxed);
+        kernel_dropped += atomic_load_explicit(&server->workers[i].kernel_dropped, memory_order_relaxed);
+    }
+
+    // quiet while idle so the log only shows traffic
+    if(received != *last_received || sent != *last_sent)
+    {
+        printf("UDP Server: %" PRIu64 " pkt/s in, %" PRIu64 " pkt/s out, %" PRIu64 " dropped by the server, %" PRIu64 " dropped by the kernel\n", received - *last_received, sent - *last_sent, dropped, kernel_dropped);
+        write_to_file(server->opts, "UDP Server", "packets per second", (double)(received - *last_received));
+    }
+
+    *last_received = received;
+    *last_sent = sent;
+}
+
+static void udp_signal_handler(int signal)
+{
+    if(signal == SIGHUP)
+    {
+        udp_reload = 1;
+    }
+    else
+    {
+        udp_running = 0;
+    }
+}
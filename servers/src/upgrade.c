@@ -0,0 +1,145 @@
+#include "upgrade.h"
+#include <dc_c/dc_stdlib.h>
+#include <dc_c/dc_string.h>
+#include <dc_posix/dc_unistd.h>
+#include <dc_posix/sys/dc_socket.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define CHANNEL_FD 3
+#define FD_TEXT_SIZE 16
+
+int upgrade_start(const struct dc_env *env, struct dc_error *err, char *const argv[], pid_t *pid)
+{
+    int channel[2];
+
+    DC_TRACE(env);
+
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, channel) != 0)
+    {
+        DC_ERROR_RAISE_SYSTEM(err, "socketpair", errno);
+        return -1;
+    }
+
+    // don't let the child flush output the parent already buffered
+    fflush(stdout);     // NOLINT(cert-err33-c)
+    *pid = dc_fork(env, err);
+
+    if(*pid == 0)
+    {
+        char fd_text[FD_TEXT_SIZE];
+
+        // the new binary inherits the channel and stdio only
+        dup2(channel[1], CHANNEL_FD);
+        close_range(CHANNEL_FD + 1, ~0U, 0);
+        snprintf(fd_text, sizeof(fd_text), "%d", CHANNEL_FD);    // NOLINT(cert-err33-c)
+        setenv(UPGRADE_ENV, fd_text, 1);
+        execvp(argv[0], argv);
+        perror("execvp");
+        _exit(EXIT_FAILURE);
+    }
+
+    dc_close(env, err, channel[1]);
+
+    if(*pid < 0)
+    {
+        dc_close(env, err, channel[0]);
+        return -1;
+    }
+
+    return channel[0];
+}
+
+int upgrade_inherited_channel(const struct dc_env *env)
+{
+    const char *value;
+    int channel;
+
+    DC_TRACE(env);
+    value = getenv(UPGRADE_ENV);     // NOLINT(concurrency-mt-unsafe)
+
+    if(value == NULL)
+    {
+        return -1;
+    }
+
+    channel = atoi(value);      // NOLINT(cert-err34-c)
+
+    // the next upgrade hands out its own channel
+    unsetenv(UPGRADE_ENV);
+
+    return channel;
+}
+
+void upgrade_send_descriptor(const struct dc_env *env, struct dc_error *err, int channel, enum upgrade_kind kind, int fd)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct upgrade_message message;
+    char control_buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+
+    DC_TRACE(env);
+    dc_memset(env, &msg, 0, sizeof(msg));
+    dc_memset(env, &iov, 0, sizeof(iov));
+    dc_memset(env, control_buf, 0, sizeof(control_buf));
+    message.kind = kind;
+    message.fd = fd;
+    iov.iov_base = &message;
+    iov.iov_len = sizeof(message);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_buf;
+    msg.msg_controllen = sizeof(control_buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+
+    if(cmsg)
+    {
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        *((int *) CMSG_DATA(cmsg)) = fd;
+        dc_sendmsg(env, err, channel, &msg, 0);
+    }
+}
+
+int upgrade_receive_descriptor(const struct dc_env *env, struct dc_error *err, int channel, enum upgrade_kind *kind)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct upgrade_message message;
+    char control_buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr *cmsg;
+    ssize_t received;
+
+    DC_TRACE(env);
+    dc_memset(env, &msg, 0, sizeof(msg));
+    dc_memset(env, &iov, 0, sizeof(iov));
+    dc_memset(env, &message, 0, sizeof(message));
+    dc_memset(env, control_buf, 0, sizeof(control_buf));
+    iov.iov_base = &message;
+    iov.iov_len = sizeof(message);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_buf;
+    msg.msg_controllen = sizeof(control_buf);
+    received = dc_recvmsg(env, err, channel, &msg, 0);
+
+    if(received <= 0 || dc_error_has_error(err))
+    {
+        return -1;
+    }
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+
+    if(cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        return -1;
+    }
+
+    *kind = message.kind;
+
+    return *((int *) CMSG_DATA(cmsg));
+}
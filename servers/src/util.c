@@ -1,20 +1,55 @@
 #include "util.h"
+#include "buffer_pool.h"
+#include "fiber.h"
 #include <dc_c/dc_stdlib.h>
 #include <dc_c/dc_string.h>
 #include <dc_posix/dc_unistd.h>
 #include <dc_util/io.h>
 #include <dc_util/system.h>
 #include <dlfcn.h>
+#include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 
+static uint8_t *read_buffer = NULL;     // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static size_t read_buffer_length = 0;   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static size_t read_size = BLOCK_SIZE;   // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static struct buffer_pool read_pool;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+static bool read_pool_ready = false;    // NOLINT(cppcoreguidelines-avoid-non-const-global-variables)
+
+#define READ_POOL_MAX_FREE 64           // one per thread reading at once is enough, more only pins memory
+
+void set_read_buffer(uint8_t *buffer, size_t length)
+{
+    read_buffer = buffer;
+    read_buffer_length = length;
+}
+
+void set_read_size(size_t length)
+{
+    // buffers may already be lent out by the time a second call comes, so only the first one sets the size
+    if(!read_pool_ready)
+    {
+        read_size = length;
+        buffer_pool_init(&read_pool, read_size * sizeof(uint8_t), READ_POOL_MAX_FREE);
+        read_pool_ready = true;
+    }
+}
+
+void read_buffer_report(FILE *out)
+{
+    if(read_pool_ready)
+    {
+        buffer_pool_report(&read_pool, "Read", out);
+    }
+}
+
 void write_to_file(struct options *opts, const char * server_name, const char * function_name, double time_taken) {
 
-    fprintf(opts->csv_file, "%s,%s,%f\n", server_name, function_name, time_taken); // NOLINT(cert-err33-c)
+    // one fixed-size record per call, written straight through so nothing is lost if the server is killed
+    metrics_log_append(&opts->metrics, server_name, function_name, time_taken);
 
     printf("%s took %f ms to execute \n", function_name, time_taken);
-    // Flush the stream
-    fclose(opts->csv_file); // NOLINT(cert-err33-c)
-    opts->csv_file = fopen("states.csv", "ae");
 }
 
 ssize_t read_message_handler(const struct dc_env *env, struct dc_error *err, uint8_t **raw_data, int client_socket)
@@ -24,10 +59,34 @@ ssize_t read_message_handler(const struct dc_env *env, struct dc_error *err, uin
     uint8_t *buffer;
 
     DC_TRACE(env);
-    buffer_len = BLOCK_SIZE * sizeof(*buffer);
-    buffer = dc_malloc(env, err, buffer_len);
+
+    // reuse the per-process buffer when one was provided, otherwise borrow one for this read only, so an idle
+    // connection never holds a buffer
+    if(read_buffer)
+    {
+        buffer_len = read_buffer_length;
+        buffer = read_buffer;
+    }
+    else if(read_pool_ready)
+    {
+        buffer_len = read_pool.buffer_size;
+        buffer = buffer_pool_borrow(env, err, &read_pool);
+    }
+    else
+    {
+        buffer_len = read_size * sizeof(*buffer);
+        buffer = dc_malloc(env, err, buffer_len);
+    }
+
     bytes_read = dc_read(env, err, client_socket, buffer, buffer_len);
 
+    // in a fiber an empty socket suspends the request until the loop sees data, elsewhere it still fails
+    while(dc_error_is_errno(err, EAGAIN) && fiber_wait_fd(client_socket, POLLIN, 0))
+    {
+        dc_error_reset(err);
+        bytes_read = dc_read(env, err, client_socket, buffer, buffer_len);
+    }
+
     if(dc_error_has_no_error(err))
     {
         *raw_data = dc_malloc(env, err, bytes_read);
@@ -38,7 +97,14 @@ ssize_t read_message_handler(const struct dc_env *env, struct dc_error *err, uin
         *raw_data = NULL;
     }
 
-    dc_free(env, buffer);
+    if(buffer != read_buffer && read_pool_ready)
+    {
+        buffer_pool_return(env, &read_pool, buffer);
+    }
+    else if(buffer != read_buffer)
+    {
+        dc_free(env, buffer);
+    }
 
     return bytes_read;
 }
@@ -61,5 +127,12 @@ void send_message_handler(const struct dc_env *env, struct dc_error *err, __attr
     DC_TRACE(env);
     uint16_t write_number = ntohs(count);
     dc_write(env, err, client_socket, &write_number, sizeof(write_number));
+
+    while(dc_error_is_errno(err, EAGAIN) && fiber_wait_fd(client_socket, POLLOUT, 0))
+    {
+        dc_error_reset(err);
+        dc_write(env, err, client_socket, &write_number, sizeof(write_number));
+    }
+
     *closed = false;
 }